@@ -0,0 +1,322 @@
+/**********************************************************************************************
+**  Alternative sieve algorithms of the CP631 tools, for the comparison with the segmented
+**  Sieve of Eratosthenes of CP631_Sieve.h.
+**
+**  Every algorithm fills the same odd-only bitmap as SieveSegmentMark() and has the same
+**  parameters, so the sieve engine (CP631_Engine.h) can run any of them with all its
+**  backends, the scan of the distances and the stitching of the borders unchanged:
+**
+**  atkin      segmented Sieve of Atkin: the bits of the odd numbers are toggled for every
+**             solution of 4x^2 + y^2 = n (n % 12 = 1, 5), 3x^2 + y^2 = n (n % 12 = 7) and
+**             3x^2 - y^2 = n (x > y, n % 12 = 11), then the multiples of the squares of the
+**             base primes are cleared. The x loops cover sqrt(high) values in every segment,
+**             so it is the slowest for the large numbers.
+**  wheel      Eratosthenes with a wheel of 2*3*5*7 for the cofactors: after the pre-sieve, the
+**             prime p only crosses off p*m for the m coprime to 210 (48 of 210), in the spirit
+**             of the wheel sieve of Pritchard. Fewer stores, but with irregular strides.
+**  sundaram   odd-only Sieve of Sundaram: i + j + 2ij is removed for all i <= j, which is
+**             the odd number (2i + 1)(2j + 1). So every odd d (not only the primes) crosses off
+**             its odd multiples from d^2, without base primes and without the pre-sieve.
+**
+**  All the functions are 'static inline' so that every tool can still be built by a single
+**  gcc/mpicc command line.
+**
+**********************************************************************************************/
+
+#ifndef CP631_ALGORITHMS_H
+#define CP631_ALGORITHMS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CP631_Sieve.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    ALGO_WHEEL_PERIOD         (2 * 3 * 5 * 7)
+#define    ALGO_WHEEL_SPOKES         (48)
+
+/* Flip the bit of the odd number n of the segment starting at 'low' */
+#define    ALGO_TOGGLE(words, low, n) \
+    ((words)[((n) - (low)) >> 7] ^= (uint64_t)1 << ((((n) - (low)) >> 1) & 63))
+
+/* The wheel: the residues coprime to 210, the step to the next one, and for every residue
+** the index of the first spoke which is no less than it. Built once by the first caller. */
+static uint32_t algoWheelSpoke[ALGO_WHEEL_SPOKES];
+static uint32_t algoWheelStep[ALGO_WHEEL_SPOKES];
+static unsigned char algoWheelIndex[ALGO_WHEEL_PERIOD + 1];
+static int algoWheelState = 0;
+
+
+/*********************************************************************
+** This function is written for the segmented Sieve of Atkin on the words
+** [firstWord, firstWord + numWords). basePrimes[] are all the odd primes up to sqrt(high - 1)
+** as for SieveSegmentMark(). 'mark' is not used.
+*********************************************************************/
+static inline void SieveAtkinSegment(uint64_t* words, uint64_t firstWord, uint64_t numWords,
+                                     const uint32_t* basePrimes, uint64_t numBasePrimes, int mark)
+{
+    uint64_t low = firstWord * SIEVE_NUMS_PER_WORD;
+    uint64_t high = low + numWords * SIEVE_NUMS_PER_WORD;
+    unsigned __int128 base;
+    uint64_t x;
+    uint64_t y;
+    uint64_t yMax;
+    uint64_t n;
+    uint64_t square;
+    uint64_t i;
+    uint32_t p;
+
+    (void)mark;
+    memset(words, 0, numWords * sizeof(uint64_t));
+
+    /* 4x^2 + y^2 = n, n % 12 = 1 or 5: y is odd */
+    for (x = 1; (base = (unsigned __int128)4 * x * x) < high; x++)
+    {
+        y = (base >= low) ? 1 : SieveIsqrt(low - (uint64_t)base - 1) + 1;
+        y |= 1;
+        for (; y * y < high - (uint64_t)base; y += 2)
+        {
+            n = (uint64_t)base + y * y;
+            if ((1 == n % 12) || (5 == n % 12))
+            {
+                ALGO_TOGGLE(words, low, n);
+            }
+        }
+    }
+
+    /* 3x^2 + y^2 = n, n % 12 = 7: x is odd and y is even */
+    for (x = 1; (base = (unsigned __int128)3 * x * x) < high; x += 2)
+    {
+        y = (base >= low) ? 2 : SieveIsqrt(low - (uint64_t)base - 1) + 1;
+        y += y & 1;
+        for (; y * y < high - (uint64_t)base; y += 2)
+        {
+            n = (uint64_t)base + y * y;
+            if (7 == n % 12)
+            {
+                ALGO_TOGGLE(words, low, n);
+            }
+        }
+    }
+
+    /* 3x^2 - y^2 = n with x > y, n % 12 = 11: x and y have not the same parity. The smallest
+    ** n of x is 3x^2 - (x - 1)^2 = 2x^2 + 2x - 1. */
+    for (x = 2; (unsigned __int128)2 * x * x + 2 * x - 1 < high; x++)
+    {
+        base = (unsigned __int128)3 * x * x;
+        if (base < low)
+        {
+            continue;
+        }
+
+        y = (base >= high) ? SieveIsqrt((uint64_t)(base - high)) + 1 : 1;
+        yMax = (base - low > (unsigned __int128)x * x) ? x - 1 : SieveIsqrt((uint64_t)(base - low));
+        yMax = (yMax < x - 1) ? yMax : x - 1;
+        if (0 == ((x ^ y) & 1))
+        {
+            y++;
+        }
+
+        for (; y <= yMax; y += 2)
+        {
+            n = (uint64_t)(base - (unsigned __int128)y * y);
+            if (11 == n % 12)
+            {
+                ALGO_TOGGLE(words, low, n);
+            }
+        }
+    }
+
+    /* The numbers with a square factor are not prime. 3 never gives n % 12 of the forms. */
+    for (i = 0; i < numBasePrimes; i++)
+    {
+        p = basePrimes[i];
+        if (3 == p)
+        {
+            continue;
+        }
+
+        square = (uint64_t)p * p;
+        if (square >= high)
+        {
+            break;
+        }
+
+        /* The first odd multiple of p^2 in the segment */
+        n = (square >= low) ? square : ((low + square - 1) / square) * square;
+        if (0 == (n & 1))
+        {
+            n += square;
+        }
+        for (; (n >= low) && (n < high); n += 2 * square)
+        {
+            words[(n - low) >> 7] &= ~((uint64_t)1 << (((n - low) >> 1) & 63));
+        }
+    }
+
+    if ((low <= 3) && (3 < high))
+    {
+        words[0] |= (uint64_t)1 << SIEVE_BIT_OF(3);
+    }
+}
+
+/*********************************************************************
+** This function is written for building the tables of the wheel once.
+*********************************************************************/
+static inline void AlgoWheelInit(void)
+{
+    int expected = 0;
+    int r;
+    int k;
+
+    if (2 == __atomic_load_n(&algoWheelState, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    if (!__atomic_compare_exchange_n(&algoWheelState, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        /* Another thread is building the tables */
+        while (2 != __atomic_load_n(&algoWheelState, __ATOMIC_ACQUIRE))
+        {
+        }
+        return;
+    }
+
+    for (r = 1, k = 0; r < ALGO_WHEEL_PERIOD; r++)
+    {
+        if ((0 != r % 2) && (0 != r % 3) && (0 != r % 5) && (0 != r % 7))
+        {
+            algoWheelSpoke[k++] = (uint32_t)r;
+        }
+    }
+
+    for (k = 0; k < ALGO_WHEEL_SPOKES; k++)
+    {
+        algoWheelStep[k] = (k + 1 < ALGO_WHEEL_SPOKES) ? algoWheelSpoke[k + 1] - algoWheelSpoke[k] :
+                           ALGO_WHEEL_PERIOD + algoWheelSpoke[0] - algoWheelSpoke[k];
+    }
+
+    /* The residues after the last spoke go to spoke 0 of the next turn (index 48) */
+    for (r = ALGO_WHEEL_PERIOD, k = ALGO_WHEEL_SPOKES; r >= 0; r--)
+    {
+        if ((k > 0) && ((uint32_t)r <= algoWheelSpoke[k - 1]))
+        {
+            k--;
+        }
+        algoWheelIndex[r] = (unsigned char)k;
+    }
+
+    __atomic_store_n(&algoWheelState, 2, __ATOMIC_RELEASE);
+}
+
+/*********************************************************************
+** This function is written for the wheel sieve on the words [firstWord, firstWord + numWords).
+** The parameters are the ones of SieveSegmentMark(). 'mark' is not used.
+*********************************************************************/
+static inline void SieveWheelSegment(uint64_t* words, uint64_t firstWord, uint64_t numWords,
+                                     const uint32_t* basePrimes, uint64_t numBasePrimes, int mark)
+{
+    uint64_t low = firstWord * SIEVE_NUMS_PER_WORD;
+    uint64_t high = low + numWords * SIEVE_NUMS_PER_WORD;
+    uint64_t m;
+    uint64_t n;
+    uint64_t i;
+    uint32_t p;
+    int k;
+
+    (void)mark;
+    AlgoWheelInit();
+    SievePresieve(words, firstWord, numWords);
+
+    for (i = 0; i < numBasePrimes; i++)
+    {
+        p = basePrimes[i];
+        if (p <= SIEVE_PRESIEVE_LAST)
+        {
+            continue;
+        }
+
+        if ((uint64_t)p * p >= high)
+        {
+            break;
+        }
+
+        /* The first cofactor m >= p with m * p >= low, moved to the next spoke */
+        m = (low + p - 1) / p;
+        m = (m > p) ? m : p;
+        k = algoWheelIndex[m % ALGO_WHEEL_PERIOD];
+        m -= m % ALGO_WHEEL_PERIOD;
+        if (ALGO_WHEEL_SPOKES == k)
+        {
+            m += ALGO_WHEEL_PERIOD;
+            k = 0;
+        }
+        m += algoWheelSpoke[k];
+
+        if ((unsigned __int128)m * p >= high)
+        {
+            continue;
+        }
+
+        for (n = m * p; n < high; )
+        {
+            words[(n - low) >> 7] &= ~((uint64_t)1 << (((n - low) >> 1) & 63));
+            if (n > UINT64_MAX - (uint64_t)(2 * ALGO_WHEEL_PERIOD) * p)
+            {
+                break;
+            }
+
+            n += (uint64_t)algoWheelStep[k] * p;
+            k = (k + 1 < ALGO_WHEEL_SPOKES) ? k + 1 : 0;
+        }
+    }
+}
+
+/*********************************************************************
+** This function is written for the odd-only Sieve of Sundaram on the words
+** [firstWord, firstWord + numWords): every odd d >= 3 with d^2 < high crosses off its odd
+** multiples, with the marking strategy 'mark' of SieveSegmentMark(). No base prime is used.
+*********************************************************************/
+static inline void SieveSundaramSegment(uint64_t* words, uint64_t firstWord, uint64_t numWords,
+                                        const uint32_t* basePrimes, uint64_t numBasePrimes, int mark)
+{
+    uint64_t low = firstWord * SIEVE_NUMS_PER_WORD;
+    uint64_t totalBits = numWords * SIEVE_WORD_BITS;
+    uint64_t last = SieveIsqrt(low + (numWords * SIEVE_NUMS_PER_WORD - 1));
+    uint64_t start;
+    uint64_t d;
+
+    (void)basePrimes;
+    (void)numBasePrimes;
+    memset(words, 0xFF, numWords * sizeof(uint64_t));
+    if (0 == firstWord)
+    {
+        /* 1 is not a prime number */
+        words[0] &= ~(uint64_t)1;
+    }
+
+    for (d = 3; d <= last; d += 2)
+    {
+        start = SieveFirstMultiple(low, (uint32_t)d);
+        if ((start - low) / 2 >= totalBits)
+        {
+            continue;
+        }
+
+        if (SIEVE_MARK_KERNELS == mark)
+        {
+            SieveMarkPrime(words, (start - low) >> 1, totalBits, d);
+        }
+        else
+        {
+            SieveMarkPrimeBits(words, (start - low) >> 1, totalBits, d);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,545 @@
+/**********************************************************************************************
+**  Persistent, memory-mappable cache of the bit-packed sieve (see CP631_Sieve.h).
+**
+**  File layout (version 1). All offsets are in bytes from the beginning of the file and the
+**  bitmap starts at a page boundary, so it can be used directly from the mapping:
+**
+**    [0, 4096)               sieveCacheHeader, the rest is zero
+**    [validOffset, ...)      one byte per segment, 1 when the segment has been sieved
+**    [countOffset, ...)      uint32_t per segment, number of odd primes in the segment
+**    [bitmapOffset, ...)     uint64_t words of the odd-only bitmap, word w = [128w, 128w+128)
+**
+**  A segment is 'segmentWords' words. The cache covers [0, maxNumber) where maxNumber is
+**  numSegments * segmentWords * 128. The missing segments are sieved when they are needed
+**  and the file is grown (copied to a larger file and renamed) when a query is beyond it.
+**
+**  Writers hold an exclusive flock() on the lock file "<cache>.lock" while they grow the file
+**  or sieve. The lock is not on the cache file itself, as growing renames a new file over it.
+**  Readers need no lock: a segment is published by its 'valid' byte only after its bitmap and
+**  count are written, so several processes can use the same cache file at the same time.
+**
+**********************************************************************************************/
+
+#ifndef CP631_CACHE_H
+#define CP631_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "CP631_Sieve.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    CACHE_MAGIC               "CP631SV"
+#define    CACHE_VERSION             (1)
+#define    CACHE_HEADER_SIZE         (4096)
+#define    CACHE_PAGE_SIZE           (4096)
+
+/* 2^15 words = 256 KB bitmap = 4194304 integers per segment */
+#define    CACHE_SEGMENT_WORDS       ((uint64_t)1 << 15)
+#define    CACHE_SEGMENT_NUMS        (CACHE_SEGMENT_WORDS * SIEVE_NUMS_PER_WORD)
+
+#define    CACHE_ALIGN_PAGE(x)       (((x) + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE * CACHE_PAGE_SIZE)
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t segmentWords;
+    uint64_t numSegments;
+    uint64_t maxNumber;
+    uint64_t validOffset;
+    uint64_t countOffset;
+    uint64_t bitmapOffset;
+} sieveCacheHeader;
+
+typedef struct
+{
+    int                 fd;
+    int                 writable;
+    size_t              mapSize;
+    unsigned char*      base;
+    sieveCacheHeader*   header;
+    unsigned char*      valid;
+    uint32_t*           counts;
+    uint64_t*           bitmap;
+} sieveCache;
+
+
+/*********************************************************************
+** This function is written for mapping an opened cache file and checking its header.
+** Return 0 when it is a cache file of the current version, otherwise -1.
+*********************************************************************/
+static inline int CacheMap(sieveCache* cache)
+{
+    struct stat st;
+    sieveCacheHeader head;
+
+    if ((0 != fstat(cache->fd, &st)) || (st.st_size < CACHE_HEADER_SIZE) ||
+        (sizeof(head) != pread(cache->fd, &head, sizeof(head), 0)))
+    {
+        return -1;
+    }
+
+    if ((0 != memcmp(head.magic, CACHE_MAGIC, sizeof(head.magic))) ||
+        (CACHE_VERSION != head.version) || (CACHE_HEADER_SIZE != head.headerSize) ||
+        ((uint64_t)st.st_size < head.bitmapOffset + head.numSegments * head.segmentWords * sizeof(uint64_t)))
+    {
+        return -1;
+    }
+
+    cache->mapSize = (size_t)st.st_size;
+    cache->base = (unsigned char*)mmap(NULL, cache->mapSize,
+                                       cache->writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                                       MAP_SHARED, cache->fd, 0);
+    if (MAP_FAILED == cache->base)
+    {
+        cache->base = NULL;
+        return -1;
+    }
+
+    cache->header = (sieveCacheHeader*)cache->base;
+    cache->valid = cache->base + head.validOffset;
+    cache->counts = (uint32_t*)(cache->base + head.countOffset);
+    cache->bitmap = (uint64_t*)(cache->base + head.bitmapOffset);
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for closing the cache.
+*********************************************************************/
+static inline void CacheClose(sieveCache* cache)
+{
+    if (NULL != cache->base)
+    {
+        munmap(cache->base, cache->mapSize);
+        cache->base = NULL;
+    }
+
+    if (cache->fd >= 0)
+    {
+        close(cache->fd);
+        cache->fd = -1;
+    }
+}
+
+/*********************************************************************
+** This function is written for opening an existing cache file. The file is opened for
+** writing when it is possible, otherwise it is opened read only.
+** Return 0 if success, otherwise -1 (no file or wrong version).
+*********************************************************************/
+static inline int CacheOpen(sieveCache* cache, const char* fileName)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    cache->writable = 1;
+    cache->fd = open(fileName, O_RDWR);
+    if (cache->fd < 0)
+    {
+        cache->writable = 0;
+        cache->fd = open(fileName, O_RDONLY);
+    }
+
+    if (cache->fd < 0)
+    {
+        return -1;
+    }
+
+    if (0 != CacheMap(cache))
+    {
+        CacheClose(cache);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for creating a new cache file for [0, maxNumber). The sieved
+** segments of the old cache (can be NULL) are copied into the new one, so they are not
+** sieved again. The new file is written to a temporary name and then renamed, the processes
+** which still use the old file are not affected.
+** Return 0 if success, otherwise -1.
+*********************************************************************/
+static inline int CacheCreate(const char* fileName, uint64_t maxNumber, const sieveCache* oldCache)
+{
+    char tmpName[4096];
+    sieveCacheHeader head;
+    sieveCache cache;
+    uint64_t numSegments;
+    uint64_t s;
+    uint64_t copySegments = 0;
+
+    numSegments = (maxNumber + CACHE_SEGMENT_NUMS - 1) / CACHE_SEGMENT_NUMS;
+    if (0 == numSegments)
+    {
+        numSegments = 1;
+    }
+
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, CACHE_MAGIC, sizeof(head.magic));
+    head.version = CACHE_VERSION;
+    head.headerSize = CACHE_HEADER_SIZE;
+    head.segmentWords = CACHE_SEGMENT_WORDS;
+    head.numSegments = numSegments;
+    head.maxNumber = numSegments * CACHE_SEGMENT_NUMS;
+    head.validOffset = CACHE_HEADER_SIZE;
+    head.countOffset = CACHE_ALIGN_PAGE(head.validOffset + numSegments);
+    head.bitmapOffset = CACHE_ALIGN_PAGE(head.countOffset + numSegments * sizeof(uint32_t));
+
+    snprintf(tmpName, sizeof(tmpName), "%s.%d.tmp", fileName, (int)getpid());
+
+    memset(&cache, 0, sizeof(cache));
+    cache.writable = 1;
+    cache.fd = open(tmpName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (cache.fd < 0)
+    {
+        return -1;
+    }
+
+    /* The file is sparse. Only the sieved segments take disk space. */
+    if ((0 != ftruncate(cache.fd, (off_t)(head.bitmapOffset + numSegments * CACHE_SEGMENT_WORDS * sizeof(uint64_t)))) ||
+        (sizeof(head) != pwrite(cache.fd, &head, sizeof(head), 0)) ||
+        (0 != CacheMap(&cache)))
+    {
+        CacheClose(&cache);
+        unlink(tmpName);
+        return -1;
+    }
+
+    if ((NULL != oldCache) && (CACHE_SEGMENT_WORDS == oldCache->header->segmentWords))
+    {
+        copySegments = oldCache->header->numSegments;
+        if (copySegments > numSegments)
+        {
+            copySegments = numSegments;
+        }
+    }
+
+    for (s = 0; s < copySegments; s++)
+    {
+        if (0 == oldCache->valid[s])
+        {
+            continue;
+        }
+
+        memcpy(&cache.bitmap[s * CACHE_SEGMENT_WORDS], &oldCache->bitmap[s * CACHE_SEGMENT_WORDS],
+               CACHE_SEGMENT_WORDS * sizeof(uint64_t));
+        cache.counts[s] = oldCache->counts[s];
+        cache.valid[s] = 1;
+    }
+
+    msync(cache.base, cache.mapSize, MS_SYNC);
+    CacheClose(&cache);
+
+    if (0 != rename(tmpName, fileName))
+    {
+        unlink(tmpName);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for taking the exclusive lock of the writers of the cache file.
+** The descriptor of the lock file is returned, or -1 if it can't be opened.
+*********************************************************************/
+static inline int CacheLock(const char* fileName)
+{
+    char lockName[4096];
+    int fd;
+
+    snprintf(lockName, sizeof(lockName), "%s.lock", fileName);
+    fd = open(lockName, O_RDWR | O_CREAT, 0644);
+    if ((fd >= 0) && (0 != flock(fd, LOCK_EX)))
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+/*********************************************************************
+** This function is written for releasing the lock of CacheLock().
+*********************************************************************/
+static inline void CacheUnlock(int fd)
+{
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/*********************************************************************
+** This function is written for checking if the opened cache is still the file 'fileName',
+** or if another process has renamed a grown file over it.
+*********************************************************************/
+static inline int CacheReplaced(const sieveCache* cache, const char* fileName)
+{
+    struct stat opened;
+    struct stat named;
+
+    return (0 != fstat(cache->fd, &opened)) || (0 != stat(fileName, &named)) ||
+           (opened.st_dev != named.st_dev) || (opened.st_ino != named.st_ino);
+}
+
+/*********************************************************************
+** This function is written for making sure that all the segments covering [low, high) are in
+** the cache. Only the missing segments are sieved (in parallel when OpenMP is enabled), and
+** they are written directly into the mapping. The cache is grown and reopened if 'high' is
+** beyond it.
+** Return 0 if success, otherwise -1 (read only cache or no memory/disk space).
+*********************************************************************/
+static inline int CacheEnsure(sieveCache* cache, const char* fileName, uint64_t low, uint64_t high)
+{
+    uint64_t firstSegment;
+    uint64_t numSegments;
+    uint64_t missing = 0;
+    uint64_t numBasePrimes;
+    uint64_t s;
+    uint64_t newSize;
+    uint32_t* basePrimes;
+    int lockFd;
+    int error = 0;
+
+    firstSegment = low / CACHE_SEGMENT_NUMS;
+    numSegments = (high + CACHE_SEGMENT_NUMS - 1) / CACHE_SEGMENT_NUMS;
+
+    if (numSegments <= cache->header->numSegments)
+    {
+        for (s = firstSegment; s < numSegments; s++)
+        {
+            missing += (0 == __atomic_load_n(&cache->valid[s], __ATOMIC_ACQUIRE));
+        }
+
+        if (0 == missing)
+        {
+            /* Everything is there: nothing is computed */
+            return 0;
+        }
+    }
+
+    if (0 == cache->writable)
+    {
+        return -1;
+    }
+
+    lockFd = CacheLock(fileName);
+    if (lockFd < 0)
+    {
+        return -1;
+    }
+
+    /* Another process may have grown the file while we waited for the lock */
+    if (CacheReplaced(cache, fileName))
+    {
+        CacheClose(cache);
+        if ((0 != CacheOpen(cache, fileName)) || (0 == cache->writable))
+        {
+            CacheUnlock(lockFd);
+            return -1;
+        }
+    }
+
+    /* Grow the file: at least double it to avoid copying it for every query */
+    if (numSegments > cache->header->numSegments)
+    {
+        newSize = cache->header->maxNumber * 2;
+        if (newSize < numSegments * CACHE_SEGMENT_NUMS)
+        {
+            newSize = numSegments * CACHE_SEGMENT_NUMS;
+        }
+
+        error = CacheCreate(fileName, newSize, cache);
+        CacheClose(cache);
+
+        if ((0 != error) || (0 != CacheOpen(cache, fileName)))
+        {
+            CacheUnlock(lockFd);
+            return -1;
+        }
+    }
+
+    basePrimes = SieveBasePrimes(SieveIsqrt(numSegments * CACHE_SEGMENT_NUMS) + 1, &numBasePrimes);
+    if (NULL == basePrimes)
+    {
+        CacheUnlock(lockFd);
+        return -1;
+    }
+
+    /* Another process may have sieved some of them while we waited for the lock */
+#pragma omp parallel for schedule(dynamic)
+    for (s = firstSegment; s < numSegments; s++)
+    {
+        uint64_t* words;
+
+        if (0 != cache->valid[s])
+        {
+            continue;
+        }
+
+        words = &cache->bitmap[s * CACHE_SEGMENT_WORDS];
+        SieveSegment(words, s * CACHE_SEGMENT_WORDS, CACHE_SEGMENT_WORDS, basePrimes, numBasePrimes);
+        cache->counts[s] = (uint32_t)SieveCountWords(words, CACHE_SEGMENT_WORDS);
+
+        /* Publish the segment after its data */
+        __atomic_store_n(&cache->valid[s], 1, __ATOMIC_RELEASE);
+    }
+
+    free(basePrimes);
+    msync(cache->base, cache->mapSize, MS_ASYNC);
+    CacheUnlock(lockFd);
+
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for checking if n is prime. The segment of n must be in cache.
+*********************************************************************/
+static inline int CacheIsPrime(const sieveCache* cache, uint64_t n)
+{
+    if (n < 3)
+    {
+        return (2 == n);
+    }
+
+    if (0 == (n & 1))
+    {
+        return 0;
+    }
+
+    return (int)((cache->bitmap[SIEVE_WORD_OF(n)] >> SIEVE_BIT_OF(n)) & 1);
+}
+
+/*********************************************************************
+** This function is written for counting the primes in [low, high). The full segments are
+** counted by the saved prime numbers, only the partial ones at both ends are read.
+*********************************************************************/
+static inline uint64_t CacheCount(const sieveCache* cache, uint64_t low, uint64_t high)
+{
+    uint64_t total = 0;
+    uint64_t firstFull;
+    uint64_t endFull;
+    uint64_t s;
+
+    if (low >= high)
+    {
+        return 0;
+    }
+
+    total = SIEVE_HAS_TWO(low, high) ? 1 : 0;
+
+    firstFull = (low + CACHE_SEGMENT_NUMS - 1) / CACHE_SEGMENT_NUMS;
+    endFull = high / CACHE_SEGMENT_NUMS;
+
+    if (firstFull >= endFull)
+    {
+        return total + SieveCountRange(cache->bitmap, 0, low, high);
+    }
+
+    total += SieveCountRange(cache->bitmap, 0, low, firstFull * CACHE_SEGMENT_NUMS);
+    for (s = firstFull; s < endFull; s++)
+    {
+        total += cache->counts[s];
+    }
+    total += SieveCountRange(cache->bitmap, 0, endFull * CACHE_SEGMENT_NUMS, high);
+
+    return total;
+}
+
+/*********************************************************************
+** This function is written for finding the 'capacity' biggest distances between the
+** consecutive primes in [low, high) from the cache. The range is split between the threads
+** and the distances across the thread borders are handled at the end, as CP631_Final_OpenMP.c.
+** 'buff' must have 'capacity' items. Return the number of saved distances.
+*********************************************************************/
+static inline int CacheGaps(const sieveCache* cache, uint64_t low, uint64_t high,
+                            primeInfo64* buff, int capacity)
+{
+    int found = 0;
+    int num_thread = 1;
+    int i;
+    int k;
+    int* foundInThd;
+    uint64_t* border;
+    primeInfo64* threadResult;
+
+#ifdef _OPENMP
+    num_thread = omp_get_max_threads();
+#endif
+
+    /* Per thread: 'capacity' records, the first and last prime, the number of records */
+    threadResult = (primeInfo64*)calloc((size_t)num_thread * capacity, sizeof(primeInfo64));
+    border = (uint64_t*)calloc((size_t)num_thread * 2, sizeof(uint64_t));
+    foundInThd = (int*)calloc((size_t)num_thread, sizeof(int));
+    if ((NULL == threadResult) || (NULL == border) || (NULL == foundInThd))
+    {
+        free(threadResult);
+        free(border);
+        free(foundInThd);
+        return 0;
+    }
+
+#pragma omp parallel num_threads(num_thread)
+    {
+        int ID = 0;
+        uint64_t numInThd;
+        uint64_t start;
+        uint64_t end;
+
+#ifdef _OPENMP
+        ID = omp_get_thread_num();
+#endif
+        numInThd = (high - low) / num_thread;
+        start = low + numInThd * ID;
+        end = (ID == (num_thread - 1)) ? high : start + numInThd;
+
+        SieveScanGaps(cache->bitmap, 0, start, end, &border[2 * ID], &border[2 * ID + 1],
+                      &threadResult[ID * capacity], &foundInThd[ID], capacity);
+    }
+
+    for (i = 0; i < num_thread; i++)
+    {
+        for (k = 0; k < foundInThd[i]; k++)
+        {
+            InsertGap64(buff, &found, capacity, threadResult[i * capacity + k].distance,
+                        threadResult[i * capacity + k].smallPrime, threadResult[i * capacity + k].largePrime);
+        }
+    }
+
+    /* Handle the border distance between threads. A thread may have no prime at all. */
+    for (i = 0, k = -1; i < num_thread; i++)
+    {
+        if (0 == border[2 * i])
+        {
+            continue;
+        }
+
+        if (k >= 0)
+        {
+            InsertGap64(buff, &found, capacity, border[2 * i] - border[2 * k + 1],
+                        border[2 * k + 1], border[2 * i]);
+        }
+        k = i;
+    }
+
+    free(foundInThd);
+    free(threadResult);
+    free(border);
+    return found;
+}
+
+#endif /* CP631_CACHE_H */
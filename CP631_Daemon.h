@@ -0,0 +1,145 @@
+/**********************************************************************************************
+**  Binary protocol of the prime query daemon CP631_Final_daemon.c over a Unix domain socket.
+**
+**  Every request is one daemonRequest (32 bytes) and is answered by one daemonResponse
+**  (80 bytes) in the same order on the same connection. All the fields are in the byte order
+**  of the host, as the socket is local. A client may send many requests before it reads the
+**  responses; they are batched together by the daemon.
+**
+**    op                      low, high                 value[] of the response
+**    DAEMON_OP_NEXT_PRIME    x                         [0] smallest prime > x
+**    DAEMON_OP_PREV_PRIME    x                         [0] largest prime < x
+**    DAEMON_OP_COUNT         [low, high)               [0] number of primes in the range
+**    DAEMON_OP_LARGEST_GAP   [low, high)               [0] small prime, [1] large prime,
+**                                                      [2] distance (0 if less than 2 primes)
+**    DAEMON_OP_STATS         -                         [0] requests, [1] batches,
+**                                                      [2] mean latency (ns), [3] max latency (ns),
+**                                                      [4] p99 latency (ns), [5] uptime (ns),
+**                                                      [6] segment cache hits, [7] misses
+**
+**********************************************************************************************/
+
+#ifndef CP631_DAEMON_H
+#define CP631_DAEMON_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    DAEMON_SOCKET_PATH        "/tmp/CP631_Final_daemon.sock"
+#define    DAEMON_MAGIC              (0x31515043)      /* "CPQ1" */
+
+#define    DAEMON_OP_NEXT_PRIME      (1)
+#define    DAEMON_OP_PREV_PRIME      (2)
+#define    DAEMON_OP_COUNT           (3)
+#define    DAEMON_OP_LARGEST_GAP     (4)
+#define    DAEMON_OP_STATS           (5)
+
+#define    DAEMON_STATUS_OK          (0)
+#define    DAEMON_STATUS_BAD_REQUEST (1)
+#define    DAEMON_STATUS_OUT_OF_RANGE (2)
+#define    DAEMON_STATUS_NOT_FOUND   (3)
+#define    DAEMON_STATUS_NO_MEMORY   (4)
+
+#define    DAEMON_NUM_VALUES         (8)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t op;
+    uint64_t id;            /* Copied back to the response */
+    uint64_t low;
+    uint64_t high;
+} daemonRequest;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t status;
+    uint64_t id;
+    uint64_t value[DAEMON_NUM_VALUES];
+} daemonResponse;
+
+
+/*********************************************************************
+** This function is written for connecting to the daemon.
+** Return the socket, or -1 if the daemon is not running.
+*********************************************************************/
+static inline int DaemonConnect(const char* path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (0 != connect(fd, (struct sockaddr*)&addr, sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*********************************************************************
+** This function is written for reading or writing exactly 'size' bytes on the socket.
+** Return 0 if success, otherwise -1.
+*********************************************************************/
+static inline int DaemonTransfer(int fd, void* buff, size_t size, int isWrite)
+{
+    unsigned char* p = (unsigned char*)buff;
+    ssize_t done;
+
+    while (size > 0)
+    {
+        done = isWrite ? send(fd, p, size, MSG_NOSIGNAL) : recv(fd, p, size, 0);
+        if (done <= 0)
+        {
+            return -1;
+        }
+        p += done;
+        size -= (size_t)done;
+    }
+
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for sending one request and waiting for its response.
+** Return 0 if success, otherwise -1 (connection lost).
+*********************************************************************/
+static inline int DaemonCall(int fd, uint32_t op, uint64_t low, uint64_t high, daemonResponse* resp)
+{
+    daemonRequest req;
+
+    memset(&req, 0, sizeof(req));
+    req.magic = DAEMON_MAGIC;
+    req.op = op;
+    req.low = low;
+    req.high = high;
+
+    if ((0 != DaemonTransfer(fd, &req, sizeof(req), 1)) ||
+        (0 != DaemonTransfer(fd, resp, sizeof(*resp), 0)) ||
+        (DAEMON_MAGIC != resp->magic))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif /* CP631_DAEMON_H */
@@ -0,0 +1,813 @@
+/**********************************************************************************************
+**  The sieve engine shared by the CP631 tools: one core for the segments, the kernels, the
+**  top-K distances and the stitching of the borders, and thin execution backends selected at
+**  run time.
+**
+**  Core:
+**  EngineRunWords() sieves the words [wordLo, wordHi) segment by segment with the selected
+**  sieve algorithm (by default SieveSegmentMark() of CP631_Sieve.h) and scans every segment
+**  for the top-K distances and the number of primes.
+**  The result of a range keeps its first and last prime, so EngineMerge() can add the result
+**  of the next range together with the distance across the border. Every backend is only a
+**  way to split the words and to merge the results, so an optimization of the core benefits
+**  all of them, and the backends can be compared with exactly the same work.
+**
+**  Backends (engineBackends[]):
+**  serial   one thread of process 0
+**  omp      the OpenMP threads of process 0, one contiguous part per thread
+**  mpi      one thread in every MPI process, the results are gathered on process 0
+**  hybrid   the MPI processes, and the OpenMP threads inside every process
+**  The MPI backends are only compiled when mpi.h is included before this file.
+**
+**  Sieve algorithms (engineAlgorithms[]):
+**  The segments are filled by the Sieve of Eratosthenes of CP631_Sieve.h, or by one of the
+**  algorithms of CP631_Algorithms.h (Atkin, wheel, Sundaram) selected by cfg->algorithm.
+**  They all give the same bitmap, so every backend runs them in the same way.
+**
+**  Shared floor:
+**  A worker only knows its own K-th biggest distance, so at the start of its range it saves
+**  many small distances which never survive the merge. With cfg->sharedFloor, the K-th
+**  distance of every worker whose list is full is published as the floor of the run, and all
+**  the workers drop the distances below the floor. The floor is an atomic of the process for
+**  the threads, and across the processes it is kept in process 0 by MPI one-sided
+**  communication: thread 0 of every process raises and reads it with MPI_Fetch_and_op(MPI_MAX)
+**  after each of its segments, so the MPI backends need MPI_THREAD_FUNNELED. No distance of
+**  the global top-K is below the floor, so the result is exactly the same, and the saving
+**  grows with K.
+**
+**  Sparse scan:
+**  Once the K-th distance of a worker (or the floor) is more than SIEVE_WORD_MAX_GAP, only
+**  the distances across the words can still enter its list, so the segments are scanned by
+**  SieveScanGapsSparse(): one test per word instead of one step per prime. The statistics of
+**  the blocks need every prime, so they keep the full scan.
+**
+**  Block statistics:
+**  With cfg->blocks, the scan of the distances also makes the statistics of every block of
+**  cfg->blocks->width integers (CP631_Stats.h) in the same pass. Every worker writes its
+**  complete blocks, and its open blocks on the borders are merged in order with the results,
+**  across the threads and then across the processes.
+**
+**  Progress and cancellation:
+**  With cfg->progress (CP631_Progress.h), every worker updates its counter after each
+**  segment, thread 0 of every process makes the reports between its segments, and all the
+**  workers stop at the end of their segment once the run is cancelled. The result of a
+**  worker which stopped early is 'cut': no distance is taken across its end.
+**
+**  All the functions are 'static inline' so that every tool can still be built by a single
+**  gcc/mpicc command line.
+**
+**********************************************************************************************/
+
+#ifndef CP631_ENGINE_H
+#define CP631_ENGINE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_Algorithms.h"
+#include "CP631_Stats.h"
+#include "CP631_Progress.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    ENGINE_MAX_TOP            (64)
+
+/* 2^15 words = 256 KB bitmap = 4194304 integers per segment */
+#define    ENGINE_SEGMENT_WORDS      ((uint64_t)1 << 15)
+
+typedef struct
+{
+    uint64_t low;                /* The range is [low, high) */
+    uint64_t high;
+    uint64_t segmentWords;
+    int      topK;               /* 1 ~ ENGINE_MAX_TOP */
+    int      numThreads;         /* OpenMP threads per process of the omp and hybrid backends */
+    int      markStrategy;       /* SIEVE_MARK_KERNELS or SIEVE_MARK_BITS */
+    int      algorithm;          /* Index in engineAlgorithms[] */
+    int      sharedFloor;        /* 1 to share the K-th distance between the workers */
+    const uint32_t* basePrimes;  /* All the odd primes up to sqrt(high - 1) */
+    uint64_t numBasePrimes;
+    statsTable* blocks;          /* NULL, or the statistics of the blocks: low, width and
+                                    numBlocks set, and the rows of all the blocks in process 0 */
+    engineProgress* progress;    /* NULL, or the counters of the threads of this process */
+} engineConfig;
+
+typedef struct
+{
+    primeInfo64 top[ENGINE_MAX_TOP];
+    int      found;
+    uint64_t firstPrime;         /* 0 if there is no prime in the range */
+    uint64_t lastPrime;
+    uint64_t primeCount;
+    int      cut;                /* 1 if it was cancelled before the end of its range */
+} engineResult;
+
+typedef struct
+{
+    const char* name;
+    const char* description;
+    /* Fill the bitmap of a segment, with the parameters of SieveSegmentMark() */
+    void (*sieve)(uint64_t* words, uint64_t firstWord, uint64_t numWords,
+                  const uint32_t* basePrimes, uint64_t numBasePrimes, int mark);
+} engineAlgorithm;
+
+static const engineAlgorithm engineAlgorithms[] =
+{
+    {"eratosthenes", "Eratosthenes, pre-sieve and kernels",  SieveSegmentMark},
+    {"atkin",        "segmented Sieve of Atkin",             SieveAtkinSegment},
+    {"wheel",        "Eratosthenes, 210-wheel cofactors",    SieveWheelSegment},
+    {"sundaram",     "odd-only Sieve of Sundaram",           SieveSundaramSegment},
+};
+
+#define    ENGINE_NUM_ALGORITHMS     ((int)(sizeof(engineAlgorithms) / sizeof(engineAlgorithms[0])))
+
+/* The floor of the distances of a run, shared by its workers */
+typedef struct
+{
+    uint64_t value;              /* Atomic: no distance below it is in the global top-K */
+    int      useWin;             /* 1 if it is shared with the other processes */
+#ifdef MPI_VERSION
+    MPI_Win  win;                /* One uint64_t in process 0 */
+    uint64_t* winBase;
+#endif
+} engineFloor;
+
+typedef struct
+{
+    const char* name;
+    const char* description;
+    /* Return 0, or -1 if the memory can't be allocated. The result is valid in process 0. */
+    int (*run)(const engineConfig* cfg, engineResult* result);
+} engineBackend;
+
+
+/*********************************************************************
+** This function is written for clearing a result.
+*********************************************************************/
+static inline void EngineResultInit(engineResult* result)
+{
+    memset(result, 0, sizeof(engineResult));
+}
+
+/*********************************************************************
+** This function is written for adding the next range (in increasing order) to 'total' from
+** its parts: its 'found' biggest distances, its first and last prime (0 if it has no prime)
+** and its number of primes. The distance across the border of the two ranges is included.
+*********************************************************************/
+static inline void EngineMergeParts(engineResult* total, const primeInfo64* top, int found, uint64_t firstPrime,
+                                    uint64_t lastPrime, uint64_t primeCount, int topK)
+{
+    int k;
+
+    for (k = 0; k < found; k++)
+    {
+        InsertGap64(total->top, &total->found, topK, top[k].distance, top[k].smallPrime, top[k].largePrime);
+    }
+
+    total->primeCount += primeCount;
+
+    if (0 == firstPrime)
+    {
+        return;
+    }
+
+    if (0 != total->lastPrime)
+    {
+        InsertGap64(total->top, &total->found, topK, firstPrime - total->lastPrime,
+                    total->lastPrime, firstPrime);
+    }
+    else
+    {
+        total->firstPrime = firstPrime;
+    }
+
+    total->lastPrime = lastPrime;
+}
+
+/*********************************************************************
+** This function is written for adding the result of the next range (in increasing order)
+** to 'total', including the distance across the border of the two ranges. If 'total' is
+** cut, the two ranges are not adjacent and there is no distance across the border.
+*********************************************************************/
+static inline void EngineMerge(engineResult* total, const engineResult* next, int topK)
+{
+    uint64_t firstPrime = total->firstPrime;
+    uint64_t lastPrime = total->lastPrime;
+
+    if (total->cut)
+    {
+        total->lastPrime = 0;
+    }
+
+    EngineMergeParts(total, next->top, next->found, next->firstPrime, next->lastPrime, next->primeCount, topK);
+
+    if (total->cut)
+    {
+        total->firstPrime = (0 != firstPrime) ? firstPrime : total->firstPrime;
+        total->lastPrime = (0 != next->firstPrime) ? total->lastPrime : lastPrime;
+    }
+    total->cut = next->cut || (total->cut && (0 == next->firstPrime));
+}
+
+/*********************************************************************
+** This function is written for the words of the whole range [low, high).
+*********************************************************************/
+static inline void EngineWordRange(const engineConfig* cfg, uint64_t* wordLo, uint64_t* wordHi)
+{
+    *wordLo = SIEVE_WORD_OF(cfg->low);
+    *wordHi = (cfg->high > cfg->low) ? SIEVE_WORD_OF(cfg->high - 1) + 1 : *wordLo;
+}
+
+/*********************************************************************
+** This function is written for splitting the words [wordLo, wordHi) into 'parts' contiguous
+** parts on the borders of the segments, and getting the part 'index' in [*partLo, *partHi).
+*********************************************************************/
+static inline void EngineSplit(const engineConfig* cfg, uint64_t wordLo, uint64_t wordHi, int parts, int index,
+                               uint64_t* partLo, uint64_t* partHi)
+{
+    uint64_t numSeg = (wordHi - wordLo + cfg->segmentWords - 1) / cfg->segmentWords;
+
+    *partLo = wordLo + numSeg * (uint64_t)index / (uint64_t)parts * cfg->segmentWords;
+    *partHi = wordLo + numSeg * (uint64_t)(index + 1) / (uint64_t)parts * cfg->segmentWords;
+    *partLo = (*partLo < wordHi) ? *partLo : wordHi;
+    *partHi = (*partHi < wordHi) ? *partHi : wordHi;
+}
+
+/*********************************************************************
+** This function is written for raising the floor to 'value' if it is lower.
+*********************************************************************/
+static inline void EngineFloorRaise(engineFloor* shared, uint64_t value)
+{
+    uint64_t old = __atomic_load_n(&shared->value, __ATOMIC_RELAXED);
+
+    while ((value > old) &&
+           !__atomic_compare_exchange_n(&shared->value, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+#ifdef MPI_VERSION
+/*********************************************************************
+** This function is written for sending the floor of this process to process 0 and taking
+** the floor of all the processes back, in one atomic MPI_MAX. Only called by thread 0.
+*********************************************************************/
+static inline void EngineFloorExchange(engineFloor* shared)
+{
+    uint64_t mine = __atomic_load_n(&shared->value, __ATOMIC_RELAXED);
+    uint64_t global = 0;
+
+    MPI_Fetch_and_op(&mine, &global, MPI_UINT64_T, 0, 0, MPI_MAX, shared->win);
+    MPI_Win_flush(0, shared->win);
+    EngineFloorRaise(shared, global);
+}
+#endif
+
+/*********************************************************************
+** This function is written for sieving and scanning the words [wordLo, wordHi) segment by
+** segment. The result of the words is added to 'result' (the range before must already be
+** in it). 'scratch' holds cfg->segmentWords words. With 'shared' (can be NULL), the
+** distances below its floor are dropped, and the K-th distance of 'result' raises it. With
+** 'stats' (can be NULL), the statistics of the blocks are added to it in the same scan.
+*********************************************************************/
+static inline void EngineRunWordsFloor(const engineConfig* cfg, uint64_t wordLo, uint64_t wordHi,
+                                       engineResult* result, uint64_t* scratch, engineFloor* shared,
+                                       statsPart* stats)
+{
+    uint64_t w;
+    uint64_t numWords;
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t minDistance = 0;
+    uint64_t need;
+
+    for (w = wordLo; w < wordHi; w += numWords)
+    {
+        numWords = (wordHi - w < cfg->segmentWords) ? wordHi - w : cfg->segmentWords;
+        engineAlgorithms[cfg->algorithm].sieve(scratch, w, numWords, cfg->basePrimes, cfg->numBasePrimes,
+                                               cfg->markStrategy);
+
+        lo = (w * SIEVE_NUMS_PER_WORD > cfg->low) ? w * SIEVE_NUMS_PER_WORD : cfg->low;
+        hi = ((w + numWords) * SIEVE_NUMS_PER_WORD < cfg->high) ? (w + numWords) * SIEVE_NUMS_PER_WORD : cfg->high;
+
+        if (NULL != shared)
+        {
+            minDistance = __atomic_load_n(&shared->value, __ATOMIC_RELAXED);
+        }
+
+        /* The smallest distance which can still enter the list */
+        need = (cfg->topK == result->found) ? result->top[cfg->topK - 1].distance + 1 : 0;
+        need = (need > minDistance) ? need : minDistance;
+
+        if (NULL != stats)
+        {
+            StatsScanGaps(scratch, w, lo, hi, &result->firstPrime, &result->lastPrime,
+                          result->top, &result->found, cfg->topK, minDistance, stats);
+        }
+        else if (need > SIEVE_WORD_MAX_GAP)
+        {
+            SieveScanGapsSparse(scratch, w, lo, hi, &result->firstPrime, &result->lastPrime,
+                                result->top, &result->found, cfg->topK, minDistance);
+        }
+        else
+        {
+            SieveScanGapsAbove(scratch, w, lo, hi, &result->firstPrime, &result->lastPrime,
+                               result->top, &result->found, cfg->topK, minDistance);
+        }
+        result->primeCount += SieveCountRange(scratch, w, lo, hi) + (SIEVE_HAS_TWO(lo, hi) ? 1 : 0);
+
+        if (NULL != cfg->progress)
+        {
+            ProgressAdd(cfg->progress, omp_get_thread_num(), lo, hi);
+            if (0 == omp_get_thread_num())
+            {
+                ProgressPoll(cfg->progress);
+            }
+            if (ProgressCancelled(cfg->progress))
+            {
+                result->cut = (w + numWords < wordHi);
+                break;
+            }
+        }
+
+        if (NULL == shared)
+        {
+            continue;
+        }
+
+        if (cfg->topK == result->found)
+        {
+            EngineFloorRaise(shared, result->top[cfg->topK - 1].distance);
+        }
+#ifdef MPI_VERSION
+        if (shared->useWin && (0 == omp_get_thread_num()))
+        {
+            EngineFloorExchange(shared);
+        }
+#endif
+    }
+}
+
+/*********************************************************************
+** This function is written for EngineRunWordsFloor() without a floor and without statistics.
+*********************************************************************/
+static inline void EngineRunWords(const engineConfig* cfg, uint64_t wordLo, uint64_t wordHi,
+                                  engineResult* result, uint64_t* scratch)
+{
+    EngineRunWordsFloor(cfg, wordLo, wordHi, result, scratch, NULL, NULL);
+}
+
+/*********************************************************************
+** This function is written for the first number of the words from 'word' in the range.
+*********************************************************************/
+static inline uint64_t EngineWordLow(const engineConfig* cfg, uint64_t word)
+{
+    uint64_t low = (word <= SIEVE_WORD_OF(UINT64_MAX)) ? word * SIEVE_NUMS_PER_WORD : UINT64_MAX;
+
+    low = (low > cfg->low) ? low : cfg->low;
+    return (low < cfg->high) ? low : cfg->high;
+}
+
+/*********************************************************************
+** This function is written for running the words [wordLo, wordHi) with the OpenMP threads.
+** Every thread takes a contiguous part and the parts are merged in order. The threads
+** share the floor 'shared' (can be NULL). With 'stats' (can be NULL), the statistics of the
+** blocks of the threads are merged into it after the ones already in it.
+*********************************************************************/
+static inline int EngineRunThreads(const engineConfig* cfg, uint64_t wordLo, uint64_t wordHi, engineResult* result,
+                                   engineFloor* shared, statsPart* stats)
+{
+    engineResult* threadRes;
+    statsPart* threadStats = NULL;
+    int memError = 0;
+    int i;
+
+    threadRes = (engineResult*)aligned_alloc(64, sizeof(engineResult) * (size_t)cfg->numThreads);
+    if (NULL != stats)
+    {
+        threadStats = (statsPart*)aligned_alloc(64, sizeof(statsPart) * (size_t)cfg->numThreads);
+    }
+    if ((NULL == threadRes) || ((NULL != stats) && (NULL == threadStats)))
+    {
+        free(threadRes);
+        free(threadStats);
+        return -1;
+    }
+
+#pragma omp parallel num_threads(cfg->numThreads)
+    {
+        int ID = omp_get_thread_num();
+        uint64_t partLo;
+        uint64_t partHi;
+        uint64_t* scratch = (uint64_t*)malloc(cfg->segmentWords * sizeof(uint64_t));
+
+        EngineResultInit(&threadRes[ID]);
+        EngineSplit(cfg, wordLo, wordHi, omp_get_num_threads(), ID, &partLo, &partHi);
+
+        /* Thread 0 keeps reporting until all the threads are done */
+        if ((NULL != cfg->progress) && (ID < cfg->progress->numCounters))
+        {
+            cfg->progress->counters[ID].next = EngineWordLow(cfg, partLo);
+            cfg->progress->counters[ID].end = EngineWordLow(cfg, partHi);
+        }
+        if (NULL != cfg->progress)
+        {
+#pragma omp atomic update
+            cfg->progress->running++;
+#pragma omp barrier
+        }
+
+        if (NULL == scratch)
+        {
+#pragma omp atomic write
+            memError = 1;
+        }
+        else
+        {
+            if (NULL != stats)
+            {
+                StatsPartInit(&threadStats[ID], stats->table, EngineWordLow(cfg, partLo));
+            }
+            EngineRunWordsFloor(cfg, partLo, partHi, &threadRes[ID], scratch, shared,
+                                (NULL != stats) ? &threadStats[ID] : NULL);
+            if (NULL != stats)
+            {
+                StatsPartFinish(&threadStats[ID]);
+            }
+        }
+        free(scratch);
+
+        if (NULL != cfg->progress)
+        {
+            __atomic_sub_fetch(&cfg->progress->running, 1, __ATOMIC_RELEASE);
+            if (0 == ID)
+            {
+                ProgressWait(cfg->progress);
+            }
+        }
+    } // end of #pragma
+
+    /* Handle the border distance between threads */
+    for (i = 0; (0 == memError) && (i < cfg->numThreads); i++)
+    {
+        if (NULL != stats)
+        {
+            StatsMergePart(stats, &threadStats[i], result->cut ? 0 : result->lastPrime, threadRes[i].firstPrime);
+        }
+        EngineMerge(result, &threadRes[i], cfg->topK);
+    }
+
+    free(threadStats);
+    free(threadRes);
+    return memError ? -1 : 0;
+}
+
+/*********************************************************************
+** This function is written for the backend 'serial'.
+*********************************************************************/
+static inline int EngineSerial(const engineConfig* cfg, engineResult* result)
+{
+    uint64_t wordLo;
+    uint64_t wordHi;
+    uint64_t* scratch;
+
+    EngineResultInit(result);
+#ifdef MPI_VERSION
+    {
+        int my_rank;
+
+        MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+        if (0 != my_rank)
+        {
+            return 0;
+        }
+    }
+#endif
+
+    scratch = (uint64_t*)malloc(cfg->segmentWords * sizeof(uint64_t));
+    if (NULL == scratch)
+    {
+        return -1;
+    }
+
+    EngineWordRange(cfg, &wordLo, &wordHi);
+    if (NULL != cfg->progress)
+    {
+        cfg->progress->counters[0].next = cfg->low;
+        cfg->progress->counters[0].end = cfg->high;
+    }
+
+    if (NULL != cfg->blocks)
+    {
+        statsPart stats;
+
+        StatsPartInit(&stats, cfg->blocks, cfg->low);
+        EngineRunWordsFloor(cfg, wordLo, wordHi, result, scratch, NULL, &stats);
+        StatsPartFinish(&stats);
+        StatsFlush(&stats);
+    }
+    else
+    {
+        EngineRunWords(cfg, wordLo, wordHi, result, scratch);
+    }
+    free(scratch);
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for the backend 'omp'.
+*********************************************************************/
+static inline int EngineOpenMP(const engineConfig* cfg, engineResult* result)
+{
+    engineFloor shared;
+    statsPart stats;
+    uint64_t wordLo;
+    uint64_t wordHi;
+    int error;
+
+    EngineResultInit(result);
+#ifdef MPI_VERSION
+    {
+        int my_rank;
+
+        MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+        if (0 != my_rank)
+        {
+            return 0;
+        }
+    }
+#endif
+
+    memset(&shared, 0, sizeof(shared));
+    StatsPartClear(&stats, cfg->blocks);
+    EngineWordRange(cfg, &wordLo, &wordHi);
+    error = EngineRunThreads(cfg, wordLo, wordHi, result, cfg->sharedFloor ? &shared : NULL,
+                             (NULL != cfg->blocks) ? &stats : NULL);
+    if ((0 == error) && (NULL != cfg->blocks))
+    {
+        StatsFlush(&stats);
+    }
+    return error;
+}
+
+#ifdef MPI_VERSION
+/*********************************************************************
+** This function is written for the first block of the part of the process 'rank', in the
+** blocks of cfg->blocks. The blocks [EngineProcessBlock(r), EngineProcessBlock(r + 1)) are the
+** rows of the process r, and the block shared with the next process is merged by process 0.
+*********************************************************************/
+static inline uint64_t EngineProcessBlock(const engineConfig* cfg, uint64_t wordLo, uint64_t wordHi,
+                                          int num_processors, int rank)
+{
+    uint64_t partLo;
+    uint64_t partHi;
+    uint64_t low;
+
+    if (rank >= num_processors)
+    {
+        return cfg->blocks->numBlocks;
+    }
+
+    EngineSplit(cfg, wordLo, wordHi, num_processors, rank, &partLo, &partHi);
+    low = EngineWordLow(cfg, partLo);
+    return (low < cfg->high) ? (low - cfg->blocks->low) / cfg->blocks->width : cfg->blocks->numBlocks;
+}
+
+/*********************************************************************
+** This function is written for running the part of this process with 'threads' threads and
+** collecting the results of all the processes to process 0.
+*********************************************************************/
+static inline int EngineRunProcesses(const engineConfig* cfg, int threads, engineResult* result)
+{
+    engineConfig procCfg = *cfg;
+    engineResult procRes;
+    engineResult* allRes = NULL;
+    engineFloor shared;
+    statsTable procTable;
+    statsPart* procStats = NULL;
+    statsPart* allStats = NULL;
+    int* rowCounts = NULL;
+    int* rowDispls = NULL;
+    MPI_Datatype rowType;
+    uint64_t wordLo;
+    uint64_t wordHi;
+    uint64_t partLo;
+    uint64_t partHi;
+    int my_rank;
+    int num_processors;
+    int memError = 0;
+    int allMemError = 0;
+    int i;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+
+    EngineResultInit(result);
+    EngineResultInit(&procRes);
+    procCfg.numThreads = threads;
+
+    EngineWordRange(cfg, &wordLo, &wordHi);
+    EngineSplit(cfg, wordLo, wordHi, num_processors, my_rank, &partLo, &partHi);
+
+    /* The floor of all the processes is one uint64_t in process 0 */
+    memset(&shared, 0, sizeof(shared));
+    shared.useWin = cfg->sharedFloor && (num_processors > 1);
+    if (shared.useWin)
+    {
+        MPI_Win_allocate((0 == my_rank) ? sizeof(uint64_t) : 0, sizeof(uint64_t), MPI_INFO_NULL,
+                         MPI_COMM_WORLD, &shared.winBase, &shared.win);
+        if (0 == my_rank)
+        {
+            *shared.winBase = 0;
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, shared.win);
+    }
+
+    /* The rows of the blocks of this process, and its open blocks */
+    if (NULL != cfg->blocks)
+    {
+        procTable = *cfg->blocks;
+        procTable.rowBase = EngineProcessBlock(cfg, wordLo, wordHi, num_processors, my_rank);
+        procTable.numRows = EngineProcessBlock(cfg, wordLo, wordHi, num_processors, my_rank + 1) - procTable.rowBase;
+        procTable.rows = (statsRow*)calloc(procTable.numRows + 1, sizeof(statsRow));
+        procStats = (statsPart*)malloc(sizeof(statsPart));
+        memError |= (NULL == procTable.rows) || (NULL == procStats);
+        if (NULL != procStats)
+        {
+            StatsPartClear(procStats, &procTable);
+        }
+    }
+
+    if (NULL != cfg->progress)
+    {
+        cfg->progress->useMPI = (num_processors > 1);
+    }
+
+    if (0 == memError)
+    {
+        memError = EngineRunThreads(&procCfg, partLo, partHi, &procRes, cfg->sharedFloor ? &shared : NULL, procStats);
+    }
+
+    /* Take part in the reductions of the progress until all the processes are done */
+    if (NULL != cfg->progress)
+    {
+        ProgressFinish(cfg->progress);
+    }
+
+    if (shared.useWin)
+    {
+        MPI_Win_unlock_all(shared.win);
+        MPI_Win_free(&shared.win);
+    }
+    if (0 == my_rank)
+    {
+        allRes = (engineResult*)malloc(sizeof(engineResult) * (size_t)num_processors);
+        memError |= (NULL == allRes);
+        if (NULL != cfg->blocks)
+        {
+            allStats = (statsPart*)malloc(sizeof(statsPart) * (size_t)num_processors);
+            rowCounts = (int*)malloc(sizeof(int) * (size_t)num_processors);
+            rowDispls = (int*)malloc(sizeof(int) * (size_t)num_processors);
+            memError |= (NULL == allStats) || (NULL == rowCounts) || (NULL == rowDispls);
+        }
+    }
+
+    /* If one process fails to allocate the memory, all the processes fail */
+    MPI_Allreduce(&memError, &allMemError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (0 != allMemError)
+    {
+        if (NULL != cfg->blocks)
+        {
+            free(procTable.rows);
+        }
+        free(procStats);
+        free(allStats);
+        free(rowCounts);
+        free(rowDispls);
+        free(allRes);
+        return -1;
+    }
+
+    MPI_Gather(&procRes, (int)sizeof(engineResult), MPI_BYTE, allRes, (int)sizeof(engineResult), MPI_BYTE,
+               0, MPI_COMM_WORLD);
+
+    /* The complete rows of every process go to their place in process 0, then the open
+    ** blocks of the processes are merged in order */
+    if (NULL != cfg->blocks)
+    {
+        for (i = 0; (0 == my_rank) && (i < num_processors); i++)
+        {
+            rowDispls[i] = (int)EngineProcessBlock(cfg, wordLo, wordHi, num_processors, i);
+            rowCounts[i] = (int)EngineProcessBlock(cfg, wordLo, wordHi, num_processors, i + 1) - rowDispls[i];
+        }
+
+        MPI_Type_contiguous((int)sizeof(statsRow), MPI_BYTE, &rowType);
+        MPI_Type_commit(&rowType);
+        MPI_Gatherv(procTable.rows, (int)procTable.numRows, rowType, cfg->blocks->rows, rowCounts, rowDispls,
+                    rowType, 0, MPI_COMM_WORLD);
+        MPI_Type_free(&rowType);
+        MPI_Gather(procStats, (int)sizeof(statsPart), MPI_BYTE, allStats, (int)sizeof(statsPart), MPI_BYTE,
+                   0, MPI_COMM_WORLD);
+        free(procTable.rows);
+    }
+
+    if ((0 == my_rank) && (NULL != cfg->blocks))
+    {
+        StatsPartClear(procStats, cfg->blocks);
+    }
+
+    /* Handle the border distance between processes */
+    for (i = 0; (0 == my_rank) && (i < num_processors); i++)
+    {
+        if (NULL != cfg->blocks)
+        {
+            StatsMergePart(procStats, &allStats[i], result->cut ? 0 : result->lastPrime, allRes[i].firstPrime);
+        }
+        EngineMerge(result, &allRes[i], cfg->topK);
+    }
+
+    if ((0 == my_rank) && (NULL != cfg->blocks))
+    {
+        StatsFlush(procStats);
+    }
+
+    free(procStats);
+    free(allStats);
+    free(rowCounts);
+    free(rowDispls);
+    free(allRes);
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for the backend 'mpi'.
+*********************************************************************/
+static inline int EngineMPI(const engineConfig* cfg, engineResult* result)
+{
+    return EngineRunProcesses(cfg, 1, result);
+}
+
+/*********************************************************************
+** This function is written for the backend 'hybrid'.
+*********************************************************************/
+static inline int EngineHybrid(const engineConfig* cfg, engineResult* result)
+{
+    return EngineRunProcesses(cfg, cfg->numThreads, result);
+}
+#endif
+
+static const engineBackend engineBackends[] =
+{
+    {"serial", "one thread of process 0",                EngineSerial},
+    {"omp",    "OpenMP threads of process 0",            EngineOpenMP},
+#ifdef MPI_VERSION
+    {"mpi",    "one thread per MPI process",             EngineMPI},
+    {"hybrid", "MPI processes x OpenMP threads",         EngineHybrid},
+#endif
+};
+
+#define    ENGINE_NUM_BACKENDS       ((int)(sizeof(engineBackends) / sizeof(engineBackends[0])))
+
+
+/*********************************************************************
+** This function is written for finding a sieve algorithm by its name. -1 if there is none.
+*********************************************************************/
+static inline int EngineFindAlgorithm(const char* name)
+{
+    int i;
+
+    for (i = 0; i < ENGINE_NUM_ALGORITHMS; i++)
+    {
+        if (0 == strcmp(engineAlgorithms[i].name, name))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*********************************************************************
+** This function is written for finding a backend by its name. NULL if there is none.
+*********************************************************************/
+static inline const engineBackend* EngineFindBackend(const char* name)
+{
+    int i;
+
+    for (i = 0; i < ENGINE_NUM_BACKENDS; i++)
+    {
+        if (0 == strcmp(engineBackends[i].name, name))
+        {
+            return &engineBackends[i];
+        }
+    }
+
+    return NULL;
+}
+
+#endif
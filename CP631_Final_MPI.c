@@ -17,7 +17,9 @@
 **  mpicc -O2 CP631_Final_MPI.c -o CP631_Final_MPI.x
 **
 ** Then, the code can be run by the command:
-**  mpirun -np 24 ./CP631_Final_MPI.x
+**  mpirun -np 24 ./CP631_Final_MPI.x [output_file]
+** With output_file, all the primes and the distances are written to it by MPI-IO (see
+** CP631_Output.h).
 **
 ** If in the server with small memory space, run the command below to prevent segfaults:
 ** ulimit -s unlimited
@@ -25,14 +27,22 @@
 
 #include<stdio.h>
 #include<stdlib.h>
+#include <inttypes.h>
 #include "mpi.h"
 #include <sys/time.h>
 
+#include "CP631_HugePage.h"
+#include "CP631_Trace.h"
+#include "CP631_Output.h"
+
 
 /********************************************************************/
 /***                                      local definition                                                 ******/
 /********************************************************************/
+/* It can be changed by the build command, e.g. -DMAX_NUMBER=100000000 */
+#ifndef MAX_NUMBER
 #define    MAX_NUMBER            (1000000000)
+#endif
 #define    NEEDED_PRIME_NUM      (5)
 
 
@@ -122,10 +132,71 @@ void DeleteLargestDistance()
     }
 }
 
+/*********************************************************************
+** This function is written for writing the primes of this process and the 5 biggest
+** distances to the file 'outputName' by MPI-IO. The process has the numbers (start, end]
+** in sieve[CPU_CALC_END+1 ...], and process 0 also has [2, CPU_CALC_END] in sieve[2 ...].
+** The file covers [0, MAX_NUMBER) as the file of CP631_Final_MPI_OpenMP.c, so the last
+** process leaves out MAX_NUMBER itself.
+*********************************************************************/
+void WritePrimes(const char* outputName, const unsigned char* sieve, int start, int end, int my_rank)
+{
+    outputEncoder encoder;
+    primeInfo64 gaps[NEEDED_PRIME_NUM];
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+    uint64_t fileSize;
+    uint64_t prime;
+    double seconds;
+    int i;
+
+    gettimeofday(&startTime, NULL);
+
+    OutputEncoderInit(&encoder, (0 == my_rank) ? 0 : (uint64_t)start + 1,
+                      (end < MAX_NUMBER) ? (uint64_t)end + 1 : (uint64_t)MAX_NUMBER);
+    for (i = (0 == my_rank) ? 2 : CPU_CALC_END + 1; i <= CPU_CALC_END + end - start; i++)
+    {
+        prime = (i <= CPU_CALC_END) ? (uint64_t)i : (uint64_t)(i - CPU_CALC_END + start);
+        if ((0 != sieve[i]) && (prime < MAX_NUMBER))
+        {
+            OutputAddPrime(&encoder, prime);
+        }
+    }
+
+    for (i = 0; i < NEEDED_PRIME_NUM; i++)
+    {
+        gaps[i].smallPrime = (uint64_t)primeList[i].smallPrime;
+        gaps[i].largePrime = (uint64_t)primeList[i].largePrime;
+        gaps[i].distance = (uint64_t)primeList[i].distance;
+    }
+
+    fileSize = OutputWrite(outputName, &encoder, 0, (uint64_t)MAX_NUMBER, gaps, NEEDED_PRIME_NUM);
+    OutputEncoderFree(&encoder);
+
+    if (0 == my_rank)
+    {
+        gettimeofday(&currentTime, NULL);
+        seconds = (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+                  (double) (currentTime.tv_sec - startTime.tv_sec);
+
+        if (0 == fileSize)
+        {
+            printf("Failed to write the file %s!\n", outputName);
+        }
+        else
+        {
+            printf("Output: %" PRIu64 " bytes written to %s in %f seconds (%.1f MB/s).\n",
+                   fileSize, outputName, seconds, (double)fileSize / seconds / 1e6);
+        }
+    }
+}
+
 int main(int argc, char **argv)
 {
     int DIM=MAX_NUMBER;
     unsigned char* sieve;
+    int sieveKind;              /* The kind of pages of the sieve, see CP631_HugePage.h */
+    int worstSieveKind;
     int i;
     int j;
     int numprimes;
@@ -143,10 +214,12 @@ int main(int argc, char **argv)
     int allMemError = 0;
     int buffIndex;
     int firstPrimeInProc;
+    const char* outputName;
 
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
     MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+    outputName = (argc > 1) ? argv[1] : NULL;
 
     if (1 == num_processors)
     {
@@ -174,7 +247,7 @@ int main(int argc, char **argv)
     numInProc = CPU_CALC_END  + end - start + 1;
 
     /* Now, the memory needs to be allocated in every process. */
-    sieve = (unsigned char*)malloc(sizeof(unsigned char)*(numInProc));
+    sieve = (unsigned char*)HugeAlloc(sizeof(unsigned char)*(numInProc), &sieveKind);
 
     if (NULL == sieve)
     {
@@ -182,15 +255,15 @@ int main(int argc, char **argv)
     }
     MPI_Allreduce(&memError, &allMemError, 1, MPI_INT,  MPI_SUM, MPI_COMM_WORLD);
 
+    /* The worst kind of pages of all the processes is reported */
+    MPI_Allreduce(&sieveKind, &worstSieveKind, 1, MPI_INT,  MPI_MAX, MPI_COMM_WORLD);
+
     /* If one process fails to allocate the memory, all the process should free the allocated
     ** memory and quit the program. The process 0 needs to print the errors
     ** message before exiting the program. */
     if (0 != allMemError)
     {
-        if (NULL != sieve)
-        {
-            free(sieve);
-        }
+        HugeFree(sieve, sizeof(unsigned char)*(numInProc), sieveKind);
 
         MPI_Finalize();
 
@@ -208,9 +281,13 @@ int main(int argc, char **argv)
 
     if (0 == my_rank)
     {
+        printf("Sieve memory: %s.\n", HugePageName(worstSieveKind));
         gettimeofday(&startTime, NULL);
     }
 
+    TRACE_INIT(my_rank, 1);
+    TRACE_BEGIN("sieve");
+
      /* CPU_CALC_END*CPU_CALC_END is larger than the maximum value,
     ** so that it's enough to CPU_CALC_END in the following algorithm   */
     for (i=2; i<numInProc; i++)
@@ -264,7 +341,6 @@ int main(int argc, char **argv)
                 firstPrimeInProc = i;
 				lastPrime = i;
                 currDistance = 0;
-				printf("Process %d found first prime %d\n", my_rank, firstPrimeInProc);
 				continue;
             }
         }
@@ -286,6 +362,9 @@ int main(int argc, char **argv)
         }
         lastPrime = i;
     }
+    TRACE_END("sieve");
+
+    TRACE_BEGIN("exchange");
     /* So far, all distances inside the range have been found out. Let's find the distance
     ** between the range in different processes . All processes except for first process
     ** send the first prime number to previous process. */
@@ -332,7 +411,6 @@ int main(int argc, char **argv)
 		{
 			/* Current process has the largest value */
 		    MPI_Allreduce(&my_rank, &rank_has_largest, 1, MPI_INT,  MPI_MAX, MPI_COMM_WORLD);
-			printf("Largest distance in %d process\n", my_rank);
 		}
 		else
 		{
@@ -354,6 +432,7 @@ int main(int argc, char **argv)
 		    InsertLargeDistance(primeList[NEEDED_PRIME_NUM].distance, primeList[NEEDED_PRIME_NUM].smallPrime, primeList[NEEDED_PRIME_NUM].largePrime);
 		}
     }
+    TRACE_END("exchange");
 
     /* Process 0 print out the information */
     if (0 == my_rank)
@@ -369,7 +448,14 @@ int main(int argc, char **argv)
                  (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
                  (double) (currentTime.tv_sec - startTime.tv_sec));
     }
-    free(sieve);
+    if (NULL != outputName)
+    {
+        TRACE_BEGIN("output");
+        WritePrimes(outputName, sieve, start, end, my_rank);
+        TRACE_END("output");
+    }
+    TRACE_FLUSH("CP631_Final_MPI_trace.json");
+    HugeFree(sieve, sizeof(unsigned char)*(numInProc), sieveKind);
     /* Finalize the parallel process */
     MPI_Finalize();
     return 0;
@@ -16,7 +16,9 @@
 **  mpicc -fopenmp -O2 CP631_Final_MPI_OpenMP.c -o CP631_Final_MPI_OpenMP.x
 **
 ** Then, the code can be run by the command:
-**  OMP_NUM_THREADS=4 OMP_SCHEDULE=guided OMP_PROC_BIND=true mpirun -np 5 ./CP631_Final_MPI_OpenMP.x
+**  OMP_NUM_THREADS=4 OMP_SCHEDULE=guided OMP_PROC_BIND=true mpirun -np 5 ./CP631_Final_MPI_OpenMP.x [output_file]
+** With output_file, all the primes and the distances are written to it by MPI-IO (see
+** CP631_Output.h).
 **
 ** If in the server with small memory space, run the command below to prevent segfaults:
 ** ulimit -s unlimited
@@ -26,16 +28,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <inttypes.h>
 #include "mpi.h"
 #include <omp.h>
 #include <sys/time.h>
 
+#include "CP631_HugePage.h"
+#include "CP631_Trace.h"
+#include "CP631_Output.h"
+
 
 /********************************************************************/
 /***                                      local definition                                                 ******/
 /********************************************************************/
+/* It can be changed by the build command, e.g. -DMAX_NUMBER=100000000 */
+#ifndef MAX_NUMBER
 #define    MAX_NUMBER            (1000000000)
+#endif
 #define    NEEDED_PRIME_NUM      (5)
+#define    CACHE_LINE_SIZE       (64)
 
 
 /* Make sure the following definition satisfy the condition:
@@ -51,6 +62,17 @@ typedef struct
     int distance;
 } primeInfo;
 
+/* The result of one thread. Every thread has its own block aligned to the cache line, so
+** the threads never write to the same cache line. primeList[] has one more item as
+** InsertRcdTobuff() may touch NEEDED_PRIME_NUM+1 items. */
+typedef struct
+{
+    primeInfo primeList[NEEDED_PRIME_NUM+1];
+    int foundPrimeNum;
+    int firstPrime;          /* The first prime in the thread range */
+    int lastPrime;           /* The last prime in the thread range */
+} __attribute__((aligned(CACHE_LINE_SIZE))) threadInfo;
+
 
 /********************************************************************/
 /***                                Static Databases/Variables                                       *****/
@@ -159,10 +181,103 @@ void InsertRcdTobuff(primeInfo* buff, int* foundPrmInThd, int newDistance, int s
     }
 }
 
+/*********************************************************************
+** This function is written for adding the result of the thread range just after the range
+** of 'left' to 'left', including the distance across the border of the two ranges.
+*********************************************************************/
+void MergeThreadResult(threadInfo* left, const threadInfo* right)
+{
+    int j;
+
+    for (j = 0; j < right->foundPrimeNum; j++)
+    {
+        if ((left->foundPrimeNum < NEEDED_PRIME_NUM) || (right->primeList[j].distance > left->primeList[NEEDED_PRIME_NUM-1].distance))
+        {
+            InsertRcdTobuff(left->primeList, &left->foundPrimeNum, right->primeList[j].distance,
+                            right->primeList[j].smallPrime, right->primeList[j].largePrime);
+        }
+    }
+
+    if (0 == right->firstPrime)
+    {
+        return;
+    }
+
+    /* Handle the border distance between the two threads */
+    if (0 == left->firstPrime)
+    {
+        left->firstPrime = right->firstPrime;
+    }
+    else if ((left->foundPrimeNum < NEEDED_PRIME_NUM) ||
+             (right->firstPrime - left->lastPrime > left->primeList[NEEDED_PRIME_NUM-1].distance))
+    {
+        InsertRcdTobuff(left->primeList, &left->foundPrimeNum, right->firstPrime - left->lastPrime,
+                        left->lastPrime, right->firstPrime);
+    }
+
+    left->lastPrime = right->lastPrime;
+}
+
+/*********************************************************************
+** This function is written for writing the primes of this process and the 5 biggest
+** distances to the file 'outputName' by MPI-IO. The process has the numbers [start, end)
+** in sieve[CPU_CALC_END ...], and process 0 has [2, end) in sieve[2 ...].
+*********************************************************************/
+void WritePrimes(const char* outputName, const unsigned char* sieve, int start, int end, int my_rank)
+{
+    outputEncoder encoder;
+    primeInfo64 gaps[NEEDED_PRIME_NUM];
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+    uint64_t fileSize;
+    double seconds;
+    int i;
+
+    gettimeofday(&startTime, NULL);
+
+    OutputEncoderInit(&encoder, (0 == my_rank) ? 0 : (uint64_t)start, (uint64_t)end);
+    for (i = (0 == my_rank) ? 2 : CPU_CALC_END; i < CPU_CALC_END + end - start; i++)
+    {
+        if (0 != sieve[i])
+        {
+            OutputAddPrime(&encoder, (uint64_t)(i - CPU_CALC_END + start));
+        }
+    }
+
+    for (i = 0; i < NEEDED_PRIME_NUM; i++)
+    {
+        gaps[i].smallPrime = (uint64_t)primeList[i].smallPrime;
+        gaps[i].largePrime = (uint64_t)primeList[i].largePrime;
+        gaps[i].distance = (uint64_t)primeList[i].distance;
+    }
+
+    fileSize = OutputWrite(outputName, &encoder, 0, (uint64_t)MAX_NUMBER, gaps, NEEDED_PRIME_NUM);
+    OutputEncoderFree(&encoder);
+
+    if (0 == my_rank)
+    {
+        gettimeofday(&currentTime, NULL);
+        seconds = (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+                  (double) (currentTime.tv_sec - startTime.tv_sec);
+
+        if (0 == fileSize)
+        {
+            printf("Failed to write the file %s!\n", outputName);
+        }
+        else
+        {
+            printf("Output: %" PRIu64 " bytes written to %s in %f seconds (%.1f MB/s).\n",
+                   fileSize, outputName, seconds, (double)fileSize / seconds / 1e6);
+        }
+    }
+}
+
 int main(int argc, char **argv)
 {
     int DIM=MAX_NUMBER;
     unsigned char* sieve;
+    int sieveKind;              /* The kind of pages of the sieve, see CP631_HugePage.h */
+    int worstSieveKind;
     int i;
     int j;
     int numprimes;
@@ -180,16 +295,18 @@ int main(int argc, char **argv)
     int memError = 0;
     int allMemError = 0;
     int buffIndex;
-    primeInfo*  threadResult;
+    threadInfo* threadResult;
     /* Save the found prime in range [2, CPU_CALC_END]. The length is estimated: 1-1/2-1/3 = 1/6 */
     int primeByCPU[CPU_CALC_END/6];
     int foundByCPU = 0;
     int threadResSize;
     int num_threadPerProc;
+    const char* outputName;
 
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
     MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+    outputName = (argc > 1) ? argv[1] : NULL;
 
     if (1 == num_processors)
     {
@@ -217,7 +334,7 @@ int main(int argc, char **argv)
     numInProc = CPU_CALC_END  + end - start + 1;
 
     /* The memory needs to be allocated in every process. */
-    sieve = (unsigned char*)malloc(sizeof(unsigned char)*(numInProc));
+    sieve = (unsigned char*)HugeAlloc(sizeof(unsigned char)*(numInProc), &sieveKind);
 
     /* Now, the memory needs to be allocated for the result from every thread. */
     /* (NEEDED_PRIME_NUM+1) per thread. The last 5 items keep the biggest and smallest prime in thread */
@@ -226,8 +343,8 @@ int main(int argc, char **argv)
 		/* The function omp_get_num_threads() can get correct value in omp mode */
         num_threadPerProc = omp_get_num_threads();
 	}
-    threadResSize = sizeof(primeInfo) * num_threadPerProc * (NEEDED_PRIME_NUM+1);
-    threadResult = (primeInfo*)malloc(threadResSize);
+    threadResSize = sizeof(threadInfo) * num_threadPerProc;
+    threadResult = (threadInfo*)aligned_alloc(CACHE_LINE_SIZE, threadResSize);
 
     if ((NULL == sieve) || (NULL == threadResult))
     {
@@ -235,15 +352,15 @@ int main(int argc, char **argv)
     }
     MPI_Allreduce(&memError, &allMemError, 1, MPI_INT,  MPI_SUM, MPI_COMM_WORLD);
 
+    /* The worst kind of pages of all the processes is reported */
+    MPI_Allreduce(&sieveKind, &worstSieveKind, 1, MPI_INT,  MPI_MAX, MPI_COMM_WORLD);
+
     /* If one process fails to allocate the memory, all the process should free the allocated
     ** memory and quit the program. The process 0 needs to print the errors
     ** message before exiting the program. */
     if (0 != allMemError)
     {
-        if (NULL != sieve)
-        {
-            free(sieve);
-        }
+        HugeFree(sieve, sizeof(unsigned char)*(numInProc), sieveKind);
 
         if (NULL != threadResult)
         {
@@ -268,8 +385,10 @@ int main(int argc, char **argv)
 
     if (0 == my_rank)
     {
+        printf("Sieve memory: %s.\n", HugePageName(worstSieveKind));
         gettimeofday(&startTime, NULL);
     }
+    TRACE_INIT(my_rank, num_threadPerProc);
 
     /* Find out all the prime number in the range [2, CPU_CALC_END] */
     for (i=2; i<CPU_CALC_END; i++)
@@ -289,9 +408,9 @@ int main(int argc, char **argv)
 
 #pragma omp parallel firstprivate(i, j, buffIndex, lastPrime, startThd, endThd)
     {
-        int foundPrimeInThread = 0;
         int ID = omp_get_thread_num();
-        primeInfo* threadCurrRes = &threadResult[ID * NEEDED_PRIME_NUM];
+        threadInfo* threadCurrRes = &threadResult[ID];
+        int step;
         int firstPrimeInProc = 0;
         int currentPrime;
 
@@ -304,7 +423,7 @@ int main(int argc, char **argv)
         {
             endThd = end;
         }
-printf("foundByCPU(%d), startThd(%d), endThd(%d), my_rank(%d), ID(%d)!\n", foundByCPU, startThd, endThd, my_rank, ID);
+        TRACE_BEGIN("sieve");
         /* The following loop will run sieve algorithm for the thread range   */
         for (i=0; i<foundByCPU; i++)
         {
@@ -333,6 +452,9 @@ printf("foundByCPU(%d), startThd(%d), endThd(%d), my_rank(%d), ID(%d)!\n", found
             buffIndex = startThd - start + CPU_CALC_END;
 		}
 
+        TRACE_END("sieve");
+
+        TRACE_BEGIN("scan");
         /* Find out all the prime numbers and save the largest distance in array */
         for (i=startThd; i<endThd; i++, buffIndex++)
         {
@@ -345,47 +467,42 @@ printf("foundByCPU(%d), startThd(%d), endThd(%d), my_rank(%d), ID(%d)!\n", found
             {
                 firstPrimeInProc = i;
                 /* Save the first prime in the thread for future use */
-                threadResult[num_threadPerProc * NEEDED_PRIME_NUM + ID].smallPrime = i;
-              printf("firstPrimeInProc(%d), my_rank(%d), ID(%d)!\n", firstPrimeInProc, my_rank, ID);
+                threadCurrRes->firstPrime = i;
             }
             else
             {
                 currDistance = i - lastPrime;
 
-                if((foundPrimeInThread < NEEDED_PRIME_NUM) || (currDistance > threadCurrRes[foundPrimeInThread -1].distance))
+                if((threadCurrRes->foundPrimeNum < NEEDED_PRIME_NUM) || (currDistance > threadCurrRes->primeList[NEEDED_PRIME_NUM-1].distance))
                 {
-                    InsertRcdTobuff(threadCurrRes, &foundPrimeInThread ,currDistance, lastPrime, i);
+                    InsertRcdTobuff(threadCurrRes->primeList, &threadCurrRes->foundPrimeNum, currDistance, lastPrime, i);
                 }
             }
 
             lastPrime = i;
         }
 
-        threadResult[num_threadPerProc * NEEDED_PRIME_NUM + ID].largePrime = lastPrime;
-    } // end of #pragma
+        threadCurrRes->lastPrime = lastPrime;
+        TRACE_END("scan");
 
-    /* Let's put largest 5 distances to prime buffer */
-    for (i=0; i<num_threadPerProc * NEEDED_PRIME_NUM; i++)
-    {
-		//printf("buffer (%d), distance(%d), small prime(%d), large prime(%d) foundPrimeNum(%d)\n", i, threadResult[i].distance, threadResult[i].smallPrime, threadResult[i].largePrime, foundPrimeNum);
-        if ((foundPrimeNum < NEEDED_PRIME_NUM) || (threadResult[i].distance > primeList[NEEDED_PRIME_NUM-1].distance))
+        /* Tree reduction: in round 'step', thread ID adds the result of thread ID+step, so
+        ** the result of all the threads is in threadResult[0] after log2(threads) rounds. */
+        for (step = 1; step < num_threadPerProc; step *= 2)
         {
-            InsertLargeDistance(threadResult[i].distance, threadResult[i].smallPrime, threadResult[i].largePrime);
-			//printf("buffer (%d), distance(%d), small prime(%d), large prime(%d)\n", foundPrimeNum-1, primeList[foundPrimeNum-1].distance, primeList[foundPrimeNum-1].smallPrime, primeList[foundPrimeNum-1].largePrime);
+#pragma omp barrier
+            if ((0 == ID % (2 * step)) && (ID + step < num_threadPerProc))
+            {
+                TRACE_BEGIN("reduce");
+                MergeThreadResult(threadCurrRes, &threadResult[ID + step]);
+                TRACE_END("reduce");
+            }
         }
-    }
+    } // end of #pragma
 
-    /* Handle the border distance between threads */
-    for (i=0; i<num_threadPerProc-1; i++)
-    {
-        j = i + num_threadPerProc * NEEDED_PRIME_NUM;
-        currDistance = threadResult[j+1].smallPrime - threadResult[j].largePrime;
-        if (currDistance > primeList[NEEDED_PRIME_NUM-1].distance)
-        {
-            InsertLargeDistance(currDistance, threadResult[j].largePrime, threadResult[j+1].smallPrime);
-        }
-    }
+    memcpy(primeList, threadResult[0].primeList, sizeof(primeInfo) * NEEDED_PRIME_NUM);
+    foundPrimeNum = threadResult[0].foundPrimeNum;
 
+    TRACE_BEGIN("exchange");
     /* So far, all distances inside the range have been found out. Let's find the distance
     ** between the range in different processes . All processes except for first process
     ** send the first prime number to previous process. */
@@ -396,18 +513,18 @@ printf("foundByCPU(%d), startThd(%d), endThd(%d), my_rank(%d), ID(%d)!\n", found
     }
     else if (my_rank == (num_processors-1))
     {
-        MPI_Send(&threadResult[num_threadPerProc * NEEDED_PRIME_NUM].smallPrime, 1, MPI_INT, my_rank-1, 0, MPI_COMM_WORLD);
+        MPI_Send(&threadResult[0].firstPrime, 1, MPI_INT, my_rank-1, 0, MPI_COMM_WORLD);
     }
     else
     {
         if (0 == (my_rank%2))
         {
             MPI_Recv(&primeList[NEEDED_PRIME_NUM].smallPrime, 1, MPI_INT, my_rank+1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            MPI_Send(&threadResult[num_threadPerProc * NEEDED_PRIME_NUM].smallPrime, 1, MPI_INT, my_rank-1, 0, MPI_COMM_WORLD);
+            MPI_Send(&threadResult[0].firstPrime, 1, MPI_INT, my_rank-1, 0, MPI_COMM_WORLD);
         }
         else
         {
-            MPI_Send(&threadResult[num_threadPerProc * NEEDED_PRIME_NUM].smallPrime, 1, MPI_INT, my_rank-1, 0, MPI_COMM_WORLD);
+            MPI_Send(&threadResult[0].firstPrime, 1, MPI_INT, my_rank-1, 0, MPI_COMM_WORLD);
             MPI_Recv(&primeList[NEEDED_PRIME_NUM].smallPrime, 1, MPI_INT, my_rank+1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
         }
     }
@@ -415,11 +532,11 @@ printf("foundByCPU(%d), startThd(%d), endThd(%d), my_rank(%d), ID(%d)!\n", found
     /* The last process doesn't need to calculate the cross border distance */
     if (my_rank < (num_processors-1))
     {
-        currDistance = primeList[NEEDED_PRIME_NUM].smallPrime - threadResult[num_threadPerProc * NEEDED_PRIME_NUM + num_threadPerProc-1].largePrime;
+        currDistance = primeList[NEEDED_PRIME_NUM].smallPrime - threadResult[0].lastPrime;
         /* The current distance is larger than the smallest record distance. Save it. */
         if (currDistance >= primeList[foundPrimeNum-1].distance)
         {
-            InsertLargeDistance(currDistance,  threadResult[num_threadPerProc * NEEDED_PRIME_NUM + num_threadPerProc-1].largePrime, primeList[NEEDED_PRIME_NUM].smallPrime);
+            InsertLargeDistance(currDistance,  threadResult[0].lastPrime, primeList[NEEDED_PRIME_NUM].smallPrime);
         }
     }
 
@@ -455,6 +572,8 @@ printf("foundByCPU(%d), startThd(%d), endThd(%d), my_rank(%d), ID(%d)!\n", found
         }
     }
 
+    TRACE_END("exchange");
+
     /* Process 0 print out the information */
     if (0 == my_rank)
     {
@@ -469,7 +588,14 @@ printf("foundByCPU(%d), startThd(%d), endThd(%d), my_rank(%d), ID(%d)!\n", found
                  (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
                  (double) (currentTime.tv_sec - startTime.tv_sec));
     }
-    free(sieve);
+    if (NULL != outputName)
+    {
+        TRACE_BEGIN("output");
+        WritePrimes(outputName, sieve, start, end, my_rank);
+        TRACE_END("output");
+    }
+    TRACE_FLUSH("CP631_Final_MPI_OpenMP_trace.json");
+    HugeFree(sieve, sizeof(unsigned char)*(numInProc), sieveKind);
     free(threadResult);
 
     /* Finalize the parallel process */
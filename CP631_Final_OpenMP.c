@@ -29,12 +29,19 @@
 #include <omp.h>
 #include <sys/time.h>
 
+#include "CP631_HugePage.h"
+#include "CP631_Trace.h"
+
 
 /********************************************************************/
 /***                                      local definition                                                 ******/
 /********************************************************************/
+/* It can be changed by the build command, e.g. -DMAX_NUMBER=100000000 */
+#ifndef MAX_NUMBER
 #define    MAX_NUMBER            (1000000000)
+#endif
 #define    NEEDED_PRIME_NUM      (5)
+#define    CACHE_LINE_SIZE       (64)
 
 
 /* Make sure the following definition satisfy the condition:
@@ -50,6 +57,17 @@ typedef struct
     int distance;
 } primeInfo;
 
+/* The result of one thread. Every thread has its own block aligned to the cache line, so
+** the threads never write to the same cache line. primeList[] has one more item as
+** InsertRcdTobuff() may touch NEEDED_PRIME_NUM+1 items. */
+typedef struct
+{
+    primeInfo primeList[NEEDED_PRIME_NUM+1];
+    int foundPrimeNum;
+    int firstPrime;          /* The first prime in the thread range */
+    int lastPrime;           /* The last prime in the thread range */
+} __attribute__((aligned(CACHE_LINE_SIZE))) threadInfo;
+
 
 /********************************************************************/
 /***                                Static Databases/Variables                                       *****/
@@ -65,102 +83,78 @@ int foundPrimeNum =0;        /* The number of found prime number. Range: 0 ~ 5 *
 ** This function is written for inserting the new large distance information to structure
 ** primeList[].
 *********************************************************************/
-void InsertLargeDistance(int newDistance, int smallPrime, int largePrime)
+void InsertRcdTobuff(primeInfo* buff, int* foundPrmInThd, int newDistance, int smallPrime, int largePrime)
 {
     int j;
 
     /* This 'for' loop moves the items for new large distance */
-    for (j=foundPrimeNum; j>=0; --j)
+    for (j=*foundPrmInThd; j>=0; --j)
     {
         /* Save the new result to the sorted place */
         /* Note: 6 items are defined in array primeList to avoid overrun */
-        if ( (0 == j) || (newDistance <= primeList[j - 1].distance))
+        if ( (0 == j) || (newDistance <= buff[j - 1].distance))
         {
-            primeList[j].smallPrime = smallPrime;
-            primeList[j].largePrime = largePrime;
-            primeList[j].distance = newDistance;
+            buff[j].smallPrime = smallPrime;
+            buff[j].largePrime = largePrime;
+            buff[j].distance = newDistance;
             break;
         }
         else if (NEEDED_PRIME_NUM != j)
         {
             /* Move the item */
-            primeList[j].smallPrime = primeList[j-1].smallPrime;
-            primeList[j].largePrime = primeList[j-1].largePrime;
-            primeList[j].distance = primeList[j-1].distance;
+            buff[j].smallPrime = buff[j-1].smallPrime;
+            buff[j].largePrime = buff[j-1].largePrime;
+            buff[j].distance = buff[j-1].distance;
         }
     }
 
-    if (foundPrimeNum < NEEDED_PRIME_NUM)
+    if (*foundPrmInThd < NEEDED_PRIME_NUM)
     {
-        foundPrimeNum++;
+        (*foundPrmInThd)++;
     }
 }
 
 /*********************************************************************
-** This function is written for deleting the largest distance information from structure
-** primeList[].
+** This function is written for adding the result of the thread range just after the range
+** of 'left' to 'left', including the distance across the border of the two ranges.
 *********************************************************************/
-void DeleteLargestDistance()
+void MergeThreadResult(threadInfo* left, const threadInfo* right)
 {
     int j;
 
-    if (foundPrimeNum > 0)
+    for (j = 0; j < right->foundPrimeNum; j++)
     {
-        foundPrimeNum--;
-
-        /* Delete the largest one, then move other items */
-        for (j = 0; j < foundPrimeNum; ++j)
+        if ((left->foundPrimeNum < NEEDED_PRIME_NUM) || (right->primeList[j].distance > left->primeList[NEEDED_PRIME_NUM-1].distance))
         {
-            primeList[j].smallPrime = primeList[j+1].smallPrime;
-            primeList[j].largePrime = primeList[j+1].largePrime;
-            primeList[j].distance = primeList[j+1].distance;
+            InsertRcdTobuff(left->primeList, &left->foundPrimeNum, right->primeList[j].distance,
+                            right->primeList[j].smallPrime, right->primeList[j].largePrime);
         }
-
-        /* Clear the old data */
-        primeList[foundPrimeNum].smallPrime = 0;
-        primeList[foundPrimeNum].largePrime = 0;
-        primeList[foundPrimeNum].distance = 0;
     }
-}
-
-/*********************************************************************
-** This function is written for inserting the new large distance information to structure
-** primeList[].
-*********************************************************************/
-void InsertRcdTobuff(primeInfo* buff, int* foundPrmInThd, int newDistance, int smallPrime, int largePrime)
-{
-    int j;
 
-    /* This 'for' loop moves the items for new large distance */
-    for (j=*foundPrmInThd; j>=0; --j)
+    if (0 == right->firstPrime)
     {
-        /* Save the new result to the sorted place */
-        /* Note: 6 items are defined in array primeList to avoid overrun */
-        if ( (0 == j) || (newDistance <= buff[j - 1].distance))
-        {
-            buff[j].smallPrime = smallPrime;
-            buff[j].largePrime = largePrime;
-            buff[j].distance = newDistance;
-            break;
-        }
-        else if (NEEDED_PRIME_NUM != j)
-        {
-            /* Move the item */
-            buff[j].smallPrime = buff[j-1].smallPrime;
-            buff[j].largePrime = buff[j-1].largePrime;
-            buff[j].distance = buff[j-1].distance;
-        }
+        return;
     }
 
-    if (*foundPrmInThd < NEEDED_PRIME_NUM)
+    /* Handle the border distance between the two threads */
+    if (0 == left->firstPrime)
     {
-        (*foundPrmInThd)++;
+        left->firstPrime = right->firstPrime;
     }
+    else if ((left->foundPrimeNum < NEEDED_PRIME_NUM) ||
+             (right->firstPrime - left->lastPrime > left->primeList[NEEDED_PRIME_NUM-1].distance))
+    {
+        InsertRcdTobuff(left->primeList, &left->foundPrimeNum, right->firstPrime - left->lastPrime,
+                        left->lastPrime, right->firstPrime);
+    }
+
+    left->lastPrime = right->lastPrime;
 }
 
 int main(int argc, char **argv)
 {
     unsigned char* sieve;
+    int sieveKind;              /* The kind of pages of the sieve, see CP631_HugePage.h */
     int i;
     int j;
     int numprimes;
@@ -171,8 +165,7 @@ int main(int argc, char **argv)
     int currDistance;
 
     int start, end, numInThd;            /* The start, end and range of thread */
-    int buffIndex;
-    primeInfo*  threadResult;
+    threadInfo* threadResult;
     /* Save the found prime in range [2, CPU_CALC_END]. The length is estimated: 1-1/2-1/3 = 1/6 */
     int primeByCPU[CPU_CALC_END/6];
     int foundByCPU = 0;
@@ -187,17 +180,14 @@ int main(int argc, char **argv)
 	}
 
     /* Allocate the memory for all threads. */
-    sieve = (unsigned char*)malloc(sizeof(unsigned char)* MAX_NUMBER);
+    sieve = (unsigned char*)HugeAlloc(sizeof(unsigned char)* MAX_NUMBER, &sieveKind);
 
-    threadResSize = sizeof(primeInfo) * num_thread * (NEEDED_PRIME_NUM+1);
-    threadResult = (primeInfo*)malloc(threadResSize);
+    threadResSize = sizeof(threadInfo) * num_thread;
+    threadResult = (threadInfo*)aligned_alloc(CACHE_LINE_SIZE, threadResSize);
 
     if ((NULL == sieve) || (NULL == threadResult))
     {
-        if (NULL != sieve)
-        {
-            free(sieve);
-        }
+        HugeFree(sieve, sizeof(unsigned char)* MAX_NUMBER, sieveKind);
 
         if (NULL != threadResult)
         {
@@ -209,6 +199,7 @@ int main(int argc, char **argv)
     }
 
     memset(threadResult, 0, threadResSize);
+    printf("Sieve memory: %s.\n", HugePageName(sieveKind));
 
     for (i=2; i<MAX_NUMBER; i++)
     {
@@ -216,6 +207,7 @@ int main(int argc, char **argv)
     }
 
     gettimeofday(&startTime, NULL);
+    TRACE_INIT(0, num_thread);
 
     /* Find out all the prime number in the range [2, CPU_CALC_END] */
     for (i=2; i<CPU_CALC_END; i++)
@@ -233,11 +225,11 @@ int main(int argc, char **argv)
         primeByCPU[foundByCPU++] = i;
     }
 
-#pragma omp parallel firstprivate(i, j, buffIndex, lastPrime, start, end)
+#pragma omp parallel firstprivate(i, j, lastPrime, start, end)
     {
-        int foundPrimeInThread = 0;
         int ID = omp_get_thread_num();
-        primeInfo* threadCurrRes = &threadResult[ID * NEEDED_PRIME_NUM];
+        threadInfo* threadCurrRes = &threadResult[ID];
+        int step;
         int firstPrimeInthreadc = 0;
         int currentPrime;
 
@@ -252,7 +244,7 @@ int main(int argc, char **argv)
             end = MAX_NUMBER;
         }
 
-printf("foundByCPU(%d), start(%d), end(%d),ID(%d)!\n", foundByCPU, start, end, ID);
+        TRACE_BEGIN("sieve");
         /* The following loop will run sieve algorithm for the thread range   */
         for (i=0; i<foundByCPU; i++)
         {
@@ -274,6 +266,9 @@ printf("foundByCPU(%d), start(%d), end(%d),ID(%d)!\n", foundByCPU, start, end, I
             start = 2;
         }
 
+        TRACE_END("sieve");
+
+        TRACE_BEGIN("scan");
         /* Find out all the prime numbers and save the largest distance in array */
         for (i=start; i<end; i++)
         {
@@ -286,46 +281,40 @@ printf("foundByCPU(%d), start(%d), end(%d),ID(%d)!\n", foundByCPU, start, end, I
             {
                 firstPrimeInthreadc = i;
                 /* Save the first prime in the thread for future use */
-                threadResult[num_thread * NEEDED_PRIME_NUM + ID].smallPrime = i;
-              printf("firstPrimeInthreadc(%d), ID(%d)!\n", firstPrimeInthreadc, ID);
+                threadCurrRes->firstPrime = i;
             }
             else
             {
                 currDistance = i - lastPrime;
 
-                if((foundPrimeInThread < NEEDED_PRIME_NUM) || (currDistance > threadCurrRes[foundPrimeInThread -1].distance))
+                if((threadCurrRes->foundPrimeNum < NEEDED_PRIME_NUM) || (currDistance > threadCurrRes->primeList[NEEDED_PRIME_NUM-1].distance))
                 {
-                    InsertRcdTobuff(threadCurrRes, &foundPrimeInThread ,currDistance, lastPrime, i);
+                    InsertRcdTobuff(threadCurrRes->primeList, &threadCurrRes->foundPrimeNum, currDistance, lastPrime, i);
                 }
             }
 
             lastPrime = i;
         }
 
-        threadResult[num_thread * NEEDED_PRIME_NUM + ID].largePrime = lastPrime;
-    } // end of #pragma
+        threadCurrRes->lastPrime = lastPrime;
+        TRACE_END("scan");
 
-    /* Let's put largest 5 distances to prime buffer */
-    for (i=0; i<num_thread * NEEDED_PRIME_NUM; i++)
-    {
-		//printf("buffer (%d), distance(%d), small prime(%d), large prime(%d) foundPrimeNum(%d)\n", i, threadResult[i].distance, threadResult[i].smallPrime, threadResult[i].largePrime, foundPrimeNum);
-        if ((foundPrimeNum < NEEDED_PRIME_NUM) || (threadResult[i].distance > primeList[NEEDED_PRIME_NUM-1].distance))
+        /* Tree reduction: in round 'step', thread ID adds the result of thread ID+step, so
+        ** the result of all the threads is in threadResult[0] after log2(threads) rounds. */
+        for (step = 1; step < num_thread; step *= 2)
         {
-            InsertLargeDistance(threadResult[i].distance, threadResult[i].smallPrime, threadResult[i].largePrime);
-			//printf("buffer (%d), distance(%d), small prime(%d), large prime(%d)\n", foundPrimeNum-1, primeList[foundPrimeNum-1].distance, primeList[foundPrimeNum-1].smallPrime, primeList[foundPrimeNum-1].largePrime);
+#pragma omp barrier
+            if ((0 == ID % (2 * step)) && (ID + step < num_thread))
+            {
+                TRACE_BEGIN("reduce");
+                MergeThreadResult(threadCurrRes, &threadResult[ID + step]);
+                TRACE_END("reduce");
+            }
         }
-    }
+    } // end of #pragma
 
-    /* Handle the border distance between threads */
-    for (i=0; i<num_thread-1; i++)
-    {
-        j = i + num_thread * NEEDED_PRIME_NUM;
-        currDistance = threadResult[j+1].smallPrime - threadResult[j].largePrime;
-        if (currDistance > primeList[NEEDED_PRIME_NUM-1].distance)
-        {
-            InsertLargeDistance(currDistance, threadResult[j].largePrime, threadResult[j+1].smallPrime);
-        }
-    }
+    memcpy(primeList, threadResult[0].primeList, sizeof(primeInfo) * NEEDED_PRIME_NUM);
+    foundPrimeNum = threadResult[0].foundPrimeNum;
 
     gettimeofday(&currentTime, NULL);
 
@@ -338,7 +327,8 @@ printf("foundByCPU(%d), start(%d), end(%d),ID(%d)!\n", foundByCPU, start, end, I
              (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
              (double) (currentTime.tv_sec - startTime.tv_sec));
 
-    free(sieve);
+    TRACE_FLUSH("CP631_Final_OpenMP_trace.json");
+    HugeFree(sieve, sizeof(unsigned char)* MAX_NUMBER, sieveKind);
     free(threadResult);
 
     return 0;
@@ -0,0 +1,605 @@
+/**********************************************************************************************
+**  This program answers a batch of range queries in one job: for every range [lo, hi) of
+**  the input file it finds out the biggest distances of the consecutive prime numbers and
+**  the number of primes, with the sieve engine of CP631_Engine.h.
+**
+**  Running one CP631_Final_* program per range would generate the base primes, allocate the
+**  buffers and start the threads again for every range. Here:
+**
+**  1. process 0 reads the ranges, and all the processes get them,
+**  2. the ranges are sorted and the overlapping ones are coalesced, then the covered numbers
+**     are cut at every border of a range into pieces, so every number is sieved only once
+**     even if it is in many ranges,
+**  3. the pieces are cut into tasks of one segment, and the tasks are split between the MPI
+**     processes and taken one by one by the OpenMP threads, which keep their segment buffer
+**     for all the tasks; the base primes up to sqrt of the biggest hi are made once,
+**  4. every process merges the results of its tasks of the same piece, process 0 gathers
+**     these parts and merges them, with the distances across the borders, into the result
+**     of every piece and then of every range, printed in the order of the input file.
+**
+**  The input file has one range "lo hi" per line (both "1000000000" and "1e9" are
+**  accepted); the empty lines and the lines starting with '#' are skipped.
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  mpicc -fopenmp -O2 -march=native CP631_Final_batch.c -o CP631_Final_batch.x
+**
+** Then, the code can be run by the command:
+**  OMP_NUM_THREADS=4 mpirun -np 6 ./CP631_Final_batch.x <range_file> [-k top] [-s segment_words] [-g algorithm]
+** e.g. ./CP631_Final_batch.x ranges.txt -k 3
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "mpi.h"
+#include <omp.h>
+#include <sys/time.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_Engine.h"
+#include "CP631_Tune.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    NEEDED_PRIME_NUM      (5)
+
+typedef struct
+{
+    uint64_t low;                /* The range is [low, high) */
+    uint64_t high;
+} batchRange;
+
+typedef struct
+{
+    uint64_t piece;              /* The piece of the task */
+    uint64_t wordLo;             /* The words of the task are [wordLo, wordHi) */
+    uint64_t wordHi;
+} batchTask;
+
+
+/*********************************************************************
+** This function is written for checking that a range is not empty and that the engine can
+** sieve it.
+*********************************************************************/
+int RangeValid(const batchRange* range)
+{
+    return (range->low < range->high) && (range->high <= UINT64_MAX - SIEVE_NUMS_PER_WORD);
+}
+
+/*********************************************************************
+** This function is written for comparing two numbers for qsort().
+*********************************************************************/
+int CompareNumber(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/*********************************************************************
+** This function is written for comparing two ranges by their low end for qsort().
+*********************************************************************/
+int CompareRange(const void* a, const void* b)
+{
+    return CompareNumber(&((const batchRange*)a)->low, &((const batchRange*)b)->low);
+}
+
+/*********************************************************************
+** This function is written for reading the ranges of 'fileName'. The number of ranges is
+** returned, or -1 if the file can't be read or the memory can't be allocated.
+*********************************************************************/
+int64_t ReadRanges(const char* fileName, batchRange** ranges)
+{
+    FILE* file;
+    batchRange* more;
+    char line[256];
+    char lowText[128];
+    char highText[128];
+    int64_t count = 0;
+    int64_t capacity = 1024;
+
+    file = fopen(fileName, "r");
+    *ranges = (batchRange*)malloc(sizeof(batchRange) * (size_t)capacity);
+    if ((NULL == file) || (NULL == *ranges))
+    {
+        if (NULL != file)
+        {
+            fclose(file);
+        }
+        return -1;
+    }
+
+    while (NULL != fgets(line, sizeof(line), file))
+    {
+        if (('#' == line[0]) || (2 != sscanf(line, "%127s %127s", lowText, highText)))
+        {
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            more = (batchRange*)realloc(*ranges, sizeof(batchRange) * (size_t)capacity * 2);
+            if (NULL == more)
+            {
+                fclose(file);
+                return -1;
+            }
+            *ranges = more;
+            capacity *= 2;
+        }
+
+        (*ranges)[count].low = ParseNumber(lowText);
+        (*ranges)[count].high = ParseNumber(highText);
+        count++;
+    }
+
+    fclose(file);
+    return count;
+}
+
+/*********************************************************************
+** This function is written for cutting the numbers covered by the ranges into pieces: the
+** ranges are sorted and coalesced, then every coalesced range is cut at all the borders of
+** the ranges inside it. The pieces are in increasing order and their number is returned,
+** or -1 if the memory can't be allocated.
+*********************************************************************/
+int64_t MakePieces(const batchRange* ranges, int64_t numRanges, batchRange** pieces)
+{
+    batchRange* sorted;
+    uint64_t* borders;
+    uint64_t unionLow;
+    uint64_t unionHigh;
+    int64_t numBorders = 0;
+    int64_t numPieces = 0;
+    int64_t b = 0;
+    int64_t i;
+    int64_t j;
+
+    sorted = (batchRange*)malloc(sizeof(batchRange) * (size_t)(numRanges + 1));
+    borders = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)(2 * numRanges + 1));
+    *pieces = (batchRange*)malloc(sizeof(batchRange) * (size_t)(2 * numRanges + 1));
+    if ((NULL == sorted) || (NULL == borders) || (NULL == *pieces))
+    {
+        free(sorted);
+        free(borders);
+        return -1;
+    }
+
+    /* The empty ranges cover nothing */
+    for (i = 0, j = 0; i < numRanges; i++)
+    {
+        if (RangeValid(&ranges[i]))
+        {
+            sorted[j++] = ranges[i];
+            borders[numBorders++] = ranges[i].low;
+            borders[numBorders++] = ranges[i].high;
+        }
+    }
+    qsort(sorted, (size_t)j, sizeof(batchRange), CompareRange);
+    qsort(borders, (size_t)numBorders, sizeof(uint64_t), CompareNumber);
+
+    for (i = 0; i < j; )
+    {
+        /* Coalesce the ranges which overlap or touch */
+        unionLow = sorted[i].low;
+        unionHigh = sorted[i].high;
+        for (i++; (i < j) && (sorted[i].low <= unionHigh); i++)
+        {
+            unionHigh = (sorted[i].high > unionHigh) ? sorted[i].high : unionHigh;
+        }
+
+        /* Cut [unionLow, unionHigh) at the borders inside it */
+        while (borders[b] < unionLow)
+        {
+            b++;
+        }
+        for (; (b + 1 < numBorders) && (borders[b + 1] <= unionHigh); b++)
+        {
+            if (borders[b] < borders[b + 1])
+            {
+                (*pieces)[numPieces].low = borders[b];
+                (*pieces)[numPieces].high = borders[b + 1];
+                numPieces++;
+            }
+        }
+    }
+
+    free(sorted);
+    free(borders);
+    return numPieces;
+}
+
+/*********************************************************************
+** This function is written for finding the piece starting at 'low'. -1 if there is none.
+*********************************************************************/
+int64_t FindPiece(const batchRange* pieces, int64_t numPieces, uint64_t low)
+{
+    int64_t lo = 0;
+    int64_t hi = numPieces;
+    int64_t mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (pieces[mid].low < low)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return ((lo < numPieces) && (pieces[lo].low == low)) ? lo : -1;
+}
+
+/*********************************************************************
+** This function is written for merging the results of the tasks [taskLo, taskHi) which are
+** next to each other in the same piece, in place at the start of 'results' (the result of
+** the task n is results[n - taskLo]). The number of merged parts is returned; with 'results'
+** NULL, they are only counted.
+*********************************************************************/
+int64_t MergeTasks(const batchTask* tasks, int64_t taskLo, int64_t taskHi, engineResult* results, int topK)
+{
+    int64_t parts = 0;
+    int64_t n;
+
+    for (n = taskLo; n < taskHi; n++)
+    {
+        if ((n == taskLo) || (tasks[n].piece != tasks[n - 1].piece))
+        {
+            if (NULL != results)
+            {
+                results[parts] = results[n - taskLo];
+            }
+            parts++;
+        }
+        else if (NULL != results)
+        {
+            EngineMerge(&results[parts - 1], &results[n - taskLo], topK);
+        }
+    }
+
+    return parts;
+}
+
+int main(int argc, char **argv)
+{
+    engineConfig cfg;
+    tuneProfile profile;
+    batchRange* ranges = NULL;
+    batchRange* pieces = NULL;
+    batchTask* tasks = NULL;
+    engineResult* taskRes = NULL;
+    engineResult* allRes = NULL;
+    engineResult rangeRes;
+    uint32_t* basePrimes = NULL;
+    uint64_t maxHigh = 0;
+    uint64_t wordLo;
+    uint64_t wordHi;
+    uint64_t w;
+    uint64_t sievedNums = 0;
+    uint64_t askedNums = 0;
+    int64_t numRanges = 0;
+    int64_t numPieces = 0;
+    int64_t numTasks = 0;
+    int64_t taskLo;
+    int64_t taskHi;
+    int64_t numParts = 0;
+    int64_t allParts = 0;
+    int64_t lastPiece;
+    int64_t i;
+    int64_t j;
+    int64_t t;
+    int* counts = NULL;
+    int* displs = NULL;
+    MPI_Datatype rangeType;
+    MPI_Datatype resultType;
+    int my_rank;
+    int num_processors;
+    int memError = 0;
+    int allMemError = 0;
+    int segmentGiven = 0;
+    int status = 0;
+    int k;
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+
+    /* The ranges and the results are sent as whole items, so the counts stay small */
+    MPI_Type_contiguous(2, MPI_UINT64_T, &rangeType);
+    MPI_Type_commit(&rangeType);
+    MPI_Type_contiguous((int)sizeof(engineResult), MPI_BYTE, &resultType);
+    MPI_Type_commit(&resultType);
+
+    cfg.low = 0;
+    cfg.high = 0;
+    cfg.segmentWords = ENGINE_SEGMENT_WORDS;
+    cfg.topK = NEEDED_PRIME_NUM;
+    cfg.numThreads = omp_get_max_threads();
+    cfg.markStrategy = SIEVE_MARK_KERNELS;
+    cfg.sharedFloor = 0;
+    cfg.algorithm = 0;
+    cfg.blocks = NULL;
+    cfg.progress = NULL;
+
+    for (k = 2; k < argc; k++)
+    {
+        if ((0 == strcmp(argv[k], "-k")) && (k + 1 < argc))
+        {
+            cfg.topK = atoi(argv[++k]);
+        }
+        else if ((0 == strcmp(argv[k], "-s")) && (k + 1 < argc))
+        {
+            cfg.segmentWords = ParseNumber(argv[++k]);
+            segmentGiven = 1;
+        }
+        else if ((0 == strcmp(argv[k], "-g")) && (k + 1 < argc))
+        {
+            cfg.algorithm = EngineFindAlgorithm(argv[++k]);
+        }
+        else
+        {
+            status = -1;
+        }
+    }
+
+    if ((argc < 2) || (0 != status) || (cfg.topK < 1) || (cfg.topK > ENGINE_MAX_TOP) ||
+        (0 == cfg.segmentWords) || (cfg.algorithm < 0))
+    {
+        if (0 == my_rank)
+        {
+            printf("Usage: %s <range_file> [-k top(1-%d)] [-s segment_words] [-g algorithm]\n",
+                   argv[0], ENGINE_MAX_TOP);
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    /* The segment size and the threads of the saved profile of the host */
+    if (!segmentGiven && (0 == TuneLoad(&profile)))
+    {
+        cfg.segmentWords = profile.segmentWords;
+        cfg.markStrategy = profile.markStrategy;
+        cfg.numThreads = profile.numThreads;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    gettimeofday(&startTime, NULL);
+
+    /* Process 0 reads the ranges, the others get them */
+    if (0 == my_rank)
+    {
+        numRanges = ReadRanges(argv[1], &ranges);
+    }
+    MPI_Bcast(&numRanges, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+    if (numRanges <= 0)
+    {
+        if (0 == my_rank)
+        {
+            printf("No range is read from %s!\n", argv[1]);
+        }
+        free(ranges);
+        MPI_Finalize();
+        return 0;
+    }
+
+    if (0 != my_rank)
+    {
+        ranges = (batchRange*)malloc(sizeof(batchRange) * (size_t)numRanges);
+        memError = (NULL == ranges);
+    }
+    MPI_Allreduce(&memError, &allMemError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (0 == allMemError)
+    {
+        MPI_Bcast(ranges, (int)numRanges, rangeType, 0, MPI_COMM_WORLD);
+
+        /* Every process makes the same pieces and tasks by itself */
+        numPieces = MakePieces(ranges, numRanges, &pieces);
+        memError = (numPieces < 0);
+        for (i = 0; i < numPieces; i++)
+        {
+            wordLo = SIEVE_WORD_OF(pieces[i].low);
+            wordHi = SIEVE_WORD_OF(pieces[i].high - 1) + 1;
+            numTasks += (int64_t)((wordHi - wordLo + cfg.segmentWords - 1) / cfg.segmentWords);
+            maxHigh = (pieces[i].high > maxHigh) ? pieces[i].high : maxHigh;
+            sievedNums += pieces[i].high - pieces[i].low;
+        }
+
+        tasks = (batchTask*)malloc(sizeof(batchTask) * (size_t)(numTasks + 1));
+        memError |= (NULL == tasks);
+        for (i = 0, t = 0; (NULL != tasks) && (i < numPieces); i++)
+        {
+            wordLo = SIEVE_WORD_OF(pieces[i].low);
+            wordHi = SIEVE_WORD_OF(pieces[i].high - 1) + 1;
+            for (w = wordLo; w < wordHi; w += cfg.segmentWords, t++)
+            {
+                tasks[t].piece = (uint64_t)i;
+                tasks[t].wordLo = w;
+                tasks[t].wordHi = (wordHi - w < cfg.segmentWords) ? wordHi : w + cfg.segmentWords;
+            }
+        }
+
+        /* The base primes of the biggest hi, for all the tasks */
+        basePrimes = SieveBasePrimes(SieveIsqrt(maxHigh - 1), &cfg.numBasePrimes);
+        cfg.basePrimes = basePrimes;
+        memError |= (NULL == basePrimes);
+        MPI_Allreduce(&memError, &allMemError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    }
+
+    if (0 != allMemError)
+    {
+        if (0 == my_rank)
+        {
+            printf("Failed to allocate the memory!\n");
+        }
+        free(ranges);
+        free(pieces);
+        free(tasks);
+        free(basePrimes);
+        MPI_Finalize();
+        return 0;
+    }
+
+    /* Every process takes a contiguous part of the tasks */
+    taskLo = numTasks * my_rank / num_processors;
+    taskHi = numTasks * (my_rank + 1) / num_processors;
+    taskRes = (engineResult*)malloc(sizeof(engineResult) * (size_t)(taskHi - taskLo + 1));
+    memError = (NULL == taskRes);
+
+    if (NULL != taskRes)
+    {
+#pragma omp parallel num_threads(cfg.numThreads)
+        {
+            engineConfig taskCfg = cfg;
+            uint64_t* scratch = (uint64_t*)malloc(cfg.segmentWords * sizeof(uint64_t));
+            int64_t n;
+
+            if (NULL == scratch)
+            {
+#pragma omp atomic write
+                memError = 1;
+            }
+
+#pragma omp for schedule(dynamic)
+            for (n = taskLo; n < taskHi; n++)
+            {
+                EngineResultInit(&taskRes[n - taskLo]);
+                if (NULL != scratch)
+                {
+                    taskCfg.low = pieces[tasks[n].piece].low;
+                    taskCfg.high = pieces[tasks[n].piece].high;
+                    EngineRunWords(&taskCfg, tasks[n].wordLo, tasks[n].wordHi, &taskRes[n - taskLo], scratch);
+                }
+            }
+            free(scratch);
+        } // end of #pragma
+    }
+
+    /* Merge the tasks of every piece in this process first, so only a part per piece is sent */
+    if (NULL != taskRes)
+    {
+        numParts = MergeTasks(tasks, taskLo, taskHi, taskRes, cfg.topK);
+    }
+
+    /* Collect the parts of all the processes in process 0 */
+    if (0 == my_rank)
+    {
+        counts = (int*)malloc(sizeof(int) * 2 * (size_t)num_processors);
+        memError |= (NULL == counts);
+        if (NULL != counts)
+        {
+            displs = counts + num_processors;
+            for (k = 0; k < num_processors; k++)
+            {
+                counts[k] = (int)MergeTasks(tasks, numTasks * k / num_processors,
+                                            numTasks * (k + 1) / num_processors, NULL, cfg.topK);
+                displs[k] = (int)allParts;
+                allParts += counts[k];
+            }
+        }
+        allRes = (engineResult*)malloc(sizeof(engineResult) * (size_t)(allParts + 1));
+        memError |= (NULL == allRes);
+    }
+    MPI_Allreduce(&memError, &allMemError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (0 == allMemError)
+    {
+        MPI_Gatherv(taskRes, (int)numParts, resultType, allRes, counts, displs, resultType, 0, MPI_COMM_WORLD);
+    }
+
+    if ((0 == my_rank) && (0 != allMemError))
+    {
+        printf("Failed to allocate the memory!\n");
+    }
+    else if (0 == my_rank)
+    {
+        /* Merge the parts into their piece, in place: a piece is never after its first part */
+        lastPiece = -1;
+        for (k = 0, j = 0; k < num_processors; k++)
+        {
+            for (t = numTasks * k / num_processors; t < numTasks * (k + 1) / num_processors; t++)
+            {
+                if ((t != numTasks * k / num_processors) && (tasks[t].piece == tasks[t - 1].piece))
+                {
+                    continue;
+                }
+                if ((int64_t)tasks[t].piece == lastPiece)
+                {
+                    EngineMerge(&allRes[lastPiece], &allRes[j], cfg.topK);
+                }
+                else
+                {
+                    lastPiece = (int64_t)tasks[t].piece;
+                    allRes[lastPiece] = allRes[j];
+                }
+                j++;
+            }
+        }
+
+        /* Merge the pieces into every range, in the order of the input file */
+        for (i = 0; i < numRanges; i++)
+        {
+            EngineResultInit(&rangeRes);
+            if (RangeValid(&ranges[i]))
+            {
+                askedNums += ranges[i].high - ranges[i].low;
+                for (j = FindPiece(pieces, numPieces, ranges[i].low);
+                     (j >= 0) && (j < numPieces) && (pieces[j].high <= ranges[i].high); j++)
+                {
+                    EngineMerge(&rangeRes, &allRes[j], cfg.topK);
+                }
+            }
+
+            printf("Range %" PRId64 " [%" PRIu64 ", %" PRIu64 "): %" PRIu64 " primes",
+                   i + 1, ranges[i].low, ranges[i].high, rangeRes.primeCount);
+            if (0 != rangeRes.firstPrime)
+            {
+                printf(" from %" PRIu64 " to %" PRIu64, rangeRes.firstPrime, rangeRes.lastPrime);
+            }
+            printf(".\n");
+            for (k = 0; k < rangeRes.found; k++)
+            {
+                printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+                       rangeRes.top[k].smallPrime, rangeRes.top[k].largePrime, rangeRes.top[k].distance);
+            }
+        }
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    gettimeofday(&currentTime, NULL);
+    if ((0 == my_rank) && (0 == allMemError))
+    {
+        printf("%" PRId64 " ranges, %" PRId64 " pieces after coalescing, %" PRId64 " tasks on %d processes x %d threads.\n",
+               numRanges, numPieces, numTasks, num_processors, cfg.numThreads);
+        printf("%" PRIu64 " integers sieved for %" PRIu64 " integers asked.\n", sievedNums, askedNums);
+        printf ("Total time taken by CPU:  %f seconds\n",
+                 (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+                 (double) (currentTime.tv_sec - startTime.tv_sec));
+    }
+
+    free(ranges);
+    free(pieces);
+    free(tasks);
+    free(taskRes);
+    free(allRes);
+    free(counts);
+    free(basePrimes);
+    MPI_Type_free(&rangeType);
+    MPI_Type_free(&resultType);
+
+    /* Finalize the parallel process */
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,174 @@
+/**********************************************************************************************
+**  This program keeps the bit-packed sieve of CP631_Sieve.h in a persistent memory-mapped
+**  cache file (see CP631_Cache.h). The first run sieves the range and writes it to the file.
+**  Later runs, and other processes at the same time, map the file and answer the is-prime,
+**  prime count and biggest distance queries without computing the sieve again. Only the
+**  segments which are not in the cache yet are sieved (by OpenMP threads).
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  gcc -fopenmp -O2 -march=native CP631_Final_cache.c -o CP631_Final_cache.x
+**
+** Then, the code can be run by the commands:
+**  OMP_NUM_THREADS=24 ./CP631_Final_cache.x build 1000000000
+**  ./CP631_Final_cache.x isprime 436273009
+**  ./CP631_Final_cache.x count 0 1000000000
+**  ./CP631_Final_cache.x gaps 0 1000000000
+**  ./CP631_Final_cache.x info
+**
+** The cache file is CP631_Final_sieve.cache in the current directory. Another file can be
+** given by '-f <file>' before the command.
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_Cache.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    NEEDED_PRIME_NUM      (5)
+#define    CACHE_FILE            "CP631_Final_sieve.cache"
+
+
+void PrintUsage(const char* name)
+{
+    printf("Usage: %s [-f cache_file] build <max_number>\n", name);
+    printf("       %s [-f cache_file] isprime <n>\n", name);
+    printf("       %s [-f cache_file] count <low> <high>\n", name);
+    printf("       %s [-f cache_file] gaps <low> <high>\n", name);
+    printf("       %s [-f cache_file] info\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    const char* fileName = CACHE_FILE;
+    const char* command;
+    sieveCache cache;
+    primeInfo64 primeList[NEEDED_PRIME_NUM];
+    uint64_t low = 0;
+    uint64_t high = 0;
+    uint64_t s;
+    uint64_t numValid = 0;
+    int foundPrimeNum;
+    int lockFd;
+    int status;
+    int i;
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+
+    if ((argc > 2) && (0 == strcmp(argv[1], "-f")))
+    {
+        fileName = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc < 2)
+    {
+        PrintUsage(argv[0]);
+        return 0;
+    }
+
+    command = argv[1];
+    if ((0 == strcmp(command, "build")) && (3 == argc))
+    {
+        low = 0;
+        high = ParseNumber(argv[2]);
+    }
+    else if ((0 == strcmp(command, "isprime")) && (3 == argc))
+    {
+        low = ParseNumber(argv[2]);
+        high = low + 1;
+    }
+    else if (((0 == strcmp(command, "count")) || (0 == strcmp(command, "gaps"))) && (4 == argc))
+    {
+        low = ParseNumber(argv[2]);
+        high = ParseNumber(argv[3]);
+    }
+    else if (0 != strcmp(command, "info"))
+    {
+        PrintUsage(argv[0]);
+        return 0;
+    }
+
+    gettimeofday(&startTime, NULL);
+
+    /* The first run creates the file. A file of old version is built again. Another run may
+    ** have created it while this one waited for the lock of the writers. */
+    if (0 != CacheOpen(&cache, fileName))
+    {
+        lockFd = CacheLock(fileName);
+        status = (lockFd < 0) ? -1 : CacheOpen(&cache, fileName);
+        if ((lockFd >= 0) && (0 != status))
+        {
+            status = CacheCreate(fileName, (high > CACHE_SEGMENT_NUMS) ? high : CACHE_SEGMENT_NUMS, NULL);
+            status = (0 == status) ? CacheOpen(&cache, fileName) : status;
+        }
+        if (lockFd >= 0)
+        {
+            CacheUnlock(lockFd);
+        }
+
+        if (0 != status)
+        {
+            printf("Failed to create the cache file %s.\n", fileName);
+            return 0;
+        }
+    }
+
+    if ((high > low) && (0 != CacheEnsure(&cache, fileName, low, high)))
+    {
+        printf("Failed to sieve the range [%" PRIu64 ", %" PRIu64 ") into the cache %s.\n", low, high, fileName);
+        CacheClose(&cache);
+        return 0;
+    }
+
+    if ((0 == strcmp(command, "build")) || (0 == strcmp(command, "info")))
+    {
+        for (s = 0; s < cache.header->numSegments; s++)
+        {
+            numValid += cache.valid[s];
+        }
+
+        printf("Cache file %s, version %u: [0, %" PRIu64 "), %" PRIu64 " of %" PRIu64 " segments are sieved.\n",
+               fileName, cache.header->version, cache.header->maxNumber, numValid, cache.header->numSegments);
+    }
+    else if (0 == strcmp(command, "isprime"))
+    {
+        printf("%" PRIu64 " is %s.\n", low, CacheIsPrime(&cache, low) ? "a prime number" : "not a prime number");
+    }
+    else if (0 == strcmp(command, "count"))
+    {
+        printf("There are %" PRIu64 " prime numbers in [%" PRIu64 ", %" PRIu64 ").\n",
+               CacheCount(&cache, low, high), low, high);
+    }
+    else
+    {
+        foundPrimeNum = CacheGaps(&cache, low, high, primeList, NEEDED_PRIME_NUM);
+
+        printf("Now, print the %d biggest distances between two continue prime numbers.\n", foundPrimeNum);
+        for (i = 0; i < foundPrimeNum; i++)
+        {
+            printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+                   primeList[i].smallPrime, primeList[i].largePrime, primeList[i].distance);
+        }
+    }
+
+    gettimeofday(&currentTime, NULL);
+    printf ("Total time taken by CPU:  %f seconds\n",
+             (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+             (double) (currentTime.tv_sec - startTime.tv_sec));
+
+    CacheClose(&cache);
+    return 0;
+}
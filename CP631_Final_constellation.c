@@ -0,0 +1,388 @@
+/**********************************************************************************************
+**  This program finds out the 5 biggest distances of the consecutive prime numbers in range
+**  [0, MAX_NUMBER) and, in the same pass over the memory, counts the prime constellations
+**  (twin, cousin, sexy primes and prime k-tuples) and records their first occurrences.
+**
+**  The bit-packed odd-only sieve of CP631_Sieve.h is used. A constellation (0, d1, ..., dk)
+**  is tested for 64 candidates at once: the word of the sieve is shifted by d/2 bits for every
+**  offset d and all the shifted words are ANDed. Every bit left in the result is a prime p
+**  with p+d1, ..., p+dk all prime, so popcount gives the number of matches in the word.
+**
+**  Every thread owns a contiguous part of the sieve and works on it segment by segment:
+**  after segment s is sieved, segment s-1 is scanned (gaps and constellations) while it is
+**  still in the cache, because the constellations starting near the end of s-1 need the
+**  beginning of s. The last segment of every thread is scanned after all the threads have
+**  sieved. The counts and first occurrences of every thread are merged at the end, in the
+**  same way as threadResult in CP631_Final_OpenMP.c.
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  gcc -fopenmp -O2 -march=native CP631_Final_constellation.c -o CP631_Final_constellation.x
+**
+** Then, the code can be run by the command:
+**  OMP_NUM_THREADS=24 ./CP631_Final_constellation.x [-n max_number] [-p 0,2,6 ...]
+**
+** Every '-p' gives one pattern of even offsets starting with 0. Without '-p' the twin, cousin,
+** sexy primes, prime triplets, quadruplets, quintuplets and sextuplets are searched.
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <omp.h>
+#include <sys/time.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_HugePage.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    MAX_NUMBER            (1000000000)
+#define    NEEDED_PRIME_NUM      (5)
+
+/* 2^15 words = 256 KB bitmap = 4194304 integers per segment */
+#define    SEGMENT_WORDS         ((uint64_t)1 << 15)
+
+#define    MAX_PATTERNS          (16)
+#define    MAX_PATTERN_SIZE      (8)
+/* The largest offset: the shift d/2 must be less than 64*(PAD_WORDS-1) bits */
+#define    MAX_PATTERN_OFFSET    (254)
+#define    PAD_WORDS             (3)
+
+typedef struct
+{
+    char     name[64];
+    int      size;
+    unsigned shift[MAX_PATTERN_SIZE];     /* offset / 2 */
+    unsigned offset[MAX_PATTERN_SIZE];
+} patternInfo;
+
+
+/********************************************************************/
+/***                                Static Databases/Variables                                       *****/
+/********************************************************************/
+patternInfo patternList[MAX_PATTERNS];
+int numPatterns = 0;
+
+static const char* defaultPatterns[][2] =
+{
+    {"twin",         "0,2"},
+    {"cousin",       "0,4"},
+    {"sexy",         "0,6"},
+    {"triplet",      "0,2,6"},
+    {"triplet",      "0,4,6"},
+    {"quadruplet",   "0,2,6,8"},
+    {"quintuplet",   "0,2,6,8,12"},
+    {"quintuplet",   "0,4,6,10,12"},
+    {"sextuplet",    "0,4,6,10,12,16"},
+};
+
+
+/*********************************************************************
+** This function is written for adding a pattern like "0,2,6" to patternList[].
+** Return 0 if success, otherwise -1.
+*********************************************************************/
+int AddPattern(const char* name, const char* text)
+{
+    patternInfo* pattern = &patternList[numPatterns];
+    const char* p = text;
+    char* end;
+    unsigned long d;
+
+    if (numPatterns >= MAX_PATTERNS)
+    {
+        return -1;
+    }
+
+    memset(pattern, 0, sizeof(*pattern));
+    while ('\0' != *p)
+    {
+        d = strtoul(p, &end, 10);
+        if ((end == p) || (pattern->size >= MAX_PATTERN_SIZE) || (0 != (d & 1)) || (d > MAX_PATTERN_OFFSET) ||
+            ((0 == pattern->size) && (0 != d)) || ((0 != pattern->size) && (d <= pattern->offset[pattern->size - 1])))
+        {
+            return -1;
+        }
+
+        pattern->offset[pattern->size] = (unsigned)d;
+        pattern->shift[pattern->size] = (unsigned)(d / 2);
+        pattern->size++;
+
+        p = (',' == *end) ? end + 1 : end;
+    }
+
+    if (pattern->size < 2)
+    {
+        return -1;
+    }
+
+    snprintf(pattern->name, sizeof(pattern->name), "%s (%s)", name, text);
+    numPatterns++;
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for getting the 64 bits of the sieve starting at bit 'shift' of
+** word w, i.e. bit b of the result is the number SIEVE_NUMBER_OF(w, b) + 2*shift.
+*********************************************************************/
+static inline uint64_t ShiftedWord(const uint64_t* words, uint64_t w, unsigned shift)
+{
+    uint64_t q = w + (shift >> 6);
+    unsigned r = shift & 63;
+
+    return (0 != r) ? ((words[q] >> r) | (words[q + 1] << (64 - r))) : words[q];
+}
+
+/*********************************************************************
+** This function is written for counting the constellations starting in the words
+** [firstWord, endWord). The words after endWord must have been sieved already.
+*********************************************************************/
+void ScanPatterns(const uint64_t* words, uint64_t firstWord, uint64_t endWord,
+                  uint64_t* patternCount, uint64_t* patternFirst)
+{
+    uint64_t w;
+    uint64_t match;
+    int i;
+    int k;
+
+    for (i = 0; i < numPatterns; i++)
+    {
+        const patternInfo* pattern = &patternList[i];
+        uint64_t count = 0;
+
+        for (w = firstWord; w < endWord; w++)
+        {
+            match = words[w];
+            for (k = 1; (k < pattern->size) && (0 != match); k++)
+            {
+                match &= ShiftedWord(words, w, pattern->shift[k]);
+            }
+
+            if (0 != match)
+            {
+                if (0 == patternFirst[i])
+                {
+                    patternFirst[i] = SIEVE_NUMBER_OF(w, __builtin_ctzll(match));
+                }
+                count += (uint64_t)__builtin_popcountll(match);
+            }
+        }
+
+        patternCount[i] += count;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t maxNumber = MAX_NUMBER;
+    uint64_t* sieve;
+    int sieveKind;
+    uint64_t numWords;
+    uint64_t numSegments;
+    uint64_t numBasePrimes;
+    uint32_t* basePrimes;
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+
+    primeInfo64 primeList[NEEDED_PRIME_NUM];
+    int foundPrimeNum = 0;
+    primeInfo64* threadResult;
+    uint64_t* threadBorder;           /* First and last prime of every thread */
+    int* threadFound;
+    uint64_t* threadCount;
+    uint64_t* threadFirst;
+    uint64_t totalCount[MAX_PATTERNS];
+    uint64_t firstMatch[MAX_PATTERNS];
+    uint64_t lastPrime;
+    int num_thread;
+    int i;
+    int j;
+    int k;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((0 == strcmp(argv[i], "-n")) && (i + 1 < argc))
+        {
+            maxNumber = ParseNumber(argv[++i]);
+        }
+        else if ((0 == strcmp(argv[i], "-p")) && (i + 1 < argc))
+        {
+            if (0 != AddPattern("pattern", argv[++i]))
+            {
+                printf("Wrong pattern %s: up to %d even increasing offsets starting with 0 and no more than %d.\n",
+                       argv[i], MAX_PATTERN_SIZE, MAX_PATTERN_OFFSET);
+                return 0;
+            }
+        }
+        else
+        {
+            printf("Usage: %s [-n max_number] [-p 0,2,6 ...]\n", argv[0]);
+            return 0;
+        }
+    }
+
+    if (0 == numPatterns)
+    {
+        for (i = 0; i < (int)(sizeof(defaultPatterns) / sizeof(defaultPatterns[0])); i++)
+        {
+            AddPattern(defaultPatterns[i][0], defaultPatterns[i][1]);
+        }
+    }
+
+    num_thread = omp_get_max_threads();
+    numWords = (maxNumber + SIEVE_NUMS_PER_WORD - 1) / SIEVE_NUMS_PER_WORD;
+    numSegments = (numWords + SEGMENT_WORDS - 1) / SEGMENT_WORDS;
+
+    /* The padding words after the sieve stay 0, so no constellation passes the end */
+    sieve = (uint64_t*)HugeAlloc((numWords + PAD_WORDS) * sizeof(uint64_t), &sieveKind);
+    threadResult = (primeInfo64*)calloc((size_t)num_thread * NEEDED_PRIME_NUM, sizeof(primeInfo64));
+    threadBorder = (uint64_t*)calloc((size_t)num_thread * 2, sizeof(uint64_t));
+    threadFound = (int*)calloc((size_t)num_thread, sizeof(int));
+    threadCount = (uint64_t*)calloc((size_t)num_thread * MAX_PATTERNS, sizeof(uint64_t));
+    threadFirst = (uint64_t*)calloc((size_t)num_thread * MAX_PATTERNS, sizeof(uint64_t));
+    basePrimes = SieveBasePrimes(SieveIsqrt(numWords * SIEVE_NUMS_PER_WORD) + 1, &numBasePrimes);
+
+    if ((NULL == sieve) || (NULL == threadResult) || (NULL == threadBorder) || (NULL == threadFound) ||
+        (NULL == threadCount) || (NULL == threadFirst) || (NULL == basePrimes))
+    {
+        HugeFree(sieve, (numWords + PAD_WORDS) * sizeof(uint64_t), sieveKind);
+        free(threadResult);
+        free(threadBorder);
+        free(threadFound);
+        free(threadCount);
+        free(threadFirst);
+        free(basePrimes);
+
+        printf("Failed to allocate the memory.\n");
+        return 0;
+    }
+
+    gettimeofday(&startTime, NULL);
+
+#pragma omp parallel num_threads(num_thread)
+    {
+        int ID = omp_get_thread_num();
+        uint64_t firstSeg = numSegments * ID / num_thread;
+        uint64_t endSeg = numSegments * (ID + 1) / num_thread;
+        uint64_t s;
+        uint64_t segWords;
+        uint64_t lastBits;
+
+        /* Segment s is sieved, then segment s-1 is scanned */
+        for (s = firstSeg; s <= endSeg; s++)
+        {
+            if (s < endSeg)
+            {
+                segWords = ((s + 1) * SEGMENT_WORDS <= numWords) ? SEGMENT_WORDS : numWords - s * SEGMENT_WORDS;
+                SieveSegment(&sieve[s * SEGMENT_WORDS], s * SEGMENT_WORDS, segWords, basePrimes, numBasePrimes);
+
+                /* The numbers >= maxNumber are not primes in this program */
+                if (s == numSegments - 1)
+                {
+                    lastBits = (maxNumber >> 1) & 63;
+                    if (0 != lastBits)
+                    {
+                        sieve[numWords - 1] &= ((uint64_t)1 << lastBits) - 1;
+                    }
+                }
+            }
+
+            if (s == endSeg)
+            {
+                /* The last segment of the thread needs the first one of the next thread */
+#pragma omp barrier
+            }
+
+            if (s > firstSeg)
+            {
+                uint64_t low = (s - 1) * SEGMENT_WORDS * SIEVE_NUMS_PER_WORD;
+                uint64_t high = s * SEGMENT_WORDS * SIEVE_NUMS_PER_WORD;
+                uint64_t endWord = (s * SEGMENT_WORDS < numWords) ? s * SEGMENT_WORDS : numWords;
+
+                SieveScanGaps(sieve, 0, low, (high < maxNumber) ? high : maxNumber,
+                              &threadBorder[2 * ID], &threadBorder[2 * ID + 1],
+                              &threadResult[ID * NEEDED_PRIME_NUM], &threadFound[ID], NEEDED_PRIME_NUM);
+                ScanPatterns(sieve, (s - 1) * SEGMENT_WORDS, endWord,
+                             &threadCount[ID * MAX_PATTERNS], &threadFirst[ID * MAX_PATTERNS]);
+            }
+        }
+    } // end of #pragma
+
+    /* Let's put largest 5 distances to prime buffer */
+    for (i = 0; i < num_thread; i++)
+    {
+        for (k = 0; k < threadFound[i]; k++)
+        {
+            InsertGap64(primeList, &foundPrimeNum, NEEDED_PRIME_NUM, threadResult[i * NEEDED_PRIME_NUM + k].distance,
+                        threadResult[i * NEEDED_PRIME_NUM + k].smallPrime, threadResult[i * NEEDED_PRIME_NUM + k].largePrime);
+        }
+    }
+
+    /* Handle the border distance between threads */
+    lastPrime = 0;
+    for (i = 0; i < num_thread; i++)
+    {
+        if (0 == threadBorder[2 * i])
+        {
+            continue;
+        }
+
+        if (0 != lastPrime)
+        {
+            InsertGap64(primeList, &foundPrimeNum, NEEDED_PRIME_NUM, threadBorder[2 * i] - lastPrime,
+                        lastPrime, threadBorder[2 * i]);
+        }
+        lastPrime = threadBorder[2 * i + 1];
+    }
+
+    /* The threads are in increasing order, so the first occurrence is in the first thread found it */
+    for (j = 0; j < numPatterns; j++)
+    {
+        totalCount[j] = 0;
+        firstMatch[j] = 0;
+        for (i = 0; i < num_thread; i++)
+        {
+            totalCount[j] += threadCount[i * MAX_PATTERNS + j];
+            if ((0 == firstMatch[j]) && (0 != threadFirst[i * MAX_PATTERNS + j]))
+            {
+                firstMatch[j] = threadFirst[i * MAX_PATTERNS + j];
+            }
+        }
+    }
+
+    gettimeofday(&currentTime, NULL);
+
+    printf("Now, print the %d biggest distances between two continue prime numbers.\n", NEEDED_PRIME_NUM);
+    for (i = 0; i < foundPrimeNum; i++)
+    {
+        printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+               primeList[i].smallPrime, primeList[i].largePrime, primeList[i].distance);
+    }
+
+    printf("Now, print the prime constellations below %" PRIu64 ".\n", maxNumber);
+    for (j = 0; j < numPatterns; j++)
+    {
+        printf("Constellation %s: count (%" PRIu64 "), first (%" PRIu64 ").\n",
+               patternList[j].name, totalCount[j], firstMatch[j]);
+    }
+
+    printf("Sieve memory: %s.\n", HugePageName(sieveKind));
+    printf ("Total time taken by CPU:  %f seconds\n",
+             (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+             (double) (currentTime.tv_sec - startTime.tv_sec));
+
+    HugeFree(sieve, (numWords + PAD_WORDS) * sizeof(uint64_t), sieveKind);
+    free(threadResult);
+    free(threadBorder);
+    free(threadFound);
+    free(threadCount);
+    free(threadFirst);
+    free(basePrimes);
+    return 0;
+}
@@ -0,0 +1,408 @@
+/**********************************************************************************************
+**  This program counts the prime numbers in [0, x], i.e. pi(x), in two ways:
+**
+**  sieve: the bit-packed sieve of CP631_Sieve.h is run segment by segment and the primes
+**         are counted by the hardware popcount of every 64-bit word. The range is split
+**         between the MPI processes, then between the OpenMP threads of every process.
+**         It also counts any range [low, x], so it is the way for the moderate ranges
+**         which don't start at 0.
+**
+**  lucy:  the combinatorial algorithm of Lucy_Hedgehog (a Legendre/Meissel style method).
+**         Only the O(sqrt(x)) values S(v) = pi(v) for v in {x/i} are kept, and each prime
+**         p <= sqrt(x) updates them by S(v) -= S(v/p) - S(p-1). It needs O(x^(3/4)) steps
+**         and O(sqrt(x)) memory, so pi(1e13) is found without sieving the whole range.
+**
+**         The values read by an update are always at a larger index (x/i table) or a
+**         smaller value (small table) than the updated one, so the indices are updated in
+**         blocks [lo, lo*p) which don't read their own values. Inside a block the OpenMP
+**         threads share the work. A large block is also split between the MPI processes
+**         and the result is exchanged by MPI_Allgatherv; a small block is computed by every
+**         process, as the exchange would cost more than the computation.
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  mpicc -fopenmp -O2 -march=native CP631_Final_count.c -o CP631_Final_count.x
+**
+** Then, the code can be run by the commands:
+**  OMP_NUM_THREADS=4 mpirun -np 6 ./CP631_Final_count.x sieve 1e10
+**  OMP_NUM_THREADS=4 mpirun -np 6 ./CP631_Final_count.x sieve 1e12 1.001e12
+**  OMP_NUM_THREADS=24 ./CP631_Final_count.x lucy 1e13
+**  ./CP631_Final_count.x 1e12           (auto: sieve below COUNT_SIEVE_LIMIT or for a range)
+**
+** If in the server with small memory space, run the command below to prevent segfaults:
+** ulimit -s unlimited
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "mpi.h"
+#include <omp.h>
+#include <sys/time.h>
+
+#include "CP631_Sieve.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+/* 2^15 words = 256 KB bitmap = 4194304 integers per segment */
+#define    SEGMENT_WORDS         ((uint64_t)1 << 15)
+#define    SEGMENT_NUMS          (SEGMENT_WORDS * SIEVE_NUMS_PER_WORD)
+
+/* Mode 'auto' uses the sieve for pi(x) below this value. Lucy is already faster at 1e8. */
+#define    COUNT_SIEVE_LIMIT     (10000000ULL)
+
+/* Lucy blocks smaller than this are computed by every process without communication */
+#define    LUCY_MPI_MIN_BLOCK    (1 << 18)
+
+/* Lucy blocks smaller than this are computed by one thread */
+#define    LUCY_OMP_MIN_BLOCK    (1 << 12)
+
+
+/*********************************************************************
+** This function is written for counting the primes in the part of [low, x] which belongs to
+** this process. The segments are split between the threads and every segment is counted by
+** popcount right after it is sieved, while it is still in the cache.
+** Return the number of primes of this process, or UINT64_MAX if there is no memory.
+*********************************************************************/
+uint64_t CountBySieve(uint64_t low, uint64_t x, int my_rank, int num_processors)
+{
+    uint64_t firstSegment = low / SEGMENT_NUMS;
+    uint64_t numSegments = x / SEGMENT_NUMS + 1;
+    uint64_t numInProc = (numSegments - firstSegment) / num_processors;
+    uint64_t start = firstSegment + numInProc * my_rank;
+    uint64_t end = (my_rank == (num_processors - 1)) ? numSegments : start + numInProc;
+    uint64_t numBasePrimes;
+    uint64_t total = 0;
+    uint32_t* basePrimes;
+    int memError = 0;
+
+    basePrimes = SieveBasePrimes(SieveIsqrt(x) + 1, &numBasePrimes);
+    if (NULL == basePrimes)
+    {
+        return UINT64_MAX;
+    }
+
+#pragma omp parallel reduction(+:total, memError)
+    {
+        uint64_t* words = (uint64_t*)malloc(SEGMENT_WORDS * sizeof(uint64_t));
+        uint64_t s;
+        int64_t k;
+
+        if (NULL == words)
+        {
+            memError = 1;
+        }
+        else
+        {
+#pragma omp for schedule(dynamic)
+            for (k = (int64_t)start; k < (int64_t)end; k++)
+            {
+                s = (uint64_t)k;
+                SieveSegment(words, s * SEGMENT_WORDS, SEGMENT_WORDS, basePrimes, numBasePrimes);
+
+                if ((s * SEGMENT_NUMS >= low) && ((s + 1) * SEGMENT_NUMS <= x))
+                {
+                    total += SieveCountWords(words, SEGMENT_WORDS);
+                }
+                else
+                {
+                    /* The first and the last segment: only count the part in [low, x] */
+                    total += SieveCountRange(words, s * SEGMENT_WORDS,
+                                             (s * SEGMENT_NUMS > low) ? s * SEGMENT_NUMS : low,
+                                             ((s + 1) * SEGMENT_NUMS <= x) ? (s + 1) * SEGMENT_NUMS : x + 1);
+                }
+            }
+        }
+        free(words);
+    } // end of #pragma
+
+    free(basePrimes);
+
+    if (0 != memError)
+    {
+        return UINT64_MAX;
+    }
+
+    /* The even prime is counted by the first process */
+    if ((0 == my_rank) && SIEVE_HAS_TWO(low, x + 1))
+    {
+        total++;
+    }
+
+    return total;
+}
+
+/*********************************************************************
+** This function is written for sharing a Lucy block [lo, hi) of 'table' between the
+** processes after every process has updated its own part. See LucySplit().
+*********************************************************************/
+void LucyExchange(int64_t* table, uint64_t lo, uint64_t hi, int num_processors, int* counts, int* displs)
+{
+    uint64_t n = hi - lo;
+    int r;
+
+    for (r = 0; r < num_processors; r++)
+    {
+        displs[r] = (int)(n * r / num_processors);
+        counts[r] = (int)(n * (r + 1) / num_processors) - displs[r];
+    }
+
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, &table[lo], counts, displs, MPI_INT64_T, MPI_COMM_WORLD);
+}
+
+/*********************************************************************
+** This function is written for finding the part [*myLo, *myHi) of block [lo, hi) which is
+** computed by this process. Return 1 if the block is shared between the processes.
+*********************************************************************/
+int LucySplit(uint64_t lo, uint64_t hi, int my_rank, int num_processors, uint64_t* myLo, uint64_t* myHi)
+{
+    uint64_t n = hi - lo;
+
+    if ((1 == num_processors) || (n < LUCY_MPI_MIN_BLOCK))
+    {
+        *myLo = lo;
+        *myHi = hi;
+        return 0;
+    }
+
+    *myLo = lo + n * my_rank / num_processors;
+    *myHi = lo + n * (my_rank + 1) / num_processors;
+    return 1;
+}
+
+/*********************************************************************
+** This function is written for calculating pi(x) by the Lucy_Hedgehog algorithm.
+**  small[v] = S(v) for v in [0, r]
+**  large[i] = S(x/i) for i in [1, r]
+** where r = floor(sqrt(x)). Return -1 if there is no memory.
+*********************************************************************/
+int64_t CountByLucy(uint64_t x, int my_rank, int num_processors)
+{
+    uint64_t r = SieveIsqrt(x);
+    uint64_t p;
+    uint64_t p2;
+    uint64_t limit;
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t myLo;
+    uint64_t myHi;
+    uint64_t v;
+    int64_t sp;
+    int64_t result;
+    int64_t* small;
+    int64_t* large;
+    int* counts;
+    int* displs;
+    int shared;
+
+    if (x < 2)
+    {
+        return 0;
+    }
+
+    small = (int64_t*)malloc((r + 1) * sizeof(int64_t));
+    large = (int64_t*)malloc((r + 1) * sizeof(int64_t));
+    counts = (int*)malloc(num_processors * sizeof(int));
+    displs = (int*)malloc(num_processors * sizeof(int));
+    if ((NULL == small) || (NULL == large) || (NULL == counts) || (NULL == displs))
+    {
+        free(small);
+        free(large);
+        free(counts);
+        free(displs);
+        return -1;
+    }
+
+    /* At first, every number >= 2 is counted */
+    small[0] = 0;
+#pragma omp parallel for schedule(static)
+    for (v = 1; v <= r; v++)
+    {
+        small[v] = (int64_t)v - 1;
+        large[v] = (int64_t)(x / v) - 1;
+    }
+
+    for (p = 2; p <= r; p++)
+    {
+        /* p is not a prime */
+        if (small[p] == small[p - 1])
+        {
+            continue;
+        }
+
+        sp = small[p - 1];
+        p2 = p * p;
+        limit = (x / p2 < r) ? x / p2 : r;
+
+        /* large[i] for i in [1, limit]: large[i*p] is read, so block [lo, lo*p) is safe */
+        for (lo = 1; lo <= limit; lo = hi)
+        {
+            hi = (lo * p < limit + 1) ? lo * p : limit + 1;
+            shared = LucySplit(lo, hi, my_rank, num_processors, &myLo, &myHi);
+
+#pragma omp parallel for schedule(static) if (myHi - myLo > LUCY_OMP_MIN_BLOCK)
+            for (v = myLo; v < myHi; v++)
+            {
+                uint64_t d = v * p;
+
+                if (d <= r)
+                {
+                    large[v] -= large[d] - sp;
+                }
+                else
+                {
+                    large[v] -= small[x / d] - sp;
+                }
+            }
+
+            if (shared)
+            {
+                LucyExchange(large, lo, hi, num_processors, counts, displs);
+            }
+        }
+
+        /* small[v] for v in [p2, r] from the top: small[v/p] is read, so block (hi/p, hi] is safe */
+        for (hi = r; hi >= p2; hi = lo - 1)
+        {
+            lo = (hi / p + 1 > p2) ? hi / p + 1 : p2;
+            shared = LucySplit(lo, hi + 1, my_rank, num_processors, &myLo, &myHi);
+
+#pragma omp parallel for schedule(static) if (myHi - myLo > LUCY_OMP_MIN_BLOCK)
+            for (v = myLo; v < myHi; v++)
+            {
+                small[v] -= small[v / p] - sp;
+            }
+
+            if (shared)
+            {
+                LucyExchange(small, lo, hi + 1, num_processors, counts, displs);
+            }
+        }
+    }
+
+    result = large[1];
+
+    free(small);
+    free(large);
+    free(counts);
+    free(displs);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    const char* mode = "auto";
+    uint64_t low = 0;
+    uint64_t x;
+    uint64_t localCount;
+    uint64_t totalCount = 0;
+    int64_t lucyCount;
+    int my_rank;
+    int num_processors;
+    int memError = 0;
+    int allMemError = 0;
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+
+    if ((argc < 2) || (argc > 4))
+    {
+        if (0 == my_rank)
+        {
+            printf("Usage: %s [sieve|lucy|auto] <x>\n", argv[0]);
+            printf("       %s sieve <low> <x>\n", argv[0]);
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    if (argc >= 3)
+    {
+        mode = argv[1];
+    }
+    x = ParseNumber(argv[argc - 1]);
+    if (4 == argc)
+    {
+        low = ParseNumber(argv[2]);
+    }
+
+    if (0 == strcmp(mode, "auto"))
+    {
+        mode = ((x < COUNT_SIEVE_LIMIT) || (0 != low)) ? "sieve" : "lucy";
+    }
+
+    if ((0 != low) && (0 != strcmp(mode, "sieve")))
+    {
+        if (0 == my_rank)
+        {
+            printf("Only the mode sieve can count a range which doesn't start at 0.\n");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (0 == my_rank)
+    {
+        gettimeofday(&startTime, NULL);
+    }
+
+    if (0 == strcmp(mode, "sieve"))
+    {
+        localCount = (low <= x) ? CountBySieve(low, x, my_rank, num_processors) : 0;
+        memError = (UINT64_MAX == localCount);
+        MPI_Allreduce(&memError, &allMemError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+        if (0 == allMemError)
+        {
+            MPI_Reduce(&localCount, &totalCount, 1, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        }
+    }
+    else if (0 == strcmp(mode, "lucy"))
+    {
+        /* Every process allocates the same tables, so they fail all together */
+        lucyCount = CountByLucy(x, my_rank, num_processors);
+        allMemError = (lucyCount < 0);
+        totalCount = (uint64_t)lucyCount;
+    }
+    else
+    {
+        if (0 == my_rank)
+        {
+            printf("Unknown mode %s.\n", mode);
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    /* Process 0 print out the information */
+    if (0 == my_rank)
+    {
+        gettimeofday(&currentTime, NULL);
+
+        if (0 != allMemError)
+        {
+            printf("Failed to allocate the memory!\n");
+        }
+        else
+        {
+            printf("Mode (%s): there are %" PRIu64 " prime numbers in [%" PRIu64 ", %" PRIu64 "].\n",
+                   mode, totalCount, low, x);
+        }
+        printf ("Total time taken by CPU:  %f seconds\n",
+                 (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+                 (double) (currentTime.tv_sec - startTime.tv_sec));
+    }
+
+    /* Finalize the parallel process */
+    MPI_Finalize();
+    return 0;
+}
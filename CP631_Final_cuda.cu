@@ -3,11 +3,16 @@
 #include "math.h"
 #include <sys/time.h>
 
+#include "CP631_HugePage.h"
+
 
 /*****************************************************************************/
 /***                      local definition                        ************/
 /*****************************************************************************/
+/* It can be changed by the build command, e.g. -DMAX_NUMBER=100000000 */
+#ifndef MAX_NUMBER
 #define    MAX_NUMBER            (1000000000)
+#endif
 #define    NEEDED_PRIME_NUM      (5)
 
 /* Make sure the following definition satisfy the condition:
@@ -142,6 +147,7 @@ __global__  void getPrimeCUDA(unsigned char* dev, int* prm, int limit)
 int main()
 {
     unsigned char* sieve;
+    int sieveKind;              /* The kind of pages of the sieve, see CP631_HugePage.h */
     unsigned char* devA;
     /* Save the found prime and pass them to cuda. The length is estimated: 1-1/2-1/3 = 1/6 */
     int primeByCPU[CPU_CALC_END/6];
@@ -173,7 +179,13 @@ int main()
     }
 
     totalSize = sizeof(unsigned char)*MAX_NUMBER;
-    sieve = (unsigned char*)malloc(totalSize);
+    sieve = (unsigned char*)HugeAlloc(totalSize, &sieveKind);
+    if (NULL == sieve)
+    {
+        printf("Failed to allocate the memory.\n");
+        return 0;
+    }
+    printf("Sieve memory: %s.\n", HugePageName(sieveKind));
 
     /* allocate arrays on device */
     cudaMalloc((void **) &devA, totalSize);
@@ -268,6 +280,6 @@ int main()
     printf ("Total time taken by CPU:  %f seconds\n",
              (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
              (double) (currentTime.tv_sec - startTime.tv_sec));
-    free(sieve);
+    HugeFree(sieve, totalSize, sieveKind);
     return 0;
 }
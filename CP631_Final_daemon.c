@@ -0,0 +1,1287 @@
+/**********************************************************************************************
+**  This program is a long running local server which answers the next prime, previous prime,
+**  prime count and largest distance queries over a Unix domain socket (protocol in
+**  CP631_Daemon.h), so the small tools in a pipeline don't pay the start up cost of a
+**  CP631_Final_* program for every question.
+**
+**  The base primes are generated once at start up. The recently sieved segments are kept in
+**  an LRU cache of bounded size. All the requests which arrive together are handled as one
+**  batch: the missing segments of the whole batch are sieved by the OpenMP threads at the
+**  same time, then the requests are answered in parallel. The large range queries which
+**  don't fit into the cache are split between the threads as in CP631_Final_OpenMP.c.
+**
+**  The responses go into an output buffer per client and are sent without blocking, so a
+**  client which reads slowly only delays itself. A client's requests are only taken while
+**  its output buffer has room for their responses, and the requests it has already sent
+**  are taken without waiting for a new event of poll().
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  gcc -fopenmp -O2 -march=native CP631_Final_daemon.c -o CP631_Final_daemon.x
+**
+** Then, the server can be started by the command:
+**  OMP_NUM_THREADS=24 ./CP631_Final_daemon.x [-s socket] [-m max_number] [-c cache_segments]
+**
+** and queried by the same program in client mode:
+**  ./CP631_Final_daemon.x -q next 1000000000
+**  ./CP631_Final_daemon.x -q prev 1000000000
+**  ./CP631_Final_daemon.x -q count 0 1000000000
+**  ./CP631_Final_daemon.x -q gap 0 1000000000
+**  ./CP631_Final_daemon.x -q stats
+**
+** The server prints the statistics and quits on SIGINT or SIGTERM.
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <omp.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_Daemon.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+/* 2^13 words = 64 KB bitmap = 1048576 integers per segment */
+#define    DAEMON_SEGMENT_WORDS      ((uint64_t)1 << 13)
+#define    DAEMON_SEGMENT_NUMS       (DAEMON_SEGMENT_WORDS * SIEVE_NUMS_PER_WORD)
+
+#define    DEFAULT_MAX_NUMBER        (1000000000000ULL)
+#define    DEFAULT_CACHE_SEGMENTS    (256)
+#define    MAX_CLIENTS               (256)
+#define    MAX_BATCH                 (4096)
+#define    CLIENT_BUFF_SIZE          (64 * sizeof(daemonRequest))
+#define    CLIENT_OUT_SIZE           (256 * sizeof(daemonResponse))
+#define    LATENCY_BUCKETS           (64)
+
+typedef struct segmentEntry
+{
+    uint64_t             segment;
+    uint64_t*            words;
+    uint64_t             batchStamp;    /* Entries used by the current batch are not evicted */
+    struct segmentEntry* hashNext;
+    struct segmentEntry* prev;          /* LRU list, lruHead is the most recently used */
+    struct segmentEntry* next;
+} segmentEntry;
+
+typedef struct
+{
+    int            fd;
+    int            closing;        /* Error: the client is closed at the end of the loop */
+    int            eof;            /* The client has sent everything: closed once it is answered */
+    int            inFlight;       /* Requests of the client in the current batch */
+    size_t         have;
+    size_t         outHave;        /* Bytes of the responses not sent yet */
+    unsigned char  buff[CLIENT_BUFF_SIZE];
+    unsigned char  out[CLIENT_OUT_SIZE];
+} clientInfo;
+
+typedef struct
+{
+    int             client;
+    int             done;
+    int             streaming;
+    int             ready;          /* All the segments of this round are in the cache */
+    uint64_t        nextSegment;    /* Segment to search for next/previous prime */
+    uint64_t        recvTime;
+    daemonRequest   req;
+    daemonResponse  resp;
+} pendingRequest;
+
+typedef struct
+{
+    uint64_t startTime;
+    uint64_t requests;
+    uint64_t batches;
+    uint64_t latencySum;
+    uint64_t latencyMax;
+    uint64_t latencyHist[LATENCY_BUCKETS];     /* Bucket i: [2^i, 2^(i+1)) ns */
+    uint64_t cacheHits;
+    uint64_t cacheMisses;
+} daemonStats;
+
+
+/********************************************************************/
+/***                                Static Databases/Variables                                       *****/
+/********************************************************************/
+uint32_t*      basePrimes;
+uint64_t       numBasePrimes;
+uint64_t       maxNumber = DEFAULT_MAX_NUMBER;
+
+segmentEntry** hashTable;
+uint64_t       hashMask;
+segmentEntry*  lruHead;
+segmentEntry*  lruTail;
+uint64_t       numEntries;
+uint64_t       cacheCapacity = DEFAULT_CACHE_SEGMENTS;
+uint64_t       batchStamp;
+
+clientInfo     clients[MAX_CLIENTS];
+pendingRequest pending[MAX_BATCH];
+int            numPending;
+
+daemonStats    stats;
+volatile sig_atomic_t stopDaemon = 0;
+
+
+uint64_t NowNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void StopHandler(int sig)
+{
+    (void)sig;
+    stopDaemon = 1;
+}
+
+/*********************************************************************
+** This function is written for finding a segment in the LRU cache. The LRU order is not
+** changed, so it can be called by many threads at the same time.
+*********************************************************************/
+segmentEntry* LruFind(uint64_t segment)
+{
+    segmentEntry* e = hashTable[(segment * 0x9E3779B97F4A7C15ULL >> 20) & hashMask];
+
+    while ((NULL != e) && (e->segment != segment))
+    {
+        e = e->hashNext;
+    }
+
+    return e;
+}
+
+void LruUnlink(segmentEntry* e)
+{
+    if (NULL != e->prev)
+    {
+        e->prev->next = e->next;
+    }
+    else
+    {
+        lruHead = e->next;
+    }
+
+    if (NULL != e->next)
+    {
+        e->next->prev = e->prev;
+    }
+    else
+    {
+        lruTail = e->prev;
+    }
+}
+
+void LruPushHead(segmentEntry* e)
+{
+    e->prev = NULL;
+    e->next = lruHead;
+    if (NULL != lruHead)
+    {
+        lruHead->prev = e;
+    }
+    lruHead = e;
+
+    if (NULL == lruTail)
+    {
+        lruTail = e;
+    }
+}
+
+void LruEvict(segmentEntry* e)
+{
+    segmentEntry** link = &hashTable[(e->segment * 0x9E3779B97F4A7C15ULL >> 20) & hashMask];
+
+    while (*link != e)
+    {
+        link = &(*link)->hashNext;
+    }
+    *link = e->hashNext;
+
+    LruUnlink(e);
+    free(e->words);
+    free(e);
+    numEntries--;
+}
+
+/*********************************************************************
+** This function is written for removing the least recently used segments until the cache
+** has room for 'room' more segments. The segments used by the current batch are kept, so
+** the cache may be larger than its capacity until the end of the batch.
+*********************************************************************/
+void LruMakeRoom(uint64_t room)
+{
+    segmentEntry* e = lruTail;
+    segmentEntry* prev;
+
+    while ((NULL != e) && (numEntries + room > cacheCapacity))
+    {
+        prev = e->prev;
+        if (e->batchStamp != batchStamp)
+        {
+            LruEvict(e);
+        }
+        e = prev;
+    }
+}
+
+/*********************************************************************
+** This function is written for getting the segment for the current batch. A new entry is
+** created for a missing segment and saved to toSieve[] to be sieved later.
+** Return the entry, or NULL if there is no memory.
+*********************************************************************/
+segmentEntry* LruUse(uint64_t segment, segmentEntry** toSieve, int* numToSieve)
+{
+    segmentEntry* e = LruFind(segment);
+    uint64_t bucket;
+
+    if (NULL != e)
+    {
+        if (e->batchStamp != batchStamp)
+        {
+            stats.cacheHits++;
+        }
+        LruUnlink(e);
+        LruPushHead(e);
+        e->batchStamp = batchStamp;
+        return e;
+    }
+
+    stats.cacheMisses++;
+    LruMakeRoom(1);
+
+    e = (segmentEntry*)malloc(sizeof(segmentEntry));
+    if (NULL == e)
+    {
+        return NULL;
+    }
+
+    e->words = (uint64_t*)malloc(DAEMON_SEGMENT_WORDS * sizeof(uint64_t));
+    if (NULL == e->words)
+    {
+        free(e);
+        return NULL;
+    }
+
+    e->segment = segment;
+    e->batchStamp = batchStamp;
+    bucket = (segment * 0x9E3779B97F4A7C15ULL >> 20) & hashMask;
+    e->hashNext = hashTable[bucket];
+    hashTable[bucket] = e;
+    LruPushHead(e);
+    numEntries++;
+
+    toSieve[(*numToSieve)++] = e;
+    return e;
+}
+
+/*********************************************************************
+** This function is written for finding the first prime in [from, to) of one segment.
+** Return 0 if there is none. 'from' and 'to' must be inside the segment.
+*********************************************************************/
+uint64_t SegmentNextPrime(const uint64_t* words, uint64_t firstWord, uint64_t from, uint64_t to)
+{
+    uint64_t bit = (from >> 1) - firstWord * SIEVE_WORD_BITS;
+    uint64_t endBit = (to >> 1) - firstWord * SIEVE_WORD_BITS;
+    uint64_t w = bit >> 6;
+    uint64_t bits;
+    uint64_t n;
+
+    if (bit >= endBit)
+    {
+        return 0;
+    }
+
+    bits = words[w] & ~(((uint64_t)1 << (bit & 63)) - 1);
+    for (;;)
+    {
+        if (0 != bits)
+        {
+            n = SIEVE_NUMBER_OF(firstWord + w, __builtin_ctzll(bits));
+            return (n < to) ? n : 0;
+        }
+
+        if (++w >= DAEMON_SEGMENT_WORDS)
+        {
+            return 0;
+        }
+        bits = words[w];
+    }
+}
+
+/*********************************************************************
+** This function is written for finding the last prime in [from, below) of one segment.
+** Return 0 if there is none. 'from' and 'below' must be inside the segment.
+*********************************************************************/
+uint64_t SegmentPrevPrime(const uint64_t* words, uint64_t firstWord, uint64_t from, uint64_t below)
+{
+    uint64_t startBit = (from >> 1) - firstWord * SIEVE_WORD_BITS;
+    uint64_t bit = (below >> 1) - firstWord * SIEVE_WORD_BITS;   /* Bits [startBit, bit) */
+    uint64_t w;
+    uint64_t bits;
+    uint64_t n;
+
+    if (startBit >= bit)
+    {
+        return 0;
+    }
+
+    w = (bit - 1) >> 6;
+    bits = words[w];
+    if (0 != (bit & 63))
+    {
+        bits &= ((uint64_t)1 << (bit & 63)) - 1;
+    }
+
+    for (;;)
+    {
+        if (0 != bits)
+        {
+            n = SIEVE_NUMBER_OF(firstWord + w, 63 - __builtin_clzll(bits));
+            return (n >= from) ? n : 0;
+        }
+
+        if (0 == w)
+        {
+            return 0;
+        }
+        bits = words[--w];
+    }
+}
+
+/*********************************************************************
+** This function is written for working out the range [s0, s1) of segments of a count or
+** largest distance query.
+*********************************************************************/
+void RangeSegments(const daemonRequest* req, uint64_t* s0, uint64_t* s1)
+{
+    *s0 = req->low / DAEMON_SEGMENT_NUMS;
+    *s1 = (req->high - 1) / DAEMON_SEGMENT_NUMS + 1;
+}
+
+/*********************************************************************
+** This function is written for checking a new request and setting the first segment which
+** it needs. The request is done here if it can be answered without any segment.
+*********************************************************************/
+void PrepareRequest(pendingRequest* p)
+{
+    daemonRequest* req = &p->req;
+    daemonResponse* resp = &p->resp;
+    uint64_t s0;
+    uint64_t s1;
+
+    memset(resp, 0, sizeof(*resp));
+    resp->magic = DAEMON_MAGIC;
+    resp->id = req->id;
+    p->done = 1;
+    p->streaming = 0;
+
+    if (DAEMON_MAGIC != req->magic)
+    {
+        resp->status = DAEMON_STATUS_BAD_REQUEST;
+        return;
+    }
+
+    switch (req->op)
+    {
+    case DAEMON_OP_NEXT_PRIME:
+        if (req->low < 2)
+        {
+            resp->value[0] = 2;
+        }
+        else if (req->low >= maxNumber - 1)
+        {
+            resp->status = DAEMON_STATUS_OUT_OF_RANGE;
+        }
+        else
+        {
+            p->nextSegment = (req->low + 1) / DAEMON_SEGMENT_NUMS;
+            p->done = 0;
+        }
+        break;
+
+    case DAEMON_OP_PREV_PRIME:
+        if (req->low <= 2)
+        {
+            resp->status = DAEMON_STATUS_NOT_FOUND;
+        }
+        else if (req->low == 3)
+        {
+            resp->value[0] = 2;
+        }
+        else if (req->low > maxNumber)
+        {
+            resp->status = DAEMON_STATUS_OUT_OF_RANGE;
+        }
+        else
+        {
+            p->nextSegment = (req->low - 1) / DAEMON_SEGMENT_NUMS;
+            p->done = 0;
+        }
+        break;
+
+    case DAEMON_OP_COUNT:
+    case DAEMON_OP_LARGEST_GAP:
+        if (req->high > maxNumber)
+        {
+            resp->status = DAEMON_STATUS_OUT_OF_RANGE;
+        }
+        else if (req->low < req->high)
+        {
+            RangeSegments(req, &s0, &s1);
+            p->done = 0;
+            /* The large range would flush the cache. It is sieved without the cache. */
+            p->streaming = (((s1 - s0) > cacheCapacity / 4) || ((s1 - s0) > MAX_BATCH));
+        }
+        break;
+
+    case DAEMON_OP_STATS:
+        resp->value[0] = stats.requests;
+        resp->value[1] = stats.batches;
+        resp->value[2] = (0 != stats.requests) ? stats.latencySum / stats.requests : 0;
+        resp->value[3] = stats.latencyMax;
+        resp->value[5] = NowNs() - stats.startTime;
+        resp->value[6] = stats.cacheHits;
+        resp->value[7] = stats.cacheMisses;
+        {
+            uint64_t total = 0;
+            int i;
+
+            for (i = 0; i < LATENCY_BUCKETS; i++)
+            {
+                total += stats.latencyHist[i];
+                if (total * 100 >= stats.requests * 99)
+                {
+                    resp->value[4] = (uint64_t)1 << (i + 1);
+                    break;
+                }
+            }
+        }
+        break;
+
+    default:
+        resp->status = DAEMON_STATUS_BAD_REQUEST;
+        break;
+    }
+}
+
+/*********************************************************************
+** This function is written for answering a request with the segments in the cache. Only
+** the cache lookups without changing it are done here, so the requests of the batch can
+** be answered by many threads at the same time.
+*********************************************************************/
+void AnswerFromCache(pendingRequest* p)
+{
+    daemonRequest* req = &p->req;
+    daemonResponse* resp = &p->resp;
+    segmentEntry* e;
+    uint64_t segLow;
+    uint64_t segHigh;
+    uint64_t from;
+    uint64_t to;
+    uint64_t prime;
+    uint64_t s;
+    uint64_t s0;
+    uint64_t s1;
+    uint64_t firstPrime = 0;
+    uint64_t lastPrime = 0;
+    primeInfo64 best;
+    int found = 0;
+
+    if (DAEMON_OP_NEXT_PRIME == req->op)
+    {
+        e = LruFind(p->nextSegment);
+        segLow = p->nextSegment * DAEMON_SEGMENT_NUMS;
+        segHigh = segLow + DAEMON_SEGMENT_NUMS;
+        from = (req->low + 1 > segLow) ? req->low + 1 : segLow;
+        to = (segHigh < maxNumber) ? segHigh : maxNumber;
+
+        prime = (from <= 2) ? 2 : SegmentNextPrime(e->words, p->nextSegment * DAEMON_SEGMENT_WORDS, from, to);
+        if (0 != prime)
+        {
+            resp->value[0] = prime;
+            p->done = 1;
+        }
+        else if (to >= maxNumber)
+        {
+            resp->status = DAEMON_STATUS_OUT_OF_RANGE;
+            p->done = 1;
+        }
+        else
+        {
+            p->nextSegment++;
+        }
+    }
+    else if (DAEMON_OP_PREV_PRIME == req->op)
+    {
+        e = LruFind(p->nextSegment);
+        segLow = p->nextSegment * DAEMON_SEGMENT_NUMS;
+        segHigh = segLow + DAEMON_SEGMENT_NUMS;
+        to = (req->low < segHigh) ? req->low : segHigh;
+
+        prime = SegmentPrevPrime(e->words, p->nextSegment * DAEMON_SEGMENT_WORDS, segLow, to);
+        if (0 != prime)
+        {
+            resp->value[0] = prime;
+            p->done = 1;
+        }
+        else if (0 == p->nextSegment)
+        {
+            /* Only the even prime 2 is left */
+            resp->value[0] = 2;
+            p->done = 1;
+        }
+        else
+        {
+            p->nextSegment--;
+        }
+    }
+    else
+    {
+        RangeSegments(req, &s0, &s1);
+        for (s = s0; s < s1; s++)
+        {
+            e = LruFind(s);
+            segLow = s * DAEMON_SEGMENT_NUMS;
+            segHigh = segLow + DAEMON_SEGMENT_NUMS;
+            from = (req->low > segLow) ? req->low : segLow;
+            to = (req->high < segHigh) ? req->high : segHigh;
+
+            if (DAEMON_OP_COUNT == req->op)
+            {
+                resp->value[0] += SieveCountRange(e->words, s * DAEMON_SEGMENT_WORDS, from, to);
+            }
+            else
+            {
+                SieveScanGaps(e->words, s * DAEMON_SEGMENT_WORDS, from, to, &firstPrime, &lastPrime, &best, &found, 1);
+            }
+        }
+
+        if (DAEMON_OP_COUNT == req->op)
+        {
+            resp->value[0] += SIEVE_HAS_TWO(req->low, req->high) ? 1 : 0;
+        }
+        else if (0 != found)
+        {
+            resp->value[0] = best.smallPrime;
+            resp->value[1] = best.largePrime;
+            resp->value[2] = best.distance;
+        }
+        p->done = 1;
+    }
+}
+
+/*********************************************************************
+** This function is written for answering a count or largest distance query over a range
+** which is too large for the cache. The segments are split between the threads; every
+** thread sieves its own part into a private buffer (or reads it from the cache) and the
+** distances across the thread borders are handled at the end.
+*********************************************************************/
+void AnswerStreaming(pendingRequest* p)
+{
+    daemonRequest* req = &p->req;
+    daemonResponse* resp = &p->resp;
+    int num_thread = omp_get_max_threads();
+    uint64_t s0;
+    uint64_t s1;
+    uint64_t total = 0;
+    uint64_t hits = 0;
+    uint64_t prevLast = 0;
+    uint64_t* border;
+    primeInfo64* threadBest;
+    int* foundInThd;
+    int found = 0;
+    int memError = 0;
+    int i;
+
+    RangeSegments(req, &s0, &s1);
+
+    border = (uint64_t*)calloc((size_t)num_thread * 2, sizeof(uint64_t));
+    threadBest = (primeInfo64*)calloc((size_t)num_thread + 1, sizeof(primeInfo64));
+    foundInThd = (int*)calloc((size_t)num_thread, sizeof(int));
+    if ((NULL == border) || (NULL == threadBest) || (NULL == foundInThd))
+    {
+        free(border);
+        free(threadBest);
+        free(foundInThd);
+        resp->status = DAEMON_STATUS_NO_MEMORY;
+        p->done = 1;
+        return;
+    }
+
+#pragma omp parallel num_threads(num_thread) reduction(+:total, hits, memError)
+    {
+        int ID = omp_get_thread_num();
+        uint64_t numInThd = (s1 - s0) / num_thread;
+        uint64_t start = s0 + numInThd * ID;
+        uint64_t end = (ID == (num_thread - 1)) ? s1 : start + numInThd;
+        uint64_t* scratch = (uint64_t*)malloc(DAEMON_SEGMENT_WORDS * sizeof(uint64_t));
+        uint64_t* words;
+        uint64_t segLow;
+        uint64_t from;
+        uint64_t to;
+        uint64_t s;
+        segmentEntry* e;
+
+        if (NULL == scratch)
+        {
+            memError = 1;
+            end = start;
+        }
+
+        for (s = start; s < end; s++)
+        {
+            e = LruFind(s);
+            if (NULL != e)
+            {
+                words = e->words;
+                hits++;
+            }
+            else
+            {
+                SieveSegment(scratch, s * DAEMON_SEGMENT_WORDS, DAEMON_SEGMENT_WORDS, basePrimes, numBasePrimes);
+                words = scratch;
+            }
+
+            segLow = s * DAEMON_SEGMENT_NUMS;
+            from = (req->low > segLow) ? req->low : segLow;
+            to = (req->high < segLow + DAEMON_SEGMENT_NUMS) ? req->high : segLow + DAEMON_SEGMENT_NUMS;
+
+            if (DAEMON_OP_COUNT == req->op)
+            {
+                total += SieveCountRange(words, s * DAEMON_SEGMENT_WORDS, from, to);
+            }
+            else
+            {
+                SieveScanGaps(words, s * DAEMON_SEGMENT_WORDS, from, to, &border[2 * ID], &border[2 * ID + 1],
+                              &threadBest[ID], &foundInThd[ID], 1);
+            }
+        }
+
+        free(scratch);
+    } // end of #pragma
+
+    stats.cacheHits += hits;
+    stats.cacheMisses += (s1 - s0) - hits;
+
+    if (0 != memError)
+    {
+        resp->status = DAEMON_STATUS_NO_MEMORY;
+    }
+    else if (DAEMON_OP_COUNT == req->op)
+    {
+        resp->value[0] = total + (SIEVE_HAS_TWO(req->low, req->high) ? 1 : 0);
+    }
+    else
+    {
+        /* Put the best of every thread and the border distances together */
+        for (i = 0; i < num_thread; i++)
+        {
+            if (0 != foundInThd[i])
+            {
+                InsertGap64(&threadBest[num_thread], &found, 1, threadBest[i].distance,
+                            threadBest[i].smallPrime, threadBest[i].largePrime);
+            }
+
+            if (0 != border[2 * i])
+            {
+                if (0 != prevLast)
+                {
+                    InsertGap64(&threadBest[num_thread], &found, 1, border[2 * i] - prevLast, prevLast, border[2 * i]);
+                }
+                prevLast = border[2 * i + 1];
+            }
+        }
+
+        if (0 != found)
+        {
+            resp->value[0] = threadBest[num_thread].smallPrime;
+            resp->value[1] = threadBest[num_thread].largePrime;
+            resp->value[2] = threadBest[num_thread].distance;
+        }
+    }
+
+    p->done = 1;
+    free(border);
+    free(threadBest);
+    free(foundInThd);
+}
+
+/*********************************************************************
+** This function is written for answering all the pending requests as one batch.
+*********************************************************************/
+void ProcessBatch()
+{
+    segmentEntry* toSieve[MAX_BATCH * 2];
+    int numToSieve;
+    int numLeft;
+    int memError;
+    int i;
+    uint64_t s;
+    uint64_t s0;
+    uint64_t s1;
+
+    batchStamp++;
+
+    for (i = 0; i < numPending; i++)
+    {
+        PrepareRequest(&pending[i]);
+    }
+
+    /* Every round sieves the missing segments of all the requests in parallel, then answers
+    ** the requests in parallel. Only the next/previous prime queries may need more rounds. */
+    for (;;)
+    {
+        numToSieve = 0;
+        numLeft = 0;
+        memError = 0;
+
+        for (i = 0; i < numPending; i++)
+        {
+            pending[i].ready = 0;
+            if (pending[i].done || pending[i].streaming)
+            {
+                continue;
+            }
+
+            if ((DAEMON_OP_NEXT_PRIME == pending[i].req.op) || (DAEMON_OP_PREV_PRIME == pending[i].req.op))
+            {
+                s0 = pending[i].nextSegment;
+                s1 = s0 + 1;
+            }
+            else
+            {
+                RangeSegments(&pending[i].req, &s0, &s1);
+            }
+
+            /* toSieve[] has room for 2 segments per request, the rest waits for next round */
+            if (numToSieve + (int)(s1 - s0) > (int)(sizeof(toSieve) / sizeof(toSieve[0])))
+            {
+                continue;
+            }
+
+            for (s = s0; s < s1; s++)
+            {
+                if (NULL == LruUse(s, toSieve, &numToSieve))
+                {
+                    memError = 1;
+                }
+            }
+            pending[i].ready = 1;
+            numLeft++;
+        }
+
+        if (0 == numLeft)
+        {
+            break;
+        }
+
+#pragma omp parallel for schedule(dynamic)
+        for (i = 0; i < numToSieve; i++)
+        {
+            SieveSegment(toSieve[i]->words, toSieve[i]->segment * DAEMON_SEGMENT_WORDS,
+                         DAEMON_SEGMENT_WORDS, basePrimes, numBasePrimes);
+        }
+
+        if (0 != memError)
+        {
+            for (i = 0; i < numPending; i++)
+            {
+                if (!pending[i].done && !pending[i].streaming)
+                {
+                    pending[i].resp.status = DAEMON_STATUS_NO_MEMORY;
+                    pending[i].done = 1;
+                }
+            }
+            break;
+        }
+
+#pragma omp parallel for schedule(dynamic)
+        for (i = 0; i < numPending; i++)
+        {
+            if (pending[i].ready)
+            {
+                AnswerFromCache(&pending[i]);
+            }
+        }
+    }
+
+    for (i = 0; i < numPending; i++)
+    {
+        if (!pending[i].done && pending[i].streaming)
+        {
+            AnswerStreaming(&pending[i]);
+        }
+    }
+
+    /* The cache may grow over its capacity while the batch is running */
+    batchStamp++;
+    LruMakeRoom(0);
+}
+
+/*********************************************************************
+** This function is written for sending the pending responses of a client without waiting:
+** what the socket can't take now stays in the output buffer for the next POLLOUT.
+*********************************************************************/
+void FlushClient(int c)
+{
+    clientInfo* client = &clients[c];
+    ssize_t done;
+
+    while (client->outHave > 0)
+    {
+        done = send(client->fd, client->out, client->outHave, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (done < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if ((EAGAIN != errno) && (EWOULDBLOCK != errno))
+            {
+                client->closing = 1;
+            }
+            return;
+        }
+
+        memmove(client->out, client->out + done, client->outHave - (size_t)done);
+        client->outHave -= (size_t)done;
+    }
+}
+
+/*********************************************************************
+** This function is written for sending the responses of the batch and updating the
+** latency statistics. The responses go into the output buffers of the clients, which
+** always have room for them (see ParseClient()), so a slow client never stops the daemon.
+*********************************************************************/
+void SendResponses()
+{
+    clientInfo* client;
+    uint64_t now;
+    uint64_t latency;
+    int i;
+    int c;
+    int bucket;
+
+    for (i = 0; i < numPending; i++)
+    {
+        client = &clients[pending[i].client];
+        client->inFlight--;
+        if ((client->fd < 0) || client->closing)
+        {
+            continue;
+        }
+
+        memcpy(client->out + client->outHave, &pending[i].resp, sizeof(daemonResponse));
+        client->outHave += sizeof(daemonResponse);
+
+        now = NowNs();
+        latency = now - pending[i].recvTime;
+        bucket = (0 == latency) ? 0 : 63 - __builtin_clzll(latency);
+
+        stats.requests++;
+        stats.latencySum += latency;
+        stats.latencyHist[bucket]++;
+        if (latency > stats.latencyMax)
+        {
+            stats.latencyMax = latency;
+        }
+    }
+
+    for (c = 0; c < MAX_CLIENTS; c++)
+    {
+        if ((clients[c].fd >= 0) && (clients[c].outHave > 0) && !clients[c].closing)
+        {
+            FlushClient(c);
+        }
+    }
+
+    stats.batches++;
+    numPending = 0;
+}
+
+/*********************************************************************
+** This function is written for checking if the next request buffered by a client can go
+** into the batch: it is complete, and its response will fit into the output buffer.
+*********************************************************************/
+int ClientCanParse(const clientInfo* client, size_t used)
+{
+    return (client->fd >= 0) && !client->closing && (client->have - used >= sizeof(daemonRequest)) &&
+           (numPending < MAX_BATCH) &&
+           (client->outHave + ((size_t)client->inFlight + 1) * sizeof(daemonResponse) <= CLIENT_OUT_SIZE);
+}
+
+/*********************************************************************
+** This function is written for cutting the data buffered from a client into requests.
+*********************************************************************/
+void ParseClient(int c, uint64_t now)
+{
+    clientInfo* client = &clients[c];
+    size_t used = 0;
+
+    while (ClientCanParse(client, used))
+    {
+        memcpy(&pending[numPending].req, client->buff + used, sizeof(daemonRequest));
+        pending[numPending].client = c;
+        pending[numPending].recvTime = now;
+        numPending++;
+        client->inFlight++;
+        used += sizeof(daemonRequest);
+    }
+
+    memmove(client->buff, client->buff + used, client->have - used);
+    client->have -= used;
+}
+
+/*********************************************************************
+** This function is written for reading the data from a client, if its buffer has room, and
+** cutting it into requests.
+*********************************************************************/
+void ReadClient(int c, uint64_t now)
+{
+    clientInfo* client = &clients[c];
+    ssize_t done;
+
+    if ((client->have < CLIENT_BUFF_SIZE) && !client->eof)
+    {
+        done = recv(client->fd, client->buff + client->have, CLIENT_BUFF_SIZE - client->have, MSG_DONTWAIT);
+        if (0 == done)
+        {
+            client->eof = 1;
+        }
+        else if (done < 0)
+        {
+            if ((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+            {
+                client->closing = 1;
+            }
+        }
+        else
+        {
+            client->have += (size_t)done;
+        }
+    }
+
+    ParseClient(c, now);
+}
+
+void PrintStats()
+{
+    double uptime = (double)(NowNs() - stats.startTime) / 1e9;
+
+    printf("Requests (%" PRIu64 "), batches (%" PRIu64 "), throughput (%f requests/s).\n",
+           stats.requests, stats.batches, (uptime > 0) ? (double)stats.requests / uptime : 0.0);
+    printf("Mean latency (%f us), max latency (%f us).\n",
+           (0 != stats.requests) ? (double)stats.latencySum / (double)stats.requests / 1000.0 : 0.0,
+           (double)stats.latencyMax / 1000.0);
+    printf("Segment cache: %" PRIu64 " of %" PRIu64 " segments, hits (%" PRIu64 "), misses (%" PRIu64 ").\n",
+           numEntries, cacheCapacity, stats.cacheHits, stats.cacheMisses);
+}
+
+/*********************************************************************
+** This function is written for the client mode: send one query and print the answer.
+*********************************************************************/
+int RunClient(const char* path, int argc, char** argv)
+{
+    static const char* names[] = {"", "next", "prev", "count", "gap", "stats"};
+    daemonResponse resp;
+    uint32_t op = 0;
+    uint64_t low = 0;
+    uint64_t high = 0;
+    int numArgs;
+    int fd;
+    int i;
+
+    for (i = 1; i <= DAEMON_OP_STATS; i++)
+    {
+        if ((argc > 0) && (0 == strcmp(argv[0], names[i])))
+        {
+            op = (uint32_t)i;
+        }
+    }
+
+    if ((0 == op) || (((DAEMON_OP_COUNT == op) || (DAEMON_OP_LARGEST_GAP == op)) && (argc < 3)) ||
+        (((DAEMON_OP_NEXT_PRIME == op) || (DAEMON_OP_PREV_PRIME == op)) && (argc < 2)))
+    {
+        printf("Usage: -q next <x> | prev <x> | count <low> <high> | gap <low> <high> | stats\n");
+        return 1;
+    }
+
+    /* The numbers of the query: <x>, or <low> <high> */
+    numArgs = ((DAEMON_OP_COUNT == op) || (DAEMON_OP_LARGEST_GAP == op)) ? 2 : (DAEMON_OP_STATS == op) ? 0 : 1;
+    for (i = 1; i <= numArgs; i++)
+    {
+        if (0 != ParseNumberChecked(argv[i], (1 == i) ? &low : &high))
+        {
+            printf("%s is not a number in [0, 2^64)!\n", argv[i]);
+            return 1;
+        }
+    }
+
+    fd = DaemonConnect(path);
+    if (fd < 0)
+    {
+        printf("Failed to connect to the daemon at %s.\n", path);
+        return 1;
+    }
+
+    if (0 != DaemonCall(fd, op, low, high, &resp))
+    {
+        printf("The connection to the daemon is lost.\n");
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    if (DAEMON_STATUS_OK != resp.status)
+    {
+        printf("The daemon failed to answer the query, status (%u).\n", resp.status);
+        return 1;
+    }
+
+    switch (op)
+    {
+    case DAEMON_OP_NEXT_PRIME:
+        printf("The next prime after (%" PRIu64 ") is (%" PRIu64 ").\n", low, resp.value[0]);
+        break;
+    case DAEMON_OP_PREV_PRIME:
+        printf("The previous prime before (%" PRIu64 ") is (%" PRIu64 ").\n", low, resp.value[0]);
+        break;
+    case DAEMON_OP_COUNT:
+        printf("There are %" PRIu64 " prime numbers in [%" PRIu64 ", %" PRIu64 ").\n", resp.value[0], low, high);
+        break;
+    case DAEMON_OP_LARGEST_GAP:
+        printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+               resp.value[0], resp.value[1], resp.value[2]);
+        break;
+    default:
+        printf("Requests (%" PRIu64 "), batches (%" PRIu64 "), throughput (%f requests/s).\n", resp.value[0],
+               resp.value[1], (0 != resp.value[5]) ? (double)resp.value[0] * 1e9 / (double)resp.value[5] : 0.0);
+        printf("Latency: mean (%f us), p99 (< %f us), max (%f us).\n", (double)resp.value[2] / 1000.0,
+               (double)resp.value[4] / 1000.0, (double)resp.value[3] / 1000.0);
+        printf("Segment cache hits (%" PRIu64 "), misses (%" PRIu64 ").\n", resp.value[6], resp.value[7]);
+        break;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char* path = DAEMON_SOCKET_PATH;
+    struct sockaddr_un addr;
+    struct pollfd fds[MAX_CLIENTS + 1];
+    int pollClient[MAX_CLIENTS + 1];
+    int listenFd;
+    int numFds;
+    int ready;
+    int fd;
+    int c;
+    int i;
+    int status = 0;
+    uint64_t hashSize;
+    uint64_t now;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((0 == strcmp(argv[i], "-s")) && (i + 1 < argc))
+        {
+            path = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-m")) && (i + 1 < argc))
+        {
+            status |= ParseNumberChecked(argv[++i], &maxNumber);
+        }
+        else if ((0 == strcmp(argv[i], "-c")) && (i + 1 < argc))
+        {
+            status |= ParseNumberChecked(argv[++i], &cacheCapacity);
+        }
+        else if (0 == strcmp(argv[i], "-q"))
+        {
+            return RunClient(path, argc - i - 1, &argv[i + 1]);
+        }
+        else
+        {
+            status = -1;
+        }
+    }
+
+    if ((0 != status) || (maxNumber < 2) || (maxNumber > UINT64_MAX - DAEMON_SEGMENT_NUMS))
+    {
+        printf("Usage: %s [-s socket] [-m max_number] [-c cache_segments] [-q query ...]\n", argv[0]);
+        return 0;
+    }
+
+    if (cacheCapacity < 4)
+    {
+        cacheCapacity = 4;
+    }
+
+    /* The base primes are generated only once for the whole life of the daemon */
+    basePrimes = SieveBasePrimes(SieveIsqrt(maxNumber) + 1, &numBasePrimes);
+
+    for (hashSize = 1; hashSize < cacheCapacity * 2; hashSize <<= 1)
+    {
+    }
+    hashMask = hashSize - 1;
+    hashTable = (segmentEntry**)calloc(hashSize, sizeof(segmentEntry*));
+
+    if ((NULL == basePrimes) || (NULL == hashTable))
+    {
+        printf("Failed to allocate the memory.\n");
+        return 0;
+    }
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+
+    if ((listenFd < 0) || (0 != bind(listenFd, (struct sockaddr*)&addr, sizeof(addr))) ||
+        (0 != listen(listenFd, 64)))
+    {
+        printf("Failed to listen on the socket %s.\n", path);
+        return 0;
+    }
+
+    signal(SIGINT, StopHandler);
+    signal(SIGTERM, StopHandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (c = 0; c < MAX_CLIENTS; c++)
+    {
+        clients[c].fd = -1;
+    }
+
+    stats.startTime = NowNs();
+    printf("The daemon is listening on %s: numbers below (%" PRIu64 "), %" PRIu64 " base primes, %d threads.\n",
+           path, maxNumber, numBasePrimes, omp_get_max_threads());
+    fflush(stdout);
+
+    while (!stopDaemon)
+    {
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        numFds = 1;
+        ready = 0;
+        for (c = 0; c < MAX_CLIENTS; c++)
+        {
+            if (clients[c].fd >= 0)
+            {
+                /* Read only while there is room, write only what is pending */
+                fds[numFds].fd = clients[c].fd;
+                fds[numFds].events = (short)((((clients[c].have < CLIENT_BUFF_SIZE) && !clients[c].eof) ? POLLIN : 0) |
+                                             ((clients[c].outHave > 0) ? POLLOUT : 0));
+                fds[numFds].revents = 0;
+                pollClient[numFds++] = c;
+
+                /* The requests already buffered don't wait for a new event */
+                ready |= ClientCanParse(&clients[c], 0);
+            }
+        }
+
+        if (poll(fds, (nfds_t)numFds, ready ? 0 : 500) < 0)
+        {
+            continue;
+        }
+
+        if (0 != (fds[0].revents & POLLIN))
+        {
+            fd = accept(listenFd, NULL, NULL);
+            for (c = 0; (fd >= 0) && (c < MAX_CLIENTS) && (clients[c].fd >= 0); c++)
+            {
+            }
+
+            if ((fd >= 0) && (c < MAX_CLIENTS))
+            {
+                clients[c].fd = fd;
+                clients[c].have = 0;
+                clients[c].outHave = 0;
+                clients[c].inFlight = 0;
+                clients[c].closing = 0;
+                clients[c].eof = 0;
+            }
+            else if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+
+        /* All the requests which are ready now go into one batch */
+        now = NowNs();
+        for (i = 1; i < numFds; i++)
+        {
+            c = pollClient[i];
+            if (0 != (fds[i].revents & POLLOUT))
+            {
+                FlushClient(c);
+            }
+
+            if (0 != (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                ReadClient(c, now);
+            }
+            else
+            {
+                ParseClient(c, now);
+            }
+        }
+
+        if (numPending > 0)
+        {
+            ProcessBatch();
+            SendResponses();
+        }
+
+        /* A client which has sent everything is closed once all its requests are answered */
+        for (c = 0; c < MAX_CLIENTS; c++)
+        {
+            if ((clients[c].fd >= 0) &&
+                (clients[c].closing || (clients[c].eof && (0 == clients[c].outHave) && (0 == clients[c].inFlight) &&
+                                        (clients[c].have < sizeof(daemonRequest)))))
+            {
+                close(clients[c].fd);
+                clients[c].fd = -1;
+            }
+        }
+    }
+
+    PrintStats();
+
+    for (c = 0; c < MAX_CLIENTS; c++)
+    {
+        if (clients[c].fd >= 0)
+        {
+            close(clients[c].fd);
+        }
+    }
+    close(listenFd);
+    unlink(path);
+
+    while (NULL != lruTail)
+    {
+        LruEvict(lruTail);
+    }
+    free(hashTable);
+    free(basePrimes);
+    return 0;
+}
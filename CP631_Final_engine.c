@@ -0,0 +1,568 @@
+/**********************************************************************************************
+**  This program finds out the biggest distances of the consecutive prime numbers in [low,
+**  high) with the sieve engine of CP631_Engine.h. The way the work is executed is selected
+**  at run time:
+**
+**  serial   one thread (the same work as CP631_Final_serial.c)
+**  omp      the OpenMP threads (CP631_Final_OpenMP.c)
+**  mpi      one thread per MPI process (CP631_Final_MPI.c)
+**  hybrid   the MPI processes and their OpenMP threads (CP631_Final_MPI_OpenMP.c)
+**  all      every backend above one after the other, with a table of the times at the end,
+**           and whether each result is the same as the first one
+**
+**  All the backends share the same segmented odd-only bitmap, presieve, marking kernels and
+**  border stitching, so their times can be compared fairly. The original four programs are
+**  kept unchanged as the reference implementations of the course.
+**
+**  With -a, the segment size, the marking strategy and the threads per process are first
+**  auto-tuned on a short range (CP631_Tune.h) and the profile of the host is saved. The next
+**  runs use the saved profile, except the values given on the command line.
+**
+**  The segments are sieved by the Sieve of Eratosthenes, or with -g by the Sieve of Atkin,
+**  the wheel sieve or the Sieve of Sundaram of CP631_Algorithms.h; "-g all" runs every
+**  algorithm with the selected backends, so the fastest one can be picked for each range size.
+**
+**  Every worker drops the distances below the K-th biggest distance known by all the workers
+**  (the shared floor of CP631_Engine.h); -f 0 turns it off to compare.
+**
+**  With -x, the query is answered from the segment summary index of CP631_Index.h in the
+**  given file instead of a backend: the summaries of the full segments of the range which
+**  are missing are built by all the processes and appended to the file, then only the
+**  partial segments at both ends are sieved. Repeated queries over the same segments need no
+**  sieving besides those two.
+**
+**  With -t, the statistics of every block of 'width' integers from low (the number of primes,
+**  the biggest, average and most frequent distance) are made in the same scan by the backend
+**  and written to the given file, as CSV if its name ends with ".csv", else as the columnar
+**  binary file of CP631_Stats.h. Every run writes the same file again.
+**
+**  With -p, the progress, the integers per second and the time left are printed to stderr
+**  every given number of seconds (CP631_Progress.h). SIGINT, SIGTERM or SIGUSR1 cancels the
+**  run: the workers stop at the end of their segment, the result of the sieved part is
+**  printed, and with -c the parts which are not sieved are written to the given file as a
+**  range file of CP631_Final_batch.c. A second signal kills the program.
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  mpicc -fopenmp -O2 -march=native CP631_Final_engine.c -o CP631_Final_engine.x
+**
+** Then, the code can be run by the command:
+**  OMP_NUM_THREADS=4 mpirun -np 6 ./CP631_Final_engine.x [-b backend|all] [-n high] [-l low] [-k top]
+**      [-s segment_words] [-a] [-f 0|1] [-g algorithm|all] [-x index_file] [-t width stats_file]
+**      [-p seconds] [-c checkpoint_file]
+** e.g. ./CP631_Final_engine.x -b omp -n 1e10 -a
+**      ./CP631_Final_engine.x -b omp -g all -n 1e9
+**      ./CP631_Final_engine.x -x primes.idx -l 123456789 -n 1e10
+**      ./CP631_Final_engine.x -n 1e10 -t 1e6 blocks.csv
+**      ./CP631_Final_engine.x -n 1e13 -p 10 -c rest.txt
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "mpi.h"
+#include <omp.h>
+#include <sys/time.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_Engine.h"
+#include "CP631_Tune.h"
+#include "CP631_Index.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    MAX_NUMBER            (1000000000)
+#define    NEEDED_PRIME_NUM      (5)
+
+
+/*********************************************************************
+** This function is written for printing the result of a run in process 0.
+*********************************************************************/
+void PrintResult(const engineResult* result, const engineConfig* cfg, double seconds)
+{
+    int i;
+
+    printf("Now, print the %d biggest distances between two continue prime numbers in [%" PRIu64 ", %" PRIu64 ").\n",
+           result->found, cfg->low, cfg->high);
+    for (i = 0; i < result->found; i++)
+    {
+        printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+               result->top[i].smallPrime, result->top[i].largePrime, result->top[i].distance);
+    }
+    printf("Number of primes: %" PRIu64 "\n", result->primeCount);
+    printf ("Total time taken by CPU:  %f seconds\n", seconds);
+}
+
+/*********************************************************************
+** This function is written for comparing two results: 1 if they have the same distances, in
+** the same order, and the same number of primes.
+*********************************************************************/
+int SameResult(const engineResult* a, const engineResult* b)
+{
+    int i;
+
+    if ((a->found != b->found) || (a->primeCount != b->primeCount))
+    {
+        return 0;
+    }
+
+    for (i = 0; i < a->found; i++)
+    {
+        if ((a->top[i].smallPrime != b->top[i].smallPrime) || (a->top[i].largePrime != b->top[i].largePrime))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*********************************************************************
+** This function is written for running one backend and printing its result in process 0.
+** The time is returned (-1 if it fails).
+*********************************************************************/
+double RunBackend(const engineBackend* backend, const engineConfig* cfg, const char* statsName,
+                  const char* checkpointName, int my_rank, engineResult* result)
+{
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+    double seconds;
+    uint64_t numbers;
+    uint64_t segments;
+    uint64_t allNumbers = 0;
+    int cancelled;
+    int allCancelled;
+    int num_processors;
+    int error;
+    int r;
+
+    if ((NULL != cfg->blocks) && (0 == my_rank))
+    {
+        memset(cfg->blocks->rows, 0, cfg->blocks->numRows * sizeof(statsRow));
+    }
+
+    ProgressStart(cfg->progress, cfg->high - cfg->low);
+    MPI_Barrier(MPI_COMM_WORLD);
+    gettimeofday(&startTime, NULL);
+
+    error = backend->run(cfg, result);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    gettimeofday(&currentTime, NULL);
+    seconds = (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+              (double) (currentTime.tv_sec - startTime.tv_sec);
+
+    /* All the processes agree on the cancellation, and write what is left one after the other */
+    cancelled = ProgressCancelled(cfg->progress);
+    MPI_Allreduce(&cancelled, &allCancelled, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    cfg->progress->stopped = allCancelled;
+    ProgressSum(cfg->progress, &numbers, &segments);
+    MPI_Reduce(&numbers, &allNumbers, 1, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if (allCancelled && (NULL != checkpointName))
+    {
+        MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+        for (r = 0; r < num_processors; r++)
+        {
+            if ((r == my_rank) && (0 != ProgressCheckpoint(cfg->progress, checkpointName, 0 != r)))
+            {
+                printf("Failed to write the checkpoint to %s!\n", checkpointName);
+            }
+            MPI_Barrier(MPI_COMM_WORLD);
+        }
+    }
+
+    if (0 != my_rank)
+    {
+        return seconds;
+    }
+
+    if (0 != error)
+    {
+        printf("Backend %s: failed to allocate the memory!\n", backend->name);
+        return -1;
+    }
+
+    if (allCancelled)
+    {
+        printf("Cancelled after %" PRIu64 " of %" PRIu64 " integers, the result is the one of the sieved part.\n",
+               allNumbers, cfg->high - cfg->low);
+        if (NULL != checkpointName)
+        {
+            printf("The parts which are not sieved are written to %s.\n", checkpointName);
+        }
+    }
+
+    printf("Backend %s (%s), algorithm %s:\n", backend->name, backend->description,
+           engineAlgorithms[cfg->algorithm].name);
+    PrintResult(result, cfg, seconds);
+
+    if (NULL != cfg->blocks)
+    {
+        if (0 != StatsWrite(cfg->blocks, cfg->high, statsName))
+        {
+            printf("Failed to write the block statistics to %s!\n", statsName);
+        }
+        else
+        {
+            printf("Statistics of %" PRIu64 " blocks of %" PRIu64 " integers written to %s.\n",
+                   cfg->blocks->numBlocks, cfg->blocks->width, statsName);
+        }
+    }
+
+    return seconds;
+}
+
+/*********************************************************************
+** This function is written for answering the query from the index 'indexName', after
+** building the summaries it misses with all the processes.
+*********************************************************************/
+void RunIndex(const char* indexName, const engineConfig* cfg, int my_rank)
+{
+    segmentIndex index;
+    engineResult result;
+    uint64_t haveSummaries;
+    uint64_t firstFull;
+    uint64_t lastFull;
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+    int error;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    gettimeofday(&startTime, NULL);
+
+    if (0 != IndexOpen(&index, indexName))
+    {
+        if (0 == my_rank)
+        {
+            printf("%s is not an index of version %d!\n", indexName, INDEX_VERSION);
+        }
+        return;
+    }
+
+    /* Only the full segments of the query are needed */
+    haveSummaries = index.numSummaries;
+    IndexFullSegments(cfg, &firstFull, &lastFull);
+    error = IndexEnsure(&index, indexName, cfg, firstFull, (firstFull < lastFull) ? lastFull : firstFull);
+    if ((0 == error) && (0 == my_rank))
+    {
+        error = IndexQuery(&index, cfg, &result);
+    }
+
+    gettimeofday(&currentTime, NULL);
+    if (0 == my_rank)
+    {
+        if (0 != error)
+        {
+            printf("Index %s: failed to build or to query the index!\n", indexName);
+        }
+        else
+        {
+            printf("Index %s: %" PRIu64 " segments of %" PRIu64 " integers, %" PRIu64 " built now.\n",
+                   indexName, index.numSummaries, (uint64_t)INDEX_SEGMENT_NUMS, index.numSummaries - haveSummaries);
+            PrintResult(&result, cfg, (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+                                      (double) (currentTime.tv_sec - startTime.tv_sec));
+        }
+    }
+
+    IndexClose(&index);
+}
+
+int main(int argc, char **argv)
+{
+    engineConfig cfg;
+    tuneProfile profile;
+    const engineBackend* backend = NULL;
+    const char* backendName = NULL;
+    const char* indexName = NULL;
+    const char* statsName = NULL;
+    const char* checkpointName = NULL;
+    statsTable blocks;
+    engineProgress progress;
+    double interval = 0;
+    const char* algorithmName = "eratosthenes";
+    double seconds[ENGINE_NUM_ALGORITHMS][ENGINE_NUM_BACKENDS];
+    static engineResult results[ENGINE_NUM_ALGORITHMS][ENGINE_NUM_BACKENDS];
+    int allAlgorithms;
+    int firstAlgorithm;
+    int lastAlgorithm;
+    int firstBackend;
+    int lastBackend;
+    int a;
+    uint32_t* basePrimes;
+    int my_rank;
+    int num_processors;
+    int memError = 0;
+    int allMemError = 0;
+    int autoTune = 0;
+    int segmentGiven = 0;
+    int provided;
+    int i;
+
+    /* Thread 0 of every process shares the floor of the distances while the others sieve */
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+    if (provided < MPI_THREAD_FUNNELED)
+    {
+        if (0 == my_rank)
+        {
+            printf("The MPI library doesn't support MPI_THREAD_FUNNELED!\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    ProgressInstall();
+
+    cfg.low = 0;
+    cfg.high = MAX_NUMBER;
+    cfg.segmentWords = ENGINE_SEGMENT_WORDS;
+    cfg.topK = NEEDED_PRIME_NUM;
+    cfg.numThreads = omp_get_max_threads();
+    cfg.markStrategy = SIEVE_MARK_KERNELS;
+    cfg.sharedFloor = 1;
+    cfg.algorithm = 0;
+    cfg.blocks = NULL;
+    cfg.progress = NULL;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((0 == strcmp(argv[i], "-b")) && (i + 1 < argc))
+        {
+            backendName = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-n")) && (i + 1 < argc))
+        {
+            cfg.high = ParseNumber(argv[++i]);
+        }
+        else if ((0 == strcmp(argv[i], "-l")) && (i + 1 < argc))
+        {
+            cfg.low = ParseNumber(argv[++i]);
+        }
+        else if ((0 == strcmp(argv[i], "-k")) && (i + 1 < argc))
+        {
+            cfg.topK = atoi(argv[++i]);
+        }
+        else if ((0 == strcmp(argv[i], "-s")) && (i + 1 < argc))
+        {
+            cfg.segmentWords = ParseNumber(argv[++i]);
+            segmentGiven = 1;
+        }
+        else if ((0 == strcmp(argv[i], "-f")) && (i + 1 < argc))
+        {
+            cfg.sharedFloor = (0 != atoi(argv[++i]));
+        }
+        else if ((0 == strcmp(argv[i], "-g")) && (i + 1 < argc))
+        {
+            algorithmName = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-x")) && (i + 1 < argc))
+        {
+            indexName = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-t")) && (i + 2 < argc))
+        {
+            memset(&blocks, 0, sizeof(blocks));
+            blocks.width = ParseNumber(argv[++i]);
+            statsName = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-p")) && (i + 1 < argc))
+        {
+            interval = atof(argv[++i]);
+        }
+        else if ((0 == strcmp(argv[i], "-c")) && (i + 1 < argc))
+        {
+            checkpointName = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "-a"))
+        {
+            autoTune = 1;
+        }
+        else
+        {
+            backendName = "?";
+            break;
+        }
+    }
+
+    /* By default, the hybrid backend with more than one process, else the omp backend */
+    if (NULL == backendName)
+    {
+        backendName = (num_processors > 1) ? "hybrid" : "omp";
+    }
+    backend = EngineFindBackend(backendName);
+    cfg.algorithm = EngineFindAlgorithm(algorithmName);
+    allAlgorithms = (0 == strcmp(algorithmName, "all"));
+
+    if (((NULL == backend) && (0 != strcmp(backendName, "all"))) ||
+        ((cfg.algorithm < 0) && !allAlgorithms) ||
+        (cfg.high <= cfg.low) || (cfg.high > UINT64_MAX - SIEVE_NUMS_PER_WORD) ||
+        (cfg.topK < 1) || (cfg.topK > ENGINE_MAX_TOP) || (0 == cfg.segmentWords) ||
+        ((NULL != indexName) && (cfg.topK > INDEX_MAX_GAPS)) ||
+        ((NULL != statsName) && ((0 == blocks.width) || (NULL != indexName))))
+    {
+        if (0 == my_rank)
+        {
+            printf("Usage: %s [-b backend|all] [-n high] [-l low] [-k top(1-%d)] [-s segment_words] [-a]\n"
+                   "       [-f 0|1] [-g algorithm|all] [-x index_file] [-t width stats_file] [-p seconds]\n"
+                   "       [-c checkpoint_file]\n", argv[0], ENGINE_MAX_TOP);
+            printf("With -x, top is 1-%d, and -t can't be used.\n", INDEX_MAX_GAPS);
+            printf("Backends:");
+            for (i = 0; i < ENGINE_NUM_BACKENDS; i++)
+            {
+                printf(" %s", engineBackends[i].name);
+            }
+            printf("\nAlgorithms:");
+            for (i = 0; i < ENGINE_NUM_ALGORITHMS; i++)
+            {
+                printf(" %s", engineAlgorithms[i].name);
+            }
+            printf("\n");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    /* The auto-tuner and the index use the first algorithm with "all" */
+    if (allAlgorithms)
+    {
+        cfg.algorithm = 0;
+    }
+
+    /* Every process generates the base primes by itself */
+    basePrimes = SieveBasePrimes(SieveIsqrt(cfg.high - 1), &cfg.numBasePrimes);
+    cfg.basePrimes = basePrimes;
+    memError = (NULL == basePrimes);
+
+    /* The rows of all the blocks are in process 0 */
+    if (NULL != statsName)
+    {
+        blocks.low = cfg.low;
+        blocks.numBlocks = (cfg.high - cfg.low - 1) / blocks.width + 1;
+        blocks.numRows = blocks.numBlocks;
+        if (0 == my_rank)
+        {
+            blocks.rows = (statsRow*)calloc(blocks.numBlocks, sizeof(statsRow));
+            memError |= (NULL == blocks.rows);
+        }
+        cfg.blocks = &blocks;
+    }
+
+    MPI_Allreduce(&memError, &allMemError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (0 != allMemError)
+    {
+        free(basePrimes);
+        if (NULL != statsName)
+        {
+            free(blocks.rows);
+        }
+        MPI_Finalize();
+
+        if (0 == my_rank)
+        {
+            printf("Failed to allocate the memory!\n");
+        }
+        return 0;
+    }
+
+    /* Use the profile of the host, or make it now */
+    if (autoTune && !segmentGiven)
+    {
+        if (0 != TuneRun(&cfg, &profile, 1))
+        {
+            if (0 == my_rank)
+            {
+                printf("Failed to auto-tune!\n");
+            }
+        }
+        else if ((0 != TuneSave(&profile)) && (0 == my_rank))
+        {
+            printf("Failed to save the profile!\n");
+        }
+    }
+    else if (!segmentGiven && (0 == TuneLoad(&profile)))
+    {
+        cfg.segmentWords = profile.segmentWords;
+        cfg.markStrategy = profile.markStrategy;
+        cfg.numThreads = profile.numThreads;
+        if (0 == my_rank)
+        {
+            printf("Using the profile of %s.\n", profile.host);
+        }
+    }
+
+    if (0 == my_rank)
+    {
+        printf("%d processes x %d threads, segment of %" PRIu64 " words, %s marking, shared floor %s.\n",
+               num_processors, cfg.numThreads, cfg.segmentWords,
+               (SIEVE_MARK_KERNELS == cfg.markStrategy) ? "kernels" : "bits", cfg.sharedFloor ? "on" : "off");
+    }
+
+    if (NULL != indexName)
+    {
+        RunIndex(indexName, &cfg, my_rank);
+    }
+    else if (0 != ProgressInit(&progress, cfg.numThreads, interval))
+    {
+        printf("Failed to allocate the memory!\n");
+    }
+    else
+    {
+        cfg.progress = &progress;
+
+        /* "all" selects every backend or every algorithm */
+        firstBackend = (NULL != backend) ? (int)(backend - engineBackends) : 0;
+        lastBackend = (NULL != backend) ? firstBackend : ENGINE_NUM_BACKENDS - 1;
+        firstAlgorithm = allAlgorithms ? 0 : cfg.algorithm;
+        lastAlgorithm = allAlgorithms ? ENGINE_NUM_ALGORITHMS - 1 : cfg.algorithm;
+
+        for (a = firstAlgorithm; (a <= lastAlgorithm) && !progress.stopped; a++)
+        {
+            cfg.algorithm = a;
+            for (i = firstBackend; (i <= lastBackend) && !progress.stopped; i++)
+            {
+                seconds[a][i] = RunBackend(&engineBackends[i], &cfg, statsName, checkpointName, my_rank,
+                                           &results[a][i]);
+                if (0 == my_rank)
+                {
+                    printf("\n");
+                }
+            }
+        }
+
+        /* The speedup and the result are against the first run of the table. The runs after a
+        ** cancelled one are not made, so there is no table. */
+        if ((0 == my_rank) && !progress.stopped && ((firstBackend != lastBackend) || (firstAlgorithm != lastAlgorithm)))
+        {
+            printf("%-8s %-14s %12s %10s %10s\n", "backend", "algorithm", "seconds", "speedup", "result");
+            for (a = firstAlgorithm; a <= lastAlgorithm; a++)
+            {
+                for (i = firstBackend; i <= lastBackend; i++)
+                {
+                    printf("%-8s %-14s %12.4f %10.3f %10s\n", engineBackends[i].name, engineAlgorithms[a].name,
+                           seconds[a][i],
+                           (seconds[a][i] > 0) ? seconds[firstAlgorithm][firstBackend] / seconds[a][i] : 0.0,
+                           (seconds[a][i] < 0) ? "failed" :
+                           SameResult(&results[a][i], &results[firstAlgorithm][firstBackend]) ? "same" : "DIFFERENT");
+                }
+            }
+        }
+        ProgressFree(&progress);
+    }
+
+    free(basePrimes);
+    if (NULL != statsName)
+    {
+        free(blocks.rows);
+    }
+
+    /* Finalize the parallel process */
+    MPI_Finalize();
+    return 0;
+}
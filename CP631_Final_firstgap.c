@@ -0,0 +1,444 @@
+/**********************************************************************************************
+**  This program finds the first distance of at least G between two consecutive prime
+**  numbers in [low, high), and stops as soon as it is known, instead of sieving the whole
+**  range like CP631_Final_MPI_OpenMP.c.
+**
+**  The range is cut into segments of SEGMENT_WORDS words. With W workers (all the OpenMP
+**  threads of all the MPI processes), the worker w sieves the segments w, w + W, w + 2W, ...
+**  so all the workers go up through the range together. For every segment the worker also
+**  finds the prime before the segment with a small window sieve, so every distance whose
+**  larger prime is in the segment is checked there, and the first hit of a segment needs
+**  nothing from the other segments.
+**
+**  Early termination:
+**  - A thread with a hit lowers the best segment of its process (an atomic minimum). Every
+**    thread checks it before the next segment, and stops if the next one is beyond it.
+**  - Thread 0 of every process keeps one MPI_Iallreduce(MPI_MIN) running in the background,
+**    between its segments, with the best segment of the process and the lowest segment the
+**    process hasn't finished yet (its frontier). The global best is given back to the
+**    threads, so the workers beyond the smallest known hit stop in all the processes.
+**  - The search is over when the global frontier is beyond the global best: every segment
+**    before the best one has been sieved and had no hit, so the hit is the first one.
+**
+**  For G above SIEVE_WORD_MAX_GAP (126), a segment is searched word by word: the words which
+**  are not zero only give their first and last prime (SieveFirstGapAbove()).
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  mpicc -fopenmp -O2 -march=native CP631_Final_firstgap.c -o CP631_Final_firstgap.x
+**
+** Then, the code can be run by the command:
+**  OMP_NUM_THREADS=4 mpirun -np 6 ./CP631_Final_firstgap.x <G> [-l low] [-n high]
+** e.g. ./CP631_Final_firstgap.x 300
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sched.h>
+#include "mpi.h"
+#include <omp.h>
+#include <sys/time.h>
+
+#include "CP631_Sieve.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+/* The default end of the search */
+#define    MAX_NUMBER            (1000000000000ULL)
+
+/* 2^15 words = 256 KB bitmap = 4194304 integers per segment */
+#define    SEGMENT_WORDS         ((uint64_t)1 << 15)
+
+/* The window to find the prime before a segment: 64 words = 8192 integers */
+#define    WINDOW_WORDS          (64)
+
+/* No hit yet */
+#define    NO_SEGMENT            (UINT64_MAX)
+
+/* The hit and the counters of one thread, on its own cache line */
+typedef struct
+{
+    uint64_t hitSegment;
+    uint64_t smallPrime;
+    uint64_t largePrime;
+    uint64_t sieved;             /* The number of segments sieved */
+    uint64_t lastSegment;        /* The last segment sieved */
+    uint64_t nextSegment;        /* The segment in work or the next one */
+} __attribute__((aligned(64))) threadSearch;
+
+
+/********************************************************************/
+/***                                Static Databases/Variables                                       *****/
+/********************************************************************/
+uint32_t* basePrimes;
+uint64_t  numBasePrimes;
+
+
+/*********************************************************************
+** This function is written for lowering the atomic value '*best' to 'value'.
+*********************************************************************/
+static inline void AtomicMin(uint64_t* best, uint64_t value)
+{
+    uint64_t old = __atomic_load_n(best, __ATOMIC_SEQ_CST);
+
+    while ((value < old) &&
+           !__atomic_compare_exchange_n(best, &old, value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+    }
+}
+
+/*********************************************************************
+** This function is written for finding the largest prime in [low, x). 0 if there is none.
+** The base primes cover sqrt(x), so the window sieve is exact.
+*********************************************************************/
+uint64_t PrevPrimeInRange(uint64_t low, uint64_t x)
+{
+    uint64_t words[WINDOW_WORDS];
+    uint64_t firstWord;
+    uint64_t endWord;
+    uint64_t bits;
+    uint64_t n;
+    int w;
+
+    if ((x <= 3) || (x <= low))
+    {
+        return ((2 >= low) && (x > 2)) ? 2 : 0;
+    }
+
+    for (endWord = SIEVE_WORD_OF(x - 1) + 1; endWord > SIEVE_WORD_OF(low); endWord = firstWord)
+    {
+        firstWord = (endWord > WINDOW_WORDS) ? endWord - WINDOW_WORDS : 0;
+        SieveSegment(words, firstWord, endWord - firstWord, basePrimes, numBasePrimes);
+
+        for (w = (int)(endWord - firstWord) - 1; w >= 0; w--)
+        {
+            bits = words[w];
+            while (0 != bits)
+            {
+                n = SIEVE_NUMBER_OF(firstWord + w, 63 - __builtin_clzll(bits));
+                bits &= ~((uint64_t)1 << (63 - __builtin_clzll(bits)));
+
+                if (n < x)
+                {
+                    return (n >= low) ? n : 0;
+                }
+            }
+        }
+    }
+
+    return ((2 >= low) && (x > 2)) ? 2 : 0;
+}
+
+/*********************************************************************
+** This function is written for searching the segment 'seg' of [low, high) for its first
+** distance of at least 'minGap'. 1 is returned with the two primes if there is one.
+*********************************************************************/
+int SearchSegment(uint64_t* words, uint64_t seg, uint64_t low, uint64_t high, uint64_t minGap,
+                  uint64_t* smallPrime, uint64_t* largePrime)
+{
+    uint64_t firstWord = SIEVE_WORD_OF(low) + seg * SEGMENT_WORDS;
+    uint64_t endWord = SIEVE_WORD_OF(high - 1) + 1;
+    uint64_t numWords = (endWord - firstWord < SEGMENT_WORDS) ? endWord - firstWord : SEGMENT_WORDS;
+    uint64_t segLow = (firstWord * SIEVE_NUMS_PER_WORD > low) ? firstWord * SIEVE_NUMS_PER_WORD : low;
+    uint64_t segHigh = ((firstWord + numWords) * SIEVE_NUMS_PER_WORD < high) ? (firstWord + numWords) * SIEVE_NUMS_PER_WORD : high;
+    uint64_t prev;
+
+    SieveSegment(words, firstWord, numWords, basePrimes, numBasePrimes);
+    prev = PrevPrimeInRange(low, segLow);
+
+    return SieveFirstGapAbove(words, firstWord, segLow, segHigh, &prev, minGap, smallPrime, largePrime);
+}
+
+/*********************************************************************
+** This function is written for the exchange between the processes, called by thread 0.
+** If the running MPI_Iallreduce is finished, the global best segment is given to the
+** threads, and the next exchange is started unless the search is over. 1 is returned when
+** the search is over in all the processes.
+*********************************************************************/
+int Exchange(MPI_Request* request, uint64_t* sendBuff, uint64_t* recvBuff, uint64_t* bestSegment,
+             threadSearch* threads, int num_thread, uint64_t numSegments)
+{
+    uint64_t frontier;
+    uint64_t next;
+    int flag;
+    int t;
+
+    MPI_Test(request, &flag, MPI_STATUS_IGNORE);
+    if (!flag)
+    {
+        return 0;
+    }
+
+    /* recvBuff = {global best, global frontier} */
+    AtomicMin(bestSegment, recvBuff[0]);
+    if ((recvBuff[1] > recvBuff[0]) || (recvBuff[1] >= numSegments))
+    {
+        return 1;
+    }
+
+    /* The frontier is read before the best, so a hit below the frontier is in the best */
+    for (frontier = NO_SEGMENT, t = 0; t < num_thread; t++)
+    {
+        next = __atomic_load_n(&threads[t].nextSegment, __ATOMIC_SEQ_CST);
+        frontier = (next < frontier) ? next : frontier;
+    }
+    sendBuff[1] = frontier;
+    sendBuff[0] = __atomic_load_n(bestSegment, __ATOMIC_SEQ_CST);
+    MPI_Iallreduce(sendBuff, recvBuff, 2, MPI_UINT64_T, MPI_MIN, MPI_COMM_WORLD, request);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    threadSearch* threads;
+    uint64_t minGap;
+    uint64_t low = 0;
+    uint64_t high = MAX_NUMBER;
+    uint64_t numSegments;
+    uint64_t bestSegment;            /* The best segment known in this process */
+    uint64_t sendBuff[2];
+    uint64_t recvBuff[2];
+    uint64_t localBest;
+    uint64_t globalBest;
+    uint64_t smallPrime = 0;
+    uint64_t largePrime = 0;
+    uint64_t sieved = 0;
+    uint64_t wasted = 0;
+    uint64_t allSieved;
+    uint64_t allWasted;
+    MPI_Request request;
+    int provided;
+    int my_rank;
+    int num_processors;
+    int num_thread;
+    int firstWorker = 0;             /* The first worker number of this process */
+    int numWorkers;
+    int owner;
+    int candidate;
+    int memError = 0;
+    int allMemError = 0;
+    int searchDone = 0;
+    int i;
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+    if (provided < MPI_THREAD_FUNNELED)
+    {
+        if (0 == my_rank)
+        {
+            printf("The MPI library doesn't support MPI_THREAD_FUNNELED!\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    minGap = (argc > 1) ? ParseNumber(argv[1]) : 0;
+    for (i = 2; i + 1 < argc; i += 2)
+    {
+        if (0 == strcmp(argv[i], "-l"))
+        {
+            low = ParseNumber(argv[i + 1]);
+        }
+        else if (0 == strcmp(argv[i], "-n"))
+        {
+            high = ParseNumber(argv[i + 1]);
+        }
+    }
+
+    if ((minGap < 1) || (0 != (argc % 2)) || (high <= low) || (high > UINT64_MAX - SIEVE_NUMS_PER_WORD))
+    {
+        if (0 == my_rank)
+        {
+            printf("Usage: %s <G> [-l low] [-n high]\n", argv[0]);
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (0 == my_rank)
+    {
+        gettimeofday(&startTime, NULL);
+    }
+
+    /* The workers of this process are [firstWorker, firstWorker + num_thread) */
+    num_thread = omp_get_max_threads();
+    MPI_Exscan(&num_thread, &firstWorker, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (0 == my_rank)
+    {
+        firstWorker = 0;
+    }
+    MPI_Allreduce(&num_thread, &numWorkers, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+    numSegments = (SIEVE_WORD_OF(high - 1) + 1 - SIEVE_WORD_OF(low) + SEGMENT_WORDS - 1) / SEGMENT_WORDS;
+    bestSegment = NO_SEGMENT;
+
+    basePrimes = SieveBasePrimes(SieveIsqrt(high - 1), &numBasePrimes);
+    threads = (threadSearch*)aligned_alloc(64, sizeof(threadSearch) * (size_t)num_thread);
+    if ((NULL == basePrimes) || (NULL == threads))
+    {
+        memError = 1;
+    }
+    MPI_Allreduce(&memError, &allMemError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (0 != allMemError)
+    {
+        free(basePrimes);
+        free(threads);
+        MPI_Finalize();
+
+        if (0 == my_rank)
+        {
+            printf("Failed to allocate the memory!\n");
+        }
+        return 0;
+    }
+
+    for (i = 0; i < num_thread; i++)
+    {
+        memset(&threads[i], 0, sizeof(threadSearch));
+        threads[i].hitSegment = NO_SEGMENT;
+        threads[i].lastSegment = NO_SEGMENT;
+        threads[i].nextSegment = (uint64_t)(firstWorker + i);
+    }
+
+    /* The first exchange: nothing found, nothing done */
+    sendBuff[0] = NO_SEGMENT;
+    sendBuff[1] = 0;
+    MPI_Iallreduce(sendBuff, recvBuff, 2, MPI_UINT64_T, MPI_MIN, MPI_COMM_WORLD, &request);
+
+#pragma omp parallel num_threads(num_thread)
+    {
+        int ID = omp_get_thread_num();
+        threadSearch* mine = &threads[ID];
+        uint64_t* words = (uint64_t*)malloc(SEGMENT_WORDS * sizeof(uint64_t));
+        uint64_t seg;
+        uint64_t sp;
+        uint64_t lp;
+
+        for (seg = (uint64_t)(firstWorker + ID); NULL != words; seg += (uint64_t)numWorkers)
+        {
+            __atomic_store_n(&mine->nextSegment, seg, __ATOMIC_SEQ_CST);
+            if ((seg >= numSegments) || (seg > __atomic_load_n(&bestSegment, __ATOMIC_SEQ_CST)))
+            {
+                break;
+            }
+
+            if (SearchSegment(words, seg, low, high, minGap, &sp, &lp))
+            {
+                mine->hitSegment = seg;
+                mine->smallPrime = sp;
+                mine->largePrime = lp;
+                AtomicMin(&bestSegment, seg);
+            }
+            mine->sieved++;
+            mine->lastSegment = seg;
+
+            /* Thread 0 drives the exchange between its segments */
+            if ((0 == ID) && !searchDone)
+            {
+                searchDone = Exchange(&request, sendBuff, recvBuff, &bestSegment, threads, num_thread, numSegments);
+            }
+        }
+        free(words);
+
+        if (NULL == words)
+        {
+            /* The segments of this thread can't be sieved: the result would be wrong */
+#pragma omp atomic write
+            memError = 1;
+            __atomic_store_n(&mine->nextSegment, NO_SEGMENT, __ATOMIC_SEQ_CST);
+        }
+
+        /* Thread 0 goes on with the exchange until the answer is known everywhere */
+        while ((0 == ID) && !searchDone)
+        {
+            searchDone = Exchange(&request, sendBuff, recvBuff, &bestSegment, threads, num_thread, numSegments);
+            if (!searchDone)
+            {
+                sched_yield();
+            }
+        }
+    } // end of #pragma
+
+    /* The best hit of this process, then the process that has the global one */
+    localBest = NO_SEGMENT;
+    for (i = 0; i < num_thread; i++)
+    {
+        if (threads[i].hitSegment < localBest)
+        {
+            localBest = threads[i].hitSegment;
+            smallPrime = threads[i].smallPrime;
+            largePrime = threads[i].largePrime;
+        }
+    }
+    MPI_Allreduce(&localBest, &globalBest, 1, MPI_UINT64_T, MPI_MIN, MPI_COMM_WORLD);
+
+    candidate = ((NO_SEGMENT != globalBest) && (localBest == globalBest)) ? my_rank : num_processors;
+    MPI_Allreduce(&candidate, &owner, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (owner < num_processors)
+    {
+        MPI_Bcast(&smallPrime, 1, MPI_UINT64_T, owner, MPI_COMM_WORLD);
+        MPI_Bcast(&largePrime, 1, MPI_UINT64_T, owner, MPI_COMM_WORLD);
+    }
+
+    /* The segments sieved beyond the answer were wasted */
+    for (i = 0; i < num_thread; i++)
+    {
+        sieved += threads[i].sieved;
+        if ((NO_SEGMENT != globalBest) && (0 != threads[i].sieved) && (threads[i].lastSegment > globalBest))
+        {
+            /* The thread sieved first + k * numWorkers up to lastSegment */
+            uint64_t first = (uint64_t)(firstWorker + i);
+            uint64_t k = (threads[i].lastSegment - first) / (uint64_t)numWorkers;
+            uint64_t kBest = (globalBest >= first) ? (globalBest - first) / (uint64_t)numWorkers + 1 : 0;
+
+            wasted += k + 1 - kBest;
+        }
+    }
+    MPI_Reduce(&sieved, &allSieved, 1, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&wasted, &allWasted, 1, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Allreduce(&memError, &allMemError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+    if (0 == my_rank)
+    {
+        gettimeofday(&currentTime, NULL);
+
+        if (0 != allMemError)
+        {
+            printf("Failed to allocate the memory!\n");
+        }
+        else if (owner < num_processors)
+        {
+            printf("The first distance of at least %" PRIu64 " in [%" PRIu64 ", %" PRIu64 "):\n", minGap, low, high);
+            printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+                   smallPrime, largePrime, largePrime - smallPrime);
+        }
+        else
+        {
+            printf("There is no distance of at least %" PRIu64 " in [%" PRIu64 ", %" PRIu64 ").\n", minGap, low, high);
+        }
+        printf("Segments sieved: %" PRIu64 " of %" PRIu64 ", %" PRIu64 " beyond the answer, %d workers.\n",
+               allSieved, numSegments, allWasted, numWorkers);
+        printf ("Total time taken by CPU:  %f seconds\n",
+                 (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+                 (double) (currentTime.tv_sec - startTime.tv_sec));
+    }
+
+    free(basePrimes);
+    free(threads);
+
+    /* Finalize the parallel process */
+    MPI_Finalize();
+    return 0;
+}
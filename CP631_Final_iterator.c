@@ -0,0 +1,106 @@
+/**********************************************************************************************
+**  This program finds out the 5 biggest distances among the first 'count' consecutive
+**  prime numbers from 'start'. The end of the range is not known up front, so the primes
+**  are pulled one by one from the lazy iterator of CP631_Iterator.h, which sieves the next
+**  segment in the background while the current one is read.
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  gcc -O2 -march=native -pthread CP631_Final_iterator.c -o CP631_Final_iterator.x
+**
+** Then, the code can be run by the command:
+**  ./CP631_Final_iterator.x <start> <count> [prefetch(1/0)]
+** e.g. ./CP631_Final_iterator.x 1e18 1e6
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_Iterator.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    NEEDED_PRIME_NUM      (5)
+
+
+int main(int argc, char **argv)
+{
+    primeIterator it;
+    primeInfo64 primeList[NEEDED_PRIME_NUM];
+    int foundPrimeNum = 0;
+    uint64_t start;
+    uint64_t count;
+    uint64_t taken = 0;
+    uint64_t firstPrime;
+    uint64_t lastPrime;
+    uint64_t p;
+    int prefetch = 1;
+    int i;
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+
+    if ((3 != argc) && (4 != argc))
+    {
+        printf("Usage: %s <start> <count> [prefetch(1/0)]\n", argv[0]);
+        return 0;
+    }
+
+    start = ParseNumber(argv[1]);
+    count = ParseNumber(argv[2]);
+    if (4 == argc)
+    {
+        prefetch = atoi(argv[3]);
+    }
+
+    gettimeofday(&startTime, NULL);
+
+    if (0 != PrimeIterInit(&it, start, prefetch))
+    {
+        printf("Failed to allocate the memory!\n");
+        return 0;
+    }
+
+    firstPrime = PrimeIterNext(&it);
+    lastPrime = firstPrime;
+    taken = (0 != firstPrime) ? 1 : 0;
+
+    /* Stop after 'count' primes, or at the last prime below 2^64 */
+    while (taken < count)
+    {
+        p = PrimeIterNext(&it);
+        if (0 == p)
+        {
+            break;
+        }
+
+        InsertGap64(primeList, &foundPrimeNum, NEEDED_PRIME_NUM, p - lastPrime, lastPrime, p);
+        lastPrime = p;
+        taken++;
+    }
+
+    PrimeIterFree(&it);
+    gettimeofday(&currentTime, NULL);
+
+    printf("The %" PRIu64 " prime numbers from %" PRIu64 " are in [%" PRIu64 ", %" PRIu64 "].\n",
+           taken, start, firstPrime, lastPrime);
+    printf("Now, print the %d biggest distances between two continue prime numbers.\n", foundPrimeNum);
+    for (i = 0; i < foundPrimeNum; i++)
+    {
+        printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+               primeList[i].smallPrime, primeList[i].largePrime, primeList[i].distance);
+    }
+    printf ("Total time taken by CPU:  %f seconds\n",
+             (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+             (double) (currentTime.tv_sec - startTime.tv_sec));
+
+    return 0;
+}
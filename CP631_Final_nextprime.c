@@ -0,0 +1,238 @@
+/**********************************************************************************************
+**  This program finds the previous prime, the next prime and the distance between the two
+**  consecutive primes around any x < 2^64, without sieving everything from 2.
+**
+**  A small window of the bit-packed sieve (CP631_Sieve.h) is sieved next to x with the base
+**  primes below PRESIEVE_LIMIT, and the window is moved away from x until a prime is found.
+**  When sqrt(x) <= PRESIEVE_LIMIT the window sieve is exact. Otherwise it only removes most
+**  of the composites and every number left is confirmed by the deterministic Miller-Rabin
+**  test with 128-bit mulmod, which is right for all the 64-bit numbers.
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  gcc -O2 -march=native CP631_Final_nextprime.c -o CP631_Final_nextprime.x
+**
+** Then, the code can be run by the command:
+**  ./CP631_Final_nextprime.x 436273100 1e18 18446744073709551557
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "CP631_Sieve.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+/* The windows are sieved by the primes below this limit. It is exact for x < 2^32. */
+#define    PRESIEVE_LIMIT        (65536)
+
+/* 32 words = 4096 integers per window. The average distance near 2^64 is only 44. */
+#define    WINDOW_WORDS          (32)
+
+#define    LAST_WORD             (UINT64_MAX >> 7)
+
+
+/********************************************************************/
+/***                                Static Databases/Variables                                       *****/
+/********************************************************************/
+uint32_t* basePrimes;
+uint64_t  numBasePrimes;
+
+
+/*********************************************************************
+** This function is written for checking a number left by the window sieve. It is prime if
+** the window sieve is exact for it, otherwise Miller-Rabin decides.
+*********************************************************************/
+static inline int ConfirmPrime(uint64_t n)
+{
+    if ((n >> 32) == 0)
+    {
+        /* n < 2^32 = PRESIEVE_LIMIT^2 */
+        return 1;
+    }
+
+    return SieveIsPrimeMR(n);
+}
+
+/*********************************************************************
+** This function is written for finding the smallest prime > x.
+** Return 0 if there is no such prime below 2^64.
+*********************************************************************/
+uint64_t NextPrime(uint64_t x)
+{
+    uint64_t words[WINDOW_WORDS];
+    uint64_t firstWord;
+    uint64_t numWords;
+    uint64_t from;
+    uint64_t bits;
+    uint64_t n;
+    uint64_t w;
+
+    if (x < 2)
+    {
+        return 2;
+    }
+
+    if (x == UINT64_MAX)
+    {
+        return 0;
+    }
+
+    from = x + 1;
+    for (firstWord = SIEVE_WORD_OF(from); firstWord <= LAST_WORD; firstWord += WINDOW_WORDS)
+    {
+        numWords = (LAST_WORD - firstWord + 1 < WINDOW_WORDS) ? LAST_WORD - firstWord + 1 : WINDOW_WORDS;
+        SieveSegment(words, firstWord, numWords, basePrimes, numBasePrimes);
+
+        for (w = 0; w < numWords; w++)
+        {
+            bits = words[w];
+            while (0 != bits)
+            {
+                n = SIEVE_NUMBER_OF(firstWord + w, __builtin_ctzll(bits));
+                bits &= bits - 1;
+
+                if ((n >= from) && ConfirmPrime(n))
+                {
+                    return n;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for finding the largest prime < x.
+** Return 0 if there is none (x <= 2).
+*********************************************************************/
+uint64_t PrevPrime(uint64_t x)
+{
+    uint64_t words[WINDOW_WORDS];
+    uint64_t firstWord;
+    uint64_t endWord;
+    uint64_t bits;
+    uint64_t n;
+    uint64_t w;
+
+    if (x <= 2)
+    {
+        return 0;
+    }
+
+    if (x == 3)
+    {
+        return 2;
+    }
+
+    /* The windows [firstWord, endWord) go down from the word of x-1 */
+    for (endWord = SIEVE_WORD_OF(x - 1) + 1; endWord > 0; endWord = firstWord)
+    {
+        firstWord = (endWord > WINDOW_WORDS) ? endWord - WINDOW_WORDS : 0;
+        SieveSegment(words, firstWord, endWord - firstWord, basePrimes, numBasePrimes);
+
+        for (w = endWord - firstWord; w > 0; w--)
+        {
+            bits = words[w - 1];
+            while (0 != bits)
+            {
+                n = SIEVE_NUMBER_OF(firstWord + w - 1, 63 - __builtin_clzll(bits));
+                bits &= ~((uint64_t)1 << (63 - __builtin_clzll(bits)));
+
+                if ((n < x) && ConfirmPrime(n))
+                {
+                    return n;
+                }
+            }
+        }
+    }
+
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t x;
+    uint64_t prev;
+    uint64_t next;
+    uint64_t gapLow;
+    int isPrime;
+    int i;
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+
+    if (argc < 2)
+    {
+        printf("Usage: %s <x> [x ...]\n", argv[0]);
+        return 0;
+    }
+
+    gettimeofday(&startTime, NULL);
+
+    basePrimes = SieveBasePrimes(PRESIEVE_LIMIT, &numBasePrimes);
+    if (NULL == basePrimes)
+    {
+        printf("Failed to allocate the memory.\n");
+        return 0;
+    }
+
+    gettimeofday(&currentTime, NULL);
+    printf ("Time taken for %" PRIu64 " base primes:  %f seconds\n", numBasePrimes,
+             (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+             (double) (currentTime.tv_sec - startTime.tv_sec));
+
+    for (i = 1; i < argc; i++)
+    {
+        x = ParseNumber(argv[i]);
+
+        gettimeofday(&startTime, NULL);
+        prev = PrevPrime(x);
+        next = NextPrime(x);
+        isPrime = (x == 2) || ((x > 2) && (x & 1) && SieveIsPrimeMR(x));
+        gettimeofday(&currentTime, NULL);
+
+        /* The distance containing x is [p, q) with p <= x < q */
+        gapLow = isPrime ? x : prev;
+
+        printf("x (%" PRIu64 ") is %s.\n", x, isPrime ? "a prime number" : "not a prime number");
+        if (0 != prev)
+        {
+            printf("  Previous prime (%" PRIu64 ").\n", prev);
+        }
+        else
+        {
+            printf("  There is no previous prime.\n");
+        }
+
+        if (0 != next)
+        {
+            printf("  Next prime (%" PRIu64 ").\n", next);
+        }
+        else
+        {
+            printf("  There is no next prime below 2^64.\n");
+        }
+
+        if ((0 != gapLow) && (0 != next))
+        {
+            printf("  Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+                   gapLow, next, next - gapLow);
+        }
+
+        printf ("  Time taken by CPU:  %f seconds\n",
+                 (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+                 (double) (currentTime.tv_sec - startTime.tv_sec));
+    }
+
+    free(basePrimes);
+    return 0;
+}
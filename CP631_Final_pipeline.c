@@ -0,0 +1,586 @@
+/**********************************************************************************************
+**  This program is the pipelined version of the prime distance search. The sieve and the
+**  analysis of a segment do not run one after the other in the same thread any more:
+**
+**  - The sieve threads (producers) sieve the segments s = ID, ID + S, ID + 2S, ... into the
+**    buffers of their own pool and publish every finished segment into one lock-free
+**    single-producer/single-consumer ring per analysis (CP631_Ring.h).
+**  - Every analysis has its own thread (consumer). It takes the segments in increasing
+**    order from the rings of the producers in turn, so the state of the analysis (the last
+**    prime, the last primes of a constellation) is simply carried to the next segment.
+**  - A buffer goes back to its producer when all the analyses have released it.
+**
+**  The analyses are the 5 biggest distances, the histogram of all the distances and the
+**  number of twin, cousin, triplet and quadruplet primes. The heavier analyses overlap with
+**  the sieve instead of adding to the total time.
+**
+**  With -r, one more analysis exports the distances of at least min_distance (-e gaps) or all
+**  the primes in batches of 7 (-e primes) to another process of the same host, through the
+**  shared-memory ring 'shm_name' of CP631_Shm.h (e.g. CP631_Final_shmreader.c). The records
+**  are written in place in the shared memory while the sieve runs. When the reader is slower,
+**  the export waits for it, then the buffers of the sieve run out and the sieve waits too, so
+**  the memory stays bounded.
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  gcc -fopenmp -O2 -march=native CP631_Final_pipeline.c -o CP631_Final_pipeline.x -lrt
+**
+** Then, the code can be run by the command:
+**  ./CP631_Final_pipeline.x [-n max_number] [-s sieve_threads] [-r shm_name [-e gaps|primes] [-m min_distance]]
+** The program starts sieve_threads + 3 threads (+ 1 with -r). With -r, start the reader
+** (./CP631_Final_shmreader.x shm_name) too, before or after the program.
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <omp.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_Ring.h"
+#include "CP631_Shm.h"
+#include "CP631_Trace.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    MAX_NUMBER            (1000000000)
+#define    NEEDED_PRIME_NUM      (5)
+
+/* 2^15 words = 256 KB bitmap = 4194304 integers per segment */
+#define    SEGMENT_WORDS         ((uint64_t)1 << 15)
+
+/* Buffers owned by every producer. Must not be more than RING_SLOTS. */
+#define    POOL_BUFFERS          (8)
+
+/* Entry d counts the distance 2*d (1 for d = 0, from 2 to 3). The distances >= 2*HIST_SIZE
+** are counted in the last entry. */
+#define    HIST_SIZE             (1024)
+
+/* Records of the shared-memory ring of the export: 2^16 records = 4 MB */
+#define    EXPORT_RECORDS        ((uint64_t)1 << 16)
+
+enum
+{
+    ANALYSIS_GAPS = 0,
+    ANALYSIS_HISTOGRAM,
+    ANALYSIS_CONSTELLATION,
+    ANALYSIS_EXPORT,        /* Only with -r */
+    NUM_ANALYSIS
+};
+
+enum
+{
+    CONS_TWIN = 0,          /* p, p+2 */
+    CONS_COUSIN,            /* p, p+4 */
+    CONS_TRIPLET_A,         /* p, p+2, p+6 */
+    CONS_TRIPLET_B,         /* p, p+4, p+6 */
+    CONS_QUADRUPLET,        /* p, p+2, p+6, p+8 */
+    NUM_CONS
+};
+
+
+/********************************************************************/
+/***                                Static Databases/Variables                                       *****/
+/********************************************************************/
+uint64_t maxNumber = MAX_NUMBER;
+uint32_t* basePrimes;
+uint64_t numBasePrimes;
+
+primeInfo64 primeList[NEEDED_PRIME_NUM];
+int foundPrimeNum = 0;
+uint64_t histogram[HIST_SIZE];
+uint64_t consCount[NUM_CONS];
+const char* consName[NUM_CONS] = {"twin (0,2)", "cousin (0,4)", "triplet (0,2,6)", "triplet (0,4,6)",
+                                  "quadruplet (0,2,6,8)"};
+
+const char* analysisName[NUM_ANALYSIS] = {"distances", "histogram", "constellations", "export"};
+
+/* The analyses which run: ANALYSIS_EXPORT, or NUM_ANALYSIS with the export */
+int numAnalysis = ANALYSIS_EXPORT;
+
+/* The export (-r, -e, -m) */
+const char* exportName = NULL;
+uint32_t exportKind = SHM_RECORD_GAP;
+uint64_t exportMinDistance = 1;
+uint64_t exportRecords = 0;
+shmRing exportRing;
+
+/* Time spent by every analysis thread on the analysis and on waiting for the segments */
+double busyTime[NUM_ANALYSIS];
+double idleTime[NUM_ANALYSIS];
+
+
+/*********************************************************************
+** This function is written for the end (excluded) of the numbers of a segment.
+*********************************************************************/
+static inline uint64_t SegmentHigh(const segmentBuffer* buffer)
+{
+    uint64_t high = (buffer->firstWord + buffer->numWords) * SIEVE_NUMS_PER_WORD;
+
+    return (high < maxNumber) ? high : maxNumber;
+}
+
+/*********************************************************************
+** This function is written for the histogram analysis. 'prev' is the last prime of the
+** segments before.
+*********************************************************************/
+void AnalyseHistogram(const segmentBuffer* buffer, uint64_t* prev)
+{
+    uint64_t high = SegmentHigh(buffer);
+    uint64_t bits;
+    uint64_t n;
+    uint64_t d;
+    uint64_t w;
+
+    for (w = 0; w < buffer->numWords; w++)
+    {
+        bits = buffer->words[w];
+        while (0 != bits)
+        {
+            n = SIEVE_NUMBER_OF(buffer->firstWord + w, __builtin_ctzll(bits));
+            bits &= bits - 1;
+
+            if (n >= high)
+            {
+                return;
+            }
+
+            if (0 != *prev)
+            {
+                d = (n - *prev) / 2;
+                histogram[(d < HIST_SIZE) ? d : HIST_SIZE - 1]++;
+            }
+            *prev = n;
+        }
+    }
+}
+
+/*********************************************************************
+** This function is written for the constellation analysis. last[0..3] are the last 4
+** primes (last[3] is the largest) of the segments before. All the counted patterns are
+** made of consecutive primes, so the last 4 primes are enough.
+*********************************************************************/
+void AnalyseConstellation(const segmentBuffer* buffer, uint64_t last[4])
+{
+    uint64_t high = SegmentHigh(buffer);
+    uint64_t bits;
+    uint64_t n;
+    uint64_t w;
+
+    for (w = 0; w < buffer->numWords; w++)
+    {
+        bits = buffer->words[w];
+        while (0 != bits)
+        {
+            n = SIEVE_NUMBER_OF(buffer->firstWord + w, __builtin_ctzll(bits));
+            bits &= bits - 1;
+
+            if (n >= high)
+            {
+                return;
+            }
+
+            last[0] = last[1];
+            last[1] = last[2];
+            last[2] = last[3];
+            last[3] = n;
+
+            /* Patterns ending at n */
+            if ((0 != last[2]) && (n - last[2] == 2))
+            {
+                consCount[CONS_TWIN]++;
+            }
+            /* (3, 7) is the only cousin pair with a prime (5) between */
+            if (((0 != last[2]) && (n - last[2] == 4)) || ((0 != last[1]) && (n - last[1] == 4)))
+            {
+                consCount[CONS_COUSIN]++;
+            }
+            if ((0 != last[1]) && (n - last[1] == 6))
+            {
+                consCount[(last[2] - last[1] == 2) ? CONS_TRIPLET_A : CONS_TRIPLET_B]++;
+            }
+            if ((0 != last[0]) && (n - last[0] == 8) && (last[1] - last[0] == 2) && (last[2] - last[0] == 6))
+            {
+                consCount[CONS_QUADRUPLET]++;
+            }
+        }
+    }
+}
+
+/*********************************************************************
+** This function is written for adding the prime n to the batch '*record' of the export of
+** the primes. A full batch is pushed.
+*********************************************************************/
+static inline void ExportPrime(uint64_t n, shmRecord** record)
+{
+    if (NULL == *record)
+    {
+        *record = ShmRingReserve(&exportRing);
+        (*record)->kind = SHM_RECORD_PRIMES;
+        (*record)->count = 0;
+    }
+
+    (*record)->value[(*record)->count++] = n;
+    if (SHM_RECORD_VALUES == (*record)->count)
+    {
+        ShmRingPush(&exportRing);
+        exportRecords++;
+        *record = NULL;
+    }
+}
+
+/*********************************************************************
+** This function is written for the export analysis. 'prev' is the last prime of the
+** segments before, '*record' the batch of primes not pushed yet. The records are written
+** directly in the shared memory.
+*********************************************************************/
+void AnalyseExport(const segmentBuffer* buffer, uint64_t* prev, shmRecord** record)
+{
+    uint64_t high = SegmentHigh(buffer);
+    uint64_t bits;
+    uint64_t n;
+    uint64_t w;
+    shmRecord* gap;
+
+    for (w = 0; w < buffer->numWords; w++)
+    {
+        bits = buffer->words[w];
+        while (0 != bits)
+        {
+            n = SIEVE_NUMBER_OF(buffer->firstWord + w, __builtin_ctzll(bits));
+            bits &= bits - 1;
+
+            if (n >= high)
+            {
+                return;
+            }
+
+            if (SHM_RECORD_PRIMES == exportKind)
+            {
+                ExportPrime(n, record);
+            }
+            else if ((0 != *prev) && (n - *prev >= exportMinDistance))
+            {
+                gap = ShmRingReserve(&exportRing);
+                gap->kind = SHM_RECORD_GAP;
+                gap->count = 2;
+                gap->value[0] = *prev;
+                gap->value[1] = n;
+                gap->value[2] = n - *prev;
+                ShmRingPush(&exportRing);
+                exportRecords++;
+            }
+            *prev = n;
+        }
+    }
+}
+
+/*********************************************************************
+** This function is written for the producer (sieve) thread 'ID' of 'numSieve'.
+*********************************************************************/
+void RunProducer(int ID, int numSieve, uint64_t numSeg, segmentBuffer** pool, spscRing* rings, double* waitTime)
+{
+    segmentBuffer* buffer;
+    uint64_t lastWord = SIEVE_WORD_OF(maxNumber - 1) + 1;
+    uint64_t seg;
+    uint64_t k = 0;
+    double start;
+    int spin;
+    int a;
+
+    for (seg = (uint64_t)ID; seg < numSeg; seg += (uint64_t)numSieve, k++)
+    {
+        buffer = pool[k % POOL_BUFFERS];
+
+        start = omp_get_wtime();
+        PoolAcquire(buffer);
+        *waitTime += omp_get_wtime() - start;
+
+        buffer->segment = seg;
+        buffer->firstWord = seg * SEGMENT_WORDS;
+        buffer->numWords = (lastWord - buffer->firstWord < SEGMENT_WORDS) ? lastWord - buffer->firstWord : SEGMENT_WORDS;
+        TRACE_BEGIN("sieve segment");
+        SieveSegment(buffer->words, buffer->firstWord, buffer->numWords, basePrimes, numBasePrimes);
+        TRACE_END("sieve segment");
+
+        /* Published by the release store of RingPush() */
+        atomic_store_explicit(&buffer->refCount, numAnalysis, memory_order_relaxed);
+        for (a = 0; a < numAnalysis; a++)
+        {
+            /* Never full: at most POOL_BUFFERS <= RING_SLOTS buffers are in flight */
+            spin = 0;
+            while (0 == RingPush(&rings[ID * numAnalysis + a], buffer))
+            {
+                RingBackoff(&spin);
+            }
+        }
+    }
+}
+
+/*********************************************************************
+** This function is written for the consumer (analysis) thread of the analysis 'a'.
+*********************************************************************/
+void RunConsumer(int a, int numSieve, uint64_t numSeg, spscRing* rings)
+{
+    segmentBuffer* buffer;
+    uint64_t firstPrime = 0;
+    uint64_t lastPrime = 0;
+    uint64_t last[4] = {0, 0, 0, 0};
+    uint64_t seg;
+    shmRecord* record = NULL;
+    double start;
+    double got;
+    int spin;
+
+    /* The even prime 2 is before all the segments */
+    if (maxNumber > 2)
+    {
+        firstPrime = 2;
+        lastPrime = 2;
+        last[3] = 2;
+        if ((ANALYSIS_EXPORT == a) && (SHM_RECORD_PRIMES == exportKind))
+        {
+            ExportPrime(2, &record);
+        }
+    }
+
+    for (seg = 0; seg < numSeg; seg++)
+    {
+        start = omp_get_wtime();
+        spin = 0;
+        while (NULL == (buffer = (segmentBuffer*)RingPop(&rings[(seg % numSieve) * numAnalysis + a])))
+        {
+            RingBackoff(&spin);
+        }
+        got = omp_get_wtime();
+        idleTime[a] += got - start;
+
+        TRACE_BEGIN(analysisName[a]);
+        switch (a)
+        {
+            case ANALYSIS_GAPS:
+                SieveScanGaps(buffer->words, buffer->firstWord, buffer->firstWord * SIEVE_NUMS_PER_WORD,
+                              SegmentHigh(buffer), &firstPrime, &lastPrime, primeList, &foundPrimeNum,
+                              NEEDED_PRIME_NUM);
+                break;
+
+            case ANALYSIS_HISTOGRAM:
+                AnalyseHistogram(buffer, &lastPrime);
+                break;
+
+            case ANALYSIS_CONSTELLATION:
+                AnalyseConstellation(buffer, last);
+                break;
+
+            default:
+                AnalyseExport(buffer, &lastPrime, &record);
+                ShmRingFlush(&exportRing);
+                break;
+        }
+
+        TRACE_END(analysisName[a]);
+        PoolRelease(buffer);
+        busyTime[a] += omp_get_wtime() - got;
+    }
+
+    if (ANALYSIS_EXPORT == a)
+    {
+        /* The last batch, then wait for the reader to read everything */
+        if (NULL != record)
+        {
+            ShmRingPush(&exportRing);
+            exportRecords++;
+        }
+        start = omp_get_wtime();
+        ShmRingClose(&exportRing);
+        idleTime[a] += omp_get_wtime() - start;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    segmentBuffer*** pools;
+    spscRing* rings;
+    double* sieveWait;
+    double startTime;
+    double totalTime;
+    uint64_t numSeg;
+    uint64_t d;
+    int numSieve = omp_get_max_threads();
+    int memError = 0;
+    int threadError = 0;
+    int printed;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((0 == strcmp(argv[i], "-n")) && (i + 1 < argc))
+        {
+            maxNumber = (uint64_t)strtod(argv[++i], NULL);
+        }
+        else if ((0 == strcmp(argv[i], "-s")) && (i + 1 < argc))
+        {
+            numSieve = atoi(argv[++i]);
+        }
+        else if ((0 == strcmp(argv[i], "-r")) && (i + 1 < argc))
+        {
+            exportName = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-e")) && (i + 1 < argc) &&
+                 ((0 == strcmp(argv[i + 1], "gaps")) || (0 == strcmp(argv[i + 1], "primes"))))
+        {
+            exportKind = (0 == strcmp(argv[++i], "gaps")) ? SHM_RECORD_GAP : SHM_RECORD_PRIMES;
+        }
+        else if ((0 == strcmp(argv[i], "-m")) && (i + 1 < argc))
+        {
+            exportMinDistance = (uint64_t)strtod(argv[++i], NULL);
+        }
+        else
+        {
+            printf("Usage: %s [-n max_number] [-s sieve_threads] [-r shm_name [-e gaps|primes] [-m min_distance]]\n",
+                   argv[0]);
+            return 0;
+        }
+    }
+
+    if ((maxNumber < 2) || (numSieve < 1) || (exportMinDistance < 1))
+    {
+        printf("max_number must be >= 2, sieve_threads >= 1 and min_distance >= 1.\n");
+        return 0;
+    }
+
+    startTime = omp_get_wtime();
+    numSeg = (SIEVE_WORD_OF(maxNumber - 1) + SEGMENT_WORDS) / SEGMENT_WORDS;
+
+    basePrimes = SieveBasePrimes(SieveIsqrt(maxNumber - 1), &numBasePrimes);
+    pools = (segmentBuffer***)calloc((size_t)numSieve, sizeof(segmentBuffer**));
+    rings = (spscRing*)aligned_alloc(RING_CACHE_LINE, (size_t)numSieve * NUM_ANALYSIS * sizeof(spscRing));
+    sieveWait = (double*)calloc((size_t)numSieve, sizeof(double));
+    if ((NULL == basePrimes) || (NULL == pools) || (NULL == rings) || (NULL == sieveWait))
+    {
+        memError = 1;
+    }
+
+    for (i = 0; (0 == memError) && (i < numSieve); i++)
+    {
+        pools[i] = PoolCreate(POOL_BUFFERS, SEGMENT_WORDS);
+        memError = (NULL == pools[i]);
+    }
+
+    if (0 != memError)
+    {
+        printf("Failed to allocate the memory!\n");
+        return 0;
+    }
+
+    if (NULL != exportName)
+    {
+        numAnalysis = NUM_ANALYSIS;
+        if (0 != ShmRingCreate(&exportRing, exportName, EXPORT_RECORDS, 0, maxNumber, exportKind, exportMinDistance))
+        {
+            printf("Failed to create the shared memory %s!\n", exportName);
+            return 0;
+        }
+    }
+
+    for (i = 0; i < numSieve * numAnalysis; i++)
+    {
+        RingInit(&rings[i]);
+    }
+
+    TRACE_INIT(0, numSieve + numAnalysis);
+
+    /* Every producer and every consumer needs its own thread, otherwise the spin loops
+    ** would never end. */
+#pragma omp parallel num_threads(numSieve + numAnalysis)
+    {
+        int ID = omp_get_thread_num();
+
+        if (omp_get_num_threads() != numSieve + numAnalysis)
+        {
+            threadError = 1;
+        }
+        else if (ID < numSieve)
+        {
+            RunProducer(ID, numSieve, numSeg, pools[ID], rings, &sieveWait[ID]);
+        }
+        else
+        {
+            RunConsumer(ID - numSieve, numSieve, numSeg, rings);
+        }
+    } // end of #pragma
+
+    totalTime = omp_get_wtime() - startTime;
+
+    if (0 != threadError)
+    {
+        printf("Failed to start %d threads.\n", numSieve + numAnalysis);
+        if (NULL != exportName)
+        {
+            ShmRingRemove(&exportRing);
+        }
+    }
+    else
+    {
+        printf("Now, print the %d biggest distances between two continue prime numbers below %" PRIu64 ".\n",
+               foundPrimeNum, maxNumber);
+        for (i = 0; i < foundPrimeNum; i++)
+        {
+            printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+                   primeList[i].smallPrime, primeList[i].largePrime, primeList[i].distance);
+        }
+
+        printf("Histogram of the distances (distance: count):");
+        for (d = 0, printed = 0; d < HIST_SIZE; d++)
+        {
+            if (0 != histogram[d])
+            {
+                printf("%s%" PRIu64 "%s: %" PRIu64, (0 == printed % 6) ? "\n  " : "   ", (0 == d) ? 1 : 2 * d,
+                       (HIST_SIZE - 1 == d) ? "+" : "", histogram[d]);
+                printed++;
+            }
+        }
+        printf("\n");
+
+        for (i = 0; i < NUM_CONS; i++)
+        {
+            printf("Number of %s primes: %" PRIu64 "\n", consName[i], consCount[i]);
+        }
+
+        for (i = 0; i < numSieve; i++)
+        {
+            printf("Sieve thread %d waited for free buffers:  %f seconds\n", i, sieveWait[i]);
+        }
+        printf("Analysis of distances / histogram / constellations busy:  %f / %f / %f seconds\n",
+               busyTime[ANALYSIS_GAPS], busyTime[ANALYSIS_HISTOGRAM], busyTime[ANALYSIS_CONSTELLATION]);
+        printf("Analysis of distances / histogram / constellations waited:  %f / %f / %f seconds\n",
+               idleTime[ANALYSIS_GAPS], idleTime[ANALYSIS_HISTOGRAM], idleTime[ANALYSIS_CONSTELLATION]);
+        if (NULL != exportName)
+        {
+            printf("Exported %" PRIu64 " records to %s, busy / waited:  %f / %f seconds\n", exportRecords, exportName,
+                   busyTime[ANALYSIS_EXPORT], idleTime[ANALYSIS_EXPORT]);
+        }
+        printf ("Total time taken by CPU:  %f seconds\n", totalTime);
+    }
+    TRACE_FLUSH("CP631_Final_pipeline_trace.json");
+
+    for (i = 0; i < numSieve; i++)
+    {
+        if (NULL != pools[i])
+        {
+            free(pools[i][0]);
+            free(pools[i]);
+        }
+    }
+    free(pools);
+    free(rings);
+    free(sieveWait);
+    free(basePrimes);
+    return 0;
+}
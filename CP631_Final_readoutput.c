@@ -0,0 +1,180 @@
+/**********************************************************************************************
+**  This program reads the prime file written by MPI-IO (CP631_Output.h) by
+**  CP631_Final_MPI.c or CP631_Final_MPI_OpenMP.c. It decodes every chunk, checks that the
+**  chunks follow each other and that the counts and the first and last primes agree, finds
+**  the 5 biggest distances again (across the chunks too) and compares them with the header.
+**  With a range [a, b) it also prints the primes in the range.
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  gcc -O2 CP631_Final_readoutput.c -o CP631_Final_readoutput.x
+**
+** Then, the code can be run by the command:
+**  ./CP631_Final_readoutput.x <file> [a b]
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_Output.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    NEEDED_PRIME_NUM      (5)
+
+
+int main(int argc, char **argv)
+{
+    FILE* file;
+    outputHeader header;
+    outputChunk chunk;
+    unsigned char* payload = NULL;
+    unsigned char* more;
+    uint64_t capacity = 0;
+    primeInfo64 primeList[NEEDED_PRIME_NUM];
+    int foundPrimeNum = 0;
+    uint64_t rangeLow = 1;
+    uint64_t rangeHigh = 0;
+    uint64_t expectLow;
+    uint64_t totalPrimes = 0;
+    uint64_t lastPrime = 0;
+    uint64_t count;
+    uint64_t prime;
+    uint64_t pos;
+    uint32_t c;
+    int errors = 0;
+    int i;
+
+    if ((2 != argc) && (4 != argc))
+    {
+        printf("Usage: %s <file> [a b]\n", argv[0]);
+        return 0;
+    }
+
+    if (4 == argc)
+    {
+        rangeLow = ParseNumber(argv[2]);
+        rangeHigh = ParseNumber(argv[3]);
+    }
+
+    file = fopen(argv[1], "rb");
+    if ((NULL == file) || (1 != fread(&header, sizeof(header), 1, file)) ||
+        (0 != memcmp(header.magic, OUTPUT_MAGIC, sizeof(header.magic))) || (OUTPUT_VERSION != header.version))
+    {
+        printf("%s is not a prime file of version %d!\n", argv[1], OUTPUT_VERSION);
+        return 0;
+    }
+
+    printf("File %s: [%" PRIu64 ", %" PRIu64 "), %u chunks, %" PRIu64 " primes, %" PRIu64 " bytes.\n",
+           argv[1], header.low, header.high, header.numChunks, header.primeCount, header.fileSize);
+
+    expectLow = header.low;
+    for (c = 0; c < header.numChunks; c++)
+    {
+        if (1 != fread(&chunk, sizeof(chunk), 1, file))
+        {
+            printf("Chunk %u is missing!\n", c);
+            errors++;
+            break;
+        }
+
+        if (chunk.payloadSize > capacity)
+        {
+            more = (unsigned char*)realloc(payload, chunk.payloadSize);
+            if (NULL == more)
+            {
+                printf("Failed to allocate the memory!\n");
+                errors++;
+                break;
+            }
+            payload = more;
+            capacity = chunk.payloadSize;
+        }
+
+        if ((0 != chunk.payloadSize) && (1 != fread(payload, chunk.payloadSize, 1, file)))
+        {
+            printf("The payload of chunk %u is cut!\n", c);
+            errors++;
+            break;
+        }
+
+        if (chunk.low != expectLow)
+        {
+            printf("Chunk %u starts at %" PRIu64 " instead of %" PRIu64 "!\n", c, chunk.low, expectLow);
+            errors++;
+        }
+        expectLow = chunk.high;
+
+        if (0 == chunk.firstPrime)
+        {
+            continue;
+        }
+
+        /* The distance from the last chunk */
+        if (0 != lastPrime)
+        {
+            InsertGap64(primeList, &foundPrimeNum, NEEDED_PRIME_NUM, chunk.firstPrime - lastPrime,
+                        lastPrime, chunk.firstPrime);
+        }
+
+        prime = chunk.firstPrime;
+        count = 1;
+        if ((rangeLow <= prime) && (prime < rangeHigh))
+        {
+            printf("%" PRIu64 "\n", prime);
+        }
+
+        for (pos = 0; pos < chunk.payloadSize; count++)
+        {
+            lastPrime = prime;
+            prime = OutputNextPrime(payload, &pos, prime);
+            InsertGap64(primeList, &foundPrimeNum, NEEDED_PRIME_NUM, prime - lastPrime, lastPrime, prime);
+            if ((rangeLow <= prime) && (prime < rangeHigh))
+            {
+                printf("%" PRIu64 "\n", prime);
+            }
+        }
+
+        if ((count != chunk.primeCount) || (prime != chunk.lastPrime) || (prime >= chunk.high))
+        {
+            printf("Chunk %u: %" PRIu64 " primes up to %" PRIu64 " decoded, %" PRIu64 " up to %" PRIu64 " expected!\n",
+                   c, count, prime, chunk.primeCount, chunk.lastPrime);
+            errors++;
+        }
+
+        totalPrimes += count;
+        lastPrime = prime;
+    }
+    fclose(file);
+    free(payload);
+
+    if ((expectLow != header.high) || (totalPrimes != header.primeCount))
+    {
+        printf("The chunks end at %" PRIu64 " with %" PRIu64 " primes!\n", expectLow, totalPrimes);
+        errors++;
+    }
+
+    printf("Now, print the %d biggest distances between two continue prime numbers.\n", foundPrimeNum);
+    for (i = 0; i < foundPrimeNum; i++)
+    {
+        printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+               primeList[i].smallPrime, primeList[i].largePrime, primeList[i].distance);
+
+        if ((i < (int)header.numGaps) && (primeList[i].distance != header.gaps[i].distance))
+        {
+            printf("The header has the distance (%" PRIu64 ")!\n", header.gaps[i].distance);
+            errors++;
+        }
+    }
+
+    printf("%s: %d errors.\n", (0 == errors) ? "OK" : "FAILED", errors);
+    return 0;
+}
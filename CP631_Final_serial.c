@@ -26,11 +26,16 @@
 #include<stdlib.h>
 #include <sys/time.h>
 
+#include "CP631_HugePage.h"
+
 
 /*********************************************************************************************/
 /***                                      local definition                        ************/
 /*********************************************************************************************/
+/* It can be changed by the build command, e.g. -DMAX_NUMBER=100000000 */
+#ifndef MAX_NUMBER
 #define    MAX_NUMBER            (1000000000)
+#endif
 #define    NEEDED_PRIME_NUM      (5)
 
 /* Make sure the following definition satisfy the condition:
@@ -56,6 +61,7 @@ int main()
 {
     int DIM=MAX_NUMBER;
     unsigned char* sieve;
+    int sieveKind;              /* The kind of pages of the sieve, see CP631_HugePage.h */
     int i;
     int j;
     int numprimes;
@@ -72,13 +78,14 @@ int main()
     ** Here, 6 items are defined for simplify the calculation in loop.  */
     primeInfo primeList[NEEDED_PRIME_NUM+1];
 
-    sieve = (unsigned char*)malloc(sizeof(unsigned char)*DIM);
+    sieve = (unsigned char*)HugeAlloc(sizeof(unsigned char)*DIM, &sieveKind);
 
     if (NULL == sieve)
     {
         printf("Failed to allocate the memory!\n");
         return 0;
     }
+    printf("Sieve memory: %s.\n", HugePageName(sieveKind));
 
     for (i=2; i<DIM; i++)
     {
@@ -149,6 +156,6 @@ int main()
     printf ("Total time taken by CPU:  %f seconds\n",
              (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
              (double) (currentTime.tv_sec - startTime.tv_sec));
-    free(sieve);
+    HugeFree(sieve, sizeof(unsigned char)*DIM, sieveKind);
     return 0;
 }
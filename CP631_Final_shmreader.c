@@ -0,0 +1,172 @@
+/**********************************************************************************************
+**  This program is the reader of the shared-memory ring (CP631_Shm.h) of the export of
+**  CP631_Final_pipeline.c (-r). It runs as a separate process on the same host, waits for
+**  the ring to be created and reads the records in place while the sieve runs, until the
+**  producer is done and every record is read. It checks that the records follow the order
+**  of the primes, counts them, finds the 5 biggest distances again and prints the rate of
+**  the ring. With -v it also prints every distance (or every prime).
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  gcc -O2 CP631_Final_shmreader.c -o CP631_Final_shmreader.x -lrt
+**
+** Then, the code can be run by the command:
+**  ./CP631_Final_shmreader.x <shm_name> [-v]
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_Shm.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    NEEDED_PRIME_NUM      (5)
+
+
+/*********************************************************************
+** This function is written for the time in seconds.
+*********************************************************************/
+double WallTime(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + 1e-9 * (double)now.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    shmRing ring;
+    const shmRecord* record;
+    primeInfo64 primeList[NEEDED_PRIME_NUM];
+    int foundPrimeNum = 0;
+    uint64_t numRecords = 0;
+    uint64_t numValues = 0;
+    uint64_t lastPrime = 0;
+    uint64_t prime;
+    uint64_t minDistance;
+    uint32_t kind;
+    uint32_t v;
+    double startTime = 0;
+    double totalTime;
+    int verbose = 0;
+    int errors = 0;
+    int spin = 0;
+    int i;
+
+    if ((2 != argc) && !((3 == argc) && (0 == strcmp(argv[2], "-v"))))
+    {
+        printf("Usage: %s <shm_name> [-v]\n", argv[0]);
+        return 0;
+    }
+    verbose = (3 == argc);
+
+    if (0 != ShmRingAttach(&ring, argv[1]))
+    {
+        printf("%s is not a ring of version %d!\n", argv[1], SHM_VERSION);
+        return 0;
+    }
+
+    kind = ring.header->kind;
+    minDistance = ring.header->minDistance;
+    printf("Ring %s: [%" PRIu64 ", %" PRIu64 "), %" PRIu64 " records, %s.\n", argv[1], ring.header->low,
+           ring.header->high, ring.header->capacity, (SHM_RECORD_GAP == kind) ? "distances" : "primes");
+
+    for (;;)
+    {
+        record = ShmRingNext(&ring);
+        if (NULL == record)
+        {
+            if (ShmRingFinished(&ring))
+            {
+                break;
+            }
+            RingBackoff(&spin);
+            continue;
+        }
+        spin = 0;
+
+        if (0 == numRecords)
+        {
+            startTime = WallTime();
+        }
+        numRecords++;
+
+        if ((kind != record->kind) || (0 == record->count) || (SHM_RECORD_VALUES < record->count))
+        {
+            printf("Record %" PRIu64 " is not a record of this ring!\n", numRecords - 1);
+            errors++;
+        }
+        else if (SHM_RECORD_GAP == kind)
+        {
+            /* The distances are in order and don't overlap */
+            if ((record->value[0] < lastPrime) || (record->value[1] - record->value[0] != record->value[2]) ||
+                (record->value[2] < minDistance))
+            {
+                printf("Wrong distance (%" PRIu64 ") to (%" PRIu64 ") after (%" PRIu64 ")!\n",
+                       record->value[0], record->value[1], lastPrime);
+                errors++;
+            }
+            InsertGap64(primeList, &foundPrimeNum, NEEDED_PRIME_NUM, record->value[2], record->value[0],
+                        record->value[1]);
+            if (verbose)
+            {
+                printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+                       record->value[0], record->value[1], record->value[2]);
+            }
+            lastPrime = record->value[1];
+            numValues++;
+        }
+        else
+        {
+            for (v = 0; v < record->count; v++)
+            {
+                prime = record->value[v];
+                if (prime <= lastPrime)
+                {
+                    printf("Prime (%" PRIu64 ") after (%" PRIu64 ")!\n", prime, lastPrime);
+                    errors++;
+                }
+                else if (0 != lastPrime)
+                {
+                    InsertGap64(primeList, &foundPrimeNum, NEEDED_PRIME_NUM, prime - lastPrime, lastPrime, prime);
+                }
+                if (verbose)
+                {
+                    printf("%" PRIu64 "\n", prime);
+                }
+                lastPrime = prime;
+            }
+            numValues += record->count;
+        }
+
+        ShmRingPop(&ring);
+    }
+
+    totalTime = (0 != numRecords) ? WallTime() - startTime : 0.0;
+    ShmRingDetach(&ring);
+
+    printf("Read %" PRIu64 " records, %" PRIu64 " %s.\n", numRecords, numValues,
+           (SHM_RECORD_GAP == kind) ? "distances" : "primes");
+    printf("Now, print the %d biggest distances between two continue prime numbers.\n", foundPrimeNum);
+    for (i = 0; i < foundPrimeNum; i++)
+    {
+        printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+               primeList[i].smallPrime, primeList[i].largePrime, primeList[i].distance);
+    }
+    printf("Read %.3e records/s, %.1f MB/s\n", (totalTime > 0) ? (double)numRecords / totalTime : 0.0,
+           (totalTime > 0) ? (double)numRecords * sizeof(shmRecord) / totalTime / 1e6 : 0.0);
+    printf("Total time taken by CPU:  %f seconds\n", totalTime);
+    printf("%s: %d errors.\n", (0 == errors) ? "OK" : "FAILED", errors);
+    return 0;
+}
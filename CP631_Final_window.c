@@ -0,0 +1,396 @@
+/**********************************************************************************************
+**  This program finds out the 5 biggest distances of the consecutive prime numbers in a
+**  narrow window [low, low + width) at a huge offset, e.g. [1e18, 1e18 + 1e11), so the cost
+**  depends on the width of the window and not on the offset.
+**
+**  The window is split between the MPI processes, and the part of every process between its
+**  OpenMP threads. Each thread keeps its part as the bit-packed odd-only bitmap of
+**  CP631_Sieve.h (width/16 bytes in total) and sieves it in two steps:
+**
+**  1. The small base primes (below SMALL_LIMIT) hit every segment many times. Their first
+**     multiples in the part are found once with 128-bit arithmetic (SieveFirstMultiple()) and
+**     the offsets are carried from segment to segment, so every segment is sieved in cache.
+**
+**  2. The large base primes (SMALL_LIMIT up to sqrt(low + width), i.e. up to 1e9 for 1e18)
+**     are never saved as a whole, unlike primeByCPU[CPU_CALC_END/6] of CP631_Final_OpenMP.c.
+**     They are generated in chunks by all the threads together, then every thread crosses off
+**     the multiples of the chunk in its own part, and the next chunk is generated.
+**
+**  A process handles at most PASS_WORDS words at once, the rest of its part is done in more
+**  passes. The distances across the threads, passes and processes are added at the end as in
+**  CP631_Final_MPI_OpenMP.c.
+**
+**  v1.0   Chunxiang Zhang
+**
+**********************************************************************************************/
+
+/* The code can be built by the command:
+**  mpicc -fopenmp -O2 -march=native CP631_Final_window.c -o CP631_Final_window.x
+**
+** Then, the code can be run by the command:
+**  OMP_NUM_THREADS=4 mpirun -np 6 ./CP631_Final_window.x 1e18 1e11
+**
+** If in the server with small memory space, run the command below to prevent segfaults:
+** ulimit -s unlimited
+**********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "mpi.h"
+#include <omp.h>
+#include <sys/time.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_HugePage.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    NEEDED_PRIME_NUM      (5)
+
+/* 2^15 words = 256 KB bitmap = 4194304 integers per segment */
+#define    SEGMENT_WORDS         ((uint64_t)1 << 15)
+
+/* The base primes below this value are the small ones (step 1 above) */
+#define    SMALL_LIMIT           (SEGMENT_WORDS * SIEVE_NUMS_PER_WORD)
+
+/* Every thread generates 2^13 words = 1048576 integers of large base primes per chunk */
+#define    GEN_WORDS             ((uint64_t)1 << 13)
+
+/* 2^26 words = 512 MB bitmap = 8.6e9 integers per pass in every process */
+#define    PASS_WORDS            ((uint64_t)1 << 26)
+
+/* The result of a thread, a pass or a process */
+typedef struct
+{
+    primeInfo64 primeList[NEEDED_PRIME_NUM];
+    int         foundPrimeNum;
+    uint64_t    firstPrime;
+    uint64_t    lastPrime;
+} rangeResult;
+
+
+/*********************************************************************
+** This function is written for adding the result of the next range (in increasing order)
+** to 'total', including the distance across the border of the two ranges.
+*********************************************************************/
+void MergeResult(rangeResult* total, const rangeResult* next)
+{
+    int k;
+
+    for (k = 0; k < next->foundPrimeNum; k++)
+    {
+        InsertGap64(total->primeList, &total->foundPrimeNum, NEEDED_PRIME_NUM, next->primeList[k].distance,
+                    next->primeList[k].smallPrime, next->primeList[k].largePrime);
+    }
+
+    if (0 == next->firstPrime)
+    {
+        return;
+    }
+
+    if (0 != total->lastPrime)
+    {
+        InsertGap64(total->primeList, &total->foundPrimeNum, NEEDED_PRIME_NUM, next->firstPrime - total->lastPrime,
+                    total->lastPrime, next->firstPrime);
+    }
+    else
+    {
+        total->firstPrime = next->firstPrime;
+    }
+
+    total->lastPrime = next->lastPrime;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t low;
+    uint64_t high;
+    uint64_t sqrtHigh;
+    uint64_t smallLimit;
+    uint64_t numSmallPrimes;
+    uint32_t* smallPrimes;
+    uint64_t lowWord;
+    uint64_t highWord;
+    uint64_t procWord0;
+    uint64_t procWord1;
+    uint64_t passWord0;
+    uint64_t passWord1;
+    uint64_t genWord0;
+    uint64_t genWord1;
+    uint64_t* bitmap;
+    size_t bitmapSize;
+    int bitmapKind;
+    int worstBitmapKind;
+    uint32_t* genList;
+    uint64_t* genCount;
+    uint64_t* offsets = NULL;
+    rangeResult* threadRes;
+    rangeResult procRes;
+    rangeResult totalRes;
+    rangeResult* allRes = NULL;
+    int my_rank;
+    int num_processors;
+    int num_thread;
+    int memError = 0;
+    int allMemError = 0;
+    int i;
+    struct timeval  startTime; /* Record the start time */
+    struct timeval  currentTime;  /* Record the current time */
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+
+    if (3 != argc)
+    {
+        if (0 == my_rank)
+        {
+            printf("Usage: %s <low> <width>\n", argv[0]);
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    low = ParseNumber(argv[1]);
+    high = low + ParseNumber(argv[2]);
+    if ((high <= low) || (high > UINT64_MAX - SIEVE_NUMS_PER_WORD))
+    {
+        if (0 == my_rank)
+        {
+            printf("The window must be inside [0, 2^64 - 128).\n");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    if (0 == my_rank)
+    {
+        gettimeofday(&startTime, NULL);
+    }
+
+    sqrtHigh = SieveIsqrt(high - 1);
+    smallLimit = (sqrtHigh < SMALL_LIMIT) ? sqrtHigh : SMALL_LIMIT;
+
+    /* The words of the window, then the part of this process */
+    lowWord = SIEVE_WORD_OF(low);
+    highWord = SIEVE_WORD_OF(high - 1) + 1;
+    procWord0 = lowWord + (highWord - lowWord) * my_rank / num_processors;
+    procWord1 = lowWord + (highWord - lowWord) * (my_rank + 1) / num_processors;
+
+    num_thread = omp_get_max_threads();
+    passWord1 = (procWord1 - procWord0 < PASS_WORDS) ? procWord1 - procWord0 : PASS_WORDS;
+
+    smallPrimes = SieveBasePrimes(smallLimit, &numSmallPrimes);
+    bitmapSize = (passWord1 + 1) * sizeof(uint64_t);
+    bitmap = (uint64_t*)HugeAlloc(bitmapSize, &bitmapKind);
+    genList = (uint32_t*)malloc((size_t)num_thread * GEN_WORDS * SIEVE_WORD_BITS * sizeof(uint32_t));
+    genCount = (uint64_t*)calloc((size_t)num_thread, sizeof(uint64_t));
+    threadRes = (rangeResult*)calloc((size_t)num_thread, sizeof(rangeResult));
+    if (NULL != smallPrimes)
+    {
+        /* The offsets of the small primes, numSmallPrimes + 1 per thread */
+        offsets = (uint64_t*)malloc((size_t)num_thread * (numSmallPrimes + 1) * sizeof(uint64_t));
+    }
+
+    if ((NULL == smallPrimes) || (NULL == bitmap) || (NULL == genList) || (NULL == genCount) || (NULL == threadRes) ||
+        (NULL == offsets))
+    {
+        memError = 1;
+    }
+    MPI_Allreduce(&memError, &allMemError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(&bitmapKind, &worstBitmapKind, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+    /* If one process fails to allocate the memory, all the process should free the allocated
+    ** memory and quit the program. */
+    if (0 != allMemError)
+    {
+        free(smallPrimes);
+        HugeFree(bitmap, bitmapSize, bitmapKind);
+        free(genList);
+        free(genCount);
+        free(offsets);
+        free(threadRes);
+        MPI_Finalize();
+
+        if (0 == my_rank)
+        {
+            printf("Failed to allocate the memory!\n");
+        }
+        return 1;
+    }
+
+    memset(&procRes, 0, sizeof(procRes));
+
+    /* The large base primes are in the words [genWord0, genWord1) */
+    genWord0 = SIEVE_WORD_OF(smallLimit + 1);
+    genWord1 = SIEVE_WORD_OF(sqrtHigh) + 1;
+
+    for (passWord0 = procWord0; passWord0 < procWord1; passWord0 = passWord1)
+    {
+        passWord1 = (procWord1 - passWord0 < PASS_WORDS) ? procWord1 : passWord0 + PASS_WORDS;
+
+#pragma omp parallel num_threads(num_thread)
+        {
+            int ID = omp_get_thread_num();
+            uint64_t numSeg = (passWord1 - passWord0 + SEGMENT_WORDS - 1) / SEGMENT_WORDS;
+            uint64_t subWord0 = passWord0 + numSeg * ID / num_thread * SEGMENT_WORDS;
+            uint64_t subWord1 = passWord0 + numSeg * (ID + 1) / num_thread * SEGMENT_WORDS;
+            uint64_t* words;
+            uint64_t subLow;
+            uint64_t subBits;
+            uint64_t* offset = &offsets[(uint64_t)ID * (numSmallPrimes + 1)];
+            uint64_t gen[GEN_WORDS];
+            uint64_t genWord;
+            uint64_t myGen;
+            uint64_t segEnd;
+            uint64_t bits;
+            uint64_t m;
+            uint64_t n;
+            uint64_t w;
+            uint64_t k;
+            uint32_t p;
+            int t;
+
+            subWord0 = (subWord0 < passWord1) ? subWord0 : passWord1;
+            subWord1 = (subWord1 < passWord1) ? subWord1 : passWord1;
+            words = &bitmap[subWord0 - passWord0];
+            subLow = subWord0 * SIEVE_NUMS_PER_WORD;
+            subBits = (subWord1 - subWord0) * SIEVE_WORD_BITS;
+
+            /* The primes up to SIEVE_PRESIEVE_LAST are done by the pre-sieve pattern */
+            SievePresieve(words, subWord0, subWord1 - subWord0);
+
+            /* Step 1: the small primes, with the offsets carried between the segments */
+            for (k = 0; k < numSmallPrimes; k++)
+            {
+                m = SieveFirstMultiple(subLow, smallPrimes[k]);
+                offset[k] = (((m - subLow) / 2 < subBits) && (smallPrimes[k] > SIEVE_PRESIEVE_LAST)) ? (m - subLow) / 2 : subBits;
+            }
+
+            for (segEnd = SEGMENT_WORDS * SIEVE_WORD_BITS; segEnd < subBits + SEGMENT_WORDS * SIEVE_WORD_BITS;
+                 segEnd += SEGMENT_WORDS * SIEVE_WORD_BITS)
+            {
+                if (segEnd > subBits)
+                {
+                    segEnd = subBits;
+                }
+
+                for (k = 0; k < numSmallPrimes; k++)
+                {
+                    offset[k] = SieveMarkPrime(words, offset[k], segEnd, smallPrimes[k]);
+                }
+            }
+
+            /* Step 2: the large primes are generated chunk by chunk by all the threads */
+            for (genWord = genWord0; genWord < genWord1; genWord += (uint64_t)num_thread * GEN_WORDS)
+            {
+                myGen = genWord + (uint64_t)ID * GEN_WORDS;
+                genCount[ID] = 0;
+
+                if (myGen < genWord1)
+                {
+                    w = (genWord1 - myGen < GEN_WORDS) ? genWord1 - myGen : GEN_WORDS;
+                    SieveSegment(gen, myGen, w, smallPrimes, numSmallPrimes);
+
+                    for (k = 0; k < w; k++)
+                    {
+                        bits = gen[k];
+                        while (0 != bits)
+                        {
+                            n = SIEVE_NUMBER_OF(myGen + k, __builtin_ctzll(bits));
+                            bits &= bits - 1;
+
+                            if ((n > smallLimit) && (n <= sqrtHigh))
+                            {
+                                genList[(uint64_t)ID * GEN_WORDS * SIEVE_WORD_BITS + genCount[ID]++] = (uint32_t)n;
+                            }
+                        }
+                    }
+                }
+
+#pragma omp barrier
+
+                /* Every thread crosses off the whole chunk in its own part */
+                for (t = 0; t < num_thread; t++)
+                {
+                    for (k = 0; k < genCount[t]; k++)
+                    {
+                        p = genList[(uint64_t)t * GEN_WORDS * SIEVE_WORD_BITS + k];
+                        m = SieveFirstMultiple(subLow, p);
+
+                        if ((m - subLow) / 2 < subBits)
+                        {
+                            SieveMarkPrime(words, (m - subLow) / 2, subBits, p);
+                        }
+                    }
+                }
+
+#pragma omp barrier
+            }
+
+            /* Step 3: find out the distances in [low, high) of the thread part */
+            memset(&threadRes[ID], 0, sizeof(rangeResult));
+            if (subWord0 < subWord1)
+            {
+                SieveScanGaps(words, subWord0, (subLow > low) ? subLow : low,
+                              (subWord1 * SIEVE_NUMS_PER_WORD < high) ? subWord1 * SIEVE_NUMS_PER_WORD : high,
+                              &threadRes[ID].firstPrime, &threadRes[ID].lastPrime,
+                              threadRes[ID].primeList, &threadRes[ID].foundPrimeNum, NEEDED_PRIME_NUM);
+            }
+        } // end of #pragma
+
+        /* Handle the border distance between threads (and passes) */
+        for (i = 0; i < num_thread; i++)
+        {
+            MergeResult(&procRes, &threadRes[i]);
+        }
+    }
+
+    /* So far, all distances inside the range of the process have been found out.
+    ** Process 0 collects the results and adds the distances across the processes. */
+    if (0 == my_rank)
+    {
+        allRes = (rangeResult*)malloc((size_t)num_processors * sizeof(rangeResult));
+    }
+    MPI_Gather(&procRes, (int)sizeof(rangeResult), MPI_BYTE, allRes, (int)sizeof(rangeResult), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    /* Process 0 print out the information */
+    if (0 == my_rank)
+    {
+        memset(&totalRes, 0, sizeof(totalRes));
+        for (i = 0; (NULL != allRes) && (i < num_processors); i++)
+        {
+            MergeResult(&totalRes, &allRes[i]);
+        }
+
+        gettimeofday(&currentTime, NULL);
+
+        printf("Now, print the %d biggest distances between two continue prime numbers in [%" PRIu64 ", %" PRIu64 ").\n",
+               totalRes.foundPrimeNum, low, high);
+        for (i = 0; i < totalRes.foundPrimeNum; i++)
+        {
+            printf("Between continue prime number (%" PRIu64 ") and (%" PRIu64 "), the distance is (%" PRIu64 "). \n",
+                   totalRes.primeList[i].smallPrime, totalRes.primeList[i].largePrime, totalRes.primeList[i].distance);
+        }
+        printf("Sieve memory: %s.\n", HugePageName(worstBitmapKind));
+        printf ("Total time taken by CPU:  %f seconds\n",
+                 (double) (currentTime.tv_usec - startTime.tv_usec) / 1000000 +
+                 (double) (currentTime.tv_sec - startTime.tv_sec));
+        free(allRes);
+    }
+
+    free(smallPrimes);
+    HugeFree(bitmap, bitmapSize, bitmapKind);
+    free(genList);
+    free(genCount);
+    free(offsets);
+    free(threadRes);
+
+    /* Finalize the parallel process */
+    MPI_Finalize();
+    return 0;
+}
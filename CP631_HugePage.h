@@ -0,0 +1,181 @@
+/**********************************************************************************************
+**  Huge page allocator for the large sieve buffers of the CP631 tools.
+**
+**  With 4 KB pages the loop 'sieve[j]=0' of a prime larger than 4096 touches a new page on
+**  every store and nearly every store is a TLB miss. HugeAlloc() tries, in this order:
+**
+**  1. 1 GB pages by mmap(MAP_HUGETLB | MAP_HUGE_1GB), only for buffers of 512 MB or more,
+**  2. 2 MB pages by mmap(MAP_HUGETLB | MAP_HUGE_2MB),
+**  3. normal pages by mmap() with madvise(MADV_HUGEPAGE), so that the kernel backs the buffer
+**     with transparent huge pages (THP) if it is enabled,
+**  4. normal pages.
+**
+**  Steps 1 and 2 need pages reserved by the administrator, e.g.
+**      echo 600 > /proc/sys/vm/nr_hugepages
+**  and fail without them. The kind of pages obtained is returned so that the programs can
+**  print it. Set the environment variable CP631_NO_HUGE_PAGES to skip steps 1-3 and compare.
+**
+**  All the functions are 'static inline' so that every tool can still be built by a single
+**  gcc/mpicc/nvcc command line.
+**
+**********************************************************************************************/
+
+#ifndef CP631_HUGEPAGE_H
+#define CP631_HUGEPAGE_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#ifndef MAP_HUGE_SHIFT
+#define    MAP_HUGE_SHIFT        (26)
+#endif
+
+#define    HUGE_SIZE_1G          ((size_t)1 << 30)
+#define    HUGE_SIZE_2M          ((size_t)1 << 21)
+#define    HUGE_FLAG_1G          (30 << MAP_HUGE_SHIFT)
+#define    HUGE_FLAG_2M          (21 << MAP_HUGE_SHIFT)
+
+/* 1 GB pages are only tried for the buffers of this size or more */
+#define    HUGE_1G_MIN_SIZE      (HUGE_SIZE_1G / 2)
+
+/* The kinds of pages, from the best to the worst, so MPI_MAX gives the worst of all ranks */
+enum
+{
+    HUGE_PAGE_1G = 0,
+    HUGE_PAGE_2M,
+    HUGE_PAGE_THP,
+    HUGE_PAGE_NONE,
+    HUGE_PAGE_FAILED
+};
+
+
+/*********************************************************************
+** This function is written for the name of a kind of pages.
+*********************************************************************/
+static inline const char* HugePageName(int kind)
+{
+    switch (kind)
+    {
+        case HUGE_PAGE_1G:
+            return "1 GB huge pages";
+        case HUGE_PAGE_2M:
+            return "2 MB huge pages";
+        case HUGE_PAGE_THP:
+            return "4 KB pages with transparent huge pages requested";
+        case HUGE_PAGE_NONE:
+            return "4 KB pages";
+        default:
+            return "no memory";
+    }
+}
+
+/*********************************************************************
+** This function is written for checking if the kernel gives transparent huge pages to the
+** buffers asking for them by madvise().
+*********************************************************************/
+static inline int HugeThpEnabled(void)
+{
+    char line[128] = "";
+    FILE* file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+
+    if (NULL == file)
+    {
+        return 0;
+    }
+
+    if (NULL == fgets(line, sizeof(line), file))
+    {
+        line[0] = '\0';
+    }
+    fclose(file);
+
+    /* The current setting is in brackets: "always [madvise] never" */
+    return (NULL == strstr(line, "[never]")) && (NULL != strchr(line, '['));
+}
+
+/*********************************************************************
+** This function is written for the size really mapped for a buffer of 'size' bytes with
+** the given kind of pages. HugeFree() needs the same value.
+*********************************************************************/
+static inline size_t HugeMappedSize(size_t size, int kind)
+{
+    size_t page = (HUGE_PAGE_1G == kind) ? HUGE_SIZE_1G : HUGE_SIZE_2M;
+
+    return (size + page - 1) / page * page;
+}
+
+/*********************************************************************
+** This function is written for allocating 'size' bytes, backed by huge pages if possible.
+** The kind of pages obtained is saved in '*kind'. The memory is filled with 0.
+** NULL is returned if it fails. The buffer must be released by HugeFree().
+*********************************************************************/
+static inline void* HugeAlloc(size_t size, int* kind)
+{
+    void* buff;
+    int useHuge = (NULL == getenv("CP631_NO_HUGE_PAGES"));
+
+    if (useHuge && (size >= HUGE_1G_MIN_SIZE))
+    {
+        buff = mmap(NULL, HugeMappedSize(size, HUGE_PAGE_1G), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | HUGE_FLAG_1G, -1, 0);
+        if (MAP_FAILED != buff)
+        {
+            *kind = HUGE_PAGE_1G;
+            return buff;
+        }
+    }
+
+    if (useHuge)
+    {
+        buff = mmap(NULL, HugeMappedSize(size, HUGE_PAGE_2M), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | HUGE_FLAG_2M, -1, 0);
+        if (MAP_FAILED != buff)
+        {
+            *kind = HUGE_PAGE_2M;
+            return buff;
+        }
+    }
+
+    /* The size is rounded to 2 MB so that THP can cover the whole buffer */
+    buff = mmap(NULL, HugeMappedSize(size, HUGE_PAGE_THP), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == buff)
+    {
+        *kind = HUGE_PAGE_FAILED;
+        return NULL;
+    }
+
+    *kind = HUGE_PAGE_NONE;
+#ifdef MADV_HUGEPAGE
+    if (useHuge && (0 == madvise(buff, HugeMappedSize(size, HUGE_PAGE_THP), MADV_HUGEPAGE)) && HugeThpEnabled())
+    {
+        *kind = HUGE_PAGE_THP;
+    }
+#endif
+
+    return buff;
+}
+
+/*********************************************************************
+** This function is written for releasing a buffer of HugeAlloc(). 'size' and 'kind' must be
+** the same as the allocation. NULL is ignored.
+*********************************************************************/
+static inline void HugeFree(void* buff, size_t size, int kind)
+{
+    if (NULL != buff)
+    {
+        munmap(buff, HugeMappedSize(size, kind));
+    }
+}
+
+#endif
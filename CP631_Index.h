@@ -0,0 +1,590 @@
+/**********************************************************************************************
+**  Segment summary index of the sieve engine (CP631_Engine.h): a small file that keeps, for
+**  fixed segments [s * INDEX_SEGMENT_NUMS, (s + 1) * INDEX_SEGMENT_NUMS), their first prime,
+**  last prime, number of primes and INDEX_MAX_GAPS biggest distances.
+**
+**  A query [a, b) is then answered without sieving the whole range, in the same way as the
+**  results of the threads are stitched together:
+**
+**  1. the partial segment at the start and the one at the end are sieved by the engine,
+**  2. the summaries of all the full segments between them are merged in order with
+**     EngineMergeParts(), which adds the distance across every border.
+**  So the cost is two segments of sieving plus O(number of segments) merges, and the number
+**  of primes gives pi(b) - pi(a). The top-K of the query is exact for K <= INDEX_MAX_GAPS,
+**  since every distance of the range is inside one segment or across a border.
+**
+**  The index is sparse: it only has the segments which were inside a query. The summaries
+**  missing for a query are built by IndexEnsure() and appended to the file, so the first
+**  query of [a, b) sieves about b - a integers whatever a is, the index grows with the
+**  queries and is reused by the next runs. With MPI the missing segments are split between
+**  the processes, and the OpenMP threads of every process take them one by one. The file is
+**  written by process 0, in batches of INDEX_BUILD_BATCH segments, and its header is updated
+**  after the summaries of a batch: a run which is stopped keeps the batches it has finished.
+**
+**  Several runs can share the file: a run holds an exclusive flock() while it appends a
+**  batch after the summaries in the file at that time, and a shared one while it reads the
+**  file. Two runs may build the same segment, then the copies are the same and only one is
+**  kept in memory.
+**
+**  File layout (version 2), all integers little-endian as in memory:
+**
+**    indexHeader                              at offset 0
+**    indexSummary x header.numSummaries       in the order they were added, each one with the
+**                                             number of its segment
+**
+**  All the functions are 'static inline'. With MPI, mpi.h must be included before this file.
+**
+**********************************************************************************************/
+
+#ifndef CP631_INDEX_H
+#define CP631_INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/types.h>
+#include <omp.h>
+
+#include "CP631_Sieve.h"
+#include "CP631_Engine.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    INDEX_MAGIC               "CP631IX"
+#define    INDEX_VERSION             (2)
+#define    INDEX_MAX_GAPS            (8)
+
+/* The segments of the index are the default segments of the engine: 4194304 integers */
+#define    INDEX_SEGMENT_WORDS       ENGINE_SEGMENT_WORDS
+#define    INDEX_SEGMENT_NUMS        (INDEX_SEGMENT_WORDS * SIEVE_NUMS_PER_WORD)
+
+/* 65536 segments = 2.7e11 integers, 15 MB of summaries */
+#define    INDEX_BUILD_BATCH         ((uint64_t)1 << 16)
+
+typedef struct
+{
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    maxGaps;
+    uint64_t    segmentWords;
+    uint64_t    numSummaries;    /* The summaries in the file */
+} indexHeader;
+
+typedef struct
+{
+    uint64_t    segment;         /* The summary is the one of [segment, segment + 1) * INDEX_SEGMENT_NUMS */
+    uint64_t    firstPrime;      /* 0 if there is no prime in the segment */
+    uint64_t    lastPrime;
+    uint64_t    primeCount;
+    uint64_t    numGaps;
+    primeInfo64 gaps[INDEX_MAX_GAPS];
+} indexSummary;
+
+typedef struct
+{
+    indexHeader   header;
+    indexSummary* summaries;     /* Only in process 0, sorted by segment, one per segment */
+    uint64_t      numSummaries;
+} segmentIndex;
+
+
+/*********************************************************************
+** This function is written for the full segments [*firstFull, *lastFull) of the query
+** [cfg->low, cfg->high). There is none if *firstFull >= *lastFull.
+*********************************************************************/
+static inline void IndexFullSegments(const engineConfig* cfg, uint64_t* firstFull, uint64_t* lastFull)
+{
+    *firstFull = (cfg->low + INDEX_SEGMENT_NUMS - 1) / INDEX_SEGMENT_NUMS;
+    *lastFull = cfg->high / INDEX_SEGMENT_NUMS;
+}
+
+/*********************************************************************
+** This function is written for qsort() of the summaries by segment.
+*********************************************************************/
+static inline int IndexCompare(const void* a, const void* b)
+{
+    uint64_t sa = ((const indexSummary*)a)->segment;
+    uint64_t sb = ((const indexSummary*)b)->segment;
+
+    return (sa > sb) - (sa < sb);
+}
+
+/*********************************************************************
+** This function is written for sorting the summaries in memory by segment and dropping the
+** copies of a segment built by two runs.
+*********************************************************************/
+static inline void IndexSort(segmentIndex* index)
+{
+    uint64_t i;
+    uint64_t n = 0;
+
+    qsort(index->summaries, index->numSummaries, sizeof(indexSummary), IndexCompare);
+    for (i = 0; i < index->numSummaries; i++)
+    {
+        if ((0 == n) || (index->summaries[i].segment != index->summaries[n - 1].segment))
+        {
+            index->summaries[n++] = index->summaries[i];
+        }
+    }
+    index->numSummaries = n;
+}
+
+/*********************************************************************
+** This function is written for the position of the first summary in memory whose segment
+** is not less than 's' (index->numSummaries if there is none).
+*********************************************************************/
+static inline uint64_t IndexLowerBound(const segmentIndex* index, uint64_t s)
+{
+    uint64_t lo = 0;
+    uint64_t hi = index->numSummaries;
+    uint64_t mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (index->summaries[mid].segment < s)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*********************************************************************
+** This function is written for opening the file 'fileName' with the lock 'lock' (LOCK_SH or
+** LOCK_EX), created if 'create'. NULL is returned if it can't be opened. The lock goes with
+** fclose().
+*********************************************************************/
+static inline FILE* IndexOpenLocked(const char* fileName, int lock, int create)
+{
+    FILE* file;
+    int fd;
+
+    fd = open(fileName, create ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    file = (0 == flock(fd, lock)) ? fdopen(fd, create ? "r+b" : "rb") : NULL;
+    if (NULL == file)
+    {
+        close(fd);
+    }
+    return file;
+}
+
+/*********************************************************************
+** This function is written for checking the header of an index file.
+*********************************************************************/
+static inline int IndexHeaderValid(const indexHeader* header)
+{
+    return (0 == memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic))) && (INDEX_VERSION == header->version) &&
+           (INDEX_MAX_GAPS == header->maxGaps) && (INDEX_SEGMENT_WORDS == header->segmentWords);
+}
+
+/*********************************************************************
+** This function is written for opening the index file 'fileName'. A missing file gives an
+** empty index. With MPI, process 0 reads the file and sends the header to the others.
+** 0 is returned, or -1 if the file is not an index of the current version or the memory
+** can't be allocated.
+*********************************************************************/
+static inline int IndexOpen(segmentIndex* index, const char* fileName)
+{
+    FILE* file;
+    int my_rank = 0;
+    int status = 0;
+
+    memset(index, 0, sizeof(segmentIndex));
+#ifdef MPI_VERSION
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+#endif
+
+    memcpy(index->header.magic, INDEX_MAGIC, sizeof(index->header.magic));
+    index->header.version = INDEX_VERSION;
+    index->header.maxGaps = INDEX_MAX_GAPS;
+    index->header.segmentWords = INDEX_SEGMENT_WORDS;
+
+    file = (0 == my_rank) ? IndexOpenLocked(fileName, LOCK_SH, 0) : NULL;
+    if (NULL != file)
+    {
+        if ((1 != fread(&index->header, sizeof(indexHeader), 1, file)) || !IndexHeaderValid(&index->header))
+        {
+            status = -1;
+        }
+        else if (0 != index->header.numSummaries)
+        {
+            index->summaries = (indexSummary*)malloc(sizeof(indexSummary) * index->header.numSummaries);
+            if ((NULL == index->summaries) ||
+                (index->header.numSummaries != fread(index->summaries, sizeof(indexSummary),
+                                                     index->header.numSummaries, file)))
+            {
+                status = -1;
+            }
+            else
+            {
+                index->numSummaries = index->header.numSummaries;
+                IndexSort(index);
+            }
+        }
+        fclose(file);
+    }
+
+#ifdef MPI_VERSION
+    MPI_Bcast(&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&index->header, (int)sizeof(indexHeader), MPI_BYTE, 0, MPI_COMM_WORLD);
+#endif
+
+    if (0 != status)
+    {
+        free(index->summaries);
+        index->summaries = NULL;
+        index->numSummaries = 0;
+    }
+    return status;
+}
+
+/*********************************************************************
+** This function is written for releasing the index.
+*********************************************************************/
+static inline void IndexClose(segmentIndex* index)
+{
+    free(index->summaries);
+    memset(index, 0, sizeof(segmentIndex));
+}
+
+/*********************************************************************
+** This function is written for making the summary of the segment 's'. 'cfg' gives the base
+** primes and the marking strategy, 'scratch' holds INDEX_SEGMENT_WORDS words.
+*********************************************************************/
+static inline void IndexSummarize(const engineConfig* cfg, uint64_t s, indexSummary* summary, uint64_t* scratch)
+{
+    engineConfig segCfg = *cfg;
+    engineResult result;
+
+    segCfg.low = s * INDEX_SEGMENT_NUMS;
+    segCfg.high = (s + 1) * INDEX_SEGMENT_NUMS;
+    segCfg.segmentWords = INDEX_SEGMENT_WORDS;
+    segCfg.topK = INDEX_MAX_GAPS;
+    segCfg.progress = NULL;
+
+    EngineResultInit(&result);
+    EngineRunWords(&segCfg, s * INDEX_SEGMENT_WORDS, (s + 1) * INDEX_SEGMENT_WORDS, &result, scratch);
+
+    memset(summary, 0, sizeof(indexSummary));
+    summary->segment = s;
+    summary->firstPrime = result.firstPrime;
+    summary->lastPrime = result.lastPrime;
+    summary->primeCount = result.primeCount;
+    summary->numGaps = (uint64_t)result.found;
+    memcpy(summary->gaps, result.top, sizeof(primeInfo64) * (size_t)result.found);
+}
+
+/*********************************************************************
+** This function is written for appending the 'count' summaries 'added' to the file, after
+** the summaries it has now (another run may have added some), and then writing the header,
+** so the header never counts a summary which is not in the file yet. They are added to the
+** index in memory too. 0 is returned, or -1 if the file can't be written or the memory
+** can't be allocated.
+*********************************************************************/
+static inline int IndexAppend(segmentIndex* index, const char* fileName, const indexSummary* added, uint64_t count)
+{
+    FILE* file;
+    indexHeader onDisk;
+    indexSummary* more;
+    int error;
+
+    file = IndexOpenLocked(fileName, LOCK_EX, 1);
+    if (NULL == file)
+    {
+        return -1;
+    }
+
+    /* A new file gets the header of this index */
+    if (1 != fread(&onDisk, sizeof(indexHeader), 1, file))
+    {
+        onDisk = index->header;
+        onDisk.numSummaries = 0;
+    }
+
+    error = !IndexHeaderValid(&onDisk) ||
+            (0 != fseeko(file, (off_t)(sizeof(indexHeader) + onDisk.numSummaries * sizeof(indexSummary)), SEEK_SET)) ||
+            (count != fwrite(added, sizeof(indexSummary), count, file)) || (0 != fflush(file));
+    if (0 == error)
+    {
+        onDisk.numSummaries += count;
+        error = (0 != fseeko(file, 0, SEEK_SET)) || (1 != fwrite(&onDisk, sizeof(indexHeader), 1, file));
+        index->header = onDisk;
+    }
+    error |= (0 != fclose(file));
+
+    more = (indexSummary*)realloc(index->summaries, sizeof(indexSummary) * (index->numSummaries + count));
+    if (NULL == more)
+    {
+        return -1;
+    }
+    index->summaries = more;
+    memcpy(index->summaries + index->numSummaries, added, sizeof(indexSummary) * count);
+    index->numSummaries += count;
+    IndexSort(index);
+
+    return error ? -1 : 0;
+}
+
+/*********************************************************************
+** This function is written for process 0: the next (at most INDEX_BUILD_BATCH) segments from
+** '*next' up to 'lastSeg' which are not in the index are saved in 'batch'. '*next' goes on
+** after them, and their number is returned.
+*********************************************************************/
+static inline uint64_t IndexMissing(const segmentIndex* index, uint64_t* next, uint64_t lastSeg, uint64_t* batch)
+{
+    uint64_t pos = IndexLowerBound(index, *next);
+    uint64_t count = 0;
+    uint64_t s;
+
+    for (s = *next; (s < lastSeg) && (count < INDEX_BUILD_BATCH); s++)
+    {
+        if ((pos < index->numSummaries) && (index->summaries[pos].segment == s))
+        {
+            pos++;
+        }
+        else
+        {
+            batch[count++] = s;
+        }
+    }
+
+    *next = s;
+    return count;
+}
+
+/*********************************************************************
+** This function is written for making sure that the index has the summaries of the
+** segments [firstSeg, lastSeg). Only the missing ones are built, and appended to the file. It
+** must be called by all the processes. cfg->basePrimes must hold the primes up to
+** sqrt(lastSeg * INDEX_SEGMENT_NUMS - 1), and cfg->numThreads threads are used per process.
+** 0 is returned, or -1 if the memory can't be allocated or the file can't be written.
+*********************************************************************/
+static inline int IndexEnsure(segmentIndex* index, const char* fileName, const engineConfig* cfg,
+                              uint64_t firstSeg, uint64_t lastSeg)
+{
+    indexSummary* local;
+    indexSummary* built = NULL;
+    uint64_t* batch;
+    uint64_t next = firstSeg;
+    uint64_t count = 0;
+    uint64_t partLo;
+    uint64_t partHi;
+    int my_rank = 0;
+    int num_processors = 1;
+    int error = 0;
+    int allError = 0;
+
+#ifdef MPI_VERSION
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+#endif
+
+    batch = (uint64_t*)malloc(sizeof(uint64_t) * INDEX_BUILD_BATCH);
+    if (0 == my_rank)
+    {
+        built = (indexSummary*)malloc(sizeof(indexSummary) * INDEX_BUILD_BATCH);
+        error = (NULL == built);
+    }
+    error |= (NULL == batch);
+#ifdef MPI_VERSION
+    MPI_Allreduce(&error, &allError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+#else
+    allError = error;
+#endif
+
+    while ((0 == allError) && (next < lastSeg))
+    {
+        /* Process 0 knows the index, and sends the segments to build to the others */
+        if (0 == my_rank)
+        {
+            count = IndexMissing(index, &next, lastSeg, batch);
+        }
+#ifdef MPI_VERSION
+        MPI_Bcast(&next, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&count, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+        MPI_Bcast(batch, (int)count, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+#endif
+        if (0 == count)
+        {
+            continue;
+        }
+
+        /* Every process builds one contiguous part of the batch */
+        partLo = count * (uint64_t)my_rank / (uint64_t)num_processors;
+        partHi = count * (uint64_t)(my_rank + 1) / (uint64_t)num_processors;
+        local = (indexSummary*)malloc(sizeof(indexSummary) * (partHi - partLo + 1));
+        error = (NULL == local);
+
+        if (NULL != local)
+        {
+#pragma omp parallel num_threads(cfg->numThreads)
+            {
+                uint64_t* scratch = (uint64_t*)malloc(INDEX_SEGMENT_WORDS * sizeof(uint64_t));
+                uint64_t i;
+
+                if (NULL == scratch)
+                {
+#pragma omp atomic write
+                    error = 1;
+                }
+
+#pragma omp for schedule(dynamic)
+                for (i = partLo; i < partHi; i++)
+                {
+                    if (NULL != scratch)
+                    {
+                        IndexSummarize(cfg, batch[i], &local[i - partLo], scratch);
+                    }
+                }
+                free(scratch);
+            } // end of #pragma
+        }
+
+#ifdef MPI_VERSION
+        /* If one process fails to allocate the memory, all the processes fail */
+        MPI_Allreduce(&error, &allError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+        if (0 == allError)
+        {
+            int* counts = NULL;
+            int* displs = NULL;
+            int i;
+
+            /* At most INDEX_BUILD_BATCH summaries: the byte counts fit in an int */
+            if (0 == my_rank)
+            {
+                counts = (int*)malloc(sizeof(int) * 2 * (size_t)num_processors);
+                displs = counts + num_processors;
+                for (i = 0; i < num_processors; i++)
+                {
+                    counts[i] = (int)(sizeof(indexSummary) *
+                                      (count * (uint64_t)(i + 1) / (uint64_t)num_processors -
+                                       count * (uint64_t)i / (uint64_t)num_processors));
+                    displs[i] = (int)(sizeof(indexSummary) * (count * (uint64_t)i / (uint64_t)num_processors));
+                }
+            }
+
+            MPI_Gatherv(local, (int)(sizeof(indexSummary) * (partHi - partLo)), MPI_BYTE,
+                        built, counts, displs, MPI_BYTE, 0, MPI_COMM_WORLD);
+            free(counts);
+        }
+#else
+        allError = error;
+        if (0 == allError)
+        {
+            memcpy(built, local, sizeof(indexSummary) * count);
+        }
+#endif
+        free(local);
+
+        if (0 == allError)
+        {
+            error = (0 == my_rank) ? IndexAppend(index, fileName, built, count) : 0;
+#ifdef MPI_VERSION
+            MPI_Allreduce(&error, &allError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+#else
+            allError = error;
+#endif
+        }
+    }
+
+    free(batch);
+    free(built);
+    return (0 == allError) ? 0 : -1;
+}
+
+/*********************************************************************
+** This function is written for answering the query [cfg->low, cfg->high) with the top
+** cfg->topK distances (<= INDEX_MAX_GAPS) from the index. Only the partial segments at both
+** ends are sieved. The index must have the full segments of the range (IndexEnsure() with
+** IndexFullSegments()), and it is only called in process 0.
+** 0 is returned, or -1 if the memory can't be allocated or the query can't be answered.
+*********************************************************************/
+static inline int IndexQuery(const segmentIndex* index, const engineConfig* cfg, engineResult* result)
+{
+    engineConfig partCfg = *cfg;
+    const indexSummary* summary;
+    uint64_t firstFull;
+    uint64_t lastFull;
+    uint64_t wordLo;
+    uint64_t wordHi;
+    uint64_t* scratch;
+    uint64_t pos;
+    uint64_t s;
+
+    EngineResultInit(result);
+
+    /* The full segments are [firstFull, lastFull), in the summaries from 'pos' on */
+    IndexFullSegments(cfg, &firstFull, &lastFull);
+    pos = IndexLowerBound(index, firstFull);
+    if ((cfg->topK > INDEX_MAX_GAPS) ||
+        ((firstFull < lastFull) && ((index->numSummaries - pos < lastFull - firstFull) ||
+                                    (index->summaries[pos + (lastFull - firstFull) - 1].segment != lastFull - 1))))
+    {
+        return -1;
+    }
+
+    scratch = (uint64_t*)malloc(INDEX_SEGMENT_WORDS * sizeof(uint64_t));
+    if (NULL == scratch)
+    {
+        return -1;
+    }
+    partCfg.segmentWords = INDEX_SEGMENT_WORDS;
+    partCfg.progress = NULL;
+
+    /* Without a full segment, the range is less than two segments: sieve it all */
+    if (firstFull >= lastFull)
+    {
+        EngineWordRange(cfg, &wordLo, &wordHi);
+        EngineRunWords(&partCfg, wordLo, wordHi, result, scratch);
+        free(scratch);
+        return 0;
+    }
+
+    /* The partial segment at the start */
+    partCfg.high = firstFull * INDEX_SEGMENT_NUMS;
+    if (partCfg.low < partCfg.high)
+    {
+        EngineWordRange(&partCfg, &wordLo, &wordHi);
+        EngineRunWords(&partCfg, wordLo, wordHi, result, scratch);
+    }
+
+    /* The full segments, with the distances across their borders. The summaries are sorted
+    ** and unique, so the ones of [firstFull, lastFull) follow each other. */
+    for (s = firstFull; s < lastFull; s++, pos++)
+    {
+        summary = &index->summaries[pos];
+        EngineMergeParts(result, summary->gaps, (int)summary->numGaps, summary->firstPrime,
+                         summary->lastPrime, summary->primeCount, cfg->topK);
+    }
+
+    /* The partial segment at the end. Its result goes on from the last prime before it. */
+    partCfg.low = lastFull * INDEX_SEGMENT_NUMS;
+    partCfg.high = cfg->high;
+    if (partCfg.low < partCfg.high)
+    {
+        EngineWordRange(&partCfg, &wordLo, &wordHi);
+        EngineRunWords(&partCfg, wordLo, wordHi, result, scratch);
+    }
+
+    free(scratch);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,341 @@
+/**********************************************************************************************
+**  Lazy prime iterator of the CP631 tools: the primes from x onward, one by one, without
+**  knowing up front where the consumer will stop.
+**
+**      primeIterator it;
+**      PrimeIterInit(&it, x, 1);
+**      while (condition) { p = PrimeIterNext(&it); ... }
+**      PrimeIterFree(&it);
+**
+**  The iterator holds two segments of the bit-packed sieve (CP631_Sieve.h). The consumer
+**  reads one of them while a background thread sieves the other one, the segment after it.
+**  When the consumer reaches the end of its segment it gives the buffer back to the thread
+**  and takes the prefetched one, so the memory is constant and at most one segment is
+**  sieved past the point where the consumer stops.
+**
+**  The base primes are generated when a segment needs them, doubling the limit every time,
+**  but never beyond ITER_BASE_LIMIT, so the memory stays bounded for any x. When sqrt of the
+**  segment is above ITER_BASE_LIMIT (x > 4.5e15) the sieve only removes most composites, and
+**  every number left is confirmed by the Miller-Rabin test, as in CP631_Final_nextprime.c.
+**
+**  With prefetch = 0, or if the thread can't be started, the segments are sieved in
+**  PrimeIterNext() itself. The iterator is used by one consumer thread. Build with -pthread.
+**
+**  All the functions are 'static inline' so that every tool can still be built by a single
+**  gcc command line.
+**
+**********************************************************************************************/
+
+#ifndef CP631_ITERATOR_H
+#define CP631_ITERATOR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "CP631_Sieve.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+/* 2^14 words = 128 KB bitmap = 2097152 integers per segment */
+#define    ITER_SEGMENT_WORDS        ((uint64_t)1 << 14)
+
+/* The base primes stop here (3.9e6 primes, 16 MB). The sieve is exact below 2^52. */
+#define    ITER_BASE_LIMIT           ((uint64_t)1 << 26)
+
+/* The first limit of the base primes */
+#define    ITER_BASE_START           ((uint64_t)1 << 16)
+
+#define    ITER_LAST_WORD            (UINT64_MAX >> 7)
+
+/* The states of a segment buffer */
+enum
+{
+    ITER_EMPTY = 0,              /* Given to the sieve thread */
+    ITER_FULL,                   /* Sieved, for the consumer */
+    ITER_END                     /* No more segment below 2^64 */
+};
+
+typedef struct
+{
+    uint64_t* words;
+    uint64_t  firstWord;
+    uint64_t  numWords;
+    int       exact;             /* 1 if every bit left is a prime */
+    int       state;
+} iterSegment;
+
+typedef struct
+{
+    /* The consumer side */
+    uint64_t  start;             /* The first number that can be returned */
+    int       current;           /* The index of the segment being read */
+    uint64_t  wordIndex;
+    uint64_t  bits;              /* The bits of words[wordIndex] not read yet */
+    int       giveTwo;
+    int       ended;             /* 1 after the last prime below 2^64 */
+
+    /* The sieve side, only used by the sieve thread (or the consumer without thread) */
+    uint64_t  nextWord;          /* The first word of the next segment to sieve */
+    int       nextSeg;           /* The buffer it goes to */
+    uint32_t* basePrimes;
+    uint64_t  numBasePrimes;
+    uint64_t  baseLimit;
+
+    iterSegment seg[2];
+    int       prefetch;
+    int       stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+} primeIterator;
+
+
+/*********************************************************************
+** This function is written for sieving the next segment into the buffer it->nextSeg.
+** The base primes are extended first if the segment needs more. The state is not set.
+*********************************************************************/
+static inline void IterSieve(primeIterator* it)
+{
+    iterSegment* seg = &it->seg[it->nextSeg];
+    uint64_t need;
+    uint64_t limit;
+    uint32_t* primes;
+    uint64_t count;
+
+    seg->firstWord = it->nextWord;
+    seg->numWords = (ITER_LAST_WORD - it->nextWord + 1 < ITER_SEGMENT_WORDS) ?
+                    ITER_LAST_WORD - it->nextWord + 1 : ITER_SEGMENT_WORDS;
+
+    /* sqrt of the last number of the segment */
+    need = SieveIsqrt(SIEVE_NUMBER_OF(seg->firstWord + seg->numWords - 1, SIEVE_WORD_BITS - 1));
+    need = (need < ITER_BASE_LIMIT) ? need : ITER_BASE_LIMIT;
+    if (need > it->baseLimit)
+    {
+        limit = (2 * it->baseLimit > need) ? 2 * it->baseLimit : need;
+        limit = (limit < ITER_BASE_LIMIT) ? limit : ITER_BASE_LIMIT;
+        primes = SieveBasePrimes(limit, &count);
+
+        /* Without memory, go on with the old primes: Miller-Rabin keeps the result right */
+        if (NULL != primes)
+        {
+            free(it->basePrimes);
+            it->basePrimes = primes;
+            it->numBasePrimes = count;
+            it->baseLimit = limit;
+        }
+    }
+
+    SieveSegment(seg->words, seg->firstWord, seg->numWords, it->basePrimes, it->numBasePrimes);
+    seg->exact = (need <= it->baseLimit) && (need < ITER_BASE_LIMIT);
+
+    it->nextWord += seg->numWords;
+    it->nextSeg ^= 1;
+}
+
+/*********************************************************************
+** This function is written for the sieve thread. It fills the empty buffers in turn until
+** the iterator is freed or the end of the numbers is reached.
+*********************************************************************/
+static inline void* IterThread(void* arg)
+{
+    primeIterator* it = (primeIterator*)arg;
+    iterSegment* seg;
+
+    pthread_mutex_lock(&it->lock);
+    for (;;)
+    {
+        seg = &it->seg[it->nextSeg];
+        while ((!it->stop) && (ITER_EMPTY != seg->state))
+        {
+            pthread_cond_wait(&it->changed, &it->lock);
+        }
+        if (it->stop)
+        {
+            break;
+        }
+
+        if (it->nextWord > ITER_LAST_WORD)
+        {
+            seg->state = ITER_END;
+            pthread_cond_broadcast(&it->changed);
+            break;
+        }
+
+        /* The buffer is ours while it is empty, so sieve it without the lock */
+        pthread_mutex_unlock(&it->lock);
+        IterSieve(it);
+        pthread_mutex_lock(&it->lock);
+
+        seg->state = ITER_FULL;
+        pthread_cond_broadcast(&it->changed);
+    }
+    pthread_mutex_unlock(&it->lock);
+
+    return NULL;
+}
+
+/*********************************************************************
+** This function is written for giving the current segment back and taking the next one.
+** 0 is returned if there is no more segment.
+*********************************************************************/
+static inline int IterAdvance(primeIterator* it)
+{
+    iterSegment* seg = &it->seg[it->current];
+
+    if (!it->prefetch)
+    {
+        if (it->nextWord > ITER_LAST_WORD)
+        {
+            return 0;
+        }
+        IterSieve(it);
+        it->current = it->nextSeg ^ 1;
+    }
+    else
+    {
+        pthread_mutex_lock(&it->lock);
+        if (ITER_FULL == seg->state)
+        {
+            seg->state = ITER_EMPTY;
+            pthread_cond_broadcast(&it->changed);
+        }
+
+        it->current ^= 1;
+        seg = &it->seg[it->current];
+        while (ITER_EMPTY == seg->state)
+        {
+            pthread_cond_wait(&it->changed, &it->lock);
+        }
+        pthread_mutex_unlock(&it->lock);
+
+        if (ITER_END == seg->state)
+        {
+            return 0;
+        }
+    }
+
+    it->wordIndex = 0;
+    it->bits = it->seg[it->current].words[0];
+    return 1;
+}
+
+/*********************************************************************
+** This function is written for starting an iterator over the primes >= x.
+** If 'prefetch', the next segment is sieved by a background thread.
+** 0 is returned, or -1 if the memory can't be allocated.
+*********************************************************************/
+static inline int PrimeIterInit(primeIterator* it, uint64_t x, int prefetch)
+{
+    memset(it, 0, sizeof(primeIterator));
+    it->start = x;
+    it->giveTwo = (x <= 2);
+    it->nextWord = SIEVE_WORD_OF(x);
+    it->baseLimit = ITER_BASE_START;
+    it->basePrimes = SieveBasePrimes(it->baseLimit, &it->numBasePrimes);
+    it->seg[0].words = (uint64_t*)malloc(ITER_SEGMENT_WORDS * sizeof(uint64_t));
+    it->seg[1].words = (uint64_t*)malloc(ITER_SEGMENT_WORDS * sizeof(uint64_t));
+
+    if ((NULL == it->basePrimes) || (NULL == it->seg[0].words) || (NULL == it->seg[1].words))
+    {
+        free(it->basePrimes);
+        free(it->seg[0].words);
+        free(it->seg[1].words);
+        return -1;
+    }
+
+    /* Both buffers start empty. IterAdvance() switches to buffer 0 first. */
+    it->current = 1;
+    it->prefetch = prefetch;
+    if (prefetch)
+    {
+        pthread_mutex_init(&it->lock, NULL);
+        pthread_cond_init(&it->changed, NULL);
+        if (0 != pthread_create(&it->thread, NULL, IterThread, it))
+        {
+            pthread_mutex_destroy(&it->lock);
+            pthread_cond_destroy(&it->changed);
+            it->prefetch = 0;
+        }
+    }
+
+    it->ended = !IterAdvance(it);
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for the next prime of the iterator, in increasing order.
+** 0 is returned when there is no more prime below 2^64.
+*********************************************************************/
+static inline uint64_t PrimeIterNext(primeIterator* it)
+{
+    iterSegment* seg;
+    uint64_t n;
+
+    if (it->giveTwo)
+    {
+        it->giveTwo = 0;
+        return 2;
+    }
+
+    if (it->ended)
+    {
+        return 0;
+    }
+
+    for (;;)
+    {
+        seg = &it->seg[it->current];
+        while (0 == it->bits)
+        {
+            if (it->wordIndex + 1 >= seg->numWords)
+            {
+                if (!IterAdvance(it))
+                {
+                    it->ended = 1;
+                    return 0;
+                }
+                seg = &it->seg[it->current];
+                continue;
+            }
+            it->bits = seg->words[++it->wordIndex];
+        }
+
+        n = SIEVE_NUMBER_OF(seg->firstWord + it->wordIndex, __builtin_ctzll(it->bits));
+        it->bits &= it->bits - 1;
+
+        if ((n >= it->start) && (seg->exact || SieveIsPrimeMR(n)))
+        {
+            return n;
+        }
+    }
+}
+
+/*********************************************************************
+** This function is written for stopping the sieve thread and releasing the iterator.
+*********************************************************************/
+static inline void PrimeIterFree(primeIterator* it)
+{
+    if (it->prefetch)
+    {
+        pthread_mutex_lock(&it->lock);
+        it->stop = 1;
+        pthread_cond_broadcast(&it->changed);
+        pthread_mutex_unlock(&it->lock);
+
+        pthread_join(it->thread, NULL);
+        pthread_mutex_destroy(&it->lock);
+        pthread_cond_destroy(&it->changed);
+        it->prefetch = 0;
+    }
+
+    free(it->basePrimes);
+    free(it->seg[0].words);
+    free(it->seg[1].words);
+    memset(it, 0, sizeof(primeIterator));
+}
+
+#endif
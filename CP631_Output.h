@@ -0,0 +1,296 @@
+/**********************************************************************************************
+**  Parallel output of the primes and the distances of the MPI tools into one shared file
+**  with MPI-IO, so no data goes through process 0.
+**
+**  Every process encodes the primes of its own range with OutputAddPrime(), then
+**  OutputWrite() is called by all the processes together:
+**
+**  1. the offset of every process in the file is the sum of the sizes of the processes
+**     before it, given by MPI_Exscan(),
+**  2. the file is opened with collective buffering hints (romio_cb_write, cb_buffer_size and,
+**     if the environment variable CP631_IO_AGGREGATORS is set, cb_nodes; striping_factor
+**     and striping_unit are given too for Lustre and ignored elsewhere),
+**  3. all the processes write their block with MPI_File_write_at_all(), so the MPI library
+**     can gather the blocks in a few aggregators and write large stripes in parallel.
+**
+**  File layout (version 1), all integers little-endian as in memory:
+**
+**    outputHeader            written by process 0 at offset 0
+**    outputChunk + payload   one per process, in the order of the ranks
+**
+**  The payload of a chunk encodes its primes after the first one: one byte (p - q) / 2 per
+**  prime p after the prime q, 0 for the distance 1 of 2 -> 3, and for a distance of 510 or
+**  more the byte 255 followed by the distance in 4 bytes. The chunk also keeps its
+**  OUTPUT_MAX_GAPS biggest distances, and the header the biggest distances of the whole run.
+**
+**  All the functions are 'static inline'. mpi.h must be included before this file.
+**
+**********************************************************************************************/
+
+#ifndef CP631_OUTPUT_H
+#define CP631_OUTPUT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CP631_Sieve.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    OUTPUT_MAGIC              "CP631PG"
+#define    OUTPUT_VERSION            (1)
+#define    OUTPUT_MAX_GAPS           (5)
+
+/* The byte followed by the distance in 4 bytes */
+#define    OUTPUT_ESCAPE             (255)
+
+/* One collective write call writes at most 1 GB per process */
+#define    OUTPUT_IO_BLOCK           ((uint64_t)1 << 30)
+
+typedef struct
+{
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    numChunks;
+    uint64_t    low;             /* The numbers of the file are [low, high) */
+    uint64_t    high;
+    uint64_t    primeCount;
+    uint64_t    fileSize;
+    uint64_t    numGaps;
+    primeInfo64 gaps[OUTPUT_MAX_GAPS];
+} outputHeader;
+
+typedef struct
+{
+    uint64_t    low;             /* The numbers of the chunk are [low, high) */
+    uint64_t    high;
+    uint64_t    firstPrime;      /* 0 if there is no prime in the chunk */
+    uint64_t    lastPrime;
+    uint64_t    primeCount;
+    uint64_t    payloadSize;     /* Bytes of the payload after this record */
+    uint64_t    numGaps;
+    primeInfo64 gaps[OUTPUT_MAX_GAPS];
+} outputChunk;
+
+/* The data of one process. The buffer starts with room for the header and the chunk, so
+** the whole block is written by one call without a copy. */
+typedef struct
+{
+    unsigned char* buff;
+    uint64_t    size;            /* Bytes used in buff, the room at the front included */
+    uint64_t    capacity;
+    int         error;
+    int         numGaps;
+    outputChunk chunk;
+} outputEncoder;
+
+#define    OUTPUT_PREFIX             (sizeof(outputHeader) + sizeof(outputChunk))
+
+
+/*********************************************************************
+** This function is written for starting the encoder of the numbers [low, high).
+*********************************************************************/
+static inline void OutputEncoderInit(outputEncoder* enc, uint64_t low, uint64_t high)
+{
+    memset(enc, 0, sizeof(outputEncoder));
+    enc->chunk.low = low;
+    enc->chunk.high = high;
+
+    /* About 1 prime in 20 numbers up to 1e9, the buffer grows if more are needed */
+    enc->capacity = OUTPUT_PREFIX + (high - low) / 16 + 64;
+    enc->size = OUTPUT_PREFIX;
+    enc->buff = (unsigned char*)malloc(enc->capacity);
+    enc->error = (NULL == enc->buff);
+}
+
+/*********************************************************************
+** This function is written for releasing the encoder.
+*********************************************************************/
+static inline void OutputEncoderFree(outputEncoder* enc)
+{
+    free(enc->buff);
+    memset(enc, 0, sizeof(outputEncoder));
+}
+
+/*********************************************************************
+** This function is written for adding the next prime p (in increasing order) to the
+** encoder.
+*********************************************************************/
+static inline void OutputAddPrime(outputEncoder* enc, uint64_t p)
+{
+    uint64_t distance;
+    unsigned char* more;
+
+    enc->chunk.primeCount++;
+    if (0 == enc->chunk.firstPrime)
+    {
+        enc->chunk.firstPrime = p;
+        enc->chunk.lastPrime = p;
+        return;
+    }
+
+    distance = p - enc->chunk.lastPrime;
+    InsertGap64(enc->chunk.gaps, &enc->numGaps, OUTPUT_MAX_GAPS, distance, enc->chunk.lastPrime, p);
+    enc->chunk.lastPrime = p;
+
+    if (enc->size + 5 > enc->capacity)
+    {
+        more = enc->error ? NULL : (unsigned char*)realloc(enc->buff, enc->capacity * 2);
+        if (NULL == more)
+        {
+            enc->error = 1;
+            return;
+        }
+        enc->buff = more;
+        enc->capacity *= 2;
+    }
+
+    if (distance < 2 * OUTPUT_ESCAPE)
+    {
+        enc->buff[enc->size++] = (unsigned char)(distance / 2);
+    }
+    else
+    {
+        uint32_t big = (uint32_t)distance;
+
+        enc->buff[enc->size++] = OUTPUT_ESCAPE;
+        memcpy(&enc->buff[enc->size], &big, sizeof(big));
+        enc->size += sizeof(big);
+    }
+}
+
+/*********************************************************************
+** This function is written for decoding the prime after 'prime' from the payload at '*pos'.
+** '*pos' is moved to the next code.
+*********************************************************************/
+static inline uint64_t OutputNextPrime(const unsigned char* payload, uint64_t* pos, uint64_t prime)
+{
+    uint32_t big;
+    unsigned char code = payload[(*pos)++];
+
+    if (OUTPUT_ESCAPE == code)
+    {
+        memcpy(&big, &payload[*pos], sizeof(big));
+        *pos += sizeof(big);
+        return prime + big;
+    }
+
+    return (0 == code) ? prime + 1 : prime + 2 * (uint64_t)code;
+}
+
+#ifdef MPI_VERSION
+/*********************************************************************
+** This function is written for writing the chunks of all the processes to 'fileName'.
+** It must be called by all the processes. The numbers of the file are [low, high), and
+** 'gaps' are the biggest distances of the whole run (only used in process 0).
+** The size of the file is returned in all the processes, 0 if it fails.
+*********************************************************************/
+static inline uint64_t OutputWrite(const char* fileName, outputEncoder* enc, uint64_t low, uint64_t high,
+                                   const primeInfo64* gaps, int numGaps)
+{
+    MPI_File file;
+    MPI_Info info;
+    outputHeader header;
+    unsigned char* block;
+    uint64_t blockSize;
+    uint64_t offset = 0;
+    uint64_t fileSize = 0;
+    uint64_t primeCount = 0;
+    uint64_t done;
+    uint64_t rounds;
+    uint64_t allRounds;
+    uint64_t r;
+    uint64_t size;
+    int my_rank;
+    int num_processors;
+    int error = enc->error;
+    int allError = 0;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+
+    /* If one process runs out of memory, nothing is written */
+    MPI_Allreduce(&error, &allError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (0 != allError)
+    {
+        return 0;
+    }
+
+    enc->chunk.payloadSize = enc->size - OUTPUT_PREFIX;
+    enc->chunk.numGaps = (uint64_t)enc->numGaps;
+    memcpy(enc->buff + sizeof(outputHeader), &enc->chunk, sizeof(outputChunk));
+
+    /* Process 0 also writes the header in front of its chunk */
+    block = (0 == my_rank) ? enc->buff : enc->buff + sizeof(outputHeader);
+    blockSize = (0 == my_rank) ? enc->size : enc->size - sizeof(outputHeader);
+
+    MPI_Exscan(&blockSize, &offset, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    if (0 == my_rank)
+    {
+        offset = 0;
+    }
+    MPI_Allreduce(&blockSize, &fileSize, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(&enc->chunk.primeCount, &primeCount, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+
+    if (0 == my_rank)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, OUTPUT_MAGIC, sizeof(header.magic));
+        header.version = OUTPUT_VERSION;
+        header.numChunks = (uint32_t)num_processors;
+        header.low = low;
+        header.high = high;
+        header.primeCount = primeCount;
+        header.fileSize = fileSize;
+        header.numGaps = (numGaps < OUTPUT_MAX_GAPS) ? (uint64_t)numGaps : OUTPUT_MAX_GAPS;
+        memcpy(header.gaps, gaps, sizeof(primeInfo64) * header.numGaps);
+        memcpy(enc->buff, &header, sizeof(header));
+    }
+
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "romio_cb_write", "enable");
+    MPI_Info_set(info, "cb_buffer_size", "16777216");
+    MPI_Info_set(info, "striping_unit", "4194304");
+    MPI_Info_set(info, "striping_factor", "-1");
+    if (NULL != getenv("CP631_IO_AGGREGATORS"))
+    {
+        MPI_Info_set(info, "cb_nodes", getenv("CP631_IO_AGGREGATORS"));
+    }
+
+    error = (MPI_SUCCESS != MPI_File_open(MPI_COMM_WORLD, fileName, MPI_MODE_CREATE | MPI_MODE_WRONLY, info, &file));
+    MPI_Info_free(&info);
+    MPI_Allreduce(&error, &allError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (0 != allError)
+    {
+        if (0 == error)
+        {
+            MPI_File_close(&file);
+        }
+        return 0;
+    }
+
+    /* Cut an older and longer file */
+    MPI_File_set_size(file, (MPI_Offset)fileSize);
+
+    /* The count of MPI is an int, so a large block is written in more collective calls.
+    ** All the processes make the same number of calls. */
+    rounds = (blockSize + OUTPUT_IO_BLOCK - 1) / OUTPUT_IO_BLOCK;
+    MPI_Allreduce(&rounds, &allRounds, 1, MPI_UINT64_T, MPI_MAX, MPI_COMM_WORLD);
+    for (r = 0, done = 0; r < allRounds; r++, done += size)
+    {
+        size = (blockSize - done < OUTPUT_IO_BLOCK) ? blockSize - done : OUTPUT_IO_BLOCK;
+        error |= (MPI_SUCCESS != MPI_File_write_at_all(file, (MPI_Offset)(offset + done), block + done,
+                                                       (int)size, MPI_BYTE, MPI_STATUS_IGNORE));
+    }
+
+    MPI_File_close(&file);
+    MPI_Allreduce(&error, &allError, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+    return (0 == allError) ? fileSize : 0;
+}
+#endif
+
+#endif
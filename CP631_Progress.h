@@ -0,0 +1,369 @@
+/**********************************************************************************************
+**  Live progress and cooperative cancellation of the sieve engine (CP631_Engine.h).
+**
+**  Counters:
+**  Every thread has its own progressCounter on its own cache line, and only updates it
+**  after each of its segments (the integers and the segments done, and the first number it
+**  hasn't sieved yet), so the counting costs nothing in the hot loops.
+**
+**  Reports:
+**  Thread 0 of every process calls ProgressPoll() between its segments (and while it waits
+**  for the other threads). Without MPI it adds the counters of the threads and prints the
+**  progress, the integers per second and the estimated time left to stderr every 'interval'
+**  seconds. With the MPI backends it keeps one MPI_Iallreduce(MPI_SUM) of the counters of the
+**  processes running in the background, like the exchange of CP631_Final_firstgap.c, and
+**  process 0 prints the sums. A process which has finished its part keeps taking part in the
+**  reductions (ProgressFinish()) until all the processes have finished.
+**
+**  Cancellation:
+**  ProgressInstall() catches SIGINT, SIGTERM and SIGUSR1 (the signal mpirun forwards to the
+**  processes). The first signal only sets a flag: the flag goes to all the processes with the
+**  next reduction, and every worker stops at the end of its current segment, so the result
+**  of the sieved part stays exact. A second signal kills the program as usual.
+**  ProgressCheckpoint() then writes the parts which are not sieved, one "lo hi" per line,
+**  which is the range file of CP631_Final_batch.c.
+**
+**  All the functions are 'static inline' so that every tool can still be built by a single
+**  gcc/mpicc command line.
+**
+**********************************************************************************************/
+
+#ifndef CP631_PROGRESS_H
+#define CP631_PROGRESS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <omp.h>
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+/* Seconds between the reductions of the processes when no report is asked, so that the
+** cancellation still reaches all of them */
+#define    PROGRESS_EXCHANGE         (1.0)
+
+/* The wait of thread 0 between two polls when its own part is done: 10 ms */
+#define    PROGRESS_WAIT_NS          (10000000L)
+
+typedef struct
+{
+    uint64_t numbers;            /* Integers sieved by the thread */
+    uint64_t segments;           /* Segments done by the thread */
+    uint64_t next;               /* The first number of its part which is not sieved */
+    uint64_t end;                /* The end of its part */
+    char     pad[32];
+} progressCounter;
+
+typedef struct
+{
+    progressCounter* counters;   /* One per thread of this process */
+    int      numCounters;
+    int      running;            /* Threads of this process still sieving */
+    int      stopped;            /* 1 when the run is cancelled */
+    uint64_t total;              /* The integers of the whole run */
+    double   interval;           /* Seconds between the reports, 0 for none */
+    double   startTime;
+    double   lastReport;
+    double   lastExchange;
+#ifdef MPI_VERSION
+    int      useMPI;             /* 1 if the counters are reduced over the processes */
+    int      pending;            /* 1 while a reduction is running */
+    int      numProcesses;
+    MPI_Request request;
+    uint64_t sendBuff[4];        /* {integers, segments, finished processes, cancelled} */
+    uint64_t recvBuff[4];
+#endif
+} engineProgress;
+
+static volatile sig_atomic_t progressSignal = 0;
+
+
+/*********************************************************************
+** This function is written for the first signal: the run is cancelled, and the next signal
+** has its default action again.
+*********************************************************************/
+static inline void ProgressHandler(int sig)
+{
+    progressSignal = 1;
+    signal(sig, SIG_DFL);
+}
+
+/*********************************************************************
+** This function is written for catching the signals of the cancellation.
+*********************************************************************/
+static inline void ProgressInstall(void)
+{
+    signal(SIGINT, ProgressHandler);
+    signal(SIGTERM, ProgressHandler);
+    signal(SIGUSR1, ProgressHandler);
+}
+
+/*********************************************************************
+** This function is written for allocating the counters of 'numThreads' threads. The
+** reports are printed every 'interval' seconds (0 for none). 0 is returned, or -1 if the
+** memory can't be allocated.
+*********************************************************************/
+static inline int ProgressInit(engineProgress* progress, int numThreads, double interval)
+{
+    memset(progress, 0, sizeof(engineProgress));
+    progress->numCounters = (numThreads > 1) ? numThreads : 1;
+    progress->interval = interval;
+    progress->counters = (progressCounter*)aligned_alloc(64, sizeof(progressCounter) * (size_t)progress->numCounters);
+
+    return (NULL == progress->counters) ? -1 : 0;
+}
+
+/*********************************************************************
+** This function is written for starting a run of 'total' integers.
+*********************************************************************/
+static inline void ProgressStart(engineProgress* progress, uint64_t total)
+{
+    memset(progress->counters, 0, sizeof(progressCounter) * (size_t)progress->numCounters);
+    progress->running = 0;
+    progress->stopped = 0;
+    progress->total = total;
+    progress->startTime = omp_get_wtime();
+    progress->lastReport = progress->startTime;
+    progress->lastExchange = progress->startTime;
+#ifdef MPI_VERSION
+    progress->useMPI = 0;
+    progress->pending = 0;
+#endif
+}
+
+/*********************************************************************
+** This function is written for freeing the counters.
+*********************************************************************/
+static inline void ProgressFree(engineProgress* progress)
+{
+    free(progress->counters);
+    progress->counters = NULL;
+}
+
+/*********************************************************************
+** This function is written for checking if the workers must stop.
+*********************************************************************/
+static inline int ProgressCancelled(engineProgress* progress)
+{
+    return progressSignal || __atomic_load_n(&progress->stopped, __ATOMIC_RELAXED);
+}
+
+/*********************************************************************
+** This function is written for the counters of thread ID after its segment [lo, hi).
+*********************************************************************/
+static inline void ProgressAdd(engineProgress* progress, int ID, uint64_t lo, uint64_t hi)
+{
+    progressCounter* counter;
+
+    if (ID >= progress->numCounters)
+    {
+        return;
+    }
+
+    counter = &progress->counters[ID];
+    __atomic_store_n(&counter->numbers, counter->numbers + (hi - lo), __ATOMIC_RELAXED);
+    __atomic_store_n(&counter->segments, counter->segments + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&counter->next, hi, __ATOMIC_RELAXED);
+}
+
+/*********************************************************************
+** This function is written for adding the counters of the threads of this process.
+*********************************************************************/
+static inline void ProgressSum(engineProgress* progress, uint64_t* numbers, uint64_t* segments)
+{
+    int t;
+
+    *numbers = 0;
+    *segments = 0;
+    for (t = 0; t < progress->numCounters; t++)
+    {
+        *numbers += __atomic_load_n(&progress->counters[t].numbers, __ATOMIC_RELAXED);
+        *segments += __atomic_load_n(&progress->counters[t].segments, __ATOMIC_RELAXED);
+    }
+}
+
+/*********************************************************************
+** This function is written for printing one report to stderr.
+*********************************************************************/
+static inline void ProgressPrint(const engineProgress* progress, uint64_t numbers, uint64_t segments, double now)
+{
+    double seconds = now - progress->startTime;
+    double rate = (seconds > 0) ? (double)numbers / seconds : 0.0;
+    double left = (rate > 0) ? (double)(progress->total - ((numbers < progress->total) ? numbers : progress->total)) / rate : 0.0;
+
+    fprintf(stderr, "Progress: %5.1f%%, %" PRIu64 " of %" PRIu64 " integers, %" PRIu64 " segments, %.3e integers/s, %.0f s left\n",
+            (progress->total > 0) ? 100.0 * (double)numbers / (double)progress->total : 100.0,
+            numbers, progress->total, segments, rate, left);
+}
+
+#ifdef MPI_VERSION
+/*********************************************************************
+** This function is written for starting the next reduction of the counters of the processes.
+*********************************************************************/
+static inline void ProgressExchangeStart(engineProgress* progress, int finished)
+{
+    ProgressSum(progress, &progress->sendBuff[0], &progress->sendBuff[1]);
+    progress->sendBuff[2] = (uint64_t)finished;
+    progress->sendBuff[3] = (uint64_t)ProgressCancelled(progress);
+    MPI_Iallreduce(progress->sendBuff, progress->recvBuff, 4, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD,
+                   &progress->request);
+    progress->pending = 1;
+}
+
+/*********************************************************************
+** This function is written for the result of a finished reduction.
+*********************************************************************/
+static inline void ProgressExchangeDone(engineProgress* progress, double now)
+{
+    int my_rank;
+
+    progress->pending = 0;
+    if (0 != progress->recvBuff[3])
+    {
+        __atomic_store_n(&progress->stopped, 1, __ATOMIC_RELAXED);
+    }
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    if ((progress->interval > 0) && (now - progress->lastReport >= progress->interval))
+    {
+        if (0 == my_rank)
+        {
+            ProgressPrint(progress, progress->recvBuff[0], progress->recvBuff[1], now);
+        }
+        progress->lastReport = now;
+    }
+}
+#endif
+
+/*********************************************************************
+** This function is written for thread 0 between its segments: the report of this process,
+** or the reduction of the processes, is made when it is time.
+*********************************************************************/
+static inline void ProgressPoll(engineProgress* progress)
+{
+    double now = omp_get_wtime();
+    uint64_t numbers;
+    uint64_t segments;
+
+#ifdef MPI_VERSION
+    if (progress->useMPI)
+    {
+        int flag = 0;
+
+        if (progress->pending)
+        {
+            MPI_Test(&progress->request, &flag, MPI_STATUS_IGNORE);
+            if (flag)
+            {
+                ProgressExchangeDone(progress, now);
+            }
+        }
+
+        if ((!progress->pending) &&
+            (now - progress->lastExchange >= ((progress->interval > 0) ? progress->interval : PROGRESS_EXCHANGE)))
+        {
+            progress->lastExchange = now;
+            ProgressExchangeStart(progress, 0);
+        }
+        return;
+    }
+#endif
+
+    if (progressSignal)
+    {
+        __atomic_store_n(&progress->stopped, 1, __ATOMIC_RELAXED);
+    }
+
+    if ((progress->interval > 0) && (now - progress->lastReport >= progress->interval))
+    {
+        ProgressSum(progress, &numbers, &segments);
+        ProgressPrint(progress, numbers, segments, now);
+        progress->lastReport = now;
+    }
+}
+
+/*********************************************************************
+** This function is written for thread 0 when its own part is done: it keeps polling until
+** the other threads of the process are done too.
+*********************************************************************/
+static inline void ProgressWait(engineProgress* progress)
+{
+    struct timespec pause = {0, PROGRESS_WAIT_NS};
+
+    while (0 < __atomic_load_n(&progress->running, __ATOMIC_ACQUIRE))
+    {
+        ProgressPoll(progress);
+        nanosleep(&pause, NULL);
+    }
+}
+
+#ifdef MPI_VERSION
+/*********************************************************************
+** This function is written for a process whose part is done: it keeps taking part in the
+** reductions until all the processes are done, so every process starts the same number of
+** them. Called by thread 0 out of the parallel region.
+*********************************************************************/
+static inline void ProgressFinish(engineProgress* progress)
+{
+    int num_processors;
+
+    if (!progress->useMPI)
+    {
+        return;
+    }
+
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+    for (;;)
+    {
+        if (!progress->pending)
+        {
+            ProgressExchangeStart(progress, 1);
+        }
+        MPI_Wait(&progress->request, MPI_STATUS_IGNORE);
+        ProgressExchangeDone(progress, omp_get_wtime());
+
+        if (progress->recvBuff[2] == (uint64_t)num_processors)
+        {
+            break;
+        }
+    }
+}
+#endif
+
+/*********************************************************************
+** This function is written for writing the parts of this process which are not sieved to
+** 'fileName', one "lo hi" per line. With 'append', they are added at the end of the file.
+** 0 is returned, or -1 if it fails.
+*********************************************************************/
+static inline int ProgressCheckpoint(const engineProgress* progress, const char* fileName, int append)
+{
+    FILE* file;
+    int error = 0;
+    int t;
+
+    file = fopen(fileName, append ? "a" : "w");
+    if (NULL == file)
+    {
+        return -1;
+    }
+
+    for (t = 0; (t < progress->numCounters) && (0 == error); t++)
+    {
+        if (progress->counters[t].next < progress->counters[t].end)
+        {
+            error = (0 > fprintf(file, "%" PRIu64 " %" PRIu64 "\n",
+                                 progress->counters[t].next, progress->counters[t].end));
+        }
+    }
+
+    error |= (0 != fclose(file));
+    return error ? -1 : 0;
+}
+
+#endif
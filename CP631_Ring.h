@@ -0,0 +1,168 @@
+/**********************************************************************************************
+**  Lock-free single-producer/single-consumer ring and segment buffer pool shared by the
+**  CP631 pipelined tools.
+**
+**  spscRing:
+**  A ring of RING_SLOTS pointers. Only one thread pushes and only one thread pops. 'tail' is
+**  written by the producer only and 'head' by the consumer only, so two C11 atomics with
+**  release/acquire ordering are enough and no lock is taken. They are kept in different cache
+**  lines so that the two threads do not bounce one line between them.
+**
+**  segmentBuffer:
+**  One bitmap segment. A producer owns POOL_BUFFERS of them and reuses them in turn. When a
+**  segment is published to N consumers its 'refCount' is set to N, every consumer decrements
+**  it after the analysis, and the producer takes the buffer again once it is back to 0.
+**
+**********************************************************************************************/
+
+#ifndef CP631_RING_H
+#define CP631_RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    RING_SLOTS            (16)      /* Must be a power of 2 */
+#define    RING_CACHE_LINE       (64)
+
+typedef struct
+{
+    _Alignas(RING_CACHE_LINE) atomic_uint_fast64_t head;   /* Next slot to pop, written by the consumer */
+    _Alignas(RING_CACHE_LINE) atomic_uint_fast64_t tail;   /* Next slot to push, written by the producer */
+    _Alignas(RING_CACHE_LINE) void* slot[RING_SLOTS];
+} spscRing;
+
+typedef struct
+{
+    _Alignas(RING_CACHE_LINE) atomic_int refCount;
+    uint64_t segment;        /* Index of the segment in the range */
+    uint64_t firstWord;
+    uint64_t numWords;
+    _Alignas(RING_CACHE_LINE) uint64_t words[];
+} segmentBuffer;
+
+
+/*********************************************************************
+** This function is written for initializing an empty ring.
+*********************************************************************/
+static inline void RingInit(spscRing* ring)
+{
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+/*********************************************************************
+** This function is written for pushing 'item' by the producer.
+** Return 0 if the ring is full.
+*********************************************************************/
+static inline int RingPush(spscRing* ring, void* item)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) >= RING_SLOTS)
+    {
+        return 0;
+    }
+
+    ring->slot[tail & (RING_SLOTS - 1)] = item;
+
+    /* The slot (and the segment behind it) is visible before the new tail */
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+/*********************************************************************
+** This function is written for popping the oldest item by the consumer.
+** Return NULL if the ring is empty.
+*********************************************************************/
+static inline void* RingPop(spscRing* ring)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    void* item;
+
+    if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    item = ring->slot[head & (RING_SLOTS - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return item;
+}
+
+/*********************************************************************
+** This function is written for waiting a short while in the spin loops. Yielding keeps the
+** pipeline moving when there are more threads than cores.
+*********************************************************************/
+static inline void RingBackoff(int* spin)
+{
+    if (++(*spin) < 64)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    else
+    {
+        sched_yield();
+    }
+}
+
+/*********************************************************************
+** This function is written for allocating 'count' segment buffers of 'numWords' words each.
+** The buffers are free (refCount 0) and must be released by free(pool[0]).
+*********************************************************************/
+static inline segmentBuffer** PoolCreate(int count, uint64_t numWords)
+{
+    size_t size = (sizeof(segmentBuffer) + numWords * sizeof(uint64_t) + RING_CACHE_LINE - 1) /
+                  RING_CACHE_LINE * RING_CACHE_LINE;
+    segmentBuffer** pool;
+    char* memory;
+    int i;
+
+    pool = (segmentBuffer**)malloc((size_t)count * sizeof(segmentBuffer*));
+    memory = (char*)aligned_alloc(RING_CACHE_LINE, size * (size_t)count);
+    if ((NULL == pool) || (NULL == memory))
+    {
+        free(pool);
+        free(memory);
+        return NULL;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        pool[i] = (segmentBuffer*)(memory + size * (size_t)i);
+        atomic_init(&pool[i]->refCount, 0);
+    }
+
+    return pool;
+}
+
+/*********************************************************************
+** This function is written for taking the buffer 'buffer' back from the consumers. The
+** producer waits until all the consumers have released it.
+*********************************************************************/
+static inline void PoolAcquire(segmentBuffer* buffer)
+{
+    int spin = 0;
+
+    while (0 != atomic_load_explicit(&buffer->refCount, memory_order_acquire))
+    {
+        RingBackoff(&spin);
+    }
+}
+
+/*********************************************************************
+** This function is written for a consumer giving the buffer back after its analysis.
+*********************************************************************/
+static inline void PoolRelease(segmentBuffer* buffer)
+{
+    atomic_fetch_sub_explicit(&buffer->refCount, 1, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,384 @@
+/**********************************************************************************************
+**  Lock-free single-producer/single-consumer ring of records in POSIX shared memory, to
+**  stream the results of a CP631 tool to another process of the same host while it runs,
+**  instead of parsing its stdout.
+**
+**  The producer creates the ring with ShmRingCreate() (shm_open() + mmap()), the consumer
+**  attaches to it by its name with ShmRingAttach(). Like spscRing of CP631_Ring.h, 'tail' is
+**  only written by the producer and 'head' only by the consumer, on their own cache lines,
+**  with release/acquire ordering, so no lock is taken. The records are written in place in
+**  the shared memory by the producer (ShmRingReserve() + ShmRingPush()) and read in place by
+**  the consumer (ShmRingNext() + ShmRingPop()): nothing is copied on the way. The indices are
+**  only published every SHM_BATCH records (and when the ring is full or empty), so the two
+**  processes do not bounce the cache lines of the indices for every record.
+**
+**  Backpressure: when the ring is full the producer waits for the consumer, so the memory is
+**  bounded by the ring. At the end ShmRingClose() marks the ring done and waits until the
+**  consumer has read every record, then removes the name.
+**
+**  Layout of the shared memory (version 1), all integers in the byte order of the host:
+**
+**    offset   0  magic "CP631SR\0", version (uint32), recordSize (uint32) = 64,
+**                capacity (uint64, records, a power of 2), low, high (uint64, the range of
+**                the run), kind (uint32, the kind of the records), minDistance (uint64)
+**    offset  64  head  (uint64, the next record to read, written by the consumer)
+**    offset 128  tail  (uint64, the next record to write, written by the producer)
+**    offset 192  state (uint32, SHM_STATE_RUNNING or SHM_STATE_DONE)
+**    offset 256  capacity records of 64 bytes; the record i is in the slot i % capacity
+**
+**  A record is {kind (uint32), count (uint32), value[7] (uint64)}:
+**    SHM_RECORD_GAP      value[0] and value[1] are consecutive primes, value[2] their
+**                        distance (at least minDistance), count is 2
+**    SHM_RECORD_PRIMES   value[0 .. count - 1] are the next 'count' primes (1 ~ 7)
+**  The records follow the increasing order of the primes.
+**
+**  All the functions are 'static inline'. Link with -lrt on the older C libraries.
+**
+**********************************************************************************************/
+
+#ifndef CP631_SHM_H
+#define CP631_SHM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "CP631_Ring.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    SHM_MAGIC                 "CP631SR"
+#define    SHM_VERSION               (1)
+#define    SHM_RECORD_VALUES         (7)
+
+/* Records written or read before the index is published to the other process */
+#define    SHM_BATCH                 (64)
+
+/* The wait of the consumer for the ring to be created: 10 ms */
+#define    SHM_ATTACH_WAIT_NS        (10000000L)
+
+#define    SHM_RECORD_GAP            (1)
+#define    SHM_RECORD_PRIMES         (2)
+
+#define    SHM_STATE_RUNNING         (0)
+#define    SHM_STATE_DONE            (1)
+
+typedef struct
+{
+    uint32_t kind;
+    uint32_t count;
+    uint64_t value[SHM_RECORD_VALUES];
+} shmRecord;
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;
+    uint64_t low;
+    uint64_t high;
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t minDistance;
+    _Alignas(RING_CACHE_LINE) atomic_uint_fast64_t head;   /* Written by the consumer */
+    _Alignas(RING_CACHE_LINE) atomic_uint_fast64_t tail;   /* Written by the producer */
+    _Alignas(RING_CACHE_LINE) atomic_uint state;
+} shmRingHeader;
+
+/* The view of the ring in one process */
+typedef struct
+{
+    shmRingHeader* header;
+    shmRecord* records;
+    size_t   size;               /* Bytes mapped */
+    uint64_t mask;               /* capacity - 1 */
+    uint64_t local;              /* The next record to write (producer) or to read (consumer) */
+    uint64_t published;          /* The index last published to the other process */
+    uint64_t other;              /* The last index of the other process seen */
+    char     name[256];
+} shmRing;
+
+/* A lock of a non lock-free atomic would be private to each process */
+_Static_assert((2 == ATOMIC_LONG_LOCK_FREE) && (2 == ATOMIC_LLONG_LOCK_FREE) && (2 == ATOMIC_INT_LOCK_FREE),
+               "the indices must be lock-free atomics");
+_Static_assert(sizeof(shmRecord) == 64, "a record is one cache line");
+_Static_assert(sizeof(shmRingHeader) == 256, "the records start at offset 256");
+
+
+/*********************************************************************
+** This function is written for creating the ring 'name' (e.g. "/cp631") of 'capacity'
+** records (a power of 2) for the records of 'kind' of the range [low, high). A ring of the
+** same name left by an old run is replaced. 0 is returned, or -1 if it fails.
+*********************************************************************/
+static inline int ShmRingCreate(shmRing* ring, const char* name, uint64_t capacity, uint64_t low, uint64_t high,
+                                uint32_t kind, uint64_t minDistance)
+{
+    shmRingHeader* header;
+    void* memory;
+    int fd;
+
+    if ((0 == capacity) || (0 != (capacity & (capacity - 1))) || (strlen(name) >= sizeof(ring->name)))
+    {
+        return -1;
+    }
+
+    memset(ring, 0, sizeof(shmRing));
+    strcpy(ring->name, name);
+    ring->size = sizeof(shmRingHeader) + capacity * sizeof(shmRecord);
+
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (0 != ftruncate(fd, (off_t)ring->size))
+    {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    memory = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == memory)
+    {
+        shm_unlink(name);
+        return -1;
+    }
+
+    header = (shmRingHeader*)memory;
+    header->version = SHM_VERSION;
+    header->recordSize = (uint32_t)sizeof(shmRecord);
+    header->capacity = capacity;
+    header->low = low;
+    header->high = high;
+    header->kind = kind;
+    header->minDistance = minDistance;
+    atomic_init(&header->head, 0);
+    atomic_init(&header->tail, 0);
+    atomic_init(&header->state, SHM_STATE_RUNNING);
+
+    /* The consumer only reads the header once it sees the magic */
+    atomic_thread_fence(memory_order_release);
+    memcpy(header->magic, SHM_MAGIC, sizeof(header->magic));
+
+    ring->header = header;
+    ring->records = (shmRecord*)((char*)memory + sizeof(shmRingHeader));
+    ring->mask = capacity - 1;
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for the producer: the records pushed so far are published now,
+** e.g. at the end of a segment, instead of waiting for a full batch.
+*********************************************************************/
+static inline void ShmRingFlush(shmRing* ring)
+{
+    if (ring->published != ring->local)
+    {
+        atomic_store_explicit(&ring->header->tail, ring->local, memory_order_release);
+        ring->published = ring->local;
+    }
+}
+
+/*********************************************************************
+** This function is written for the producer: the slot of the next record, to be filled and
+** then given by ShmRingPush(). While the ring is full, the producer waits for the consumer.
+*********************************************************************/
+static inline shmRecord* ShmRingReserve(shmRing* ring)
+{
+    int spin = 0;
+
+    while (ring->local - ring->other > ring->mask)
+    {
+        /* Let the consumer see all the records before waiting for it */
+        ShmRingFlush(ring);
+
+        ring->other = atomic_load_explicit(&ring->header->head, memory_order_acquire);
+        if (ring->local - ring->other > ring->mask)
+        {
+            RingBackoff(&spin);
+        }
+    }
+
+    return &ring->records[ring->local & ring->mask];
+}
+
+/*********************************************************************
+** This function is written for the producer: the record of ShmRingReserve() is written.
+*********************************************************************/
+static inline void ShmRingPush(shmRing* ring)
+{
+    ring->local++;
+    if (ring->local - ring->published >= SHM_BATCH)
+    {
+        /* The records are visible before the new tail */
+        atomic_store_explicit(&ring->header->tail, ring->local, memory_order_release);
+        ring->published = ring->local;
+    }
+}
+
+/*********************************************************************
+** This function is written for the producer at the end: the last records are published,
+** the ring is marked done, and when the consumer has read all of them the ring is removed.
+*********************************************************************/
+static inline void ShmRingClose(shmRing* ring)
+{
+    int spin = 0;
+
+    atomic_store_explicit(&ring->header->tail, ring->local, memory_order_release);
+    atomic_store_explicit(&ring->header->state, SHM_STATE_DONE, memory_order_release);
+
+    while (atomic_load_explicit(&ring->header->head, memory_order_acquire) != ring->local)
+    {
+        RingBackoff(&spin);
+    }
+
+    munmap(ring->header, ring->size);
+    shm_unlink(ring->name);
+    ring->header = NULL;
+}
+
+/*********************************************************************
+** This function is written for the producer when it stops before writing the records: the
+** ring is marked done, so a consumer doesn't wait for it, and it is removed at once.
+*********************************************************************/
+static inline void ShmRingRemove(shmRing* ring)
+{
+    atomic_store_explicit(&ring->header->state, SHM_STATE_DONE, memory_order_release);
+    munmap(ring->header, ring->size);
+    shm_unlink(ring->name);
+    ring->header = NULL;
+}
+
+/*********************************************************************
+** This function is written for the consumer: attaching to the ring 'name', waiting for the
+** producer to create it. 0 is returned, or -1 if it is not a ring of this version.
+*********************************************************************/
+static inline int ShmRingAttach(shmRing* ring, const char* name)
+{
+    struct timespec pause = {0, SHM_ATTACH_WAIT_NS};
+    struct stat info;
+    shmRingHeader* header;
+    void* memory;
+    int fd;
+
+    memset(ring, 0, sizeof(shmRing));
+
+    /* The ring exists, has its size and its magic */
+    for (;;)
+    {
+        fd = shm_open(name, O_RDWR, 0600);
+        if ((fd >= 0) && (0 == fstat(fd, &info)) && ((size_t)info.st_size >= sizeof(shmRingHeader)))
+        {
+            memory = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (MAP_FAILED != memory)
+            {
+                header = (shmRingHeader*)memory;
+                if (0 == memcmp(header->magic, SHM_MAGIC, sizeof(header->magic)))
+                {
+                    close(fd);
+                    break;
+                }
+                munmap(memory, (size_t)info.st_size);
+            }
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        nanosleep(&pause, NULL);
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    if ((SHM_VERSION != header->version) || (sizeof(shmRecord) != header->recordSize) ||
+        ((size_t)info.st_size != sizeof(shmRingHeader) + header->capacity * sizeof(shmRecord)))
+    {
+        munmap(memory, (size_t)info.st_size);
+        return -1;
+    }
+
+    ring->header = header;
+    ring->records = (shmRecord*)((char*)memory + sizeof(shmRingHeader));
+    ring->size = (size_t)info.st_size;
+    ring->mask = header->capacity - 1;
+    ring->local = atomic_load_explicit(&header->head, memory_order_relaxed);
+    ring->published = ring->local;
+    ring->other = ring->local;
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for the consumer: the next record, read in place until
+** ShmRingPop(). NULL is returned if there is none yet.
+*********************************************************************/
+static inline const shmRecord* ShmRingNext(shmRing* ring)
+{
+    if (ring->local == ring->other)
+    {
+        /* Give the read slots back before waiting for the producer */
+        if (ring->published != ring->local)
+        {
+            atomic_store_explicit(&ring->header->head, ring->local, memory_order_release);
+            ring->published = ring->local;
+        }
+
+        ring->other = atomic_load_explicit(&ring->header->tail, memory_order_acquire);
+        if (ring->local == ring->other)
+        {
+            return NULL;
+        }
+    }
+
+    return &ring->records[ring->local & ring->mask];
+}
+
+/*********************************************************************
+** This function is written for the consumer: the record of ShmRingNext() is read.
+*********************************************************************/
+static inline void ShmRingPop(shmRing* ring)
+{
+    ring->local++;
+    if (ring->local - ring->published >= SHM_BATCH)
+    {
+        atomic_store_explicit(&ring->header->head, ring->local, memory_order_release);
+        ring->published = ring->local;
+    }
+}
+
+/*********************************************************************
+** This function is written for the consumer: 1 if the producer is done and every record
+** has been read. Only valid after ShmRingNext() returned NULL.
+*********************************************************************/
+static inline int ShmRingFinished(shmRing* ring)
+{
+    if (SHM_STATE_DONE != atomic_load_explicit(&ring->header->state, memory_order_acquire))
+    {
+        return 0;
+    }
+
+    /* The last tail is published before the state */
+    return ring->local == atomic_load_explicit(&ring->header->tail, memory_order_acquire);
+}
+
+/*********************************************************************
+** This function is written for the consumer at the end.
+*********************************************************************/
+static inline void ShmRingDetach(shmRing* ring)
+{
+    atomic_store_explicit(&ring->header->head, ring->local, memory_order_release);
+    munmap(ring->header, ring->size);
+    ring->header = NULL;
+}
+
+#endif
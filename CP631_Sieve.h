@@ -0,0 +1,928 @@
+/**********************************************************************************************
+**  Bit-packed, odd-only segmented Sieve of Eratosthenes shared by the CP631 tools.
+**
+**  Layout of the bitmap:
+**  Only the odd numbers are kept. The odd number n is saved in bit ((n >> 1) & 63) of the
+**  64-bit word (n >> 7), so one word covers the 128 integers [128*w, 128*w + 128). A set bit
+**  means the number is prime. The even prime 2 is never in the bitmap and must be handled by
+**  the caller (see SIEVE_HAS_TWO()).
+**
+**  Because the word index only depends on the number itself, a segment is just a range of
+**  words [firstWord, firstWord + numWords) and segments sieved by different threads, processes
+**  or runs can be put side by side without any conversion.
+**
+**  All the functions are 'static inline' so that every tool can still be built by a single
+**  gcc/mpicc command line as the original CP631_Final_*.c programs.
+**
+**********************************************************************************************/
+
+#ifndef CP631_SIEVE_H
+#define CP631_SIEVE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    SIEVE_WORD_BITS           (64)
+#define    SIEVE_NUMS_PER_WORD       (128)
+
+/* Number <-> bitmap position conversion. 'n' must be odd. */
+#define    SIEVE_WORD_OF(n)          ((uint64_t)(n) >> 7)
+#define    SIEVE_BIT_OF(n)           (((uint64_t)(n) >> 1) & 63)
+#define    SIEVE_NUMBER_OF(w, b)     (((uint64_t)(w) << 7) + ((uint64_t)(b) << 1) + 1)
+
+/* The even prime 2 is inside [low, high) */
+#define    SIEVE_HAS_TWO(low, high)  (((low) <= 2) && (2 < (high)))
+
+/* Two primes of the same word are at most 126 apart, so every bigger distance crosses the
+** border of a word: it is between the last bit of a word and the first bit of the next
+** word which is not zero. */
+#define    SIEVE_WORD_MAX_GAP        (SIEVE_NUMS_PER_WORD - 2)
+
+/* 64-bit version of primeInfo used by the tools working beyond the range of 'int'. */
+typedef struct
+{
+    uint64_t smallPrime;
+    uint64_t largePrime;
+    uint64_t distance;
+} primeInfo64;
+
+
+/*********************************************************************
+** This function is written for reading a number from the command line of the tools. Both
+** "1000000000" and "1e9" are accepted.
+*********************************************************************/
+static inline uint64_t ParseNumber(const char* text)
+{
+    if (NULL != strpbrk(text, "eE"))
+    {
+        return (uint64_t)strtod(text, NULL);
+    }
+
+    return (uint64_t)strtoull(text, NULL, 0);
+}
+
+/*********************************************************************
+** This function is written for reading a number as ParseNumber(), but checking it: the whole
+** text must be a number in [0, 2^64). 0 is returned, or -1 if it isn't.
+*********************************************************************/
+static inline int ParseNumberChecked(const char* text, uint64_t* value)
+{
+    char* end = NULL;
+    double number;
+
+    if (('\0' == text[0]) || (NULL != strchr(text, '-')))
+    {
+        return -1;
+    }
+
+    errno = 0;
+    if (NULL != strpbrk(text, "eE"))
+    {
+        number = strtod(text, &end);
+        if (!(number >= 0.0) || !(number < 18446744073709551616.0))
+        {
+            return -1;
+        }
+        *value = (uint64_t)number;
+    }
+    else
+    {
+        *value = (uint64_t)strtoull(text, &end, 0);
+    }
+
+    return ((0 == errno) && ('\0' == *end)) ? 0 : -1;
+}
+
+/*********************************************************************
+** This function is written for calculating floor(sqrt(n)) without rounding errors of the
+** double precision sqrt() for the numbers near 2^64.
+*********************************************************************/
+static inline uint64_t SieveIsqrt(uint64_t n)
+{
+    uint64_t r = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while (bit > n)
+    {
+        bit >>= 2;
+    }
+
+    while (0 != bit)
+    {
+        if (n >= r + bit)
+        {
+            n -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else
+        {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return r;
+}
+
+/*********************************************************************
+** This function is written for finding the first odd multiple of the odd prime p which is
+** no less than both 'low' and p*p. 128-bit arithmetic is used so that the result is right
+** for every low < 2^64. A value >= 2^64 is returned as UINT64_MAX (no multiple in range).
+*********************************************************************/
+static inline uint64_t SieveFirstMultiple(uint64_t low, uint32_t p)
+{
+    unsigned __int128 square = (unsigned __int128)p * p;
+    unsigned __int128 m;
+    uint64_t rem;
+
+    if (square >= low)
+    {
+        return (uint64_t)square;
+    }
+
+    rem = low % p;
+    m = (unsigned __int128)low + (rem ? (p - rem) : 0);
+
+    /* Only odd multiples are in the bitmap */
+    if (0 == (m & 1))
+    {
+        m += p;
+    }
+
+    return (m > UINT64_MAX) ? UINT64_MAX : (uint64_t)m;
+}
+
+/*********************************************************************
+** Pre-sieve: the odd multiples of 3, 5, 7, 11 and 13 are not crossed off one by one. Their
+** pattern repeats every 3*5*7*11*13 = 15015 bits, so it is built once and copied into every
+** segment, which saves about 54 stores per word.
+*********************************************************************/
+#define    SIEVE_PRESIEVE_LAST       (13)
+#define    SIEVE_PRESIEVE_PERIOD     (3 * 5 * 7 * 11 * 13)
+#define    SIEVE_PRESIEVE_WORDS      ((SIEVE_PRESIEVE_PERIOD + 2 * SIEVE_WORD_BITS) / SIEVE_WORD_BITS + 1)
+
+/* Bit i is the odd number 2i+1. Built once by the first caller: 0 = not built, 1 = building,
+** 2 = ready. */
+static uint64_t sievePresieve[SIEVE_PRESIEVE_WORDS];
+static int sievePresieveState = 0;
+
+/*********************************************************************
+** This function is written for building the pre-sieve pattern. It is thread safe: one
+** thread builds it and the others wait until it is ready.
+*********************************************************************/
+static inline void SievePresieveInit(void)
+{
+    static const uint32_t presievePrimes[] = {3, 5, 7, 11, 13};
+    uint64_t i;
+    uint64_t n;
+    int expected = 0;
+    int k;
+
+    if (2 == __atomic_load_n(&sievePresieveState, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    if (!__atomic_compare_exchange_n(&sievePresieveState, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        while (2 != __atomic_load_n(&sievePresieveState, __ATOMIC_ACQUIRE))
+        {
+        }
+        return;
+    }
+
+    for (i = 0; i < SIEVE_PRESIEVE_WORDS * SIEVE_WORD_BITS; i++)
+    {
+        n = 2 * i + 1;
+        for (k = 0; k < 5; k++)
+        {
+            if (0 == n % presievePrimes[k])
+            {
+                break;
+            }
+        }
+
+        if (5 == k)
+        {
+            sievePresieve[i >> 6] |= (uint64_t)1 << (i & 63);
+        }
+    }
+
+    __atomic_store_n(&sievePresieveState, 2, __ATOMIC_RELEASE);
+}
+
+/*********************************************************************
+** This function is written for filling the words [firstWord, firstWord + numWords) with
+** the pre-sieve pattern: all the odd numbers except 1 and the multiples of 3..13 are set.
+*********************************************************************/
+static inline void SievePresieve(uint64_t* words, uint64_t firstWord, uint64_t numWords)
+{
+    uint64_t offset;
+    uint64_t w;
+    unsigned int shift;
+
+    SievePresieveInit();
+
+    offset = (firstWord % SIEVE_PRESIEVE_PERIOD) * SIEVE_WORD_BITS % SIEVE_PRESIEVE_PERIOD;
+    for (w = 0; w < numWords; w++)
+    {
+        shift = (unsigned int)(offset & 63);
+        words[w] = (0 == shift) ? sievePresieve[offset >> 6] :
+                   (sievePresieve[offset >> 6] >> shift) | (sievePresieve[(offset >> 6) + 1] << (64 - shift));
+
+        offset += SIEVE_WORD_BITS;
+        if (offset >= SIEVE_PRESIEVE_PERIOD)
+        {
+            offset -= SIEVE_PRESIEVE_PERIOD;
+        }
+    }
+
+    if ((0 == firstWord) && (numWords > 0))
+    {
+        /* 1 is not a prime number, 3..13 are */
+        words[0] &= ~(uint64_t)1;
+        words[0] |= ((uint64_t)1 << SIEVE_BIT_OF(3)) | ((uint64_t)1 << SIEVE_BIT_OF(5)) |
+                    ((uint64_t)1 << SIEVE_BIT_OF(7)) | ((uint64_t)1 << SIEVE_BIT_OF(11)) |
+                    ((uint64_t)1 << SIEVE_BIT_OF(13));
+    }
+}
+
+/*********************************************************************
+** Specialized marking kernels. Crossing off the odd prime p from bit b clears the bits
+** b, b+p, ..., b+7p, and then the same pattern again p bytes later. Seen as bytes, mark k is
+** in byte (b>>3) + k*(p>>3) + ((b%8 + k*(p%8)) >> 3) with the mask 1 << ((b%8 + k*(p%8)) % 8),
+** so once p%8 and b%8 are known everything but p>>3 is a constant. One kernel is generated
+** for each of the 4 x 8 cases, with the 8 marks unrolled and constant masks, and
+** SieveMarkPrime() picks the kernel at run time. The byte view needs a little-endian CPU.
+*********************************************************************/
+#define    SIEVE_KERNEL_CLEAR(R, S, k) \
+    b[(k) * q + (((S) + (k) * (R)) >> 3)] &= (unsigned char)~(1u << (((S) + (k) * (R)) & 7))
+
+#define    SIEVE_KERNEL(R, S) \
+static inline uint64_t SieveKernel_##R##_##S(unsigned char* bytes, uint64_t bit, uint64_t endBit, uint64_t p) \
+{ \
+    uint64_t q = p >> 3; \
+    unsigned char* b = bytes + (bit >> 3); \
+    for (; bit + 7 * p < endBit; bit += 8 * p, b += p) \
+    { \
+        SIEVE_KERNEL_CLEAR(R, S, 0); SIEVE_KERNEL_CLEAR(R, S, 1); \
+        SIEVE_KERNEL_CLEAR(R, S, 2); SIEVE_KERNEL_CLEAR(R, S, 3); \
+        SIEVE_KERNEL_CLEAR(R, S, 4); SIEVE_KERNEL_CLEAR(R, S, 5); \
+        SIEVE_KERNEL_CLEAR(R, S, 6); SIEVE_KERNEL_CLEAR(R, S, 7); \
+    } \
+    return bit; \
+}
+
+#define    SIEVE_KERNELS_OF(R) \
+    SIEVE_KERNEL(R, 0) SIEVE_KERNEL(R, 1) SIEVE_KERNEL(R, 2) SIEVE_KERNEL(R, 3) \
+    SIEVE_KERNEL(R, 4) SIEVE_KERNEL(R, 5) SIEVE_KERNEL(R, 6) SIEVE_KERNEL(R, 7)
+
+#define    SIEVE_KERNEL_NAMES_OF(R) \
+    SieveKernel_##R##_0, SieveKernel_##R##_1, SieveKernel_##R##_2, SieveKernel_##R##_3, \
+    SieveKernel_##R##_4, SieveKernel_##R##_5, SieveKernel_##R##_6, SieveKernel_##R##_7
+
+/* The marking strategies of SieveSegmentMark() */
+#define    SIEVE_MARK_KERNELS        (0)
+#define    SIEVE_MARK_BITS           (1)
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define    SIEVE_USE_KERNELS         (1)
+
+SIEVE_KERNELS_OF(1)
+SIEVE_KERNELS_OF(3)
+SIEVE_KERNELS_OF(5)
+SIEVE_KERNELS_OF(7)
+
+/* Index ((p % 8) / 2) * 8 + b % 8 */
+static uint64_t (* const sieveKernels[32])(unsigned char*, uint64_t, uint64_t, uint64_t) =
+{
+    SIEVE_KERNEL_NAMES_OF(1), SIEVE_KERNEL_NAMES_OF(3), SIEVE_KERNEL_NAMES_OF(5), SIEVE_KERNEL_NAMES_OF(7)
+};
+#endif
+
+/*********************************************************************
+** This function is written for crossing off the odd prime p at the bits
+** bit, bit + p, bit + 2p, ... below endBit of 'words'. The next bit (>= endBit) is returned,
+** so the caller can carry it to the next segment.
+*********************************************************************/
+static inline uint64_t SieveMarkPrime(uint64_t* words, uint64_t bit, uint64_t endBit, uint64_t p)
+{
+#ifdef SIEVE_USE_KERNELS
+    bit = sieveKernels[((p & 7) >> 1) * 8 + (bit & 7)]((unsigned char*)words, bit, endBit, p);
+#endif
+
+    for (; bit < endBit; bit += p)
+    {
+        words[bit >> 6] &= ~((uint64_t)1 << (bit & 63));
+    }
+
+    return bit;
+}
+
+/*********************************************************************
+** This function is written for crossing off the odd prime p like SieveMarkPrime(), one bit
+** after the other without the kernels. It is kept for the comparison of the auto-tuner.
+*********************************************************************/
+static inline uint64_t SieveMarkPrimeBits(uint64_t* words, uint64_t bit, uint64_t endBit, uint64_t p)
+{
+    for (; bit < endBit; bit += p)
+    {
+        words[bit >> 6] &= ~((uint64_t)1 << (bit & 63));
+    }
+
+    return bit;
+}
+
+/*********************************************************************
+** This function is written for running the sieve algorithm on the words
+** [firstWord, firstWord + numWords) with the marking strategy 'mark' (SIEVE_MARK_KERNELS or
+** SIEVE_MARK_BITS). The caller must give all the odd primes up to sqrt(high - 1) in
+** basePrimes[] in increasing order, where high = 128*(firstWord + numWords).
+** The primes up to SIEVE_PRESIEVE_LAST are done by the pre-sieve pattern.
+*********************************************************************/
+static inline void SieveSegmentMark(uint64_t* words, uint64_t firstWord, uint64_t numWords,
+                                    const uint32_t* basePrimes, uint64_t numBasePrimes, int mark)
+{
+    uint64_t low = firstWord * SIEVE_NUMS_PER_WORD;
+    uint64_t totalBits = numWords * SIEVE_WORD_BITS;
+    uint64_t i;
+    uint64_t start;
+    uint32_t p;
+
+    SievePresieve(words, firstWord, numWords);
+
+    for (i = 0; i < numBasePrimes; i++)
+    {
+        p = basePrimes[i];
+        if (p <= SIEVE_PRESIEVE_LAST)
+        {
+            continue;
+        }
+
+        start = SieveFirstMultiple(low, p);
+
+        /* p*p is out of the segment. The larger primes are also out of it. */
+        if ((start - low) / 2 >= totalBits)
+        {
+            if ((uint64_t)p * p >= low)
+            {
+                break;
+            }
+            continue;
+        }
+
+        if (SIEVE_MARK_KERNELS == mark)
+        {
+            SieveMarkPrime(words, (start - low) >> 1, totalBits, p);
+        }
+        else
+        {
+            SieveMarkPrimeBits(words, (start - low) >> 1, totalBits, p);
+        }
+    }
+}
+
+/*********************************************************************
+** This function is written for running the sieve algorithm on the words
+** [firstWord, firstWord + numWords) with the marking kernels. See SieveSegmentMark().
+*********************************************************************/
+static inline void SieveSegment(uint64_t* words, uint64_t firstWord, uint64_t numWords,
+                                const uint32_t* basePrimes, uint64_t numBasePrimes)
+{
+    SieveSegmentMark(words, firstWord, numWords, basePrimes, numBasePrimes, SIEVE_MARK_KERNELS);
+}
+
+/*********************************************************************
+** This function is written for generating all the odd primes in [3, limit] (limit < 2^32).
+** The primes are found segment by segment, so no 'limit' sized array is needed.
+** The returned array must be released by free(). NULL is returned if it fails.
+*********************************************************************/
+static inline uint32_t* SieveBasePrimes(uint64_t limit, uint64_t* count)
+{
+    /* 2^16 words = 512 KB per step */
+    const uint64_t stepWords = (uint64_t)1 << 16;
+    uint64_t smallLimit = SieveIsqrt(limit);
+    uint64_t capacity;
+    uint64_t found = 0;
+    uint64_t numSmall = 0;
+    uint64_t firstWord;
+    uint64_t numWords;
+    uint64_t lastWord;
+    uint64_t w;
+    uint64_t bits;
+    uint64_t n;
+    uint32_t* primes;
+    uint32_t* smallPrimes;
+    uint64_t* words;
+    unsigned char* small;
+    uint64_t i;
+    uint64_t j;
+
+    *count = 0;
+
+    /* pi(limit) < 1.26 * limit / ln(limit). ln(limit) is estimated by the bit length so that
+    ** no libm is needed for linking. */
+    capacity = (limit < 1000) ? 200 :
+               (uint64_t)(1.3 * (double)limit / (0.69 * (63 - __builtin_clzll(limit)))) + 64;
+
+    primes = (uint32_t*)malloc(sizeof(uint32_t) * capacity);
+    smallPrimes = (uint32_t*)malloc(sizeof(uint32_t) * (smallLimit / 2 + 2));
+    small = (unsigned char*)malloc(smallLimit + 2);
+    words = (uint64_t*)malloc(sizeof(uint64_t) * stepWords);
+
+    if ((NULL == primes) || (NULL == smallPrimes) || (NULL == small) || (NULL == words))
+    {
+        free(primes);
+        free(smallPrimes);
+        free(small);
+        free(words);
+        return NULL;
+    }
+
+    /* The classic sieve for [2, sqrt(limit)] */
+    memset(small, 1, smallLimit + 2);
+    for (i = 3; i <= smallLimit; i += 2)
+    {
+        if (0 == small[i])
+        {
+            continue;
+        }
+
+        smallPrimes[numSmall++] = (uint32_t)i;
+        for (j = i * i; j <= smallLimit; j += 2 * i)
+        {
+            small[j] = 0;
+        }
+    }
+
+    lastWord = SIEVE_WORD_OF(limit);
+    for (firstWord = 0; firstWord <= lastWord; firstWord += stepWords)
+    {
+        numWords = lastWord + 1 - firstWord;
+        if (numWords > stepWords)
+        {
+            numWords = stepWords;
+        }
+
+        SieveSegment(words, firstWord, numWords, smallPrimes, numSmall);
+
+        for (w = 0; w < numWords; w++)
+        {
+            bits = words[w];
+            while (0 != bits)
+            {
+                n = SIEVE_NUMBER_OF(firstWord + w, __builtin_ctzll(bits));
+                bits &= bits - 1;
+
+                if (n > limit)
+                {
+                    break;
+                }
+                primes[found++] = (uint32_t)n;
+            }
+        }
+    }
+
+    free(smallPrimes);
+    free(small);
+    free(words);
+
+    *count = found;
+    return primes;
+}
+
+/*********************************************************************
+** This function is written for counting the primes whose bits are set in
+** words[0, numWords). The hardware popcount is used when it is enabled by -mpopcnt or
+** -march=native.
+*********************************************************************/
+static inline uint64_t SieveCountWords(const uint64_t* words, uint64_t numWords)
+{
+    uint64_t total = 0;
+    uint64_t w;
+
+    for (w = 0; w < numWords; w++)
+    {
+        total += (uint64_t)__builtin_popcountll(words[w]);
+    }
+
+    return total;
+}
+
+/*********************************************************************
+** This function is written for counting the odd primes in [low, high) on a bitmap whose
+** word 0 is the word 'firstWord'. The range must be inside the bitmap.
+*********************************************************************/
+static inline uint64_t SieveCountRange(const uint64_t* words, uint64_t firstWord,
+                                       uint64_t low, uint64_t high)
+{
+    uint64_t lowBit;
+    uint64_t highBit;
+    uint64_t lowWord;
+    uint64_t highWord;
+    uint64_t total;
+    uint64_t mask;
+
+    if (low >= high)
+    {
+        return 0;
+    }
+
+    /* Bit positions counted from the first word: [lowBit, highBit) */
+    lowBit = (low >> 1) - firstWord * SIEVE_WORD_BITS;
+    highBit = (high >> 1) - firstWord * SIEVE_WORD_BITS;
+    lowWord = lowBit >> 6;
+    highWord = highBit >> 6;
+
+    if (lowWord == highWord)
+    {
+        mask = (((uint64_t)1 << (highBit & 63)) - 1) & ~(((uint64_t)1 << (lowBit & 63)) - 1);
+        return (uint64_t)__builtin_popcountll(words[lowWord] & mask);
+    }
+
+    total = (uint64_t)__builtin_popcountll(words[lowWord] & ~(((uint64_t)1 << (lowBit & 63)) - 1));
+    total += SieveCountWords(&words[lowWord + 1], highWord - lowWord - 1);
+    if (0 != (highBit & 63))
+    {
+        total += (uint64_t)__builtin_popcountll(words[highWord] & (((uint64_t)1 << (highBit & 63)) - 1));
+    }
+
+    return total;
+}
+
+/*********************************************************************
+** This function is written for the order of the top lists: the bigger distance first, and
+** of two equal distances the one of the smaller primes first, as a scan in increasing order
+** finds them. 1 is returned if the distance (newDistance, smallPrime) goes before 'item'.
+*********************************************************************/
+static inline int GapBefore(uint64_t newDistance, uint64_t smallPrime, const primeInfo64* item)
+{
+    return (newDistance > item->distance) || ((newDistance == item->distance) && (smallPrime < item->smallPrime));
+}
+
+/*********************************************************************
+** This function is written for inserting the new large distance information to the sorted
+** buffer buff[0, capacity). Different from InsertRcdTobuff() in CP631_Final_OpenMP.c, no
+** item beyond buff[capacity-1] is touched. The ties are ordered by GapBefore(), so the list
+** is the same whatever the order of the insertions: the merges of the parallel parts give
+** the list of the serial scan.
+*********************************************************************/
+static inline void InsertGap64(primeInfo64* buff, int* found, int capacity,
+                               uint64_t newDistance, uint64_t smallPrime, uint64_t largePrime)
+{
+    int j;
+
+    if ((*found == capacity) && !GapBefore(newDistance, smallPrime, &buff[capacity - 1]))
+    {
+        return;
+    }
+
+    j = (*found < capacity) ? *found : capacity - 1;
+
+    /* This 'for' loop moves the items for new large distance */
+    for (; (j > 0) && GapBefore(newDistance, smallPrime, &buff[j - 1]); --j)
+    {
+        buff[j] = buff[j - 1];
+    }
+
+    buff[j].smallPrime = smallPrime;
+    buff[j].largePrime = largePrime;
+    buff[j].distance = newDistance;
+
+    if (*found < capacity)
+    {
+        (*found)++;
+    }
+}
+
+/*********************************************************************
+** This function is written for scanning the primes in [low, high) of a bitmap whose word 0
+** is the word 'firstWord'. The distances between consecutive primes are saved into the top
+** list 'buff'. '*lastPrime' is the prime before this range (0 if none) and it is updated to
+** the last prime found. The first prime of the range is saved in '*firstPrime' if it is 0.
+** The prime 2 is handled here too. The distances below 'minDistance' are not saved, even
+** when the list is not full: the caller knows that they can't be in the final top list.
+*********************************************************************/
+static inline void SieveScanGapsAbove(const uint64_t* words, uint64_t firstWord, uint64_t low, uint64_t high,
+                                      uint64_t* firstPrime, uint64_t* lastPrime,
+                                      primeInfo64* buff, int* found, int capacity, uint64_t minDistance)
+{
+    uint64_t lowBit;
+    uint64_t highBit;
+    uint64_t w;
+    uint64_t bits;
+    uint64_t n;
+    uint64_t prev = *lastPrime;
+
+    if (SIEVE_HAS_TWO(low, high))
+    {
+        if (0 == *firstPrime)
+        {
+            *firstPrime = 2;
+        }
+        prev = 2;
+    }
+
+    lowBit = (low >> 1) - firstWord * SIEVE_WORD_BITS;
+    highBit = (high >> 1) - firstWord * SIEVE_WORD_BITS;
+
+    /* No odd number in the range */
+    if ((low >= high) || (lowBit >= highBit))
+    {
+        *lastPrime = prev;
+        return;
+    }
+
+    for (w = lowBit >> 6; w <= ((highBit - 1) >> 6); w++)
+    {
+        bits = words[w];
+
+        /* Clear the bits out of the range in the first and the last word */
+        if (w == (lowBit >> 6))
+        {
+            bits &= ~(((uint64_t)1 << (lowBit & 63)) - 1);
+        }
+        if ((w == (highBit >> 6)) && (0 != (highBit & 63)))
+        {
+            bits &= ((uint64_t)1 << (highBit & 63)) - 1;
+        }
+
+        while (0 != bits)
+        {
+            n = SIEVE_NUMBER_OF(firstWord + w, __builtin_ctzll(bits));
+            bits &= bits - 1;
+
+            if (0 == *firstPrime)
+            {
+                *firstPrime = n;
+            }
+
+            if ((0 != prev) && (n - prev >= minDistance) &&
+                ((*found < capacity) || (n - prev > buff[capacity - 1].distance)))
+            {
+                InsertGap64(buff, found, capacity, n - prev, prev, n);
+            }
+            prev = n;
+        }
+    }
+
+    *lastPrime = prev;
+}
+
+/*********************************************************************
+** This function is written for SieveScanGapsAbove() without a minimum distance.
+*********************************************************************/
+static inline void SieveScanGaps(const uint64_t* words, uint64_t firstWord, uint64_t low, uint64_t high,
+                                 uint64_t* firstPrime, uint64_t* lastPrime,
+                                 primeInfo64* buff, int* found, int capacity)
+{
+    SieveScanGapsAbove(words, firstWord, low, high, firstPrime, lastPrime, buff, found, capacity, 0);
+}
+
+/*********************************************************************
+** This function is written for SieveScanGapsAbove() when 'minDistance' is more than
+** SIEVE_WORD_MAX_GAP: only the distances across the words can be saved, so every word is
+** tested once for zero and only its first and last prime are taken, whatever the number of
+** primes in it. The time is proportional to the words instead of the primes.
+*********************************************************************/
+static inline void SieveScanGapsSparse(const uint64_t* words, uint64_t firstWord, uint64_t low, uint64_t high,
+                                       uint64_t* firstPrime, uint64_t* lastPrime,
+                                       primeInfo64* buff, int* found, int capacity, uint64_t minDistance)
+{
+    uint64_t lowBit;
+    uint64_t highBit;
+    uint64_t w;
+    uint64_t bits;
+    uint64_t n;
+    uint64_t prev = *lastPrime;
+
+    if (SIEVE_HAS_TWO(low, high))
+    {
+        if (0 == *firstPrime)
+        {
+            *firstPrime = 2;
+        }
+        prev = 2;
+    }
+
+    lowBit = (low >> 1) - firstWord * SIEVE_WORD_BITS;
+    highBit = (high >> 1) - firstWord * SIEVE_WORD_BITS;
+
+    /* No odd number in the range */
+    if ((low >= high) || (lowBit >= highBit))
+    {
+        *lastPrime = prev;
+        return;
+    }
+
+    for (w = lowBit >> 6; w <= ((highBit - 1) >> 6); w++)
+    {
+        bits = words[w];
+
+        /* Clear the bits out of the range in the first and the last word */
+        if (w == (lowBit >> 6))
+        {
+            bits &= ~(((uint64_t)1 << (lowBit & 63)) - 1);
+        }
+        if ((w == (highBit >> 6)) && (0 != (highBit & 63)))
+        {
+            bits &= ((uint64_t)1 << (highBit & 63)) - 1;
+        }
+
+        if (0 == bits)
+        {
+            continue;
+        }
+
+        n = SIEVE_NUMBER_OF(firstWord + w, __builtin_ctzll(bits));
+        if (0 == *firstPrime)
+        {
+            *firstPrime = n;
+        }
+
+        if ((0 != prev) && (n - prev >= minDistance) &&
+            ((*found < capacity) || (n - prev > buff[capacity - 1].distance)))
+        {
+            InsertGap64(buff, found, capacity, n - prev, prev, n);
+        }
+        prev = SIEVE_NUMBER_OF(firstWord + w, 63 - __builtin_clzll(bits));
+    }
+
+    *lastPrime = prev;
+}
+
+/*********************************************************************
+** This function is written for finding the first distance of at least 'minGap' in [low,
+** high) of a bitmap whose word 0 is the word 'firstWord'. '*prevPrime' is the prime before
+** the range (0 if none) and it is updated to the last prime scanned. 1 is returned with the
+** two primes if there is one. Above SIEVE_WORD_MAX_GAP, only the borders of the words which
+** are not zero are looked at, as in SieveScanGapsSparse().
+*********************************************************************/
+static inline int SieveFirstGapAbove(const uint64_t* words, uint64_t firstWord, uint64_t low, uint64_t high,
+                                     uint64_t* prevPrime, uint64_t minGap, uint64_t* smallPrime, uint64_t* largePrime)
+{
+    uint64_t lowBit;
+    uint64_t highBit;
+    uint64_t w;
+    uint64_t bits;
+    uint64_t n;
+    uint64_t prev = *prevPrime;
+    int sparse = (minGap > SIEVE_WORD_MAX_GAP);
+
+    /* The distance 2 -> 3 is 1, so 2 is only the previous prime of 3 */
+    if (SIEVE_HAS_TWO(low, high))
+    {
+        prev = 2;
+    }
+
+    lowBit = (low >> 1) - firstWord * SIEVE_WORD_BITS;
+    highBit = (high >> 1) - firstWord * SIEVE_WORD_BITS;
+
+    if ((low >= high) || (lowBit >= highBit))
+    {
+        *prevPrime = prev;
+        return 0;
+    }
+
+    for (w = lowBit >> 6; w <= ((highBit - 1) >> 6); w++)
+    {
+        bits = words[w];
+
+        /* Clear the bits out of the range in the first and the last word */
+        if (w == (lowBit >> 6))
+        {
+            bits &= ~(((uint64_t)1 << (lowBit & 63)) - 1);
+        }
+        if ((w == (highBit >> 6)) && (0 != (highBit & 63)))
+        {
+            bits &= ((uint64_t)1 << (highBit & 63)) - 1;
+        }
+
+        while (0 != bits)
+        {
+            n = SIEVE_NUMBER_OF(firstWord + w, __builtin_ctzll(bits));
+
+            if ((0 != prev) && (n - prev >= minGap))
+            {
+                *smallPrime = prev;
+                *largePrime = n;
+                *prevPrime = n;
+                return 1;
+            }
+
+            if (sparse)
+            {
+                prev = SIEVE_NUMBER_OF(firstWord + w, 63 - __builtin_clzll(bits));
+                break;
+            }
+            prev = n;
+            bits &= bits - 1;
+        }
+    }
+
+    *prevPrime = prev;
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for calculating (a * b) mod m with 128-bit arithmetic.
+*********************************************************************/
+static inline uint64_t SieveMulMod(uint64_t a, uint64_t b, uint64_t m)
+{
+    return (uint64_t)(((unsigned __int128)a * b) % m);
+}
+
+/*********************************************************************
+** This function is written for calculating (a ^ e) mod m.
+*********************************************************************/
+static inline uint64_t SievePowMod(uint64_t a, uint64_t e, uint64_t m)
+{
+    uint64_t result = 1 % m;
+
+    a %= m;
+    while (0 != e)
+    {
+        if (e & 1)
+        {
+            result = SieveMulMod(result, a, m);
+        }
+        a = SieveMulMod(a, a, m);
+        e >>= 1;
+    }
+
+    return result;
+}
+
+/*********************************************************************
+** This function is written for testing if n is prime by the deterministic Miller-Rabin test.
+** The 7 bases of Jim Sinclair give the right answer for every n < 2^64.
+*********************************************************************/
+static inline int SieveIsPrimeMR(uint64_t n)
+{
+    static const uint64_t smallPrimes[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+    static const uint64_t bases[] = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+    uint64_t d;
+    uint64_t x;
+    uint64_t a;
+    int s = 0;
+    int i;
+    int r;
+
+    if (n < 2)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < (int)(sizeof(smallPrimes) / sizeof(smallPrimes[0])); i++)
+    {
+        if (0 == n % smallPrimes[i])
+        {
+            return (n == smallPrimes[i]);
+        }
+    }
+
+    /* n - 1 = d * 2^s */
+    for (d = n - 1; 0 == (d & 1); d >>= 1)
+    {
+        s++;
+    }
+
+    for (i = 0; i < (int)(sizeof(bases) / sizeof(bases[0])); i++)
+    {
+        a = bases[i] % n;
+        if (0 == a)
+        {
+            continue;
+        }
+
+        x = SievePowMod(a, d, n);
+        if ((1 == x) || (n - 1 == x))
+        {
+            continue;
+        }
+
+        for (r = 1; r < s; r++)
+        {
+            x = SieveMulMod(x, x, n);
+            if (n - 1 == x)
+            {
+                break;
+            }
+        }
+
+        if (r == s)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+#endif /* CP631_SIEVE_H */
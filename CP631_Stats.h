@@ -0,0 +1,440 @@
+/**********************************************************************************************
+**  Per-block statistics of the sieve engine (CP631_Engine.h): for every block of 'width'
+**  integers [low + b * width, low + (b + 1) * width) of the range, the number of primes, the
+**  biggest distance, the average distance and the most frequent distance (the mode). A
+**  distance belongs to the block of its larger prime.
+**
+**  The statistics are made in the scan of the distances itself (StatsScanGaps() is
+**  SieveScanGapsAbove() with the statistics added), so there is no extra pass over the
+**  bitmap. Every worker (thread) keeps a statsPart:
+**
+**  first   the block of its first prime, kept open with its histogram of distances, because
+**          the distance from the last prime of the previous worker is only known at the merge,
+**  cur     the block being scanned, which is the last block of the worker at the end and may
+**          be shared with the next worker, so it is kept open too,
+**  and every block between them is complete: its mode is taken from the histogram and its row
+**  is written directly into the table, where no other worker writes.
+**
+**  StatsMergePart() adds the parts in the order of the range, like EngineMerge() does for the
+**  top-K: the distance across the border goes to the first block of the next part, the open
+**  blocks of the same block are added together, and the blocks which can't change any more
+**  are written into the table. With MPI every process makes the rows of its own blocks, and
+**  process 0 gathers them and merges the open blocks of the processes.
+**
+**  StatsWrite() writes the table as CSV (file name ending with ".csv") or as a columnar
+**  binary file: a statsFileHeader, then every column as an array of numBlocks values.
+**
+**  All the functions are 'static inline' so that every tool can still be built by a single
+**  gcc/mpicc command line.
+**
+**********************************************************************************************/
+
+#ifndef CP631_STATS_H
+#define CP631_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CP631_Sieve.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+#define    STATS_MAGIC               "CP631BS"
+#define    STATS_VERSION             (1)
+
+/* Histogram of distance / 2: every distance below 2^64 is less than 2048 */
+#define    STATS_HIST                (1024)
+
+typedef struct
+{
+    uint64_t primeCount;
+    uint64_t numGaps;
+    uint64_t sumGaps;
+    uint64_t maxGap;
+    uint64_t modeGap;            /* The smallest of the most frequent distances, 0 if none */
+} statsRow;
+
+typedef struct
+{
+    statsRow* rows;              /* The rows of the blocks [rowBase, rowBase + numRows) */
+    uint64_t rowBase;
+    uint64_t numRows;
+    uint64_t low;                /* The blocks are [low + b * width, low + (b + 1) * width) */
+    uint64_t width;
+    uint64_t numBlocks;          /* The blocks of the whole range */
+} statsTable;
+
+/* A block which is not complete yet */
+typedef struct
+{
+    int      valid;
+    uint64_t block;
+    statsRow row;
+    uint64_t hist[STATS_HIST];   /* 64 bits: a block may be wider than 2^32 distances */
+} statsOpen;
+
+/* The statistics of one worker */
+typedef struct
+{
+    statsTable* table;
+    uint64_t blockEnd;           /* The end of the block of 'cur' */
+    statsOpen first;
+    statsOpen cur;
+} statsPart;
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t numColumns;
+    uint64_t low;
+    uint64_t high;
+    uint64_t width;
+    uint64_t numBlocks;
+} statsFileHeader;
+
+
+/*********************************************************************
+** This function is written for the end of the block b (the start of block b + 1).
+*********************************************************************/
+static inline uint64_t StatsBlockEnd(const statsTable* table, uint64_t b)
+{
+    unsigned __int128 end = (unsigned __int128)table->low + (unsigned __int128)(b + 1) * table->width;
+
+    return (end > UINT64_MAX) ? UINT64_MAX : (uint64_t)end;
+}
+
+/*********************************************************************
+** This function is written for starting the statistics of a worker whose numbers start at
+** 'low' (in the range of the table).
+*********************************************************************/
+static inline void StatsPartInit(statsPart* part, statsTable* table, uint64_t low)
+{
+    part->table = table;
+    part->first.valid = 0;
+    memset(&part->cur, 0, sizeof(statsOpen));
+    part->cur.valid = 1;
+    part->cur.block = (low > table->low) ? (low - table->low) / table->width : 0;
+    part->blockEnd = StatsBlockEnd(table, part->cur.block);
+}
+
+/*********************************************************************
+** This function is written for writing the complete block 'open' into the table, with the
+** mode taken from its histogram.
+*********************************************************************/
+static inline void StatsWriteRow(statsTable* table, const statsOpen* open)
+{
+    statsRow* row;
+    uint64_t best = 0;
+    int i;
+
+    if ((!open->valid) || (0 == open->row.primeCount) ||
+        (open->block < table->rowBase) || (open->block >= table->rowBase + table->numRows))
+    {
+        return;
+    }
+
+    row = &table->rows[open->block - table->rowBase];
+    *row = open->row;
+    row->modeGap = 0;
+    for (i = 0; i < STATS_HIST; i++)
+    {
+        if (open->hist[i] > best)
+        {
+            best = open->hist[i];
+            row->modeGap = (0 == i) ? 1 : 2 * (uint64_t)i;
+        }
+    }
+}
+
+/*********************************************************************
+** This function is written for adding the distance d to the open block.
+*********************************************************************/
+static inline void StatsAddGap(statsOpen* open, uint64_t d)
+{
+    open->row.numGaps++;
+    open->row.sumGaps += d;
+    open->row.maxGap = (d > open->row.maxGap) ? d : open->row.maxGap;
+    open->hist[((d >> 1) < STATS_HIST) ? (d >> 1) : STATS_HIST - 1]++;
+}
+
+/*********************************************************************
+** This function is written for starting the merged statistics of several workers, empty.
+*********************************************************************/
+static inline void StatsPartClear(statsPart* part, statsTable* table)
+{
+    part->table = table;
+    part->blockEnd = 0;
+    part->first.valid = 0;
+    part->cur.valid = 0;
+}
+
+/*********************************************************************
+** This function is written for moving the worker to the block of n. The block being left
+** becomes 'first' if it has the first prime of the worker, or else it is complete.
+*********************************************************************/
+static inline void StatsAdvance(statsPart* part, uint64_t n)
+{
+    statsTable* table = part->table;
+
+    if (0 != part->cur.row.primeCount)
+    {
+        if (!part->first.valid)
+        {
+            part->first = part->cur;
+        }
+        else
+        {
+            StatsWriteRow(table, &part->cur);
+        }
+    }
+
+    memset(&part->cur.row, 0, sizeof(statsRow));
+    memset(part->cur.hist, 0, sizeof(part->cur.hist));
+    part->cur.block = (n - table->low) / table->width;
+    part->blockEnd = StatsBlockEnd(table, part->cur.block);
+}
+
+/*********************************************************************
+** This function is written for SieveScanGapsAbove() of CP631_Sieve.h together with the
+** statistics of the blocks in 'part'. The numbers must be in increasing order from one call
+** to the next one of the same part.
+*********************************************************************/
+static inline void StatsScanGaps(const uint64_t* words, uint64_t firstWord, uint64_t low, uint64_t high,
+                                 uint64_t* firstPrime, uint64_t* lastPrime,
+                                 primeInfo64* buff, int* found, int capacity, uint64_t minDistance,
+                                 statsPart* part)
+{
+    uint64_t lowBit;
+    uint64_t highBit;
+    uint64_t w;
+    uint64_t bits;
+    uint64_t n;
+    uint64_t prev = *lastPrime;
+
+    if (SIEVE_HAS_TWO(low, high))
+    {
+        if (0 == *firstPrime)
+        {
+            *firstPrime = 2;
+        }
+        if (2 >= part->blockEnd)
+        {
+            StatsAdvance(part, 2);
+        }
+        part->cur.row.primeCount++;
+        prev = 2;
+    }
+
+    lowBit = (low >> 1) - firstWord * SIEVE_WORD_BITS;
+    highBit = (high >> 1) - firstWord * SIEVE_WORD_BITS;
+
+    /* No odd number in the range */
+    if ((low >= high) || (lowBit >= highBit))
+    {
+        *lastPrime = prev;
+        return;
+    }
+
+    for (w = lowBit >> 6; w <= ((highBit - 1) >> 6); w++)
+    {
+        bits = words[w];
+
+        /* Clear the bits out of the range in the first and the last word */
+        if (w == (lowBit >> 6))
+        {
+            bits &= ~(((uint64_t)1 << (lowBit & 63)) - 1);
+        }
+        if ((w == (highBit >> 6)) && (0 != (highBit & 63)))
+        {
+            bits &= ((uint64_t)1 << (highBit & 63)) - 1;
+        }
+
+        while (0 != bits)
+        {
+            n = SIEVE_NUMBER_OF(firstWord + w, __builtin_ctzll(bits));
+            bits &= bits - 1;
+
+            if (0 == *firstPrime)
+            {
+                *firstPrime = n;
+            }
+
+            if (n >= part->blockEnd)
+            {
+                StatsAdvance(part, n);
+            }
+            part->cur.row.primeCount++;
+
+            if (0 != prev)
+            {
+                StatsAddGap(&part->cur, n - prev);
+                if ((n - prev >= minDistance) &&
+                    ((*found < capacity) || (n - prev > buff[capacity - 1].distance)))
+                {
+                    InsertGap64(buff, found, capacity, n - prev, prev, n);
+                }
+            }
+            prev = n;
+        }
+    }
+
+    *lastPrime = prev;
+}
+
+/*********************************************************************
+** This function is written for ending the scan of a worker: if no block has been left since
+** its first prime, the current block is its first one.
+*********************************************************************/
+static inline void StatsPartFinish(statsPart* part)
+{
+    if ((!part->first.valid) && (0 != part->cur.row.primeCount))
+    {
+        part->first = part->cur;
+        part->cur.valid = 0;
+    }
+}
+
+/*********************************************************************
+** This function is written for adding the open block 'next' after the open blocks of 'total'.
+*********************************************************************/
+static inline void StatsPush(statsPart* total, const statsOpen* next)
+{
+    statsOpen* open;
+    int i;
+
+    if ((!next->valid) || (0 == next->row.primeCount))
+    {
+        return;
+    }
+
+    open = total->cur.valid ? &total->cur : (total->first.valid ? &total->first : NULL);
+    if ((NULL != open) && (open->block == next->block))
+    {
+        open->row.primeCount += next->row.primeCount;
+        open->row.numGaps += next->row.numGaps;
+        open->row.sumGaps += next->row.sumGaps;
+        open->row.maxGap = (next->row.maxGap > open->row.maxGap) ? next->row.maxGap : open->row.maxGap;
+        for (i = 0; i < STATS_HIST; i++)
+        {
+            open->hist[i] += next->hist[i];
+        }
+        return;
+    }
+
+    if (!total->first.valid)
+    {
+        total->first = *next;
+        return;
+    }
+
+    /* The last open block of 'total' is complete now, 'first' stays open */
+    if (total->cur.valid)
+    {
+        StatsWriteRow(total->table, &total->cur);
+    }
+    total->cur = *next;
+}
+
+/*********************************************************************
+** This function is written for adding the worker 'next' after 'total' (both finished).
+** 'lastPrime' is the last prime of 'total' and 'firstPrime' the first prime of 'next'
+** (0 if none): their distance goes to the first block of 'next'. The complete blocks are
+** written into the table of 'total'.
+*********************************************************************/
+static inline void StatsMergePart(statsPart* total, statsPart* next, uint64_t lastPrime, uint64_t firstPrime)
+{
+    if ((0 != lastPrime) && (0 != firstPrime) && next->first.valid)
+    {
+        StatsAddGap(&next->first, firstPrime - lastPrime);
+    }
+
+    StatsPush(total, &next->first);
+    StatsPush(total, &next->cur);
+}
+
+/*********************************************************************
+** This function is written for writing the open blocks of the whole range into the table.
+*********************************************************************/
+static inline void StatsFlush(statsPart* total)
+{
+    StatsWriteRow(total->table, &total->first);
+    StatsWriteRow(total->table, &total->cur);
+    total->first.valid = 0;
+    total->cur.valid = 0;
+}
+
+/*********************************************************************
+** This function is written for writing the table of [low, high) to 'fileName', as CSV if the
+** name ends with ".csv", else as columnar binary. 0 is returned, or -1 if it fails.
+*********************************************************************/
+static inline int StatsWrite(const statsTable* table, uint64_t high, const char* fileName)
+{
+    statsFileHeader header;
+    const statsRow* row;
+    FILE* file;
+    uint64_t b;
+    uint64_t value;
+    double average;
+    size_t nameLength = strlen(fileName);
+    int error = 0;
+    int c;
+
+    file = fopen(fileName, "wb");
+    if (NULL == file)
+    {
+        return -1;
+    }
+
+    if ((nameLength > 4) && (0 == strcmp(fileName + nameLength - 4, ".csv")))
+    {
+        fprintf(file, "block_low,primes,max_gap,average_gap,mode_gap\n");
+        for (b = 0; (b < table->numRows) && (0 == error); b++)
+        {
+            row = &table->rows[b];
+            average = (0 != row->numGaps) ? (double)row->sumGaps / (double)row->numGaps : 0.0;
+            error = (0 > fprintf(file, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.4f,%" PRIu64 "\n",
+                                 table->low + (table->rowBase + b) * table->width, row->primeCount,
+                                 row->maxGap, average, row->modeGap));
+        }
+    }
+    else
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STATS_MAGIC, sizeof(header.magic));
+        header.version = STATS_VERSION;
+        header.numColumns = 4;
+        header.low = table->low;
+        header.high = high;
+        header.width = table->width;
+        header.numBlocks = table->numRows;
+        error = (1 != fwrite(&header, sizeof(header), 1, file));
+
+        /* primes, max_gap and mode_gap as uint64_t, then average_gap as double */
+        for (c = 0; c < 3; c++)
+        {
+            for (b = 0; (b < table->numRows) && (0 == error); b++)
+            {
+                row = &table->rows[b];
+                value = (0 == c) ? row->primeCount : ((1 == c) ? row->maxGap : row->modeGap);
+                error = (1 != fwrite(&value, sizeof(value), 1, file));
+            }
+        }
+        for (b = 0; (b < table->numRows) && (0 == error); b++)
+        {
+            row = &table->rows[b];
+            average = (0 != row->numGaps) ? (double)row->sumGaps / (double)row->numGaps : 0.0;
+            error = (1 != fwrite(&average, sizeof(average), 1, file));
+        }
+    }
+
+    error |= (0 != fclose(file));
+    return error ? -1 : 0;
+}
+
+#endif
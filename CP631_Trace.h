@@ -0,0 +1,270 @@
+/**********************************************************************************************
+**  Event tracing for the CP631 tools, exported in the Chrome trace format (chrome://tracing
+**  or https://ui.perfetto.dev).
+**
+**  The tracing is only compiled in with -DCP631_TRACE. Without it all the TRACE_*() macros
+**  are empty, so the hot loops have no extra cost at all.
+**
+**  With -DCP631_TRACE:
+**  - Every thread has its own event buffer aligned to the cache line. A thread only writes
+**    its own buffer, so recording an event takes no lock and no atomic operation.
+**  - The time stamp is the TSC (rdtsc) of x86 or clock_gettime() elsewhere. The TSC ticks are
+**    converted to microseconds at the end by comparing them with clock_gettime() over the run.
+**  - TRACE_FLUSH() writes the events of all the threads to the trace file after the parallel
+**    part. In the MPI programs (mpi.h included before this file) the processes append their
+**    events to the same file one after the other, with one track per rank and thread.
+**
+**  Usage:
+**      TRACE_INIT(rank, maxThreads);     after MPI_Init()/MPI_Barrier(), before the work
+**      TRACE_BEGIN("sieve");             in any thread, the name must be a string literal
+**      TRACE_END("sieve");
+**      TRACE_FLUSH("CP631_Final_OpenMP_trace.json");
+**  The environment variable CP631_TRACE_FILE overrides the file name.
+**
+**********************************************************************************************/
+
+#ifndef CP631_TRACE_H
+#define CP631_TRACE_H
+
+#ifndef CP631_TRACE
+
+#define    TRACE_INIT(rank, maxThreads)    ((void)0)
+#define    TRACE_BEGIN(name)               ((void)0)
+#define    TRACE_END(name)                 ((void)0)
+#define    TRACE_FLUSH(fileName)           ((void)0)
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+/* Events per thread. The events after it are counted and dropped. */
+#define    TRACE_MAX_EVENTS      (1 << 16)
+
+typedef struct
+{
+    const char* name;
+    uint64_t    tick;
+    char        phase;       /* 'B' or 'E' */
+} traceEvent;
+
+typedef struct
+{
+    traceEvent* events;
+    int         numEvents;
+    int         dropped;
+} __attribute__((aligned(64))) traceThread;
+
+#define    TRACE_INIT(rank, maxThreads)    TraceInit((rank), (maxThreads))
+#define    TRACE_BEGIN(name)               TraceRecord((name), 'B')
+#define    TRACE_END(name)                 TraceRecord((name), 'E')
+#define    TRACE_FLUSH(fileName)           TraceFlush(fileName)
+
+
+/********************************************************************/
+/***                                Static Databases/Variables                                       *****/
+/********************************************************************/
+static traceThread* traceThreads = NULL;
+static int traceNumThreads = 0;
+static int traceRank = 0;
+static uint64_t traceStartTick;
+static double traceStartSec;
+
+
+/*********************************************************************
+** This function is written for reading the time stamp counter.
+*********************************************************************/
+static inline uint64_t TraceTick(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+#endif
+}
+
+/*********************************************************************
+** This function is written for reading the wall time in seconds.
+*********************************************************************/
+static inline double TraceSeconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/*********************************************************************
+** This function is written for allocating the event buffers of 'maxThreads' threads.
+*********************************************************************/
+static inline void TraceInit(int rank, int maxThreads)
+{
+    int i;
+
+    traceRank = rank;
+    traceThreads = (traceThread*)aligned_alloc(64, sizeof(traceThread) * (size_t)maxThreads);
+    if (NULL == traceThreads)
+    {
+        return;
+    }
+
+    traceNumThreads = maxThreads;
+    for (i = 0; i < maxThreads; i++)
+    {
+        traceThreads[i].events = (traceEvent*)malloc(sizeof(traceEvent) * TRACE_MAX_EVENTS);
+        traceThreads[i].numEvents = 0;
+        traceThreads[i].dropped = 0;
+    }
+
+    traceStartSec = TraceSeconds();
+    traceStartTick = TraceTick();
+}
+
+/*********************************************************************
+** This function is written for recording one event of the calling thread.
+*********************************************************************/
+static inline void TraceRecord(const char* name, char phase)
+{
+#ifdef _OPENMP
+    int ID = omp_get_thread_num();
+#else
+    int ID = 0;
+#endif
+    traceThread* thd;
+
+    if (ID >= traceNumThreads)
+    {
+        return;
+    }
+
+    thd = &traceThreads[ID];
+    if ((NULL == thd->events) || (thd->numEvents >= TRACE_MAX_EVENTS))
+    {
+        thd->dropped++;
+        return;
+    }
+
+    thd->events[thd->numEvents].name = name;
+    thd->events[thd->numEvents].tick = TraceTick();
+    thd->events[thd->numEvents].phase = phase;
+    thd->numEvents++;
+}
+
+/*********************************************************************
+** This function is written for writing the events of this process to 'file'. '*first' is
+** 1 if no event has been written to the file yet, it decides where the commas go.
+*********************************************************************/
+static inline void TraceWriteEvents(FILE* file, int* first)
+{
+    double usPerTick = (TraceSeconds() - traceStartSec) * 1e6 / (double)(TraceTick() - traceStartTick + 1);
+    int i;
+    int k;
+
+    fprintf(file, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}}",
+            *first ? "" : ",\n", traceRank, traceRank);
+    *first = 0;
+
+    for (i = 0; i < traceNumThreads; i++)
+    {
+        if (0 == traceThreads[i].numEvents)
+        {
+            continue;
+        }
+
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                traceRank, i, i);
+
+        for (k = 0; k < traceThreads[i].numEvents; k++)
+        {
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    traceThreads[i].events[k].name, traceThreads[i].events[k].phase,
+                    (double)(traceThreads[i].events[k].tick - traceStartTick) * usPerTick, traceRank, i);
+        }
+
+        if (0 != traceThreads[i].dropped)
+        {
+            fprintf(stderr, "Trace: rank %d thread %d dropped %d events.\n", traceRank, i, traceThreads[i].dropped);
+        }
+    }
+}
+
+/*********************************************************************
+** This function is written for writing all the events to the trace file and releasing the
+** buffers. It is called by one thread after the parallel part. With MPI, it must be called
+** by all the processes: they write the file in the order of the ranks.
+*********************************************************************/
+static inline void TraceFlush(const char* fileName)
+{
+    FILE* file;
+    int first = 1;
+    int i;
+#ifdef MPI_VERSION
+    int numRanks;
+
+    MPI_Comm_size(MPI_COMM_WORLD, &numRanks);
+    if (0 != traceRank)
+    {
+        /* Wait for the previous rank */
+        MPI_Recv(&first, 1, MPI_INT, traceRank - 1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+#endif
+
+    if (NULL != getenv("CP631_TRACE_FILE"))
+    {
+        fileName = getenv("CP631_TRACE_FILE");
+    }
+
+    file = fopen(fileName, (0 == traceRank) ? "w" : "a");
+    if (NULL != file)
+    {
+        if (0 == traceRank)
+        {
+            fprintf(file, "[\n");
+        }
+
+        TraceWriteEvents(file, &first);
+
+#ifdef MPI_VERSION
+        if (traceRank == numRanks - 1)
+#endif
+        {
+            fprintf(file, "\n]\n");
+            printf("Trace written to %s.\n", fileName);
+        }
+        fclose(file);
+    }
+
+#ifdef MPI_VERSION
+    if (traceRank < numRanks - 1)
+    {
+        MPI_Send(&first, 1, MPI_INT, traceRank + 1, 0, MPI_COMM_WORLD);
+    }
+#endif
+
+    for (i = 0; i < traceNumThreads; i++)
+    {
+        free(traceThreads[i].events);
+    }
+    free(traceThreads);
+    traceThreads = NULL;
+    traceNumThreads = 0;
+}
+
+#endif /* CP631_TRACE */
+
+#endif
@@ -0,0 +1,584 @@
+/**********************************************************************************************
+**  Start-up auto-tuner of the sieve engine (CP631_Engine.h).
+**
+**  The best segment size depends on the L1/L2 sizes of the host, and the best marking
+**  strategy and number of threads differ between the hosts too. TuneRun():
+**
+**  1. reads the cache topology of the host from
+**     /sys/devices/system/cpu/cpu0/cache/index*, or from cpuid leaf 4 if sysfs is missing,
+**  2. times the engine on a short range at the end of the job, [high - width, high), with
+**     every candidate segment size (the powers of 2 from 16 KB up to 2 x L2),
+**  3. times the two marking strategies of SieveSegmentMark() with the best segment size,
+**  4. times 1, 2, 4, ... and the maximum number of OpenMP threads per process.
+**  The throughput (nanoseconds per integer) is compared, so the candidates can use different
+**  widths. With MPI all the processes run their part of every trial at the same time, and
+**  the slowest process gives the time, so the memory contention of a real run is included.
+**
+**  The winning profile is saved as a small text file per host, by default
+**  $HOME/.cp631_tune_<hostname>, or the file of the environment variable CP631_TUNE_FILE.
+**  TuneLoad() gives it back to the next runs, unless the cache sizes, the number of processes
+**  or the maximum number of OpenMP threads (OMP_NUM_THREADS) have changed since. The split
+**  between the processes and the threads is chosen by mpirun, so only the threads per process
+**  are tuned for the number of processes in use.
+**
+**  All the functions are 'static inline' so that every tool can still be built by a single
+**  gcc/mpicc command line.
+**
+**********************************************************************************************/
+
+#ifndef CP631_TUNE_H
+#define CP631_TUNE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <omp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "CP631_Sieve.h"
+#include "CP631_Engine.h"
+
+
+/********************************************************************/
+/***                                      local definition                                                 ******/
+/********************************************************************/
+/* The shortest range of a trial: 2^28 integers = 2 MB of bitmap */
+#define    TUNE_MIN_WIDTH            ((uint64_t)1 << 28)
+
+/* Every thread gets at least this number of segments in a trial */
+#define    TUNE_SEGMENTS_PER_THREAD  (4)
+
+/* The segment sizes tried, in bytes */
+#define    TUNE_MIN_SEGMENT_BYTES    ((uint64_t)16 << 10)
+#define    TUNE_MAX_SEGMENT_BYTES    ((uint64_t)8 << 20)
+
+/* Every candidate is run this number of times and the best time is kept */
+#define    TUNE_REPEAT               (2)
+
+typedef struct
+{
+    char     host[64];
+    uint64_t cacheL1;            /* Bytes of the L1 data cache, 0 if unknown */
+    uint64_t cacheL2;
+    uint64_t cacheL3;
+    int      cacheLine;
+    int      processes;          /* The number of MPI processes of the tuning */
+    int      maxThreads;         /* omp_get_max_threads() of the tuning */
+    uint64_t segmentWords;
+    int      markStrategy;
+    int      numThreads;         /* OpenMP threads per process */
+    double   nsPerNumber;        /* The best throughput of the tuning */
+} tuneProfile;
+
+
+/*********************************************************************
+** This function is written for reading a cache size of sysfs such as "48K" or "2048K".
+*********************************************************************/
+static inline uint64_t TuneParseSize(const char* text)
+{
+    char* end;
+    uint64_t size = strtoull(text, &end, 10);
+
+    if (('K' == *end) || ('k' == *end))
+    {
+        size <<= 10;
+    }
+    else if (('M' == *end) || ('m' == *end))
+    {
+        size <<= 20;
+    }
+
+    return size;
+}
+
+/*********************************************************************
+** This function is written for reading the first line of a sysfs file. 0 if it fails.
+*********************************************************************/
+static inline int TuneReadLine(const char* path, char* line, int size)
+{
+    FILE* file = fopen(path, "r");
+    int ok;
+
+    if (NULL == file)
+    {
+        return 0;
+    }
+
+    ok = (NULL != fgets(line, size, file));
+    fclose(file);
+    return ok;
+}
+
+/*********************************************************************
+** This function is written for reading the cache topology of the CPU 0 into 'profile'.
+** sysfs is read first, and cpuid leaf 4 is used if sysfs gives nothing.
+*********************************************************************/
+static inline void TuneReadCaches(tuneProfile* profile)
+{
+    char path[128];
+    char type[32];
+    char line[32];
+    uint64_t size;
+    int level;
+    int i;
+
+    profile->cacheL1 = 0;
+    profile->cacheL2 = 0;
+    profile->cacheL3 = 0;
+    profile->cacheLine = 64;
+
+    for (i = 0; i < 8; i++)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+        if (!TuneReadLine(path, type, sizeof(type)))
+        {
+            break;
+        }
+
+        /* The instruction cache doesn't hold the bitmap */
+        if (0 == strncmp(type, "Instruction", 11))
+        {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+        level = TuneReadLine(path, line, sizeof(line)) ? atoi(line) : 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+        size = TuneReadLine(path, line, sizeof(line)) ? TuneParseSize(line) : 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/coherency_line_size", i);
+        if (TuneReadLine(path, line, sizeof(line)) && (atoi(line) > 0))
+        {
+            profile->cacheLine = atoi(line);
+        }
+
+        if (1 == level)
+        {
+            profile->cacheL1 = size;
+        }
+        else if (2 == level)
+        {
+            profile->cacheL2 = size;
+        }
+        else if (3 == level)
+        {
+            profile->cacheL3 = size;
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    /* cpuid leaf 4, if sysfs is missing: one sub-leaf per cache until the type is 0 */
+    if (0 == profile->cacheL1)
+    {
+        for (i = 0; i < 8; i++)
+        {
+            unsigned int eax;
+            unsigned int ebx;
+            unsigned int ecx;
+            unsigned int edx;
+
+            if (!__get_cpuid_count(4, i, &eax, &ebx, &ecx, &edx) || (0 == (eax & 0x1f)))
+            {
+                break;
+            }
+            if (2 == (eax & 0x1f))
+            {
+                continue;
+            }
+
+            level = (eax >> 5) & 7;
+            size = (uint64_t)(((ebx >> 22) & 0x3ff) + 1) * (((ebx >> 12) & 0x3ff) + 1) *
+                   ((ebx & 0xfff) + 1) * ((uint64_t)ecx + 1);
+            profile->cacheLine = (int)(ebx & 0xfff) + 1;
+            if (1 == level)
+            {
+                profile->cacheL1 = size;
+            }
+            else if (2 == level)
+            {
+                profile->cacheL2 = size;
+            }
+            else if (3 == level)
+            {
+                profile->cacheL3 = size;
+            }
+        }
+    }
+#endif
+}
+
+/*********************************************************************
+** This function is written for the file name of the profile of 'host'.
+*********************************************************************/
+static inline void TuneProfilePath(char* path, size_t size, const char* host)
+{
+    const char* home = getenv("HOME");
+
+    if (NULL != getenv("CP631_TUNE_FILE"))
+    {
+        snprintf(path, size, "%s", getenv("CP631_TUNE_FILE"));
+    }
+    else
+    {
+        snprintf(path, size, "%s/.cp631_tune_%s", (NULL != home) ? home : ".", host);
+    }
+}
+
+/*********************************************************************
+** This function is written for the host name, the cache topology and the number of
+** processes and threads of this run, i.e. everything of a profile but the tuned values.
+*********************************************************************/
+static inline void TuneProfileInit(tuneProfile* profile)
+{
+    memset(profile, 0, sizeof(tuneProfile));
+    if (0 != gethostname(profile->host, sizeof(profile->host) - 1))
+    {
+        strcpy(profile->host, "unknown");
+    }
+    TuneReadCaches(profile);
+
+    profile->processes = 1;
+#ifdef MPI_VERSION
+    MPI_Comm_size(MPI_COMM_WORLD, &profile->processes);
+#endif
+    profile->maxThreads = omp_get_max_threads();
+    profile->segmentWords = ENGINE_SEGMENT_WORDS;
+    profile->markStrategy = SIEVE_MARK_KERNELS;
+    profile->numThreads = profile->maxThreads;
+}
+
+/*********************************************************************
+** This function is written for saving the profile of this host. Only process 0 writes.
+** 0 is returned, or -1 if the file can't be written.
+*********************************************************************/
+static inline int TuneSave(const tuneProfile* profile)
+{
+    char path[512];
+    FILE* file;
+    int my_rank = 0;
+
+#ifdef MPI_VERSION
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+#endif
+    if (0 != my_rank)
+    {
+        return 0;
+    }
+
+    TuneProfilePath(path, sizeof(path), profile->host);
+    file = fopen(path, "w");
+    if (NULL == file)
+    {
+        return -1;
+    }
+
+    fprintf(file, "# CP631 sieve engine profile, written by the auto-tuner\n");
+    fprintf(file, "host=%s\n", profile->host);
+    fprintf(file, "cache_l1=%" PRIu64 "\n", profile->cacheL1);
+    fprintf(file, "cache_l2=%" PRIu64 "\n", profile->cacheL2);
+    fprintf(file, "cache_l3=%" PRIu64 "\n", profile->cacheL3);
+    fprintf(file, "cache_line=%d\n", profile->cacheLine);
+    fprintf(file, "processes=%d\n", profile->processes);
+    fprintf(file, "max_threads=%d\n", profile->maxThreads);
+    fprintf(file, "segment_words=%" PRIu64 "\n", profile->segmentWords);
+    fprintf(file, "mark=%s\n", (SIEVE_MARK_KERNELS == profile->markStrategy) ? "kernels" : "bits");
+    fprintf(file, "threads=%d\n", profile->numThreads);
+    fprintf(file, "ns_per_number=%.6f\n", profile->nsPerNumber);
+    fclose(file);
+    return 0;
+}
+
+/*********************************************************************
+** This function is written for loading the saved profile of this host into 'profile'.
+** 0 is returned if there is a profile for the same host, caches and numbers of processes
+** and threads, else -1 and 'profile' only holds the values of TuneProfileInit(). With MPI, process 0
+** reads the file and sends the profile to the others.
+*********************************************************************/
+static inline int TuneLoad(tuneProfile* profile)
+{
+    tuneProfile saved;
+    char path[512];
+    char line[128];
+    char* value;
+    FILE* file;
+    int my_rank = 0;
+    int status = -1;
+
+    TuneProfileInit(profile);
+#ifdef MPI_VERSION
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+#endif
+
+    TuneProfilePath(path, sizeof(path), profile->host);
+    file = (0 == my_rank) ? fopen(path, "r") : NULL;
+    if (NULL != file)
+    {
+        memset(&saved, 0, sizeof(saved));
+        while (NULL != fgets(line, sizeof(line), file))
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            value = strchr(line, '=');
+            if (('#' == line[0]) || (NULL == value))
+            {
+                continue;
+            }
+            *value++ = '\0';
+
+            if (0 == strcmp(line, "host"))
+            {
+                snprintf(saved.host, sizeof(saved.host), "%s", value);
+            }
+            else if (0 == strcmp(line, "cache_l1"))
+            {
+                saved.cacheL1 = strtoull(value, NULL, 10);
+            }
+            else if (0 == strcmp(line, "cache_l2"))
+            {
+                saved.cacheL2 = strtoull(value, NULL, 10);
+            }
+            else if (0 == strcmp(line, "cache_l3"))
+            {
+                saved.cacheL3 = strtoull(value, NULL, 10);
+            }
+            else if (0 == strcmp(line, "cache_line"))
+            {
+                saved.cacheLine = atoi(value);
+            }
+            else if (0 == strcmp(line, "processes"))
+            {
+                saved.processes = atoi(value);
+            }
+            else if (0 == strcmp(line, "max_threads"))
+            {
+                saved.maxThreads = atoi(value);
+            }
+            else if (0 == strcmp(line, "segment_words"))
+            {
+                saved.segmentWords = strtoull(value, NULL, 10);
+            }
+            else if (0 == strcmp(line, "mark"))
+            {
+                saved.markStrategy = (0 == strcmp(value, "bits")) ? SIEVE_MARK_BITS : SIEVE_MARK_KERNELS;
+            }
+            else if (0 == strcmp(line, "threads"))
+            {
+                saved.numThreads = atoi(value);
+            }
+            else if (0 == strcmp(line, "ns_per_number"))
+            {
+                saved.nsPerNumber = strtod(value, NULL);
+            }
+        }
+        fclose(file);
+
+        /* A profile of another host, other caches or another layout is stale */
+        if ((0 == strcmp(saved.host, profile->host)) && (saved.cacheL1 == profile->cacheL1) &&
+            (saved.cacheL2 == profile->cacheL2) && (saved.cacheL3 == profile->cacheL3) &&
+            (saved.processes == profile->processes) && (saved.maxThreads == profile->maxThreads) &&
+            (0 != saved.segmentWords) && (saved.numThreads > 0))
+        {
+            *profile = saved;
+            status = 0;
+        }
+    }
+
+#ifdef MPI_VERSION
+    MPI_Bcast(&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (0 == status)
+    {
+        MPI_Bcast(profile, (int)sizeof(tuneProfile), MPI_BYTE, 0, MPI_COMM_WORLD);
+    }
+#endif
+
+    return status;
+}
+
+/*********************************************************************
+** This function is written for timing the engine with 'cfg' on [low, high). Every process
+** runs its part, and the time of the slowest one is returned in nanoseconds per integer
+** (the best of TUNE_REPEAT runs). A negative value is returned if it fails.
+*********************************************************************/
+static inline double TuneTrial(const engineConfig* cfg, uint64_t low, uint64_t high)
+{
+    engineConfig trialCfg = *cfg;
+    engineResult result;
+    uint64_t wordLo;
+    uint64_t wordHi;
+    uint64_t partLo;
+    uint64_t partHi;
+    double best = -1;
+    double seconds;
+    int my_rank = 0;
+    int num_processors = 1;
+    int error;
+    int r;
+
+#ifdef MPI_VERSION
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processors);
+#endif
+
+    trialCfg.low = low;
+    trialCfg.high = high;
+    trialCfg.blocks = NULL;
+    trialCfg.progress = NULL;
+    EngineWordRange(&trialCfg, &wordLo, &wordHi);
+    EngineSplit(&trialCfg, wordLo, wordHi, num_processors, my_rank, &partLo, &partHi);
+
+    for (r = 0; r < TUNE_REPEAT; r++)
+    {
+        EngineResultInit(&result);
+#ifdef MPI_VERSION
+        MPI_Barrier(MPI_COMM_WORLD);
+#endif
+        seconds = omp_get_wtime();
+        error = EngineRunThreads(&trialCfg, partLo, partHi, &result, NULL, NULL);
+        seconds = (0 == error) ? omp_get_wtime() - seconds : -1;
+#ifdef MPI_VERSION
+        {
+            double mine = seconds;
+
+            /* A failed process gives -1, so the minimum shows it */
+            MPI_Allreduce(&mine, &seconds, 1, MPI_DOUBLE, (mine < 0) ? MPI_MIN : MPI_MAX, MPI_COMM_WORLD);
+        }
+#endif
+        if (seconds < 0)
+        {
+            return -1;
+        }
+        if ((best < 0) || (seconds < best))
+        {
+            best = seconds;
+        }
+    }
+
+    return best * 1e9 / (double)(high - low);
+}
+
+/*********************************************************************
+** This function is written for the range of a trial: the end of the job, at least
+** TUNE_MIN_WIDTH wide and with TUNE_SEGMENTS_PER_THREAD segments for every thread.
+*********************************************************************/
+static inline void TuneTrialRange(const engineConfig* cfg, int processes, uint64_t* low, uint64_t* high)
+{
+    uint64_t width = cfg->segmentWords * SIEVE_NUMS_PER_WORD * TUNE_SEGMENTS_PER_THREAD *
+                     (uint64_t)cfg->numThreads * (uint64_t)processes;
+
+    width = (width > TUNE_MIN_WIDTH) ? width : TUNE_MIN_WIDTH;
+    *high = cfg->high;
+    *low = (cfg->high > width) ? cfg->high - width : 0;
+}
+
+/*********************************************************************
+** This function is written for auto-tuning the engine for the job 'cfg' (its base primes
+** must cover cfg->high). The result is saved in 'profile' and applied to 'cfg'.
+** If 'verbose', process 0 prints every trial. 0 is returned, or -1 if it fails.
+*********************************************************************/
+static inline int TuneRun(engineConfig* cfg, tuneProfile* profile, int verbose)
+{
+    engineConfig trialCfg = *cfg;
+    uint64_t maxBytes;
+    uint64_t bytes;
+    uint64_t low;
+    uint64_t high;
+    double ns;
+    double bestNs = -1;
+    int maxThreads = omp_get_max_threads();
+    int threads;
+    int my_rank = 0;
+    int mark;
+
+#ifdef MPI_VERSION
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+#endif
+    verbose = verbose && (0 == my_rank);
+
+    TuneProfileInit(profile);
+    if (verbose)
+    {
+        printf("Tuning on %s: L1 %" PRIu64 " KB, L2 %" PRIu64 " KB, L3 %" PRIu64 " KB, line %d bytes.\n",
+               profile->host, profile->cacheL1 >> 10, profile->cacheL2 >> 10, profile->cacheL3 >> 10,
+               profile->cacheLine);
+    }
+
+    /* Step 1: the segment size, with the kernels and all the threads */
+    trialCfg.markStrategy = SIEVE_MARK_KERNELS;
+    trialCfg.numThreads = maxThreads;
+    maxBytes = (0 != profile->cacheL2) ? 2 * profile->cacheL2 : ENGINE_SEGMENT_WORDS * sizeof(uint64_t) * 4;
+    maxBytes = (maxBytes < TUNE_MAX_SEGMENT_BYTES) ? maxBytes : TUNE_MAX_SEGMENT_BYTES;
+    for (bytes = TUNE_MIN_SEGMENT_BYTES; bytes <= maxBytes; bytes *= 2)
+    {
+        trialCfg.segmentWords = bytes / sizeof(uint64_t);
+        TuneTrialRange(&trialCfg, profile->processes, &low, &high);
+        ns = TuneTrial(&trialCfg, low, high);
+        if (ns < 0)
+        {
+            return -1;
+        }
+        if (verbose)
+        {
+            printf("  segment %6" PRIu64 " KB: %.4f ns per integer\n", bytes >> 10, ns);
+        }
+        if ((bestNs < 0) || (ns < bestNs))
+        {
+            bestNs = ns;
+            profile->segmentWords = trialCfg.segmentWords;
+        }
+    }
+    trialCfg.segmentWords = profile->segmentWords;
+    TuneTrialRange(&trialCfg, profile->processes, &low, &high);
+
+    /* Step 2: the marking strategy */
+    for (mark = SIEVE_MARK_KERNELS; mark <= SIEVE_MARK_BITS; mark++)
+    {
+        trialCfg.markStrategy = mark;
+        ns = TuneTrial(&trialCfg, low, high);
+        if (ns < 0)
+        {
+            return -1;
+        }
+        if (verbose)
+        {
+            printf("  marking %-7s: %.4f ns per integer\n", (SIEVE_MARK_KERNELS == mark) ? "kernels" : "bits", ns);
+        }
+        if (ns < bestNs)
+        {
+            bestNs = ns;
+            profile->markStrategy = mark;
+        }
+    }
+    trialCfg.markStrategy = profile->markStrategy;
+
+    /* Step 3: the threads per process, on the same range */
+    profile->numThreads = maxThreads;
+    for (threads = 1; threads < maxThreads; threads *= 2)
+    {
+        trialCfg.numThreads = threads;
+        ns = TuneTrial(&trialCfg, low, high);
+        if (ns < 0)
+        {
+            return -1;
+        }
+        if (verbose)
+        {
+            printf("  threads %7d: %.4f ns per integer\n", threads, ns);
+        }
+        if (ns < bestNs)
+        {
+            bestNs = ns;
+            profile->numThreads = threads;
+        }
+    }
+
+    profile->nsPerNumber = bestNs;
+    cfg->segmentWords = profile->segmentWords;
+    cfg->markStrategy = profile->markStrategy;
+    cfg->numThreads = profile->numThreads;
+    return 0;
+}
+
+#endif
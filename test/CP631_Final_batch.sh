@@ -0,0 +1,7 @@
+#!/bin/bash
+#SBATCH --time=00:30:00
+#SBATCH --account=mcs
+for i in $(seq 1 2000); do echo "$((i * 500000000)) $((i * 500000000 + 1000000))"; done > CP631_Final_batch_ranges.txt
+echo "1e9 2e9" >> CP631_Final_batch_ranges.txt
+echo "1500000000 2500000000" >> CP631_Final_batch_ranges.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_batch.x CP631_Final_batch_ranges.txt > CP631_Final_batch_test_result.txt
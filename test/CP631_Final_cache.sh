@@ -0,0 +1,6 @@
+#!/bin/bash
+#SBATCH --time=00:05:00
+#SBATCH --account=mcs
+OMP_NUM_THREADS=24 ./CP631_Final_cache.x build 1000000000 > CP631_Final_cache_test_result.txt
+./CP631_Final_cache.x gaps 0 1000000000 >> CP631_Final_cache_test_result.txt
+./CP631_Final_cache.x count 0 1000000000 >> CP631_Final_cache_test_result.txt
@@ -0,0 +1,4 @@
+#!/bin/bash
+#SBATCH --time=00:05:00
+#SBATCH --account=mcs
+OMP_NUM_THREADS=24 ./CP631_Final_constellation.x > CP631_Final_constellation_test_result.txt
@@ -0,0 +1,5 @@
+#!/bin/bash
+#SBATCH --time=00:05:00
+#SBATCH --account=mcs
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_count.x sieve 1000000000 > CP631_Final_count_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_count.x lucy 1e13 >> CP631_Final_count_test_result.txt
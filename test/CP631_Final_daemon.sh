@@ -0,0 +1,14 @@
+#!/bin/bash
+#SBATCH --time=00:05:00
+#SBATCH --account=mcs
+OMP_NUM_THREADS=24 ./CP631_Final_daemon.x > CP631_Final_daemon_test_result.txt &
+sleep 2
+./CP631_Final_daemon.x -q gap 0 1000000000 >> CP631_Final_daemon_test_result.txt
+./CP631_Final_daemon.x -q count 0 1000000000 >> CP631_Final_daemon_test_result.txt
+./CP631_Final_daemon.x -q next 436273009 >> CP631_Final_daemon_test_result.txt
+./CP631_Final_daemon.x -q count 0 1e8 >> CP631_Final_daemon_test_result.txt
+./CP631_Final_daemon.x -q next 18446744073709551615 >> CP631_Final_daemon_test_result.txt
+./CP631_Final_daemon.x -q count 0 1e8x >> CP631_Final_daemon_test_result.txt
+./CP631_Final_daemon.x -q stats >> CP631_Final_daemon_test_result.txt
+kill -INT %1
+wait
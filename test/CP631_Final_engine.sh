@@ -0,0 +1,17 @@
+#!/bin/bash
+#SBATCH --time=00:30:00
+#SBATCH --account=mcs
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -b hybrid -n 1e10 -a > CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -b all -n 1e10 >> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -x CP631_Final_engine.idx -n 1e10 >> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -x CP631_Final_engine.idx -l 123456789 -n 987654321 >> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -b all -n 1e10 -k 64 -f 0 >> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -b all -n 1e10 -k 64 -f 1 >> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -b hybrid -g all -n 1e8 >> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -b hybrid -g all -n 1e10 >> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -b hybrid -g all -l 1e14 -n 100000010000000 >> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -b hybrid -n 1e10 -t 1e6 CP631_Final_engine_blocks.csv >> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -b hybrid -n 1e11 -p 10 >> CP631_Final_engine_test_result.txt 2>> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -b all -g all -s 1 -l 1030010 -n 1031010 -k 4 >> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -b all -s 1 -l 1063021 -n 1064021 -k 4 >> CP631_Final_engine_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_engine.x -x CP631_Final_engine.idx -l 1e15 -n 1000000100000000 >> CP631_Final_engine_test_result.txt
@@ -0,0 +1,4 @@
+#!/bin/bash
+#SBATCH --time=00:10:00
+#SBATCH --account=mcs
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_firstgap.x 400 -n 1e12 > CP631_Final_firstgap_test_result.txt
@@ -0,0 +1,5 @@
+#!/bin/bash
+#SBATCH --time=00:10:00
+#SBATCH --account=mcs
+./CP631_Final_iterator.x 1e18 1e6 > CP631_Final_iterator_test_result.txt
+./CP631_Final_iterator.x 1e18 1e6 0 >> CP631_Final_iterator_test_result.txt
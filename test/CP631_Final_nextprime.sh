@@ -0,0 +1,4 @@
+#!/bin/bash
+#SBATCH --time=00:05:00
+#SBATCH --account=mcs
+./CP631_Final_nextprime.x 436273100 1000000000000000000 18446744073709551557 > CP631_Final_nextprime_test_result.txt
@@ -0,0 +1,7 @@
+#!/bin/bash
+#SBATCH --time=00:10:00
+#SBATCH --account=mcs
+mpirun -np 24 -mca btl ^openib ./CP631_Final_MPI.x CP631_Final_MPI_primes.bin > CP631_Final_output_test_result.txt
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_MPI_OpenMP.x CP631_Final_MPI_OpenMP_primes.bin >> CP631_Final_output_test_result.txt
+./CP631_Final_readoutput.x CP631_Final_MPI_primes.bin >> CP631_Final_output_test_result.txt
+./CP631_Final_readoutput.x CP631_Final_MPI_OpenMP_primes.bin >> CP631_Final_output_test_result.txt
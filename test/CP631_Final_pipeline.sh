@@ -0,0 +1,12 @@
+#!/bin/bash
+#SBATCH --time=00:05:00
+#SBATCH --account=mcs
+#SBATCH --cpus-per-task=8
+./CP631_Final_pipeline.x -n 1e9 -s 5 > CP631_Final_pipeline_test_result.txt
+./CP631_Final_pipeline.x -n 1e10 -s 5 >> CP631_Final_pipeline_test_result.txt
+./CP631_Final_shmreader.x /cp631_test > CP631_Final_shmreader_test_result.txt &
+./CP631_Final_pipeline.x -n 1e10 -s 4 -r /cp631_test -m 300 >> CP631_Final_pipeline_test_result.txt
+wait
+./CP631_Final_shmreader.x /cp631_test >> CP631_Final_shmreader_test_result.txt &
+./CP631_Final_pipeline.x -n 1e9 -s 4 -r /cp631_test -e primes >> CP631_Final_pipeline_test_result.txt
+wait
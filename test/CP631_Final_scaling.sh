@@ -0,0 +1,132 @@
+#!/bin/bash
+#SBATCH --time=03:00:00
+#SBATCH --account=mcs
+#SBATCH --exclusive
+#
+# Strong and weak scaling study of CP631_Final_serial/OpenMP/MPI/MPI_OpenMP on one machine.
+#
+# Strong scaling: every size in SIZES is run with 1 thread (the serial program), with the
+# thread counts THREADS (OpenMP), the rank counts RANKS (MPI) and the splits HYBRID (RxT,
+# MPI+OpenMP). Weak scaling: the size is WEAK_BASE * p for p workers, up to 1024000000
+# (CPU_CALC_END^2 must stay above MAX_NUMBER).
+#
+# For every run with p = ranks * threads workers:
+#   speedup     S = T1 / Tp                    (T1 = serial time of the same size)
+#   efficiency  E = S / p                      (weak scaling: E = T1(WEAK_BASE) / Tp)
+#   Karp-Flatt  e = (1/S - 1/p) / (1 - 1/p)    (experimentally determined serial fraction,
+#                                              strong scaling only: empty for weak scaling)
+#
+# The results are written to $OUT_DIR/scaling.csv and printed as a table. Every setting can
+# be changed in the environment, e.g.
+#   SIZES="100000000 1000000000" THREADS="1 2 4" RANKS="2 4" HYBRID="2x2" ./CP631_Final_scaling.sh
+# mpirun runs with --oversubscribe, so more workers than cores can be tried on a small box.
+
+SRC_DIR=${SRC_DIR:-$(cd "$(dirname "$0")/.." && pwd)}
+OUT_DIR=${OUT_DIR:-CP631_Final_scaling}
+SIZES=${SIZES:-"100000000 500000000 1000000000"}
+THREADS=${THREADS:-"1 2 4 8 16 24"}
+RANKS=${RANKS:-"2 4 8 16 24"}
+HYBRID=${HYBRID:-"2x12 4x6 6x4 12x2"}
+WEAK_BASE=${WEAK_BASE:-40000000}
+REPEAT=${REPEAT:-1}
+MPIRUN=${MPIRUN:-"mpirun --oversubscribe"}
+
+mkdir -p "$OUT_DIR/bin" || exit 1
+CSV="$OUT_DIR/scaling.csv"
+echo "study,variant,size,ranks,threads,workers,seconds,speedup,efficiency,karp_flatt" > "$CSV"
+
+# Build every variant for the size $1
+build()
+{
+    local size=$1
+    [ -x "$OUT_DIR/bin/serial_$size.x" ] && return 0
+    gcc -O2 -DMAX_NUMBER=$size "$SRC_DIR/CP631_Final_serial.c" -o "$OUT_DIR/bin/serial_$size.x" &&
+    gcc -fopenmp -O2 -DMAX_NUMBER=$size "$SRC_DIR/CP631_Final_OpenMP.c" -o "$OUT_DIR/bin/OpenMP_$size.x" &&
+    mpicc -O2 -DMAX_NUMBER=$size "$SRC_DIR/CP631_Final_MPI.c" -o "$OUT_DIR/bin/MPI_$size.x" &&
+    mpicc -fopenmp -O2 -DMAX_NUMBER=$size "$SRC_DIR/CP631_Final_MPI_OpenMP.c" -o "$OUT_DIR/bin/MPI_OpenMP_$size.x"
+}
+
+# Run a variant: run <variant> <size> <ranks> <threads>. Print the best time of REPEAT runs.
+run()
+{
+    local variant=$1 size=$2 ranks=$3 threads=$4 best="" t i cmd
+    case $variant in
+        serial)     cmd="$OUT_DIR/bin/serial_$size.x" ;;
+        OpenMP)     cmd="env OMP_NUM_THREADS=$threads $OUT_DIR/bin/OpenMP_$size.x" ;;
+        MPI)        cmd="$MPIRUN -np $ranks $OUT_DIR/bin/MPI_$size.x" ;;
+        MPI_OpenMP) cmd="$MPIRUN -np $ranks -x OMP_NUM_THREADS=$threads $OUT_DIR/bin/MPI_OpenMP_$size.x" ;;
+    esac
+
+    for ((i = 0; i < REPEAT; i++)); do
+        t=$($cmd 2>/dev/null | awk '/Total time taken by CPU/ {print $(NF-1)}')
+        [ -z "$t" ] && continue
+        if [ -z "$best" ] || awk "BEGIN {exit !($t < $best)}"; then
+            best=$t
+        fi
+    done
+    echo "$best"
+}
+
+# Add one line to the CSV: record <study> <variant> <size> <ranks> <threads> <seconds> <T1>
+record()
+{
+    local study=$1 variant=$2 size=$3 ranks=$4 threads=$5 tp=$6 t1=$7
+    [ -z "$tp" ] && { echo "$variant size $size ${ranks}x$threads failed" >&2; return; }
+    awk -v st=$study -v v=$variant -v n=$size -v r=$ranks -v t=$threads -v tp=$tp -v t1=$t1 'BEGIN {
+        p = r * t
+        if (st == "weak") { s = t1 * p / tp; e = t1 / tp } else { s = t1 / tp; e = s / p }
+        kf = ((st != "weak") && (p > 1)) ? sprintf("%.4f", (1 / s - 1 / p) / (1 - 1 / p)) : ""
+        printf "%s,%s,%d,%d,%d,%d,%.4f,%.3f,%.3f,%s\n", st, v, n, r, t, p, tp, s, e, kf
+    }' >> "$CSV"
+}
+
+# Run all the parallel configurations of one size. T1 is the serial time to compare with.
+sweep()
+{
+    local study=$1 size=$2 t1=$3 n r t
+    for t in $THREADS; do
+        [ "$study" = weak ] && size=$(weak_size $t)
+        [ -z "$size" ] && continue
+        build $size && record $study OpenMP $size 1 $t "$(run OpenMP $size 1 $t)" $t1
+    done
+    for r in $RANKS; do
+        [ "$study" = weak ] && size=$(weak_size $r)
+        [ -z "$size" ] && continue
+        build $size && record $study MPI $size $r 1 "$(run MPI $size $r 1)" $t1
+    done
+    for n in $HYBRID; do
+        r=${n%x*}; t=${n#*x}
+        [ "$study" = weak ] && size=$(weak_size $((r * t)))
+        [ -z "$size" ] && continue
+        build $size && record $study MPI_OpenMP $size $r $t "$(run MPI_OpenMP $size $r $t)" $t1
+    done
+}
+
+# The weak scaling size for p workers, empty if it is too large
+weak_size()
+{
+    awk -v b=$WEAK_BASE -v p=$1 'BEGIN {n = b * p; if (n <= 1024000000) printf "%d", n}'
+}
+
+# Strong scaling
+for size in $SIZES; do
+    build $size || exit 1
+    t1=$(run serial $size 1 1)
+    record strong serial $size 1 1 "$t1" $t1
+    sweep strong $size $t1
+done
+
+# Weak scaling
+build $WEAK_BASE || exit 1
+t1=$(run serial $WEAK_BASE 1 1)
+record weak serial $WEAK_BASE 1 1 "$t1" $t1
+sweep weak $WEAK_BASE $t1
+
+# Print the CSV as a table
+awk -F, '{ for (i = 1; i <= NF; i++) printf "%-12s", $i; printf "\n" }' "$CSV"
+echo
+echo "Best decomposition by efficiency at the largest workers count of every study and size:"
+awk -F, 'NR > 1 && $6 > 1 {
+    key = $1 " " ($1 == "weak" ? "" : $3)
+    if (($6 > maxp[key]) || (($6 == maxp[key]) && ($9 > best[key]))) { maxp[key] = $6; best[key] = $9; line[key] = $0 }
+} END { for (k in line) print "  " line[k] }' "$CSV" | sort
@@ -0,0 +1,4 @@
+#!/bin/bash
+#SBATCH --time=00:30:00
+#SBATCH --account=mcs
+OMP_NUM_THREADS=4 mpirun -np 6 -mca btl ^openib ./CP631_Final_window.x 1e18 1e11 > CP631_Final_window_test_result.txt